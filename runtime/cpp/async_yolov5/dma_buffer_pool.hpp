@@ -0,0 +1,245 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file dma_buffer_pool.hpp
+ * @brief Pool of page-aligned stream buffers mapped once at startup and recycled frame after frame.
+ **/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <vector>
+
+#if defined(__unix__)
+#include <sys/mman.h>
+#include <unistd.h>
+#elif defined(_MSC_VER)
+#include <windows.h>
+#endif
+
+namespace common
+{
+    /**
+     * @brief Fixed set of page-aligned buffers of one stream, for write_async() / read_async().
+     *
+     * All the buffers are carved from a single mapping made (and pre-faulted) when the pool is created,
+     * so a frame costs no mmap/munmap, no page fault and no TLB shootdown. acquire() hands out a buffer
+     * as a shared_ptr whose deleter pushes it back on a lock-free free list, so a buffer returns to the
+     * pool as soon as its transfer completed and the last frame holding it (queue, post-process) is done.
+     *
+     * acquire() never blocks: when the pool is exhausted it maps a one-off buffer, which is unmapped on
+     * release, and counts it in Stats::exhausted. The pool is kept alive by the buffers it handed out.
+     */
+    class DmaBufferPool : public std::enable_shared_from_this<DmaBufferPool>
+    {
+    public:
+        /**
+         * @brief Counters of the pool.
+         */
+        struct Stats
+        {
+            size_t buffers;            // buffers mapped at creation
+            size_t acquires;           // acquire() calls
+            size_t exhausted;          // acquire() calls that found no free buffer and mapped a one-off buffer
+            size_t mappings;           // memory mappings made, 1 at creation plus one per exhaustion
+            size_t in_use_high_water;  // most buffers held at once
+            bool huge_pages;           // the pool is backed by huge pages
+        };
+
+        /**
+         * @param buffer_size Size of a buffer, e.g. the stream frame size.
+         * @param num_buffers Buffers of the pool, at least the frames of the stream in flight at once.
+         * @param huge_pages Back the pool with huge pages (Linux, falls back to regular pages if none are reserved).
+         */
+        static std::shared_ptr<DmaBufferPool> create(size_t buffer_size, size_t num_buffers, bool huge_pages = false)
+        {
+            return std::shared_ptr<DmaBufferPool>(new DmaBufferPool(buffer_size, num_buffers, huge_pages));
+        }
+
+        ~DmaBufferPool()
+        {
+            unmap(m_base, m_stride * m_num_buffers);
+        }
+
+        DmaBufferPool(const DmaBufferPool &) = delete;
+        DmaBufferPool &operator=(const DmaBufferPool &) = delete;
+
+        size_t buffer_size() const { return m_buffer_size; }
+        size_t num_buffers() const { return m_num_buffers; }
+
+        Stats stats() const
+        {
+            return Stats{m_num_buffers, m_acquires.load(std::memory_order_relaxed), m_exhausted.load(std::memory_order_relaxed),
+                         m_mappings.load(std::memory_order_relaxed), m_high_water.load(std::memory_order_relaxed), m_huge_pages};
+        }
+
+        /**
+         * @brief Get a free buffer, returned to the pool when the last copy of the pointer is destroyed.
+         */
+        std::shared_ptr<uint8_t> acquire()
+        {
+            m_acquires.fetch_add(1, std::memory_order_relaxed);
+            update_high_water(m_in_use.fetch_add(1, std::memory_order_relaxed) + 1);
+            const uint32_t index = pop();
+            if (EMPTY == index)
+            {
+                m_exhausted.fetch_add(1, std::memory_order_relaxed);
+                m_mappings.fetch_add(1, std::memory_order_relaxed);
+                const size_t size = m_buffer_size;
+                auto pool = shared_from_this();
+                return std::shared_ptr<uint8_t>(map(size, false), [pool, size](uint8_t *buffer)
+                                                {
+                                                    unmap(buffer, size);
+                                                    pool->m_in_use.fetch_sub(1, std::memory_order_relaxed); });
+            }
+            auto pool = shared_from_this();
+            return std::shared_ptr<uint8_t>(m_base + m_stride * index, [pool, index](uint8_t *)
+                                            { pool->release(index); });
+        }
+
+    private:
+        static constexpr uint32_t EMPTY = UINT32_MAX;
+        static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+        uint8_t *m_base;
+        size_t m_buffer_size;
+        size_t m_num_buffers;
+        size_t m_stride; // buffer size rounded up to the page size, every buffer starts on a page
+        bool m_huge_pages;
+        // Free list: head is (tag << 32 | index), the tag changes on every update so a stale head never matches (ABA)
+        std::atomic<uint64_t> m_head;
+        std::vector<std::atomic<uint32_t>> m_next;
+        std::atomic<size_t> m_acquires;
+        std::atomic<size_t> m_exhausted;
+        std::atomic<size_t> m_mappings;
+        std::atomic<size_t> m_in_use;
+        std::atomic<size_t> m_high_water;
+
+        DmaBufferPool(size_t buffer_size, size_t num_buffers, bool huge_pages)
+            : m_base(nullptr), m_buffer_size(buffer_size), m_num_buffers(num_buffers), m_stride(0), m_huge_pages(false),
+              m_head(EMPTY), m_next(num_buffers), m_acquires(0), m_exhausted(0), m_mappings(0), m_in_use(0), m_high_water(0)
+        {
+            if (num_buffers >= EMPTY)
+                throw std::bad_alloc();
+            if (0 == num_buffers)
+                return;
+#if defined(__unix__) && defined(MAP_HUGETLB)
+            if (huge_pages)
+            {
+                m_stride = round_up(buffer_size, HUGE_PAGE_SIZE);
+                void *addr = mmap(NULL, m_stride * num_buffers, PROT_WRITE | PROT_READ,
+                                  MAP_ANONYMOUS | MAP_PRIVATE | MAP_POPULATE | MAP_HUGETLB, -1, 0);
+                if (MAP_FAILED != addr)
+                {
+                    m_base = reinterpret_cast<uint8_t *>(addr);
+                    m_huge_pages = true;
+                }
+            }
+#else
+            (void)huge_pages;
+#endif
+            if (nullptr == m_base)
+            {
+                m_stride = round_up(buffer_size, page_size());
+                m_base = map(m_stride * num_buffers, true);
+            }
+            m_mappings.store(1, std::memory_order_relaxed);
+            for (size_t i = num_buffers; i > 0; i--)
+                push((uint32_t)(i - 1));
+        }
+
+        static size_t round_up(size_t size, size_t alignment)
+        {
+            return ((size + alignment - 1) / alignment) * alignment;
+        }
+
+        static size_t page_size()
+        {
+#if defined(__unix__)
+            return (size_t)sysconf(_SC_PAGESIZE);
+#else
+            return 4096;
+#endif
+        }
+
+        static uint8_t *map(size_t size, bool populate)
+        {
+#if defined(__unix__)
+            int flags = MAP_ANONYMOUS | MAP_PRIVATE;
+#if defined(MAP_POPULATE)
+            if (populate)
+                flags |= MAP_POPULATE;
+#else
+            (void)populate;
+#endif
+            void *addr = mmap(NULL, size, PROT_WRITE | PROT_READ, flags, -1, 0);
+            if (MAP_FAILED == addr)
+                throw std::bad_alloc();
+            return reinterpret_cast<uint8_t *>(addr);
+#elif defined(_MSC_VER)
+            (void)populate;
+            void *addr = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+            if (!addr)
+                throw std::bad_alloc();
+            return reinterpret_cast<uint8_t *>(addr);
+#else
+#pragma error("Aligned alloc not supported")
+#endif
+        }
+
+        static void unmap(uint8_t *addr, size_t size)
+        {
+            if (nullptr == addr)
+                return;
+#if defined(__unix__)
+            munmap(addr, size);
+#elif defined(_MSC_VER)
+            (void)size;
+            VirtualFree(addr, 0, MEM_RELEASE);
+#endif
+        }
+
+        void update_high_water(size_t in_use)
+        {
+            size_t high_water = m_high_water.load(std::memory_order_relaxed);
+            while (in_use > high_water && !m_high_water.compare_exchange_weak(high_water, in_use, std::memory_order_relaxed))
+                ;
+        }
+
+        uint32_t pop()
+        {
+            uint64_t head = m_head.load(std::memory_order_acquire);
+            for (;;)
+            {
+                const uint32_t index = (uint32_t)head;
+                if (EMPTY == index)
+                    return EMPTY;
+                const uint64_t next = (((head >> 32) + 1) << 32) | m_next[index].load(std::memory_order_relaxed);
+                if (m_head.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+                    return index;
+            }
+        }
+
+        void push(uint32_t index)
+        {
+            uint64_t head = m_head.load(std::memory_order_relaxed);
+            uint64_t next;
+            do
+            {
+                m_next[index].store((uint32_t)head, std::memory_order_relaxed);
+                next = (((head >> 32) + 1) << 32) | index;
+            } while (!m_head.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        void release(uint32_t index)
+        {
+            push(index);
+            m_in_use.fetch_sub(1, std::memory_order_relaxed);
+        }
+    };
+}
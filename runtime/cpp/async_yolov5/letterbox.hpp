@@ -0,0 +1,278 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file letterbox.hpp
+ * @brief Resize (letterbox or stretch) and BGR to RGB conversion of a frame into the network input, in one pass.
+ **/
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define LETTERBOX_NEON
+#endif
+
+namespace common
+{
+    enum class ResizeMode
+    {
+        LETTERBOX, // keep the aspect ratio, pad the borders
+        STRETCH    // fill the whole network input
+    };
+
+    /**
+     * @brief Where a source frame lies in the network input, to map results back to the source frame.
+     */
+    struct Letterbox
+    {
+        int src_width;
+        int src_height;
+        int dst_width;
+        int dst_height;
+        int image_width;  // size of the resized frame within the network input
+        int image_height;
+        int pad_left;     // network input pixels left and above the resized frame
+        int pad_top;
+        float scale_x;    // network input pixels per source pixel
+        float scale_y;
+
+        Letterbox() : Letterbox(0, 0) {}
+        // The identity, the source is the network input
+        Letterbox(int width, int height)
+            : src_width(width), src_height(height), dst_width(width), dst_height(height), image_width(width), image_height(height),
+              pad_left(0), pad_top(0), scale_x(1.f), scale_y(1.f) {}
+
+        static Letterbox compute(int src_width, int src_height, int dst_width, int dst_height, ResizeMode mode)
+        {
+            Letterbox letterbox(dst_width, dst_height);
+            letterbox.src_width = src_width;
+            letterbox.src_height = src_height;
+            if (ResizeMode::LETTERBOX == mode)
+            {
+                const double scale = std::min((double)dst_width / src_width, (double)dst_height / src_height);
+                letterbox.image_width = std::min(dst_width, std::max(1, (int)std::lround(src_width * scale)));
+                letterbox.image_height = std::min(dst_height, std::max(1, (int)std::lround(src_height * scale)));
+                letterbox.pad_left = (dst_width - letterbox.image_width) / 2;
+                letterbox.pad_top = (dst_height - letterbox.image_height) / 2;
+            }
+            letterbox.scale_x = (float)letterbox.image_width / src_width;
+            letterbox.scale_y = (float)letterbox.image_height / src_height;
+            return letterbox;
+        }
+
+        bool identity() const
+        {
+            return src_width == dst_width && src_height == dst_height && image_width == dst_width && image_height == dst_height;
+        }
+
+        // Network input coordinates to source frame coordinates, clamped to the source frame
+        float to_source_x(float x) const
+        {
+            return std::min(std::max((x - pad_left) / scale_x, 0.f), (float)(src_width - 1));
+        }
+
+        float to_source_y(float y) const
+        {
+            return std::min(std::max((y - pad_top) / scale_y, 0.f), (float)(src_height - 1));
+        }
+    };
+
+    /**
+     * @brief Bilinear resize of 3 channel 8 bit frames into a letterbox, with an optional swap of the first
+     *        and third channels (BGR to RGB), in a single pass over the source.
+     *
+     * The sampling is the one of cv::resize(INTER_LINEAR): pixel centers aligned, 11 bit fixed point weights.
+     * The tables are built once for a source and network input size, then run() is called on every frame. Each
+     * source row is interpolated horizontally (and swapped) once, then the two rows around a destination row
+     * are blended vertically straight into the destination. Rows can be split among threads with run_rows().
+     */
+    class LetterboxResizer
+    {
+    public:
+        static constexpr uint8_t DEFAULT_PAD_VALUE = 114; // gray, as in the YOLOv5 training letterbox
+
+        LetterboxResizer(const Letterbox &letterbox, bool swap_rb, uint8_t pad_value = DEFAULT_PAD_VALUE)
+            : m_letterbox(letterbox), m_swap_rb(swap_rb), m_pad_value(pad_value)
+        {
+            build_table(letterbox.src_width, letterbox.image_width, m_x_offsets, m_x_weights, 3);
+            build_table(letterbox.src_height, letterbox.image_height, m_y_rows, m_y_weights, 1);
+        }
+
+        const Letterbox &letterbox() const { return m_letterbox; }
+
+        void run(const uint8_t *src, size_t src_step, uint8_t *dst, size_t dst_step) const
+        {
+            run_rows(src, src_step, dst, dst_step, 0, m_letterbox.dst_height);
+        }
+
+        /**
+         * @brief Write the destination rows [row_begin, row_end).
+         */
+        void run_rows(const uint8_t *src, size_t src_step, uint8_t *dst, size_t dst_step, int row_begin, int row_end) const
+        {
+            const Letterbox &lb = m_letterbox;
+            if (lb.identity())
+            {
+                for (int y = row_begin; y < row_end; y++)
+                    copy_row(src + src_step * y, dst + dst_step * y, (size_t)lb.dst_width);
+                return;
+            }
+            const size_t left = (size_t)lb.pad_left * 3;
+            const size_t image = (size_t)lb.image_width * 3;
+            const size_t right = (size_t)lb.dst_width * 3 - left - image;
+            // horizontally interpolated source rows, cached as consecutive destination rows share source rows
+            static thread_local std::vector<int32_t> rows[2];
+            int cached[2] = {-1, -1};
+            rows[0].resize(image);
+            rows[1].resize(image);
+            for (int y = row_begin; y < row_end; y++)
+            {
+                uint8_t *out = dst + dst_step * y;
+                const int iy = y - lb.pad_top;
+                if (iy < 0 || iy >= lb.image_height)
+                {
+                    memset(out, m_pad_value, (size_t)lb.dst_width * 3);
+                    continue;
+                }
+                memset(out, m_pad_value, left);
+                memset(out + left + image, m_pad_value, right);
+                const int sy0 = m_y_rows[2 * iy];
+                const int sy1 = m_y_rows[2 * iy + 1];
+                const int32_t *row0 = horizontal(src, src_step, sy0, rows, cached);
+                const int32_t *row1 = horizontal(src, src_step, sy1, rows, cached);
+                vertical(row0, row1, m_y_weights[2 * iy], m_y_weights[2 * iy + 1], out + left, image);
+            }
+        }
+
+    private:
+        static constexpr int WEIGHT_BITS = 11; // as cv::resize, the weights of a pixel pair sum to 1 << 11
+
+        Letterbox m_letterbox;
+        bool m_swap_rb;
+        uint8_t m_pad_value;
+        std::vector<int32_t> m_x_offsets; // per destination column, the byte offsets of the 2 source pixels
+        std::vector<int32_t> m_x_weights; // per destination column, the weights of the 2 source pixels
+        std::vector<int32_t> m_y_rows;    // per destination row, the 2 source rows
+        std::vector<int32_t> m_y_weights;
+
+        static void build_table(int src_size, int dst_size, std::vector<int32_t> &offsets, std::vector<int32_t> &weights, int pixel_size)
+        {
+            const double inv_scale = (double)src_size / dst_size;
+            offsets.resize(2 * (size_t)dst_size);
+            weights.resize(2 * (size_t)dst_size);
+            for (int d = 0; d < dst_size; d++)
+            {
+                double f = (d + 0.5) * inv_scale - 0.5;
+                int s = (int)std::floor(f);
+                f -= s;
+                if (s < 0)
+                {
+                    s = 0;
+                    f = 0;
+                }
+                if (s >= src_size - 1)
+                {
+                    s = src_size - 1;
+                    f = 0;
+                }
+                const int32_t w1 = (int32_t)std::lround(f * (1 << WEIGHT_BITS));
+                offsets[2 * d] = s * pixel_size;
+                offsets[2 * d + 1] = std::min(s + 1, src_size - 1) * pixel_size;
+                weights[2 * d] = (1 << WEIGHT_BITS) - w1;
+                weights[2 * d + 1] = w1;
+            }
+        }
+
+        // Same size, only the channels may be swapped
+        void copy_row(const uint8_t *in, uint8_t *out, size_t width) const
+        {
+            if (!m_swap_rb)
+            {
+                memcpy(out, in, width * 3);
+                return;
+            }
+            for (size_t x = 0; x < width; x++)
+            {
+                out[3 * x] = in[3 * x + 2];
+                out[3 * x + 1] = in[3 * x + 1];
+                out[3 * x + 2] = in[3 * x];
+            }
+        }
+
+        const int32_t *horizontal(const uint8_t *src, size_t src_step, int sy, std::vector<int32_t> *rows, int *cached) const
+        {
+            if (cached[0] == sy)
+                return rows[0].data();
+            if (cached[1] == sy)
+                return rows[1].data();
+            // replace the row that is not the other one of the pair
+            const int slot = (cached[0] < cached[1]) ? 0 : 1;
+            cached[slot] = sy;
+            int32_t *out = rows[slot].data();
+            const uint8_t *in = src + src_step * sy;
+            const int c0 = m_swap_rb ? 2 : 0;
+            const int c2 = m_swap_rb ? 0 : 2;
+            const int width = m_letterbox.image_width;
+            for (int x = 0; x < width; x++)
+            {
+                const uint8_t *p0 = in + m_x_offsets[2 * x];
+                const uint8_t *p1 = in + m_x_offsets[2 * x + 1];
+                const int32_t w0 = m_x_weights[2 * x];
+                const int32_t w1 = m_x_weights[2 * x + 1];
+                out[3 * x] = p0[c0] * w0 + p1[c0] * w1;
+                out[3 * x + 1] = p0[1] * w0 + p1[1] * w1;
+                out[3 * x + 2] = p0[c2] * w0 + p1[c2] * w1;
+            }
+            return out;
+        }
+
+        static void vertical(const int32_t *row0, const int32_t *row1, int32_t w0, int32_t w1, uint8_t *out, size_t count)
+        {
+            // both passes scale by 1 << 11, the sum of the weights, so the result is within [0, 255 << 22]
+            const int shift = 2 * WEIGHT_BITS;
+            const int32_t round = 1 << (shift - 1);
+            size_t i = 0;
+#if defined(__AVX2__)
+            const __m256i vw0 = _mm256_set1_epi32(w0);
+            const __m256i vw1 = _mm256_set1_epi32(w1);
+            const __m256i vround = _mm256_set1_epi32(round);
+            for (; i + 16 <= count; i += 16)
+            {
+                __m256i a = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(row0 + i)), vw0),
+                                             _mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1 + i)), vw1));
+                __m256i b = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(row0 + i + 8)), vw0),
+                                             _mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1 + i + 8)), vw1));
+                a = _mm256_srai_epi32(_mm256_add_epi32(a, vround), shift);
+                b = _mm256_srai_epi32(_mm256_add_epi32(b, vround), shift);
+                // the packs work within 128 bit lanes, the permutes put the values back in order
+                __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xD8);
+                __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0xD8);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm256_castsi256_si128(bytes));
+            }
+#elif defined(LETTERBOX_NEON)
+            const int32x4_t vw0 = vdupq_n_s32(w0);
+            const int32x4_t vw1 = vdupq_n_s32(w1);
+            const int32x4_t vround = vdupq_n_s32(round);
+            for (; i + 8 <= count; i += 8)
+            {
+                int32x4_t a = vmlaq_s32(vmlaq_s32(vround, vld1q_s32(row0 + i), vw0), vld1q_s32(row1 + i), vw1);
+                int32x4_t b = vmlaq_s32(vmlaq_s32(vround, vld1q_s32(row0 + i + 4), vw0), vld1q_s32(row1 + i + 4), vw1);
+                uint16x8_t words = vcombine_u16(vqmovun_s32(vshrq_n_s32(a, 22)), vqmovun_s32(vshrq_n_s32(b, 22)));
+                vst1_u8(out + i, vqmovn_u16(words));
+            }
+#endif
+            for (; i < count; i++)
+                out[i] = (uint8_t)((row0[i] * w0 + row1[i] * w1 + round) >> shift);
+        }
+    };
+}
@@ -1,5 +1,11 @@
 #include "tensors_buffers.hpp"
+#include "dma_buffer_pool.hpp"
+#include "letterbox.hpp"
 #include "yolo_post.hpp"
+#include "post_processor.hpp"
+#include "hailort_backend.hpp"
+#include "mock_backend.hpp"
+#include "stage_stats.hpp"
 #include "hailo/hailort.hpp"
 
 #include <opencv2/opencv.hpp>
@@ -9,6 +15,7 @@
 #include <condition_variable>
 #include <memory>
 #include <vector>
+#include <numeric>
 #include <chrono>
 #include <algorithm>
 #include <atomic>
@@ -24,26 +31,111 @@ using namespace hailort;
 
 constexpr auto TIMEOUT = std::chrono::milliseconds(1000);
 constexpr int default_max_num_frames_to_process = 1200;
+constexpr size_t default_pool_slack = 4; // frames held after their transfers, waiting for post-process
 
 class AbstractCapture {
 public:
     int counter_frames;
 
-    AbstractCapture(const std::string& filename, int max_num_frames_to_process, int counter_frames) : filename(filename), max_num_frames_to_process(max_num_frames_to_process), counter_frames(counter_frames) {}
-    virtual int getNextFrame(AlignedBuffer buffer) = 0; // Pure virtual function
+    AbstractCapture(const std::string& filename, int max_num_frames_to_process, int counter_frames) : filename(filename), max_num_frames_to_process(max_num_frames_to_process), counter_frames(counter_frames),
+        width(0), height(0), source_width(0), source_height(0), resize_mode(common::ResizeMode::LETTERBOX), swap_rb(true), parallel_preprocess(false) {}
+    virtual ~AbstractCapture() = default;
+    // Write the next frame into frame.buffer (the network input), and fill frame.source and frame.letterbox
+    virtual int getNextFrame(InputFrame &frame) = 0; // Pure virtual function
     virtual hailo_status setHeightWidth(double height_hef, double width_hef) = 0; // Pure virtual function
+    // How frames are brought to the HEF input (to call before setHeightWidth): resize_mode when their size differs,
+    // swap_rb to convert BGR to RGB, parallel_preprocess to split the resize among the OpenCV threads
+    void setPreprocess(common::ResizeMode resize_mode, bool swap_rb, bool parallel_preprocess) {
+        this->resize_mode = resize_mode;
+        this->swap_rb = swap_rb;
+        this->parallel_preprocess = parallel_preprocess;
+    }
+    // The source frames are decoded into buffers of their own when they are preprocessed, mapped here once (as many as
+    // the input buffers, they are held as long)
+    void createSourcePool(size_t num_buffers, bool huge_pages) {
+        if (resizer) {
+            source_pool = common::DmaBufferPool::create(static_cast<size_t>(source_width) * source_height * 3, num_buffers, huge_pages);
+        }
+    }
+    const common::DmaBufferPool *getSourcePool() {
+        return source_pool.get(); // null when the frames are decoded straight into the input buffers
+    }
     int getWidth() {
         return width;
     }
     int getHeight() {
         return height;
     }
+    int getSourceWidth() {
+        return source_width;
+    }
+    int getSourceHeight() {
+        return source_height;
+    }
 
 protected:
     std::string filename;
     int max_num_frames_to_process;
     int width;
     int height;
+    int source_width;
+    int source_height;
+    common::ResizeMode resize_mode;
+    bool swap_rb;
+    bool parallel_preprocess;
+    std::unique_ptr<common::LetterboxResizer> resizer; // null when the source frames are the network input as is
+    std::shared_ptr<common::DmaBufferPool> source_pool;
+
+    hailo_status configure(double height_hef, double width_hef, int height_capture, int width_capture) {
+        if (height_capture <= 0 || width_capture <= 0) {
+            std::cerr << "Error: Invalid frame size of capture device, hxw: " << height_capture << "x" << width_capture << std::endl;
+            return HAILO_INVALID_ARGUMENT;
+        }
+        height = static_cast<int>(height_hef);
+        width = static_cast<int>(width_hef);
+        source_height = height_capture;
+        source_width = width_capture;
+        auto letterbox = common::Letterbox::compute(source_width, source_height, width, height, resize_mode);
+        if (!letterbox.identity()) {
+            std::cout << "Frames of hxw " << source_height << "x" << source_width << " are " << (common::ResizeMode::LETTERBOX == resize_mode ? "letterboxed" : "resized")
+                      << " to the HEF input hxw " << height << "x" << width << std::endl;
+        }
+        if (!letterbox.identity() || swap_rb) {
+            resizer = std::make_unique<common::LetterboxResizer>(letterbox, swap_rb);
+        }
+        return HAILO_SUCCESS;
+    }
+
+    // Where to decode the next frame: a source buffer if it is preprocessed, the network input otherwise
+    cv::Mat sourceFrame(InputFrame &frame) {
+        if (!resizer) {
+            frame.source.reset();
+            frame.letterbox = common::Letterbox(width, height);
+            return cv::Mat(height, width, CV_8UC3, static_cast<void*>(frame.buffer.get()));
+        }
+        frame.source = source_pool->acquire();
+        frame.letterbox = resizer->letterbox();
+        return cv::Mat(source_height, source_width, CV_8UC3, static_cast<void*>(frame.source.get()));
+    }
+
+    // Resize (and convert) the decoded source frame straight into the network input
+    void preprocess(InputFrame &frame) {
+        if (!resizer) {
+            return;
+        }
+        const uint8_t *src = frame.source.get();
+        uint8_t *dst = frame.buffer.get();
+        const size_t src_step = static_cast<size_t>(source_width) * 3;
+        const size_t dst_step = static_cast<size_t>(width) * 3;
+        if (parallel_preprocess) {
+            const common::LetterboxResizer &rows_resizer = *resizer;
+            cv::parallel_for_(cv::Range(0, height), [&rows_resizer, src, src_step, dst, dst_step](const cv::Range &range) {
+                rows_resizer.run_rows(src, src_step, dst, dst_step, range.start, range.end);
+            });
+        } else {
+            resizer->run(src, src_step, dst, dst_step);
+        }
+    }
 };
 
 class ImageCapture : public AbstractCapture {
@@ -56,10 +148,11 @@ public:
         }
     }
 
-    int getNextFrame(AlignedBuffer buffer) override {
+    int getNextFrame(InputFrame &frame) override {
         if (counter_frames < max_num_frames_to_process) {
-            cv::Mat frame(height, width, CV_8UC3, static_cast<void*>(buffer.get()));
-            capture.copyTo(frame); // TODO: make sure same type and size, so there won't be reallocation
+            cv::Mat source = sourceFrame(frame);
+            capture.copyTo(source); // same type and size, so there is no reallocation
+            preprocess(frame);
             counter_frames++;
             return EXIT_SUCCESS;
         }
@@ -68,15 +161,7 @@ public:
 
     hailo_status setHeightWidth(double height_hef, double width_hef) override {
         cv::Size size = capture.size();
-        int height_capture = size.height;
-        int width_capture = size.width;
-        if (height_hef != height_capture || width_hef != width_capture) {
-            std::cerr << "Error: Frame size of HEF and capture device do not match, hxw HEF: " << height_hef << "x" << width_hef << ", hxw capture: " << height_capture << "x" << width_capture << std::endl;
-            return HAILO_INVALID_ARGUMENT; // TODO: maybe resize video and not fail, and only print warnning
-        }
-        height = height_hef;
-        width = width_hef;
-        return HAILO_SUCCESS;
+        return configure(height_hef, width_hef, size.height, size.width);
     }
 
 private:
@@ -94,14 +179,22 @@ public:
         max_num_frames_to_process = static_cast<int>(capture.get(cv::CAP_PROP_FRAME_COUNT));
     }
 
-    int getNextFrame(AlignedBuffer buffer) override {
+    int getNextFrame(InputFrame &frame) override {
         if (counter_frames < max_num_frames_to_process) {
-            cv::Mat frame(height, width, CV_8UC3, static_cast<void*>(buffer.get()));
-            capture >> frame;
-            if (!frame.empty()) {
-                counter_frames++;
-                return EXIT_SUCCESS;
+            cv::Mat source = sourceFrame(frame);
+            const uint8_t *data = source.data;
+            capture >> source;
+            if (source.empty()) {
+                return EXIT_FAILURE; // finished all frames (video)
+            }
+            if (source.data != data) {
+                // a frame of another size was decoded into a new Mat instead of the buffer
+                std::cerr << "Error: Frame size of capture device changed, hxw: " << source.rows << "x" << source.cols << std::endl;
+                return EXIT_FAILURE;
             }
+            preprocess(frame);
+            counter_frames++;
+            return EXIT_SUCCESS;
         }
         return EXIT_FAILURE; // finished all frames (video)
     }
@@ -109,13 +202,7 @@ public:
     hailo_status setHeightWidth(double height_hef, double width_hef) override {
         double height_capture = capture.get(cv::CAP_PROP_FRAME_HEIGHT);
         double width_capture = capture.get(cv::CAP_PROP_FRAME_WIDTH);
-        if (height_hef != height_capture || width_hef != width_capture) {
-            std::cerr << "Error: Frame size of HEF and capture device do not match, hxw HEF: " << height_hef << "x" << width_hef << ", hxw capture: " << height_capture << "x" << width_capture << std::endl;
-            return HAILO_INVALID_ARGUMENT; // TODO: maybe resize video and not fail, and only print warnning
-        }
-        height = height_hef;
-        width = width_hef;
-        return HAILO_SUCCESS;
+        return configure(height_hef, width_hef, static_cast<int>(height_capture), static_cast<int>(width_capture));
     }
 
 private:
@@ -123,24 +210,99 @@ private:
 
 };
 
+// YOLOv5 decoding and NMS (yolo_post.hpp), the boxes are drawn on the frame
+class YoloV5PostProcessor : public PostProcessor {
+public:
+    YoloV5PostProcessor(bool print, std::mutex &print_mutex, std::vector<std::vector<int>> anchors = default_anchors) :
+        print(print), print_mutex(print_mutex), anchors(anchors), image_width(0), image_height(0) {}
+
+    hailo_status configure(const hailo_stream_info_t &input, const std::vector<hailo_stream_info_t> &outputs) override {
+        if (outputs.size() != anchors.size()) {
+            std::cerr << "Error: YOLOv5 post-process expects " << anchors.size() << " outputs, the network has " << outputs.size() << std::endl;
+            return HAILO_INVALID_ARGUMENT;
+        }
+        image_width = input.hw_shape.width;
+        image_height = input.hw_shape.height;
+        output_tensors.clear();
+        for (auto &output : outputs) {
+            output_tensors.push_back(std::make_shared<OutputTensor>(output));
+        }
+        // the anchors go from the largest output (stride 8) to the smallest, whatever the order of the streams
+        order.resize(outputs.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [this](size_t i, size_t j) {
+            return OutputTensor::sort_tensors_by_size(output_tensors[i], output_tensors[j]);
+        });
+        return HAILO_SUCCESS;
+    }
+
+    void process(cv::Mat &frame, const common::Letterbox &letterbox, const std::vector<AlignedBuffer> &outputs) override {
+        YoloPost yolo_post;
+        // smallest output first, as the detections of the coarse outputs were extracted first so far
+        for (size_t k = order.size(); k > 0; k--) {
+            auto &tensor = output_tensors[order[k - 1]];
+            yolo_post.feature_maps.push_back(FeatureMap(outputs[order[k - 1]], tensor->m_height, tensor->m_width, tensor->m_channels,
+                default_anchors_num, default_feature_map_channels, tensor->m_qp_zp, tensor->m_qp_scale, default_conf_threshold, anchors[k - 1],
+                image_width, image_height));
+        }
+        yolo_post.decode();
+        yolo_post.to_source(letterbox); // the boxes are drawn on the source frame
+        const std::vector<DetectionObject> &detections = yolo_post.detections;
+        for (auto& detection : detections) {
+            if (detection.confidence > 0) {
+                if (print) {
+                    std::unique_lock<std::mutex> lock(print_mutex);
+                    std::cout << "detection: id: "  << detection.class_id << ", bbox: " << detection.xmin << ", " << detection.ymin << ", " << detection.xmax << ", " << detection.ymax << ", " << detection.confidence << std::endl;
+                }
+                cv::rectangle(frame, cv::Point2f(detection.xmin, detection.ymin), 
+                    cv::Point2f(detection.xmax, detection.ymax), 
+                    cv::Scalar(0, 0, 255), 1);
+            }
+        }
+    }
+
+private:
+    bool print;
+    std::mutex &print_mutex;
+    std::vector<std::vector<int>> anchors;
+    int image_width;
+    int image_height;
+    std::vector<std::shared_ptr<OutputTensor>> output_tensors;
+    std::vector<size_t> order; // output indices from the largest output to the smallest
+};
+
 class App {
 private:
-    std::unique_ptr<hailort::Device> device;
-    std::shared_ptr<ConfiguredNetworkGroup> network_group; // TODO: all the .get() are because of reference_wrapper, maybe save as plain reference of inputs & outputs vstreams instead (or in addition)
-    int num_outputs;
-    std::mutex print_mutex;
+    std::unique_ptr<common::AsyncBackend> backend; // the device, or a mock of it (see main)
+    size_t num_outputs;
     std::atomic<int> input_ctr;
-    std::array<std::atomic<int>, default_num_outputs> output_ctr;
-    std::array<std::atomic<int>, default_num_outputs> output_callback_ctr;
     std::atomic<int> pp_ctr;
-    std::atomic<bool> continue_run;
     bool print;
-    std::mutex outputs_mutex;
-    std::condition_variable outputs_cv;
+    std::unique_ptr<PostProcessor> post_processor;
+    std::shared_ptr<common::DmaBufferPool> input_pool;
+    std::vector<std::shared_ptr<common::DmaBufferPool>> output_pools;
+    size_t frames_capacity; // frames held at once between the input thread and the post-process
+    size_t in_flight; // transfers in flight per stream
+    common::StageStats stats;
+    common::StageStats::Stage &capture_stage;
+    common::StageStats::Stage &inference_stage;
+    common::StageStats::Stage &pp_stage;
+    common::StageStats::Stage &encode_stage;
+
+    static void print_pool_stats(const std::string &name, const common::DmaBufferPool &pool) {
+        auto stats = pool.stats();
+        std::cout << "Buffer pool " << name << ": " << stats.buffers << " buffers" << (stats.huge_pages ? " (huge pages)" : "")
+                  << ", at most " << stats.in_use_high_water << " in use, " << stats.exhausted << " exhausted" << std::endl;
+    }
 
 public:
     std::unique_ptr<AbstractCapture> camera;
-    App(const std::string filename) : num_outputs(0), input_ctr(0), pp_ctr(0), continue_run(false), print(false) {
+    std::mutex print_mutex;
+    // resize_mode, swap_rb and parallel_preprocess: how the frames are brought to the HEF input, see AbstractCapture::setPreprocess
+    App(const std::string filename, common::ResizeMode resize_mode = common::ResizeMode::LETTERBOX, bool swap_rb = true, bool parallel_preprocess = false) :
+        num_outputs(0), input_ctr(0), pp_ctr(0), print(false), frames_capacity(0), in_flight(0),
+        capture_stage(stats.stage("capture")), inference_stage(stats.stage("write -> outputs")),
+        pp_stage(stats.stage("post-process")), encode_stage(stats.stage("encode")) {
         size_t dot_position = filename.rfind('.');
         if (dot_position != std::string::npos) {
             const std::string extension = filename.substr(dot_position + 1);
@@ -158,123 +320,111 @@ public:
             std::cout << "Unknown file format" << std::endl;
             exit(1);
         }
+        camera->setPreprocess(resize_mode, swap_rb, parallel_preprocess);
     }
 
     const int get_num_frames_processed() {
         return camera->counter_frames;
     }
 
-    hailo_status init(const std::string& hef_path, bool print) {
-        auto device_exp = Device::create();
-        if (!device_exp) {
-            std::cerr << "Failed to create device " << device_exp.status() << std::endl;
-            return device_exp.status();
-        }
-        device = device_exp.release();
-
-        auto network_group_exp = configureNetwork(hef_path);
-        if (!network_group_exp) {
-            std::cerr << "Failed to configure network group" << std::endl;
-            return network_group_exp.status();
-        }
-        network_group = std::move(network_group_exp.value());
-        auto status = camera->setHeightWidth(network_group->get_input_streams()[0].get().get_info().hw_shape.height, network_group->get_input_streams()[0].get().get_info().hw_shape.width);
+    // max_in_flight: transfers in flight per stream, 0 (or more than the streams can queue) for their max async queue size
+    // pool_buffers: buffers per stream pool, 0 to size the pools for the frames in flight and the ones waiting for post-process
+    // backend: the network group to run, see common::HailoAsyncBackend and common::MockAsyncBackend
+    hailo_status init(std::unique_ptr<common::AsyncBackend> backend, bool print, std::unique_ptr<PostProcessor> post_processor, size_t max_in_flight = 0,
+        size_t pool_buffers = 0, bool huge_pages = false) {
+        this->backend = std::move(backend);
+        const hailo_stream_info_t &input_info = this->backend->input_infos()[0];
+        auto status = camera->setHeightWidth(input_info.hw_shape.height, input_info.hw_shape.width);
         if (status != HAILO_SUCCESS) {
             std::cerr << "Failed to set input width and height" << std::endl;
             return status;
         }
-        num_outputs = network_group->get_output_vstream_infos()->size();
         // TODO: add num_inputs to support multiple inputs
-        for (int i = 0; i < num_outputs; i++) {
-            output_ctr[i].store(0);
-        }
-        for (int i = 0; i < num_outputs; i++) {
-            output_callback_ctr[i].store(0);
-        }
-
-        continue_run = true;
-        this->print = print;
-        return HAILO_SUCCESS;
-    }
-
-    hailort::Expected<std::shared_ptr<hailort::ConfiguredNetworkGroup>> configureNetwork(const std::string& hef_path) {
-        auto hef_exp = Hef::create(hef_path);
-        if (!hef_exp) {
-            return make_unexpected(hef_exp.status());
+        num_outputs = this->backend->output_infos().size();
+        status = post_processor->configure(input_info, this->backend->output_infos());
+        if (status != HAILO_SUCCESS) {
+            std::cerr << "Failed to configure post-process" << std::endl;
+            return status;
         }
-        auto hef = hef_exp.release();
-
-        auto configure_params = device->create_configure_params(hef);
-        if (!configure_params) {
-            return make_unexpected(configure_params.status());
+        this->post_processor = std::move(post_processor);
+        // keep as many transfers in flight as every stream can queue, so the device never waits for the host
+        in_flight = this->backend->input_queue_size(0);
+        for (size_t i = 0; i < num_outputs; i++) {
+            in_flight = std::min(in_flight, this->backend->output_queue_size(i));
         }
-
-        // change stream_params to operate in async mode
-        for (auto &ng_name_params_pair : *configure_params) {
-            for (auto &stream_params_name_pair : ng_name_params_pair.second.stream_params_by_name) {
-                stream_params_name_pair.second.flags = HAILO_STREAM_FLAGS_ASYNC;
-            }
+        if (max_in_flight > 0) {
+            in_flight = std::min(in_flight, max_in_flight);
         }
-
-        auto network_groups = device->configure(hef, configure_params.value());
-        if (!network_groups) {
-            return make_unexpected(network_groups.status());
+        // frames between their write and their post-process: in_flight writes, in_flight frames inferred and being read back,
+        // and the ones waiting for post-process
+        frames_capacity = 2 * in_flight + default_pool_slack;
+        // the stream buffers are mapped once here and recycled, instead of mmap/munmap for every frame.
+        // an input buffer is held from the capture to the end of its post-process (+2 for the ones being captured
+        // and post-processed), an output buffer from its read (posted up to in_flight reads ahead) to the end of
+        // the post-process
+        input_pool = common::DmaBufferPool::create(this->backend->input_frame_size(0), pool_buffers ? pool_buffers : frames_capacity + 2, huge_pages);
+        camera->createSourcePool(input_pool->num_buffers(), huge_pages);
+        for (size_t i = 0; i < num_outputs; i++) {
+            output_pools.push_back(common::DmaBufferPool::create(this->backend->output_frame_size(i),
+                pool_buffers ? pool_buffers : frames_capacity + in_flight + 1, huge_pages));
         }
 
-        if (1 != network_groups->size()) {
-            std::cerr << "Invalid amount of network groups" << std::endl;
-            return make_unexpected(HAILO_INTERNAL_FAILURE);
-        }
-
-        return std::move(network_groups->at(0));
+        this->print = print;
+        return HAILO_SUCCESS;
     }
 
-    static void input_async_callback(const InputStream::CompletionInfo &completion_info)
+    static void input_async_callback(hailo_status status)
     {
-        if ((HAILO_SUCCESS != completion_info.status) && (HAILO_STREAM_ABORTED_BY_USER  != completion_info.status)) {
-            // We will get HAILO_STREAM_ABORTED_BY_USER  when activated_network_group is destructed.
-            std::cerr << "Got an unexpected status on callback. status=" << completion_info.status << std::endl;
+        if ((HAILO_SUCCESS != status) && (HAILO_STREAM_ABORTED_BY_USER  != status)) {
+            // We will get HAILO_STREAM_ABORTED_BY_USER  when the backend is deactivated.
+            std::cerr << "Got an unexpected status on callback. status=" << status << std::endl;
         }
     }
 
     hailo_status run() {
-        auto inputs = network_group->get_input_streams();
-        auto outputs = network_group->get_output_streams();
-        // --------------------------------------------------- create wrappers for input / output -----------------------------------
-        InputTensor input_tensor(inputs[0].get().get_info()); // we have only 1 input
-        std::vector<hailo_stream_info_t> outputs_stream_infos; // we have n outputs
-        for (auto& output : outputs) {
-            outputs_stream_infos.push_back(output.get().get_info());
-        }
-        OutputTensors output_tensors(outputs_stream_infos);
+        // the input buffer and the output buffers of each frame, joined by sequence number for the post-process
+        // (declared before the activation, whose end aborts the reads posted ahead into it)
+        FrameJoiner joiner(num_outputs, frames_capacity, in_flight);
         // --------------------------------------------------- activate network group -----------------------------------------------
-        auto activated_network_group = network_group->activate();
-        if (!activated_network_group) {
-            std::cerr << "Failed to activate network group "  << activated_network_group.status() << std::endl;
-            return activated_network_group.status();
+        auto activate_status = backend->activate();
+        if (HAILO_SUCCESS != activate_status) {
+            return activate_status;
         }
         std::chrono::steady_clock::time_point begin_time = std::chrono::steady_clock::now();
         // --------------------------------------------------- input thread -------------------------------------------------------
         std::atomic<hailo_status> input_status(HAILO_UNINITIALIZED);
-        std::thread input_thread([&print_mutex=print_mutex, &input_status, &inputs, &camera=camera, &input_tensor, &input_ctr=input_ctr, &continue_run=continue_run, &print=print]() {
-            while (continue_run) {
-                input_status = inputs[0].get().wait_for_async_ready(inputs[0].get().get_frame_size(), TIMEOUT);
-                if (HAILO_SUCCESS != input_status) { return; }
-                auto input_buffer = page_aligned_alloc(inputs[0].get().get_frame_size());
-                auto get_frame_status = camera->getNextFrame(input_buffer);
+        std::thread input_thread([&print_mutex=print_mutex, &input_status, &backend=backend, &camera=camera, &joiner, &input_ctr=input_ctr, &print=print, &input_pool=input_pool,
+            &capture_stage=capture_stage]() {
+            while (HAILO_SUCCESS == joiner.status()) { // stops if a stream failed
+                input_status = backend->wait_for_write_ready(0, TIMEOUT);
+                if (HAILO_SUCCESS != input_status) { break; }
+                InputFrame frame;
+                frame.buffer = input_pool->acquire();
+                auto capture_begin = std::chrono::steady_clock::now();
+                auto get_frame_status = camera->getNextFrame(frame);
                 if (EXIT_SUCCESS != get_frame_status) {
-                    continue_run = false;
-                    return; 
+                    break; // finished all frames
                 }
-                input_tensor.m_queue.push(input_buffer);
-                input_status = inputs[0].get().write_async(input_buffer.get(), inputs[0].get().get_frame_size(), input_async_callback);
-                if (HAILO_SUCCESS != input_status) { return; }
+                frame.written = std::chrono::steady_clock::now();
+                capture_stage.add(capture_begin, frame.written);
+                auto input_buffer = frame.buffer;
+                joiner.add_input(std::move(frame));
+                input_status = backend->write_async(0, input_buffer.get(), backend->input_frame_size(0),
+                    [&joiner](hailo_status status) {
+                    input_async_callback(status);
+                    joiner.input_done();
+                });
+                if (HAILO_SUCCESS != input_status) { break; }
                 if (print) {
                     std::unique_lock<std::mutex> lock(print_mutex);
                     std::cout << "input async write " << input_ctr << std::endl;
                 }
                 input_ctr++;
             }
+            if ((HAILO_SUCCESS != input_status) && (HAILO_UNINITIALIZED != input_status)) {
+                joiner.abort(input_status);
+            }
+            joiner.finish();
         });
         // --------------------------------------------------- outputs threads -------------------------------------------------------
         std::vector<std::thread> output_threads;
@@ -283,110 +433,73 @@ public:
         for (auto& status : output_statuses) {
             status.store(HAILO_UNINITIALIZED);
         }
-        std::vector<OutputStream::TransferDoneCallback> output_async_callbacks_guard;
-        for (int i = 0; i < num_outputs; i++) {
-            OutputStream::TransferDoneCallback output_async_callback = [&output_callback_ctr=output_callback_ctr, i, &outputs_mutex=outputs_mutex, &outputs_cv=outputs_cv](const OutputStream::CompletionInfo &completion_info) {
-                if ((HAILO_SUCCESS != completion_info.status) && (HAILO_STREAM_ABORTED_BY_USER != completion_info.status)) {
-                    // We will get HAILO_STREAM_ABORTED_BY_USER when activated_network_group is destructed.
-                    std::cerr << "Got an unexpected status on callback. status=" << completion_info.status << std::endl;
-                }
-                std::unique_lock<std::mutex> lock(outputs_mutex);
-                output_callback_ctr[i]++;
-                if (output_callback_ctr[0] > 0 && output_callback_ctr[1] > 0 && output_callback_ctr[2] > 0) {
-                    outputs_cv.notify_all();
-                }
-                lock.unlock();
-
-            };
-            output_async_callbacks_guard.push_back(output_async_callback);
-        }
-        for (int i = 0; i < num_outputs; i++) {
-            output_threads.emplace_back(std::thread([&print_mutex=print_mutex, &output_statuses, &outputs, i, &output_tensors, &input_ctr=input_ctr, &output_ctr=output_ctr[i], &continue_run=continue_run, &print=print, &output_async_callback=output_async_callbacks_guard[i]]() {
-            while (output_ctr < input_ctr || continue_run) { // we haven't finished to process all the input frames
-                output_statuses[i] = outputs[i].get().wait_for_async_ready(outputs[i].get().get_frame_size(), TIMEOUT);
-                if (HAILO_SUCCESS != output_statuses[i]) { return; }
-
-                auto output_buffer = page_aligned_alloc(outputs[i].get().get_frame_size());
-                output_statuses[i] = outputs[i].get().read_async(output_buffer.get(), outputs[i].get().get_frame_size(), output_async_callback);
-                if (HAILO_SUCCESS != output_statuses[i]) { return; }
-                output_tensors.outputs[i].get()->m_queue.push(output_buffer);
+        for (size_t i = 0; i < num_outputs; i++) {
+            output_threads.emplace_back(std::thread([&print_mutex=print_mutex, &output_statuses, &backend=backend, i, &joiner, &print=print, &output_pool=output_pools[i]]() {
+            // up to in_flight reads are posted, ahead of the writes, and they stop with the input
+            for (uint64_t seq = 0; joiner.wait_for_read(i, seq); seq++) {
+                output_statuses[i] = backend->wait_for_read_ready(i, TIMEOUT);
+                if (HAILO_SUCCESS != output_statuses[i]) { break; }
+
+                auto output_buffer = output_pool->acquire();
+                // the callback holds the buffer until the read completed, then hands it over to the joiner
+                output_statuses[i] = backend->read_async(i, output_buffer.get(), backend->output_frame_size(i),
+                    [&joiner, seq, i, output_buffer](hailo_status status) {
+                    if ((HAILO_SUCCESS != status) && (HAILO_STREAM_ABORTED_BY_USER != status)) {
+                        // We will get HAILO_STREAM_ABORTED_BY_USER when the backend is deactivated.
+                        std::cerr << "Got an unexpected status on callback. status=" << status << std::endl;
+                    }
+                    joiner.output_done(seq, i, output_buffer, status);
+                });
+                if (HAILO_SUCCESS != output_statuses[i]) { break; }
                 if (print) {
                     std::unique_lock<std::mutex> lock(print_mutex);
-                    std::cout << "output async read " << output_ctr << ", thread " << i << std::endl;
-                }
-                output_ctr++;
+                    std::cout << "output async read " << seq << ", thread " << i << std::endl;
                 }
+            }
+            if ((HAILO_SUCCESS != output_statuses[i]) && (HAILO_UNINITIALIZED != output_statuses[i])) {
+                joiner.abort(output_statuses[i]);
+            }
             }));
         }
         // --------------------------------------------------- post-process thread -------------------------------------------------------
         std::atomic<hailo_status> pp_status(HAILO_UNINITIALIZED);
-        std::thread pp_thread([&print_mutex=print_mutex, &camera=camera, &input_tensor, &output_tensors, &input_ctr=input_ctr, &output_callback_ctr=output_callback_ctr, &pp_ctr=pp_ctr, &continue_run=continue_run, &print=print, &pp_status=pp_status, &outputs_mutex=outputs_mutex, &outputs_cv=outputs_cv]() {
+        std::thread pp_thread([&print_mutex=print_mutex, &camera=camera, &joiner, &post_processor=post_processor, &pp_ctr=pp_ctr, &print=print, &pp_status=pp_status,
+            &inference_stage=inference_stage, &pp_stage=pp_stage, &encode_stage=encode_stage]() {
 #ifdef SAVE_TO_FILE
-            cv::VideoWriter video("./processed_video.mp4", cv::VideoWriter::fourcc('m','p','4','v'),30, cv::Size(camera->getWidth(), camera->getHeight())); // add in order to save to file the processed video
+            cv::VideoWriter video("./processed_video.mp4", cv::VideoWriter::fourcc('m','p','4','v'),30, cv::Size(camera->getSourceWidth(), camera->getSourceHeight())); // add in order to save to file the processed video
 #endif
-            while (pp_ctr < input_ctr || continue_run) { // we haven't finished to process all the input frames // was: while (pp_ctr < input_ctr || continue_run)
-                // we have to make sure that all 3 outputs finished calback before we can pop them 
-                std::unique_lock<std::mutex> lock(outputs_mutex);
-                while (output_callback_ctr[0] <= 0 || output_callback_ctr[1] <= 0 || output_callback_ctr[2] <= 0) {
-                    outputs_cv.wait(lock); // Release the lock and wait for a signal.
-                }
-                // was: lock.unlock() here
-
-                auto out_0 = output_tensors.outputs[0]->m_queue.pop();
-                auto out_1 = output_tensors.outputs[1]->m_queue.pop();
-                auto out_2 = output_tensors.outputs[2]->m_queue.pop();
-                auto raw_input = input_tensor.m_queue.pop();
-                output_callback_ctr[0]--;
-                output_callback_ctr[1]--;
-                output_callback_ctr[2]--;
-                lock.unlock();
-                if ( !out_0 || !out_1 || !out_2 || !raw_input) {
-                    std::cerr << "Failed to pop input or output buffer" << std::endl;
-                    pp_status = HAILO_INTERNAL_FAILURE;
-                    return;
-                }
+            InputFrame raw_input;
+            std::vector<AlignedBuffer> frame_outputs;
+            while (joiner.pop(raw_input, frame_outputs)) { // waits until all the outputs of the next frame completed
+                auto pp_begin = std::chrono::steady_clock::now();
+                inference_stage.add(raw_input.written, pp_begin);
                 if (print) {
                     std::unique_lock<std::mutex> lock(print_mutex);
                     std::cout << "post-process async write " << pp_ctr << std::endl;
                 }
-                cv::Mat raw_frame(camera->getHeight(), camera->getWidth(), CV_8UC3, static_cast<void*>(raw_input.get()));
-
-                FeatureMap feature_map_2(out_2, output_tensors.outputs[2]->m_height, output_tensors.outputs[2]->m_width, output_tensors.outputs[2]->m_channels, 
-                default_anchors_num, default_feature_map_channels, output_tensors.outputs[2]->m_qp_zp, output_tensors.outputs[2]->m_qp_scale, default_conf_threshold, {116, 90, 156, 198, 373, 326});
-                FeatureMap feature_map_1(out_1, output_tensors.outputs[1]->m_height, output_tensors.outputs[1]->m_width, output_tensors.outputs[1]->m_channels, 
-                default_anchors_num, default_feature_map_channels, output_tensors.outputs[1]->m_qp_zp, output_tensors.outputs[1]->m_qp_scale, default_conf_threshold, {30, 61, 62, 45, 59, 119});
-                FeatureMap feature_map_0(out_0, output_tensors.outputs[0]->m_height, output_tensors.outputs[0]->m_width, output_tensors.outputs[0]->m_channels, 
-                default_anchors_num, default_feature_map_channels, output_tensors.outputs[0]->m_qp_zp, output_tensors.outputs[0]->m_qp_scale, default_conf_threshold, {10, 13, 16, 30, 33, 23});
-                
-                YoloPost yolo_post;
-                yolo_post.feature_maps.push_back(feature_map_2);
-                yolo_post.feature_maps.push_back(feature_map_1);
-                yolo_post.feature_maps.push_back(feature_map_0);
-
-                std::vector<DetectionObject> detections = yolo_post.decode();
-                // // -------------------------------------------------------------------------------------------------------------------
-
-                for (auto& detection : detections) {
-                    if (detection.confidence > 0) {
-                        if (print) {
-                            std::unique_lock<std::mutex> lock(print_mutex);
-                            std::cout << "detection: id: "  << detection.class_id << ", bbox: " << detection.xmin << ", " << detection.ymin << ", " << detection.xmax << ", " << detection.ymax << ", " << detection.confidence << std::endl;
-                        }
-                        cv::rectangle(raw_frame, cv::Point2f(detection.xmin, detection.ymin), 
-                            cv::Point2f(detection.xmax, detection.ymax), 
-                            cv::Scalar(0, 0, 255), 1);
-                    }
-                }
+                // the detections are drawn on the source frame, which is the network input when it was not preprocessed
+                cv::Mat raw_frame = raw_input.source ?
+                    cv::Mat(camera->getSourceHeight(), camera->getSourceWidth(), CV_8UC3, static_cast<void*>(raw_input.source.get())) :
+                    cv::Mat(camera->getHeight(), camera->getWidth(), CV_8UC3, static_cast<void*>(raw_input.buffer.get()));
+                post_processor->process(raw_frame, raw_input.letterbox, frame_outputs);
+                auto pp_end = std::chrono::steady_clock::now();
+                pp_stage.add(pp_begin, pp_end);
 #ifdef SAVE_TO_FILE
                 video << raw_frame; // add in order to save to file the processed video
+                encode_stage.add(pp_end, std::chrono::steady_clock::now());
 #endif
-    
+                // give the buffers back to their pools
+                raw_input.buffer.reset();
+                raw_input.source.reset();
+                for (auto &output : frame_outputs) {
+                    output.reset();
+                }
                 pp_ctr++;
             }
 #ifdef SAVE_TO_FILE
             video.release(); // add in order to save to file the processed video
 #endif
-            pp_status = HAILO_SUCCESS;
+            pp_status = joiner.status();
         });
         // ------------------------------------------------ join threads ----------------------------------------------------------------
         input_thread.join();
@@ -394,8 +507,18 @@ public:
             output_thread.join();
         }
         pp_thread.join();
+        backend->deactivate(); // aborts the reads posted ahead of the last frame
         std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
         std::cout << "FPS = " << get_num_frames_processed() * 1000 / std::chrono::duration_cast<std::chrono::milliseconds> (end_time - begin_time).count() << std::endl;
+        stats.print(std::cout, static_cast<size_t>(pp_ctr), end_time - begin_time);
+        std::cout << "Transfers in flight per stream: " << in_flight << ", frames in flight: at most " << joiner.in_flight_high_water() << std::endl;
+        print_pool_stats("input", *input_pool);
+        if (camera->getSourcePool()) {
+            print_pool_stats("source", *camera->getSourcePool());
+        }
+        for (size_t i = 0; i < num_outputs; i++) {
+            print_pool_stats("output " + std::to_string(i), *output_pools[i]);
+        }
         // ----------------------------------------------- check statuses --------------------------------------------------------------
 
         if ((HAILO_STREAM_NOT_ACTIVATED != input_status) && (HAILO_SUCCESS != input_status)) {
@@ -404,7 +527,7 @@ public:
         }
         if (std::any_of(output_statuses.begin(), output_statuses.end(),
                      [](const std::atomic<hailo_status>& status) {
-                         return (status != HAILO_STREAM_NOT_ACTIVATED) && (status != HAILO_SUCCESS);
+                         return (status != HAILO_STREAM_NOT_ACTIVATED) && (status != HAILO_SUCCESS) && (status != HAILO_UNINITIALIZED);
                      })) {
             std::cerr << "Got unexpected status from output thread" << std::endl;
             return HAILO_INTERNAL_FAILURE; // TODO: return specific error code
@@ -425,14 +548,46 @@ int main() {
     const std::string video_source = "640.jpg";
     const bool print = true;
     const std::string hef_path = "yolov5m_wo_spp_60p_async_h15.hef";
+    const size_t max_in_flight = 0; // transfers in flight per stream, 0: the max async queue size of the streams
+    const size_t pool_buffers = 0; // buffers per stream, 0: enough for the frames in flight and default_pool_slack frames waiting for post-process
+    const common::ResizeMode resize_mode = common::ResizeMode::LETTERBOX; // frames of another size than the HEF input are letterboxed, or STRETCH
+    const bool swap_rb = true; // the network takes RGB, OpenCV decodes BGR
+    const bool parallel_preprocess = false; // split the resize among the OpenCV threads
+    const bool huge_pages = false;
+    const std::string mock_spec = ""; // mock spec (see common/mock_backend.hpp) to run without the device, empty to run on the device
 #else
     const std::string video_source = "640.mp4";
     const bool print = true;
     const std::string hef_path = "yolov5m_wo_spp_60p.hef";
+    const size_t max_in_flight = 0; // transfers in flight per stream, 0: the max async queue size of the streams
+    const size_t pool_buffers = 0; // buffers per stream, 0: enough for the frames in flight and default_pool_slack frames waiting for post-process
+    const common::ResizeMode resize_mode = common::ResizeMode::LETTERBOX; // frames of another size than the HEF input are letterboxed, or STRETCH
+    const bool swap_rb = true; // the network takes RGB, OpenCV decodes BGR
+    const bool parallel_preprocess = false; // split the resize among the OpenCV threads
+    const bool huge_pages = false; // needs huge pages reserved in /proc/sys/vm/nr_hugepages, falls back to regular pages
+    const std::string mock_spec = ""; // mock spec (see common/mock_backend.hpp) to run without the device, empty to run on the device
 #endif
     // -------------------------------------------- main -------------------------------------------------------------------------
-    App app(video_source);
-    hailo_status status = app.init(hef_path, print);
+    std::unique_ptr<common::AsyncBackend> backend;
+    if (mock_spec.empty()) {
+        auto device_backend = common::HailoAsyncBackend::create(hef_path);
+        if (!device_backend) {
+            std::cerr << "Failed to configure " << hef_path << ", error: " << device_backend.status() << std::endl;
+            return device_backend.status();
+        }
+        backend = device_backend.release();
+    } else {
+        try {
+            backend = std::make_unique<common::MockAsyncBackend>(common::MockNetworkSpec::load(mock_spec));
+        } catch (const std::exception &e) {
+            std::cerr << "Failed to create the mock device: " << e.what() << std::endl;
+            return HAILO_INVALID_ARGUMENT;
+        }
+    }
+    App app(video_source, resize_mode, swap_rb, parallel_preprocess);
+    // the post-process of the network, any PostProcessor (see post_processor.hpp) fits the same App
+    auto post_processor = std::make_unique<YoloV5PostProcessor>(print, app.print_mutex);
+    hailo_status status = app.init(std::move(backend), print, std::move(post_processor), max_in_flight, pool_buffers, huge_pages);
     if (status != HAILO_SUCCESS) {
         std::cerr << "Failed to init app, error: " << status << std::endl;
         return status;
@@ -443,4 +598,4 @@ int main() {
         return status;
     }
     return 0;
-}
+}
\ No newline at end of file
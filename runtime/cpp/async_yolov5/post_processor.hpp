@@ -0,0 +1,45 @@
+/**
+ * Copyright 2023 (C) Hailo Technologies Ltd.
+ * All rights reserved.
+ *
+ * Hailo Technologies Ltd. ("Hailo") disclaims any warranties, including, but not limited to,
+ * the implied warranties of merchantability and fitness for a particular purpose.
+ * This software is provided on an "AS IS" basis, and Hailo has no obligation to provide maintenance,
+ * support, updates, enhancements, or modifications.
+ *
+ * You may use this software in the development of any project.
+ * You shall not reproduce, modify or distribute this software without prior written permission.
+ **/
+/**
+ * @file post_processor.hpp
+ * @brief Interface of the post-process run by the async App on every frame
+ **/
+
+#ifndef _HAILO_POST_PROCESSOR_HPP_
+#define _HAILO_POST_PROCESSOR_HPP_
+
+#include "tensors_buffers.hpp"
+#include "letterbox.hpp"
+#include "hailo/hailort.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// The App reads all the output streams of the network group, joins the outputs of each frame and hands them over
+// to a PostProcessor, so the same engine runs any network: YOLOv5 (3 outputs), YOLOv8 (6), yolov5-seg (4),
+// a network with NMS on chip or a classifier (1).
+class PostProcessor {
+public:
+    virtual ~PostProcessor() = default;
+
+    // Called once before the first frame, outputs are the infos of the output streams, in the order of the
+    // buffers given to process(). Returns an error if the network does not fit this post-process.
+    virtual hailo_status configure(const hailo_stream_info_t &input, const std::vector<hailo_stream_info_t> &outputs) = 0;
+
+    // Post-process one frame, frame is the source image (results are drawn on it), letterbox maps the network input
+    // coordinates to it, and outputs[i] is the raw buffer of output stream i. Called by a single thread, in the order
+    // of the frames.
+    virtual void process(cv::Mat &frame, const common::Letterbox &letterbox, const std::vector<AlignedBuffer> &outputs) = 0;
+};
+
+#endif /* _HAILO_POST_PROCESSOR_HPP_ */
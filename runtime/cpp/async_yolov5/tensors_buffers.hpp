@@ -2,8 +2,13 @@
 #define _OUTPUT_TENSORS_HPP_
 
 #include "hailo/hailort.hpp"
+#include "letterbox.hpp"
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
 #include <vector>
 #include <queue>
 #include <mutex>
@@ -11,25 +16,8 @@
 
 constexpr int timeoutMs = 1000;
 
-#if defined(__unix__)
-#include <sys/mman.h>
-#endif
-
+// Page-aligned stream buffer, handed out by a common::DmaBufferPool (see dma_buffer_pool.hpp)
 using AlignedBuffer = std::shared_ptr<uint8_t>;
-static AlignedBuffer page_aligned_alloc(size_t size)
-{
-#if defined(__unix__)
-    auto addr = mmap(NULL, size, PROT_WRITE | PROT_READ, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-    if (MAP_FAILED == addr) throw std::bad_alloc();
-    return AlignedBuffer(reinterpret_cast<uint8_t*>(addr), [size](void *addr) { munmap(addr, size); });
-#elif defined(_MSC_VER)
-    auto addr = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-    if (!addr) throw std::bad_alloc();
-    return AlignedBuffer(reinterpret_cast<uint8_t*>(addr), [](void *addr){ VirtualFree(addr, 0, MEM_RELEASE); });
-#else
-#pragma error("Aligned alloc not supported")
-#endif
-}
 
 template <typename T>
 class ThreadSafeQueue {
@@ -135,16 +123,12 @@ class OutputTensors {
 public:
 	OutputTensors(int num_outputs) {
 		outputs.reserve(num_outputs);
-		for (size_t i = 0; i < 3; i++) {
+		for (int i = 0; i < num_outputs; i++) {
 			std::shared_ptr<OutputTensor> tensor(nullptr);
 			outputs.emplace_back(tensor);
 		}
 	}
 
-	OutputTensors() {
-		OutputTensors(3);
-	}
-
 	OutputTensors(std::vector<hailo_stream_info_t> stream_infos) {
 		outputs.reserve(stream_infos.size());
 		for (auto& stream_info : stream_infos) {
@@ -156,4 +140,162 @@ public:
 
 };
 
+// The network input of a frame, and the source frame it was preprocessed from
+struct InputFrame {
+	AlignedBuffer buffer;        // network input, written to the input stream
+	AlignedBuffer source;        // source frame (as decoded, BGR) when it is not the network input itself, null otherwise
+	common::Letterbox letterbox; // where the source frame lies in the network input
+	std::chrono::steady_clock::time_point written; // when it was written to the input stream, for the latency stats
+};
+
+// Joins the input buffer and the n output buffers of each frame by its sequence number, for the post-process.
+// The input thread adds frames in order, the read of output i of frame seq can complete before or after the
+// reads of the other outputs (each output stream completes its own reads in order), and the post-process pops
+// the frames in order once all their outputs completed. At most capacity frames are held at once, add_input()
+// waits for the post-process when it is full, so the frames in flight never outgrow the buffer pools.
+// Every stream keeps up to window transfers in flight: window writes, and window reads per output, posted ahead
+// of the writes so the device always finds read buffers waiting.
+class FrameJoiner {
+public:
+	FrameJoiner(size_t num_outputs, size_t capacity, size_t window) : m_slots(capacity != 0 ? capacity : 1), m_num_outputs(num_outputs),
+		m_window(window != 0 ? window : 1), m_written(0), m_writes_done(0), m_reads_done(num_outputs, 0), m_completed(0), m_popped(0),
+		m_in_flight_high_water(0), m_finished(false), m_status(HAILO_SUCCESS) {
+		for (auto& slot : m_slots) {
+			slot.outputs.resize(num_outputs);
+		}
+	}
+	FrameJoiner(const FrameJoiner&) = delete;
+	FrameJoiner& operator=(const FrameJoiner&) = delete;
+
+	size_t num_outputs() const { return m_num_outputs; }
+	size_t window() const { return m_window; }
+
+	// Most frames in flight at once (written, and not all their outputs read back)
+	size_t in_flight_high_water() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_in_flight_high_water;
+	}
+
+	// Input thread: add the next frame before writing it, returns its sequence number
+	// (waits while window writes are in flight or capacity frames are held)
+	uint64_t add_input(InputFrame input) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [this] {
+			return ((m_written - m_popped) < m_slots.size() && (m_written - m_writes_done) < m_window) || HAILO_SUCCESS != m_status;
+		});
+		Slot& slot = m_slots[m_written % m_slots.size()];
+		slot.input = std::move(input);
+		slot.pending = m_num_outputs;
+		const uint64_t seq = m_written++;
+		m_in_flight_high_water = std::max(m_in_flight_high_water, static_cast<size_t>(m_written - m_completed));
+		lock.unlock();
+		m_cond.notify_all();
+		return seq;
+	}
+
+	// Input callback: a write completed (the buffer stays in the frame for the post-process)
+	void input_done() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_writes_done++;
+		m_cond.notify_all();
+	}
+
+	// Input thread: no frame will be added anymore
+	void finish() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_finished = true;
+		lock.unlock();
+		m_cond.notify_all();
+	}
+
+	// Stop all the waits with an error, e.g. when a stream failed
+	void abort(hailo_status status) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (HAILO_SUCCESS == m_status) {
+			m_status = status;
+		}
+		lock.unlock();
+		m_cond.notify_all();
+	}
+
+	hailo_status status() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_status;
+	}
+
+	// Output thread i: wait until the read of frame seq can be posted (less than window reads in flight), which can be
+	// before the frame is written. False if there will be no such frame (finished or aborted).
+	bool wait_for_read(size_t i, uint64_t seq) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [this, i, seq] {
+			return seq < m_reads_done[i] + m_window || (m_finished && seq >= m_written) || HAILO_SUCCESS != m_status;
+		});
+		return !(m_finished && seq >= m_written) && HAILO_SUCCESS == m_status;
+	}
+
+	// Output callback: the read of output i of frame seq into buffer completed.
+	// Notifies under the lock: the last callback must not touch the joiner once the post-process can see the last
+	// frame, as the owner may destroy the joiner as soon as the post-process is done.
+	void output_done(uint64_t seq, size_t i, AlignedBuffer buffer, hailo_status status) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (seq >= m_written) {
+			return; // a read posted ahead for a frame that never came, aborted when the network group is deactivated
+		}
+		if (HAILO_SUCCESS != status) {
+			if (HAILO_SUCCESS == m_status) {
+				m_status = status;
+			}
+		} else {
+			Slot& slot = m_slots[seq % m_slots.size()];
+			slot.outputs[i] = std::move(buffer);
+			m_reads_done[i]++;
+			if (0 == --slot.pending) {
+				m_completed++; // each output completes its reads in order, so do the frames
+			}
+		}
+		m_cond.notify_all();
+	}
+
+	// Post-process: wait for the next frame and take its buffers, false once all the frames were popped or on abort.
+	// The buffers are swapped with the ones given, which should be reset when done so they return to their pools.
+	bool pop(InputFrame& input, std::vector<AlignedBuffer>& outputs) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [this] {
+			return m_popped < m_completed || (m_finished && m_popped == m_written) || HAILO_SUCCESS != m_status;
+		});
+		if (HAILO_SUCCESS != m_status || m_popped == m_written) {
+			return false;
+		}
+		Slot& slot = m_slots[m_popped % m_slots.size()];
+		std::swap(input, slot.input);
+		outputs.resize(m_num_outputs);
+		outputs.swap(slot.outputs);
+		m_popped++;
+		lock.unlock();
+		m_cond.notify_all();
+		return true;
+	}
+
+private:
+	struct Slot {
+		InputFrame input;
+		std::vector<AlignedBuffer> outputs;
+		size_t pending; // outputs not completed yet
+	};
+
+	std::vector<Slot> m_slots;
+	size_t m_num_outputs;
+	size_t m_window;
+	uint64_t m_written;                 // frames added
+	uint64_t m_writes_done;             // writes completed
+	std::vector<uint64_t> m_reads_done; // reads completed, per output
+	uint64_t m_completed;               // frames whose outputs all completed
+	uint64_t m_popped;                  // frames popped
+	size_t m_in_flight_high_water;
+	bool m_finished;
+	hailo_status m_status;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+};
+
 #endif /* _OUTPUT_TENSORS_HPP_ */
@@ -16,6 +16,7 @@
  **/
 
 #include "yolo_post.hpp"
+#include "nms_engine.hpp"
 #include "hailo/hailort.hpp"
 
 #include <iostream>
@@ -23,35 +24,18 @@
 #include <memory>
 #include <algorithm>
 
-#define YOLOV5M_IMAGE_SIZE   640
 #define CONF_CHANNEL_OFFSET  4
 #define CLASS_CHANNEL_OFFSET 5
 
 
-// TODO: in hpp file
 
-float iou(const DetectionObject& box_1, const DetectionObject& box_2) {
-    const float width_of_overlap_area = std::min(box_1.xmax, box_2.xmax) - std::max(box_1.xmin, box_2.xmin);
-    const float height_of_overlap_area = std::min(box_1.ymax, box_2.ymax) - std::max(box_1.ymin, box_2.ymin);
-    const float positive_width_of_overlap_area = std::max(width_of_overlap_area, 0.0f);
-    const float positive_height_of_overlap_area = std::max(height_of_overlap_area, 0.0f);
-    const float area_of_overlap = positive_width_of_overlap_area * positive_height_of_overlap_area;
-    const float box_1_area = (box_1.ymax - box_1.ymin)  * (box_1.xmax - box_1.xmin);
-    const float box_2_area = (box_2.ymax - box_2.ymin)  * (box_2.xmax - box_2.xmin);
-    return area_of_overlap / (box_1_area + box_2_area - area_of_overlap);
-}
-
-float fix_scale(uint8_t& input, float &qp_scale, float &qp_zp) {
-  return (float(input) - qp_zp) * qp_scale;
-}
-
-YoloPost::YoloPost() : num_detections(0), conf_threshold(default_conf_threshold), iou_threshold(default_iou_threshold), num_outputs(default_num_outputs), max_num_detections(default_max_num_detections) {
+YoloPost::YoloPost() : num_detections(0), conf_threshold(default_conf_threshold), iou_threshold(default_iou_threshold), num_outputs(static_cast<int>(default_anchors.size())), max_num_detections(default_max_num_detections) {
     feature_maps.reserve(num_outputs);
     detections.reserve(default_max_num_detections);
 }
 
 YoloPost::YoloPost(float conf_threshold, float iou_threshold, int max_num_detections)
-    : num_detections(0), conf_threshold(conf_threshold), iou_threshold(iou_threshold), num_outputs(default_num_outputs), max_num_detections(max_num_detections) {
+    : num_detections(0), conf_threshold(conf_threshold), iou_threshold(iou_threshold), num_outputs(static_cast<int>(default_anchors.size())), max_num_detections(max_num_detections) {
     feature_maps.reserve(num_outputs);
     detections.reserve(max_num_detections);
 }
@@ -60,23 +44,30 @@ void FeatureMap::extract_boxes(std::vector<DetectionObject>& detections, const i
     float  confidence, x, y, h, w, xmin, ymin, xmax, ymax, conf_max = 0.0f;
     int add = 0, anchor = 0, chosen_row = 0, chosen_col = 0, chosen_cls = -1;
     uint8_t cls_prob, prob_max;
+    // the output as HWC cells of channels values (the hw stride), dequantized by table lookup, the table is built once per output
+    const common::TensorView<uint8_t> output(data.get(), height, width, channels, m_qp_scale, m_qp_zp);
+    const common::DequantLut<uint8_t> &lut = *m_lut;
+    // the confidence threshold as a quantized cutoff, anchors below it are skipped without dequantizing
+    const auto conf_gate = common::QuantizedGate<uint8_t>::at_least(conf_threshold, lut.data());
+    if (conf_gate.closed())
+        return;
     // channels 0-3 are box coordinates, channel 4 is the confidence, and channels 5-84 are classes
 
     for (int row = 0; row < height; ++row) {
         for (int col = 0; col < width; ++col) {
             prob_max = 0;
+            const uint8_t *cell = output.channels(row, col).data();
             for (int a = 0; a < anchors_num; ++a) {
-                add =  (feature_map_channels * anchors_num + 1) * width * row + (feature_map_channels * anchors_num + 1) * col + feature_map_channels * a + CONF_CHANNEL_OFFSET;
-                confidence = fix_scale(data.get()[add], m_qp_scale, m_qp_zp);
-                if (confidence < conf_threshold)
+                add = feature_map_channels * a;
+                if (!conf_gate.passes(cell[add + CONF_CHANNEL_OFFSET]))
                     continue;
+                confidence = lut[cell[add + CONF_CHANNEL_OFFSET]];
                 for (int c = CLASS_CHANNEL_OFFSET; c < feature_map_channels; ++c) {
-                    add = (feature_map_channels * anchors_num + 1) * width * row + (feature_map_channels * anchors_num + 1) * col + feature_map_channels * a + c;
                     // final confidence: box confidence * class probability
-                    cls_prob = data.get()[add];
+                    cls_prob = cell[add + c];
                     if (cls_prob > prob_max) 
 					{
-                        conf_max = fix_scale(cls_prob, m_qp_scale,  m_qp_zp) * confidence;
+                        conf_max = lut[cls_prob] * confidence;
                         chosen_cls = c - CLASS_CHANNEL_OFFSET + 1;
                         prob_max = cls_prob;
                         anchor = a;
@@ -85,18 +76,18 @@ void FeatureMap::extract_boxes(std::vector<DetectionObject>& detections, const i
                     }
                 }
                 if (conf_max >= conf_threshold) {
-                    add = (feature_map_channels * anchors_num + 1) * width * chosen_row + (feature_map_channels * anchors_num + 1) * chosen_col + feature_map_channels * anchor;
+                    const uint8_t *box = output.channels(chosen_row, chosen_col).data() + feature_map_channels * anchor;
                     // box centers
-                    x = (fix_scale(data.get()[add], m_qp_scale,  m_qp_zp) * 2.0f - 0.5f + (float)(chosen_col)) / ((float)(width));
-                    y = (fix_scale(data.get()[add + 1], m_qp_scale,  m_qp_zp) * 2.0f - 0.5f +  (float)(chosen_row)) / (float)(height);
+                    x = (lut[box[0]] * 2.0f - 0.5f + (float)(chosen_col)) / ((float)(width));
+                    y = (lut[box[1]] * 2.0f - 0.5f +  (float)(chosen_row)) / (float)(height);
                     // box scales
-                    w = (float)pow(2.0f * (fix_scale(data.get()[add + 2], m_qp_scale,  m_qp_zp)), 2.0f) * (float)(anchors[anchor * 2]) / YOLOV5M_IMAGE_SIZE;
-                    h = (float)pow(2.0f * (fix_scale(data.get()[add + 3], m_qp_scale,  m_qp_zp)), 2.0f) * (float)(anchors[anchor * 2 + 1]) / YOLOV5M_IMAGE_SIZE;
+                    w = (float)pow(2.0f * (lut[box[2]]), 2.0f) * (float)(anchors[anchor * 2]) / image_width;
+                    h = (float)pow(2.0f * (lut[box[3]]), 2.0f) * (float)(anchors[anchor * 2 + 1]) / image_height;
                     // x,y,h,w to xmin,ymin,xmax,ymax
-                    xmin = std::max(((x - (w / 2.0f)) * YOLOV5M_IMAGE_SIZE), 0.0f);
-                    ymin = std::max(((y - (h / 2.0f)) * YOLOV5M_IMAGE_SIZE), 0.0f);
-                    xmax = std::min(((x + (w / 2.0f)) * YOLOV5M_IMAGE_SIZE), (static_cast<float>(YOLOV5M_IMAGE_SIZE) - 1));
-                    ymax = std::min(((y + (h / 2.0f)) * YOLOV5M_IMAGE_SIZE), (static_cast<float>(YOLOV5M_IMAGE_SIZE) - 1));
+                    xmin = std::max(((x - (w / 2.0f)) * image_width), 0.0f);
+                    ymin = std::max(((y - (h / 2.0f)) * image_height), 0.0f);
+                    xmax = std::min(((x + (w / 2.0f)) * image_width), (static_cast<float>(image_width) - 1));
+                    ymax = std::min(((y + (h / 2.0f)) * image_height), (static_cast<float>(image_height) - 1));
 
                     if (detections.size() >= max_num_detections) {
                         return;
@@ -110,18 +101,21 @@ void FeatureMap::extract_boxes(std::vector<DetectionObject>& detections, const i
 
 void YoloPost::iou_over_frame() {
     std::sort(detections.begin(), detections.end());
-    for (size_t i = 0; i < detections.size(); ++i) {
-        if (detections[i].confidence <= conf_threshold) {
+    static thread_local common::NmsEngine engine;
+    engine.clear();
+    for (const auto &detection : detections) {
+        engine.add_box(detection.xmin, detection.ymin, detection.xmax, detection.ymax, detection.confidence, detection.class_id);
+    }
+    // detections are already sorted, so the kept indices come back in ascending order
+    const std::vector<uint32_t> &keep = engine.nms(iou_threshold);
+    size_t next_kept = 0;
+    for (uint32_t i = 0; i < detections.size(); ++i) {
+        if (next_kept < keep.size() && keep[next_kept] == i) {
+            next_kept++;
             continue;
         }
-        for (size_t j = i + 1; j < detections.size(); ++j) {
-            if ((detections[i].class_id == detections[j].class_id) && (detections[j].confidence >= conf_threshold)) {
-                if (iou(detections[i], detections[j]) >= iou_threshold) {
-                    detections[j].confidence = -1.f;
-                    num_detections--;
-                }
-            }
-        }
+        detections[i].confidence = -1.f;
+        num_detections--;
     }
 }
 
@@ -129,6 +123,18 @@ const std::vector<DetectionObject> YoloPost::get_detections() const {
     return detections;
 }
 
+void YoloPost::to_source(const common::Letterbox &letterbox) {
+    if (letterbox.identity()) {
+        return;
+    }
+    for (auto &detection : detections) {
+        detection.xmin = letterbox.to_source_x(detection.xmin);
+        detection.ymin = letterbox.to_source_y(detection.ymin);
+        detection.xmax = letterbox.to_source_x(detection.xmax);
+        detection.ymax = letterbox.to_source_y(detection.ymax);
+    }
+}
+
 std::vector<DetectionObject> YoloPost::decode() {
     for (int i = 0; i < feature_maps.size(); ++i) {
         feature_maps[i].extract_boxes(detections, max_num_detections);
@@ -19,6 +19,10 @@
 #define _HAILO_YOLO_POST_HPP_
 
 #include "hailo/hailort.hpp"
+#include "quant_lut.hpp"
+#include "quant_gate.hpp"
+#include "tensor_view.hpp"
+#include "letterbox.hpp"
 #include <algorithm>
 #include <vector>
 #include <memory>
@@ -28,9 +32,9 @@ constexpr float default_conf_threshold = 0.6f;
 constexpr int default_anchors_num = 3;
 constexpr int default_feature_map_channels = 85;
 constexpr float default_iou_threshold = 0.6f;
-constexpr int default_num_outputs = 3; // Note: this is used to declare const-sized array only, but for real usage, we use dynamic num_outputs from hef.
-// TODO: maybe add an assertion we don't exceed this default_num_outputs number of outputs
 constexpr int default_max_num_detections = 50;
+// YOLOv5 anchors (w, h pairs in input pixels) of the stride 8, 16 and 32 outputs, i.e. from the largest output to the smallest
+const std::vector<std::vector<int>> default_anchors = {{10, 13, 16, 30, 33, 23}, {30, 61, 62, 45, 59, 119}, {116, 90, 156, 198, 373, 326}};
 
 struct DetectionObject {
     float ymin, xmin, ymax, xmax, confidence;
@@ -49,9 +53,14 @@ struct DetectionObject {
 
 class FeatureMap {
 public:
-    FeatureMap() : data(nullptr), height(0), width(0), channels(0), m_qp_zp(0.), m_qp_scale(1.), conf_threshold(default_conf_threshold), anchors_num(default_anchors_num), feature_map_channels(default_feature_map_channels) {}
-    FeatureMap(std::shared_ptr<uint8_t> data, int height, int width, int channels, int anchors_num, int feature_map_channels, float32_t m_qp_zp, float32_t m_qp_scale, float conf_threshold, std::vector<int> anchors) :
-        data(data), height(height), width(width), channels(channels), anchors_num(anchors_num), feature_map_channels(feature_map_channels), m_qp_zp(m_qp_zp), m_qp_scale(m_qp_scale), conf_threshold(conf_threshold), anchors(anchors) {}
+    FeatureMap() : data(nullptr), height(0), width(0), channels(0), m_qp_zp(0.), m_qp_scale(1.), conf_threshold(default_conf_threshold), anchors_num(default_anchors_num), feature_map_channels(default_feature_map_channels),
+        image_width(0), image_height(0), m_lut(common::get_dequant_lut<uint8_t>(m_qp_scale, m_qp_zp, common::LutActivation::NONE)) {}
+    // channels is the stride between two pixels of the output (anchors_num * feature_map_channels, plus padding),
+    // image_width x image_height is the network input the boxes are scaled to
+    FeatureMap(std::shared_ptr<uint8_t> data, int height, int width, int channels, int anchors_num, int feature_map_channels, float32_t m_qp_zp, float32_t m_qp_scale, float conf_threshold, std::vector<int> anchors,
+        int image_width, int image_height) :
+        data(data), height(height), width(width), channels(channels), anchors_num(anchors_num), feature_map_channels(feature_map_channels), m_qp_zp(m_qp_zp), m_qp_scale(m_qp_scale), conf_threshold(conf_threshold), anchors(anchors),
+        image_width(image_width), image_height(image_height), m_lut(common::get_dequant_lut<uint8_t>(m_qp_scale, m_qp_zp, common::LutActivation::NONE)) {}
     void extract_boxes(std::vector<DetectionObject>& detections, const int max_num_detections);
 
 private:
@@ -65,6 +74,9 @@ private:
     float32_t m_qp_scale;
     float conf_threshold;
     std::vector<int> anchors;
+    int image_width;
+    int image_height;
+    common::DequantLutPtr<uint8_t> m_lut; // dequantization table of this output, shared by all frames
 
 };
 
@@ -76,6 +88,8 @@ public:
     void iou_over_frame();
     const std::vector<DetectionObject> get_detections() const;
     std::vector<DetectionObject> decode();
+    // Map the decoded boxes from the network input to the source frame it was letterboxed from
+    void to_source(const common::Letterbox &letterbox);
 
     std::vector<DetectionObject> detections;
     int num_detections;
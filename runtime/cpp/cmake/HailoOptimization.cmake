@@ -0,0 +1,72 @@
+# Optimization profile shared by the post-processing library and the examples linking it.
+#
+#   HAILO_LTO          Link time optimization (ON by default, when the toolchain supports it)
+#   HAILO_NATIVE_ARCH  Compile for the CPU of the build machine (-march=native), OFF by default as the binaries
+#                      may then not run on another CPU. Ignored when cross compiling.
+#   HAILO_PGO          Profile guided optimization: OFF, GENERATE (instrumented build, run it on a representative
+#                      video to write the profiles to HAILO_PGO_DIR) or USE (rebuild with these profiles)
+#   HAILO_PGO_DIR      Directory of the profiles
+#
+# hailo_optimize(<target>) applies the profile to a target.
+
+include_guard(GLOBAL)
+
+include(CheckIPOSupported)
+include(CheckCXXCompilerFlag)
+
+option(HAILO_LTO "Link time optimization of the post-processing library and the examples" ON)
+option(HAILO_NATIVE_ARCH "Compile for the CPU of the build machine (-march=native)" OFF)
+set(HAILO_PGO "OFF" CACHE STRING "Profile guided optimization: OFF, GENERATE or USE")
+set_property(CACHE HAILO_PGO PROPERTY STRINGS OFF GENERATE USE)
+set(HAILO_PGO_DIR "${CMAKE_BINARY_DIR}/pgo" CACHE PATH "Directory of the profile guided optimization profiles")
+
+if(HAILO_LTO)
+    check_ipo_supported(RESULT HAILO_LTO_CHECK OUTPUT HAILO_LTO_ERROR LANGUAGES CXX)
+    if(NOT HAILO_LTO_CHECK)
+        message(STATUS "Link time optimization is not supported by the toolchain: ${HAILO_LTO_ERROR}")
+    endif()
+    # cached, as hailo_optimize() is also called from the directories of the examples
+    set(HAILO_LTO_SUPPORTED ${HAILO_LTO_CHECK} CACHE INTERNAL "")
+endif()
+
+if(HAILO_NATIVE_ARCH AND CMAKE_CROSSCOMPILING)
+    message(WARNING "HAILO_NATIVE_ARCH is ignored when cross compiling, set the target CPU flags in the toolchain instead")
+endif()
+
+if(NOT HAILO_PGO STREQUAL "OFF" AND NOT CMAKE_CXX_COMPILER_ID MATCHES "GNU|Clang")
+    message(WARNING "HAILO_PGO is only supported with GCC and Clang")
+endif()
+
+# A function or file without profile (e.g. not run by the training video) is expected, not an error under -Werror
+check_cxx_compiler_flag(-Wno-missing-profile HAILO_HAS_NO_MISSING_PROFILE)
+
+function(hailo_optimize target)
+    if(HAILO_LTO AND HAILO_LTO_SUPPORTED)
+        set_property(TARGET ${target} PROPERTY INTERPROCEDURAL_OPTIMIZATION TRUE)
+    endif()
+
+    if(NOT CMAKE_CXX_COMPILER_ID MATCHES "GNU|Clang")
+        return()
+    endif()
+
+    if(HAILO_NATIVE_ARCH AND NOT CMAKE_CROSSCOMPILING)
+        target_compile_options(${target} PRIVATE -march=native)
+    endif()
+
+    if(HAILO_PGO STREQUAL "GENERATE")
+        # the post-processing runs on several threads, the counters must be updated atomically
+        target_compile_options(${target} PRIVATE -fprofile-generate=${HAILO_PGO_DIR} $<$<CXX_COMPILER_ID:GNU>:-fprofile-update=atomic>)
+        # a link property rather than target_link_libraries, which the examples call with either signature
+        set_property(TARGET ${target} APPEND_STRING PROPERTY LINK_FLAGS " -fprofile-generate=${HAILO_PGO_DIR}")
+    elseif(HAILO_PGO STREQUAL "USE")
+        if(CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+            # the raw profiles must be merged first: llvm-profdata merge -o default.profdata *.profraw
+            target_compile_options(${target} PRIVATE -fprofile-use=${HAILO_PGO_DIR}/default.profdata)
+        else()
+            target_compile_options(${target} PRIVATE -fprofile-use=${HAILO_PGO_DIR} -fprofile-correction)
+        endif()
+        if(HAILO_HAS_NO_MISSING_PROFILE)
+            target_compile_options(${target} PRIVATE -Wno-missing-profile)
+        endif()
+    endif()
+endfunction()
@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file config_registry.hpp
+ * @brief Process wide cache of the post-process parameters of each model, reloaded when their config file changes.
+ **/
+#pragma once
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+namespace common
+{
+    /**
+     * @brief Process wide cache of post-process parameters, keyed by model name.
+     *
+     * Each config file is loaded (and validated) once by the given loader, and the resulting
+     * params are handed out as immutable shared pointers. The file's mtime is re-checked at most
+     * once per recheck interval, and the params are reloaded only when the file has changed,
+     * so the per-frame path does no file I/O, JSON parsing or allocation.
+     *
+     * @tparam Params The params class the loader builds.
+     */
+    template <typename Params>
+    class ConfigRegistry
+    {
+    public:
+        using ParamsPtr = std::shared_ptr<const Params>;
+        using Loader = std::function<Params *(const std::string &config_path, const std::string &name)>;
+
+        /**
+         * @brief Construct a new Config Registry object
+         *
+         * @param loader Function that builds new params from a config file (or defaults when it doesn't exist).
+         * @param recheck_interval Minimal time between two mtime checks of the same config file.
+         */
+        ConfigRegistry(Loader loader, std::chrono::milliseconds recheck_interval = std::chrono::milliseconds(1000))
+            : m_loader(loader), m_recheck_interval(recheck_interval){};
+
+        /**
+         * @brief Get the params of a model, loading them on first use or when the config file changed.
+         *
+         * @param name The model name the params are registered under.
+         * @param config_path Path to the JSON config file of the model.
+         * @return ParamsPtr shared immutable params.
+         * @note If a reload of a changed file fails, the previously loaded params are kept.
+         */
+        ParamsPtr get(const std::string &name, const std::string &config_path)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto now = std::chrono::steady_clock::now();
+            auto it = m_entries.find(name);
+            if (it != m_entries.end() && it->second.config_path == config_path &&
+                now - it->second.last_check < m_recheck_interval)
+            {
+                return it->second.params;
+            }
+
+            bool file_exists = false;
+            struct timespec mtime = {0, 0};
+            struct stat file_stat;
+            if (0 == stat(config_path.c_str(), &file_stat))
+            {
+                file_exists = true;
+                mtime = file_mtime(file_stat);
+            }
+
+            if (it == m_entries.end())
+            {
+                Entry entry;
+                entry.config_path = config_path;
+                entry.params = ParamsPtr(m_loader(config_path, name));
+                entry.file_exists = file_exists;
+                entry.mtime = mtime;
+                entry.last_check = now;
+                it = m_entries.emplace(name, std::move(entry)).first;
+                return it->second.params;
+            }
+
+            Entry &entry = it->second;
+            entry.last_check = now;
+            if (entry.config_path != config_path || entry.file_exists != file_exists ||
+                entry.mtime.tv_sec != mtime.tv_sec || entry.mtime.tv_nsec != mtime.tv_nsec)
+            {
+                try
+                {
+                    entry.params = ParamsPtr(m_loader(config_path, name));
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << "Failed reloading config " << config_path << ", keeping previous parameters: " << e.what() << std::endl;
+                }
+                entry.config_path = config_path;
+                entry.file_exists = file_exists;
+                entry.mtime = mtime;
+            }
+            return entry.params;
+        }
+
+        /**
+         * @brief Drop all cached params, the next get() of every model reloads its config.
+         */
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_entries.clear();
+        }
+
+    private:
+        // The nanoseconds of the mtime are in st_mtim on Linux and st_mtimespec on macOS, other systems have seconds only
+        static struct timespec file_mtime(const struct stat &file_stat)
+        {
+            struct timespec mtime = {0, 0};
+#if defined(__linux__)
+            mtime = file_stat.st_mtim;
+#elif defined(__APPLE__)
+            mtime = file_stat.st_mtimespec;
+#else
+            mtime.tv_sec = file_stat.st_mtime;
+#endif
+            return mtime;
+        }
+
+        struct Entry
+        {
+            std::string config_path;
+            ParamsPtr params;
+            bool file_exists;
+            struct timespec mtime;
+            std::chrono::steady_clock::time_point last_check;
+        };
+
+        Loader m_loader;
+        std::chrono::milliseconds m_recheck_interval;
+        std::mutex m_mutex;
+        std::map<std::string, Entry> m_entries;
+    };
+}
@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file detection_record.hpp
+ * @brief Flat detection type used on the post-processing hot path, from decode through NMS.
+ *        The HailoDetection objects of the records are built by the detection_objects.hpp of each example.
+ **/
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace common
+{
+    /**
+     * @brief A detection as plain data - no mutex, label string or sub-objects.
+     *
+     * The bbox is (xmin, ymin, width, height), normalized like HailoBBox.
+     * label_index is the key of the label in the decoder's labels map.
+     */
+    struct DetectionRecord
+    {
+        float xmin;
+        float ymin;
+        float width;
+        float height;
+        float confidence;
+        int class_id;
+        int label_index;
+    };
+
+    /**
+     * @brief Per-frame storage of detection records.
+     *
+     * The records buffer is reset (not freed) at the start of each frame, so once it has grown to
+     * the largest frame seen, decoding a frame makes no allocations.
+     */
+    class DetectionArena
+    {
+    public:
+        static const size_t DEFAULT_CAPACITY = 1024;
+
+        DetectionArena(size_t capacity = DEFAULT_CAPACITY)
+        {
+            m_records.reserve(capacity);
+        };
+
+        /**
+         * @brief Drop the records of the previous frame, keeping the buffer.
+         */
+        void reset()
+        {
+            m_records.clear();
+        }
+
+        std::vector<DetectionRecord> &records() { return m_records; }
+        const std::vector<DetectionRecord> &records() const { return m_records; }
+        size_t size() const { return m_records.size(); }
+        size_t capacity() const { return m_records.capacity(); }
+
+    private:
+        std::vector<DetectionRecord> m_records;
+    };
+
+    /**
+     * @brief Get the label of a record, empty when the label index is not in the map.
+     */
+    inline const std::string &record_label(const DetectionRecord &record, const std::map<uint8_t, std::string> &labels)
+    {
+        static const std::string empty_label = "";
+        auto label = labels.find((uint8_t)record.label_index);
+        return (label != labels.end()) ? label->second : empty_label;
+    }
+}
@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file frame_arena.cpp
+ * @brief Block management of the frame arena and the per-thread arenas.
+ **/
+#include "frame_arena.hpp"
+
+namespace common
+{
+    void FrameArena::add_block(size_t size)
+    {
+        uint8_t *data = static_cast<uint8_t *>(std::malloc(size));
+        if (data == nullptr)
+            throw std::bad_alloc();
+        m_blocks.push_back(Block{data, size});
+        m_system_allocations++;
+    }
+
+    void FrameArena::next_block(size_t min_size)
+    {
+        // Reuse a block kept from a previous frame when it is large enough, otherwise grow.
+        while (m_current + 1 < m_blocks.size())
+        {
+            m_current++;
+            m_offset = 0;
+            if (m_blocks[m_current].size >= min_size)
+                return;
+        }
+        size_t size = m_blocks.back().size * 2;
+        add_block(size > min_size ? size : min_size);
+        m_current = m_blocks.size() - 1;
+        m_offset = 0;
+    }
+
+    void FrameArena::release_blocks()
+    {
+        for (auto &block : m_blocks)
+            std::free(block.data);
+        m_blocks.clear();
+    }
+
+    // One arena per thread for the whole process, also when the library is linked as a shared object
+    FrameArena &frame_arena()
+    {
+        static thread_local FrameArena arena;
+        return arena;
+    }
+}
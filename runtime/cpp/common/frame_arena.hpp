@@ -0,0 +1,264 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file frame_arena.hpp
+ * @brief Frame-scoped monotonic arena for post-processing temporaries, and an allocator adaptor over it.
+ **/
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace common
+{
+    /**
+     * @brief Monotonic (bump) arena, rewound instead of freed at the end of each frame.
+     *
+     * Memory comes from a few large blocks. When a frame needs more than the current block, a new
+     * block is allocated, and at the next full reset all the blocks are merged into a single one,
+     * so once the arena has grown to the largest frame seen, frames make no system allocations.
+     *
+     * Not thread safe, each thread uses its own arena (see frame_arena()).
+     */
+    class FrameArena
+    {
+    public:
+        static const size_t DEFAULT_CAPACITY = 1 << 20;
+
+        /**
+         * @brief Position in the arena, everything allocated after it is dropped by rewind().
+         */
+        struct Marker
+        {
+            size_t block;
+            size_t offset;
+        };
+
+        /**
+         * @brief Allocation counters of the arena.
+         */
+        struct Stats
+        {
+            size_t allocations;        // allocate() calls
+            size_t system_allocations; // blocks taken from the system (malloc)
+            size_t bytes_in_use;       // bytes used since the last full reset, including alignment and skipped block tails
+            size_t high_water;         // largest bytes_in_use seen
+            size_t capacity;           // total size of the blocks
+        };
+
+        FrameArena(size_t capacity = DEFAULT_CAPACITY) : m_current(0), m_offset(0), m_allocations(0), m_system_allocations(0), m_high_water(0)
+        {
+            add_block(capacity);
+        }
+
+        ~FrameArena()
+        {
+            release_blocks();
+        }
+
+        FrameArena(const FrameArena &) = delete;
+        FrameArena &operator=(const FrameArena &) = delete;
+
+        /**
+         * @brief Allocate memory that stays valid until the arena is rewound past it.
+         *
+         * @param bytes Size of the allocation.
+         * @param alignment Alignment of the allocation, a power of 2.
+         * @return void* The allocated memory.
+         */
+        void *allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+        {
+            m_allocations++;
+            size_t start = align_up(m_blocks[m_current].data, m_offset, alignment);
+            if (start + bytes > m_blocks[m_current].size)
+            {
+                next_block(bytes + alignment);
+                start = align_up(m_blocks[m_current].data, m_offset, alignment);
+            }
+            m_offset = start + bytes;
+            size_t in_use = bytes_in_use();
+            if (in_use > m_high_water)
+                m_high_water = in_use;
+            return m_blocks[m_current].data + start;
+        }
+
+        /**
+         * @brief Memory is only reclaimed by rewind() / reset().
+         */
+        void deallocate(void *, size_t) {}
+
+        Marker mark() const
+        {
+            return Marker{m_current, m_offset};
+        }
+
+        /**
+         * @brief Drop everything allocated after the marker, keeping the blocks.
+         */
+        void rewind(const Marker &marker)
+        {
+            if (marker.block == 0 && marker.offset == 0)
+            {
+                reset();
+                return;
+            }
+            m_current = marker.block;
+            m_offset = marker.offset;
+        }
+
+        /**
+         * @brief Drop everything allocated, merging the blocks into one if the last frames needed more than one.
+         */
+        void reset()
+        {
+            if (m_blocks.size() > 1)
+            {
+                size_t size = capacity();
+                release_blocks();
+                add_block(size);
+            }
+            m_current = 0;
+            m_offset = 0;
+        }
+
+        Stats stats() const
+        {
+            return Stats{m_allocations, m_system_allocations, bytes_in_use(), m_high_water, capacity()};
+        }
+
+    private:
+        struct Block
+        {
+            uint8_t *data;
+            size_t size;
+        };
+
+        std::vector<Block> m_blocks;
+        size_t m_current;
+        size_t m_offset;
+        size_t m_allocations;
+        size_t m_system_allocations;
+        size_t m_high_water;
+
+        size_t bytes_in_use() const
+        {
+            size_t used = m_offset;
+            for (size_t i = 0; i < m_current; i++)
+                used += m_blocks[i].size;
+            return used;
+        }
+
+        size_t capacity() const
+        {
+            size_t size = 0;
+            for (auto &block : m_blocks)
+                size += block.size;
+            return size;
+        }
+
+        /**
+         * @brief First offset from offset in the block whose address is aligned, the blocks themselves are
+         *        only aligned for std::max_align_t.
+         */
+        static size_t align_up(const uint8_t *block, size_t offset, size_t alignment)
+        {
+            uintptr_t address = (uintptr_t)(block + offset);
+            return offset + (size_t)(((address + alignment - 1) & ~(uintptr_t)(alignment - 1)) - address);
+        }
+
+        void add_block(size_t size);
+
+        void next_block(size_t min_size);
+
+        void release_blocks();
+    };
+
+    /**
+     * @brief The frame arena of the calling thread.
+     */
+    FrameArena &frame_arena();
+
+    /**
+     * @brief Scope of a frame (or of one stage of a frame): everything allocated from the arena
+     *        while the scope is alive is dropped when it ends. Scopes nest.
+     *
+     * All the objects using arena memory must be destroyed before the scope, declare it first.
+     */
+    class FrameArenaScope
+    {
+    public:
+        FrameArenaScope(FrameArena &arena = frame_arena()) : m_arena(arena), m_marker(arena.mark()),
+                                                             m_system_allocations(arena.stats().system_allocations){};
+        ~FrameArenaScope()
+        {
+            m_arena.rewind(m_marker);
+        }
+
+        FrameArenaScope(const FrameArenaScope &) = delete;
+        FrameArenaScope &operator=(const FrameArenaScope &) = delete;
+
+        /**
+         * @brief Number of blocks the arena took from the system during this scope, 0 in steady state.
+         */
+        size_t system_allocations() const
+        {
+            return m_arena.stats().system_allocations - m_system_allocations;
+        }
+
+    private:
+        FrameArena &m_arena;
+        FrameArena::Marker m_marker;
+        size_t m_system_allocations;
+    };
+
+    /**
+     * @brief Standard allocator over a FrameArena, for std containers, xtensor containers and allocate_shared.
+     *        Default constructed, it uses the arena of the constructing thread.
+     */
+    template <typename T>
+    class ArenaAllocator
+    {
+    public:
+        typedef T value_type;
+
+        ArenaAllocator() : m_arena(&frame_arena()){};
+        ArenaAllocator(FrameArena &arena) : m_arena(&arena){};
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U> &other) : m_arena(other.arena()){};
+
+        T *allocate(size_t count)
+        {
+            return static_cast<T *>(m_arena->allocate(count * sizeof(T), alignof(T) > alignof(std::max_align_t) ? alignof(T) : alignof(std::max_align_t)));
+        }
+
+        void deallocate(T *ptr, size_t count)
+        {
+            m_arena->deallocate(ptr, count * sizeof(T));
+        }
+
+        FrameArena *arena() const { return m_arena; }
+
+    private:
+        FrameArena *m_arena;
+    };
+
+    template <typename T, typename U>
+    bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+    {
+        return a.arena() == b.arena();
+    }
+
+    template <typename T, typename U>
+    bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+    {
+        return a.arena() != b.arena();
+    }
+
+    template <typename T>
+    using arena_vector = std::vector<T, ArenaAllocator<T>>;
+}
@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file frame_ring.hpp
+ * @brief Fixed-capacity FIFO of frames between the capture (writer) and the post-processing (drawing) stages.
+ **/
+#pragma once
+
+#include <stddef.h>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+namespace common
+{
+    /**
+     * @brief Ring of capacity frame slots, written by one thread and read in the same order by another.
+     *
+     * The writer fills a slot, which is then held until the reader is done with it, so at most capacity
+     * frames are resident whatever the length of the video. When the ring is full the writer waits,
+     * which slows the capture down to the pace of the post-processing. The slots are never freed, a
+     * frame written into a slot of the same size (e.g. with cv::resize) reuses its storage.
+     *
+     * @tparam Frame The frame type, e.g. cv::Mat.
+     */
+    template <typename Frame>
+    class FrameRing
+    {
+    public:
+        /**
+         * @brief Counters of the ring.
+         */
+        struct Stats
+        {
+            size_t frames;       // frames written
+            size_t writer_waits; // times the writer found the ring full
+            size_t high_water;   // most frames resident at once
+        };
+
+        explicit FrameRing(size_t capacity)
+            : m_slots(capacity != 0 ? capacity : 1), m_head(0), m_count(0), m_closed(false),
+              m_frames(0), m_writer_waits(0), m_high_water(0){};
+
+        FrameRing(const FrameRing &) = delete;
+        FrameRing &operator=(const FrameRing &) = delete;
+
+        size_t capacity() const { return m_slots.size(); }
+
+        /**
+         * @brief Allocate the storage of the slots up front, init(frame) is called on each one.
+         */
+        template <typename Init>
+        void preallocate(Init init)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto &slot : m_slots)
+                init(slot);
+        }
+
+        /**
+         * @brief Number of frames written and not yet released by the reader.
+         */
+        size_t size()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_count;
+        }
+
+        Stats stats()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return Stats{m_frames, m_writer_waits, m_high_water};
+        }
+
+        /**
+         * @brief Get the next free slot to write a frame into, waits while the ring is full.
+         */
+        Frame &acquire_write()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_count == m_slots.size())
+            {
+                m_writer_waits++;
+                m_cv.wait(lock, [this]
+                          { return m_count < m_slots.size(); });
+            }
+            return m_slots[(m_head + m_count) % m_slots.size()];
+        }
+
+        /**
+         * @brief Publish the frame written into the slot of acquire_write() to the reader.
+         */
+        void release_write()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_count++;
+                m_frames++;
+                if (m_count > m_high_water)
+                    m_high_water = m_count;
+            }
+            m_cv.notify_all();
+        }
+
+        /**
+         * @brief Get the oldest frame, waits until it is written.
+         *
+         * @return Frame* The frame, or nullptr once the ring is closed and all its frames were read.
+         */
+        Frame *acquire_read()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this]
+                      { return m_count > 0 || m_closed; });
+            if (m_count == 0)
+                return nullptr;
+            return &m_slots[m_head];
+        }
+
+        /**
+         * @brief Give the slot of acquire_read() back to the writer.
+         */
+        void release_read()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_head = (m_head + 1) % m_slots.size();
+                m_count--;
+            }
+            m_cv.notify_all();
+        }
+
+        /**
+         * @brief No more frames will be written, the reader gets nullptr once it read the remaining ones.
+         */
+        void close()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_closed = true;
+            }
+            m_cv.notify_all();
+        }
+
+    private:
+        std::vector<Frame> m_slots;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        size_t m_head;  // slot of the oldest frame
+        size_t m_count; // frames written and not released by the reader
+        bool m_closed;
+        size_t m_frames;
+        size_t m_writer_waits;
+        size_t m_high_water;
+    };
+}
@@ -0,0 +1,238 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file hailort_backend.hpp
+ * @brief Inference backends running a HEF on a Hailo device with HailoRT.
+ **/
+#pragma once
+
+#include "inference_backend.hpp"
+#include "hailo/hailort.hpp"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace common
+{
+    /**
+     * @brief The vstreams of a HEF configured on a VDevice (PCIe).
+     */
+    class HailoVStreamBackend : public VStreamBackend
+    {
+    public:
+        static hailort::Expected<std::unique_ptr<HailoVStreamBackend>> create(const std::string &hef_path, bool quantized,
+                                                                              hailo_format_type_t input_format,
+                                                                              hailo_format_type_t output_format)
+        {
+            auto vdevice = hailort::VDevice::create();
+            if (!vdevice)
+            {
+                std::cerr << "Failed create vdevice, status = " << vdevice.status() << std::endl;
+                return hailort::make_unexpected(vdevice.status());
+            }
+
+            auto hef = hailort::Hef::create(hef_path);
+            if (!hef)
+            {
+                std::cerr << "Failed to read HEF " << hef_path << std::endl;
+                return hailort::make_unexpected(hef.status());
+            }
+            auto configure_params = hef->create_configure_params(HAILO_STREAM_INTERFACE_PCIE);
+            if (!configure_params)
+                return hailort::make_unexpected(configure_params.status());
+            auto network_groups = vdevice.value()->configure(hef.value(), configure_params.value());
+            if (!network_groups)
+            {
+                std::cerr << "Failed to configure network group " << hef_path << std::endl;
+                return hailort::make_unexpected(network_groups.status());
+            }
+            if (1 != network_groups->size())
+            {
+                std::cerr << "Invalid amount of network groups" << std::endl;
+                return hailort::make_unexpected(HAILO_INTERNAL_FAILURE);
+            }
+            auto network_group = network_groups->at(0);
+
+            auto input_params = network_group->make_input_vstream_params(quantized, input_format, HAILO_DEFAULT_VSTREAM_TIMEOUT_MS,
+                                                                         HAILO_DEFAULT_VSTREAM_QUEUE_SIZE);
+            if (!input_params)
+            {
+                std::cerr << "Failed creating input vstreams " << input_params.status() << std::endl;
+                return hailort::make_unexpected(input_params.status());
+            }
+            auto output_params = network_group->make_output_vstream_params(quantized, output_format, HAILO_DEFAULT_VSTREAM_TIMEOUT_MS,
+                                                                           HAILO_DEFAULT_VSTREAM_QUEUE_SIZE);
+            if (!output_params)
+            {
+                std::cerr << "Failed creating vstreams " << output_params.status() << std::endl;
+                return hailort::make_unexpected(output_params.status());
+            }
+            auto inputs = hailort::VStreamsBuilder::create_input_vstreams(*network_group, input_params.value());
+            if (!inputs)
+            {
+                std::cerr << "Failed creating input vstreams " << inputs.status() << std::endl;
+                return hailort::make_unexpected(inputs.status());
+            }
+            auto outputs = hailort::VStreamsBuilder::create_output_vstreams(*network_group, output_params.value());
+            if (!outputs)
+            {
+                std::cerr << "Failed creating output vstreams " << outputs.status() << std::endl;
+                return hailort::make_unexpected(outputs.status());
+            }
+
+            return std::unique_ptr<HailoVStreamBackend>(new HailoVStreamBackend(vdevice.release(), network_group,
+                                                                                inputs.release(), outputs.release()));
+        }
+
+        const std::vector<hailo_vstream_info_t> &input_infos() const override { return m_input_infos; }
+        const std::vector<hailo_vstream_info_t> &output_infos() const override { return m_output_infos; }
+        size_t input_frame_size(size_t input) const override { return m_inputs[input].get_frame_size(); }
+        size_t output_frame_size(size_t output) const override { return m_outputs[output].get_frame_size(); }
+
+        hailo_status write(size_t input, const void *buffer, size_t size) override
+        {
+            return m_inputs[input].write(hailort::MemoryView::create_const(buffer, size));
+        }
+
+        hailo_status read(size_t output, void *buffer, size_t size) override
+        {
+            return m_outputs[output].read(hailort::MemoryView(buffer, size));
+        }
+
+    private:
+        HailoVStreamBackend(std::unique_ptr<hailort::VDevice> vdevice, std::shared_ptr<hailort::ConfiguredNetworkGroup> network_group,
+                            std::vector<hailort::InputVStream> inputs, std::vector<hailort::OutputVStream> outputs)
+            : m_vdevice(std::move(vdevice)), m_network_group(std::move(network_group)),
+              m_inputs(std::move(inputs)), m_outputs(std::move(outputs))
+        {
+            for (auto &input : m_inputs)
+                m_input_infos.push_back(input.get_info());
+            for (auto &output : m_outputs)
+                m_output_infos.push_back(output.get_info());
+        }
+
+        std::unique_ptr<hailort::VDevice> m_vdevice;
+        std::shared_ptr<hailort::ConfiguredNetworkGroup> m_network_group;
+        std::vector<hailort::InputVStream> m_inputs;
+        std::vector<hailort::OutputVStream> m_outputs;
+        std::vector<hailo_vstream_info_t> m_input_infos;
+        std::vector<hailo_vstream_info_t> m_output_infos;
+    };
+
+    /**
+     * @brief The raw streams of a HEF configured in async mode on a Device.
+     */
+    class HailoAsyncBackend : public AsyncBackend
+    {
+    public:
+        static hailort::Expected<std::unique_ptr<HailoAsyncBackend>> create(const std::string &hef_path)
+        {
+            auto device = hailort::Device::create();
+            if (!device)
+            {
+                std::cerr << "Failed to create device " << device.status() << std::endl;
+                return hailort::make_unexpected(device.status());
+            }
+
+            auto hef = hailort::Hef::create(hef_path);
+            if (!hef)
+            {
+                std::cerr << "Failed to read HEF " << hef_path << std::endl;
+                return hailort::make_unexpected(hef.status());
+            }
+            auto configure_params = device.value()->create_configure_params(hef.value());
+            if (!configure_params)
+                return hailort::make_unexpected(configure_params.status());
+            // change stream_params to operate in async mode
+            for (auto &ng_name_params_pair : *configure_params)
+            {
+                for (auto &stream_params_name_pair : ng_name_params_pair.second.stream_params_by_name)
+                    stream_params_name_pair.second.flags = HAILO_STREAM_FLAGS_ASYNC;
+            }
+            auto network_groups = device.value()->configure(hef.value(), configure_params.value());
+            if (!network_groups)
+            {
+                std::cerr << "Failed to configure network group" << std::endl;
+                return hailort::make_unexpected(network_groups.status());
+            }
+            if (1 != network_groups->size())
+            {
+                std::cerr << "Invalid amount of network groups" << std::endl;
+                return hailort::make_unexpected(HAILO_INTERNAL_FAILURE);
+            }
+
+            return std::unique_ptr<HailoAsyncBackend>(new HailoAsyncBackend(device.release(), network_groups->at(0)));
+        }
+
+        const std::vector<hailo_stream_info_t> &input_infos() const override { return m_input_infos; }
+        const std::vector<hailo_stream_info_t> &output_infos() const override { return m_output_infos; }
+        size_t input_queue_size(size_t input) const override { return async_queue_size(m_inputs[input].get()); }
+        size_t output_queue_size(size_t output) const override { return async_queue_size(m_outputs[output].get()); }
+
+        hailo_status activate() override
+        {
+            auto activated_network_group = m_network_group->activate();
+            if (!activated_network_group)
+            {
+                std::cerr << "Failed to activate network group " << activated_network_group.status() << std::endl;
+                return activated_network_group.status();
+            }
+            m_activated_network_group = activated_network_group.release();
+            return HAILO_SUCCESS;
+        }
+
+        void deactivate() override { m_activated_network_group.reset(); }
+
+        hailo_status wait_for_write_ready(size_t input, std::chrono::milliseconds timeout) override
+        {
+            return m_inputs[input].get().wait_for_async_ready(input_frame_size(input), timeout);
+        }
+
+        hailo_status wait_for_read_ready(size_t output, std::chrono::milliseconds timeout) override
+        {
+            return m_outputs[output].get().wait_for_async_ready(output_frame_size(output), timeout);
+        }
+
+        hailo_status write_async(size_t input, const void *buffer, size_t size, TransferDoneCallback done) override
+        {
+            return m_inputs[input].get().write_async(buffer, size, [done](const hailort::InputStream::CompletionInfo &completion_info)
+                                                     { done(completion_info.status); });
+        }
+
+        hailo_status read_async(size_t output, void *buffer, size_t size, TransferDoneCallback done) override
+        {
+            return m_outputs[output].get().read_async(buffer, size, [done](const hailort::OutputStream::CompletionInfo &completion_info)
+                                                      { done(completion_info.status); });
+        }
+
+    private:
+        HailoAsyncBackend(std::unique_ptr<hailort::Device> device, std::shared_ptr<hailort::ConfiguredNetworkGroup> network_group)
+            : m_device(std::move(device)), m_network_group(std::move(network_group)),
+              m_inputs(m_network_group->get_input_streams()), m_outputs(m_network_group->get_output_streams())
+        {
+            for (auto &input : m_inputs)
+                m_input_infos.push_back(input.get().get_info());
+            for (auto &output : m_outputs)
+                m_output_infos.push_back(output.get().get_info());
+        }
+
+        template <typename Stream>
+        static size_t async_queue_size(Stream &stream)
+        {
+            auto queue_size = stream.get_async_max_queue_size();
+            return queue_size ? queue_size.value() : 1;
+        }
+
+        std::unique_ptr<hailort::Device> m_device;
+        std::shared_ptr<hailort::ConfiguredNetworkGroup> m_network_group;
+        std::unique_ptr<hailort::ActivatedNetworkGroup> m_activated_network_group;
+        std::vector<std::reference_wrapper<hailort::InputStream>> m_inputs;
+        std::vector<std::reference_wrapper<hailort::OutputStream>> m_outputs;
+        std::vector<hailo_stream_info_t> m_input_infos;
+        std::vector<hailo_stream_info_t> m_output_infos;
+    };
+}
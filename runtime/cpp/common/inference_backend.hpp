@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file inference_backend.hpp
+ * @brief Inference backends of the examples: the device (hailort_backend.hpp) or a mock of it (mock_backend.hpp).
+ **/
+#pragma once
+
+#include "hailo/hailort.h"
+
+#include <stddef.h>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+namespace common
+{
+    /**
+     * @brief Blocking inference on the vstreams of a network group, as used by the vstream examples.
+     *
+     * Each input is written and each output is read by a thread of its own, frame after frame. The
+     * outputs of a frame are read in the order of the writes. Streams are referred to by their index
+     * in input_infos() / output_infos().
+     */
+    class VStreamBackend
+    {
+    public:
+        virtual ~VStreamBackend() = default;
+
+        virtual const std::vector<hailo_vstream_info_t> &input_infos() const = 0;
+        virtual const std::vector<hailo_vstream_info_t> &output_infos() const = 0;
+        virtual size_t input_frame_size(size_t input) const = 0;
+        virtual size_t output_frame_size(size_t output) const = 0;
+
+        /**
+         * @brief Write one frame to an input, waits while its queue is full.
+         */
+        virtual hailo_status write(size_t input, const void *buffer, size_t size) = 0;
+
+        /**
+         * @brief Read the next frame of an output, waits until it is inferred.
+         */
+        virtual hailo_status read(size_t output, void *buffer, size_t size) = 0;
+    };
+
+    /**
+     * @brief Asynchronous inference on the raw streams of a network group, as used by the async examples.
+     *
+     * Transfers are posted with write_async() / read_async() and completed by the backend, which calls
+     * their callback from a thread of its own. The reads of an output complete in the order they were posted,
+     * the n-th read gets the outputs of the n-th frame written. deactivate() aborts the pending transfers:
+     * their callback gets HAILO_STREAM_ABORTED_BY_USER.
+     */
+    class AsyncBackend
+    {
+    public:
+        using TransferDoneCallback = std::function<void(hailo_status status)>;
+
+        virtual ~AsyncBackend() = default;
+
+        virtual const std::vector<hailo_stream_info_t> &input_infos() const = 0;
+        virtual const std::vector<hailo_stream_info_t> &output_infos() const = 0;
+        size_t input_frame_size(size_t input) const { return input_infos()[input].hw_frame_size; }
+        size_t output_frame_size(size_t output) const { return output_infos()[output].hw_frame_size; }
+
+        /**
+         * @brief Most transfers a stream can have pending at once.
+         */
+        virtual size_t input_queue_size(size_t input) const = 0;
+        virtual size_t output_queue_size(size_t output) const = 0;
+
+        virtual hailo_status activate() = 0;
+        virtual void deactivate() = 0;
+
+        /**
+         * @brief Wait until a transfer of a frame can be posted to the stream.
+         */
+        virtual hailo_status wait_for_write_ready(size_t input, std::chrono::milliseconds timeout) = 0;
+        virtual hailo_status wait_for_read_ready(size_t output, std::chrono::milliseconds timeout) = 0;
+
+        /**
+         * @brief Post a transfer, buffer must stay valid until done is called.
+         */
+        virtual hailo_status write_async(size_t input, const void *buffer, size_t size, TransferDoneCallback done) = 0;
+        virtual hailo_status read_async(size_t output, void *buffer, size_t size, TransferDoneCallback done) = 0;
+    };
+}
@@ -0,0 +1,803 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file mock_backend.hpp
+ * @brief Inference backends without a device: recorded or synthetic outputs delivered with the timing of a device model.
+ **/
+#pragma once
+
+#include "inference_backend.hpp"
+
+#include <stdint.h>
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace common
+{
+    /**
+     * @brief A stream of the mocked network, in the user format of its vstream (no padding).
+     */
+    struct MockStreamSpec
+    {
+        std::string name;
+        hailo_3d_image_shape_t shape;
+        hailo_format_type_t type; // HAILO_FORMAT_TYPE_UINT8, _UINT16 or _FLOAT32
+        hailo_quant_info_t quant_info;
+
+        size_t element_size() const
+        {
+            return (HAILO_FORMAT_TYPE_FLOAT32 == type) ? 4 : ((HAILO_FORMAT_TYPE_UINT16 == type) ? 2 : 1);
+        }
+
+        size_t frame_size() const { return (size_t)shape.height * shape.width * shape.features * element_size(); }
+    };
+
+    /**
+     * @brief The streams of the mocked network and the model of the device, read from a spec file.
+     *
+     * The spec is a text file, one entry per line ('#' starts a comment):
+     *   input <name> <height> <width> <features> <uint8|uint16|float32> <qp_zp> <qp_scale>
+     *   output <name> <height> <width> <features> <uint8|uint16|float32> <qp_zp> <qp_scale>
+     *   latency_ms <ms>   - from the write of a frame to its outputs (default 0)
+     *   fps <fps>         - most frames the device infers per second, 0 for no limit (default 0)
+     *   queue_size <n>    - frames each stream queues (default 4)
+     *   fill <random|n>   - synthetic outputs: random values, or every byte set to n (default random)
+     *   seed <n>          - seed of the random outputs (default 0)
+     * The outputs are replayed from output_<i>.bin next to the spec when they exist (frames of output i
+     * back to back, replayed in a loop), they are synthetic otherwise.
+     */
+    struct MockNetworkSpec
+    {
+        std::vector<MockStreamSpec> inputs;
+        std::vector<MockStreamSpec> outputs;
+        std::chrono::microseconds latency{0};
+        double fps = 0;
+        size_t queue_size = 4;
+        std::string fill = "random";
+        uint32_t seed = 0;
+        std::string dir; // where output_<i>.bin are read from (and written to by the recorder)
+
+        static std::string output_path(const std::string &dir, size_t output)
+        {
+            return dir + "/output_" + std::to_string(output) + ".bin";
+        }
+
+        static std::string dir_of(const std::string &path)
+        {
+            size_t slash = path.rfind('/');
+            return (std::string::npos == slash) ? "." : path.substr(0, slash);
+        }
+
+        /**
+         * @brief Read a spec file, throws std::runtime_error if it can't be read or is invalid.
+         */
+        static MockNetworkSpec load(const std::string &path)
+        {
+            std::ifstream file(path);
+            if (!file)
+                throw std::runtime_error("Can't open mock spec " + path);
+
+            MockNetworkSpec spec;
+            spec.dir = dir_of(path);
+            std::string line;
+            for (size_t line_number = 1; std::getline(file, line); line_number++)
+            {
+                line = line.substr(0, line.find('#'));
+                std::istringstream fields(line);
+                std::string key;
+                if (!(fields >> key))
+                    continue;
+                bool valid = true;
+                if ("input" == key || "output" == key)
+                {
+                    MockStreamSpec stream{};
+                    std::string type;
+                    valid = (bool)(fields >> stream.name >> stream.shape.height >> stream.shape.width >> stream.shape.features >> type >>
+                                   stream.quant_info.qp_zp >> stream.quant_info.qp_scale);
+                    stream.type = parse_type(type);
+                    valid = valid && (HAILO_FORMAT_TYPE_AUTO != stream.type) && (0 != stream.frame_size());
+                    ("input" == key ? spec.inputs : spec.outputs).push_back(stream);
+                }
+                else if ("latency_ms" == key)
+                {
+                    double latency_ms = 0;
+                    valid = (bool)(fields >> latency_ms) && latency_ms >= 0;
+                    spec.latency = std::chrono::microseconds((int64_t)(latency_ms * 1000.0));
+                }
+                else if ("fps" == key)
+                    valid = (bool)(fields >> spec.fps) && spec.fps >= 0;
+                else if ("queue_size" == key)
+                    valid = (bool)(fields >> spec.queue_size) && spec.queue_size > 0;
+                else if ("fill" == key)
+                    valid = (bool)(fields >> spec.fill) && ("random" == spec.fill || is_byte(spec.fill));
+                else if ("seed" == key)
+                    valid = (bool)(fields >> spec.seed);
+                else
+                    valid = false;
+                if (!valid)
+                    throw std::runtime_error(path + ":" + std::to_string(line_number) + ": invalid line: " + line);
+            }
+            if (spec.inputs.empty() || spec.outputs.empty())
+                throw std::runtime_error(path + ": a mock network needs at least one input and one output");
+            return spec;
+        }
+
+        /**
+         * @brief Write the spec file (the outputs are written apart, by the recorder).
+         */
+        void save(const std::string &path) const
+        {
+            std::ofstream file(path);
+            if (!file)
+                throw std::runtime_error("Can't write mock spec " + path);
+            file << "latency_ms " << (double)latency.count() / 1000.0 << std::endl;
+            file << "fps " << fps << std::endl;
+            file << "queue_size " << queue_size << std::endl;
+            file << "fill " << fill << std::endl;
+            file << "seed " << seed << std::endl;
+            for (auto &input : inputs)
+                save_stream(file, "input", input);
+            for (auto &output : outputs)
+                save_stream(file, "output", output);
+        }
+
+        static MockStreamSpec stream_of(const hailo_vstream_info_t &info)
+        {
+            MockStreamSpec stream{};
+            stream.name = info.name;
+            stream.shape = info.shape;
+            stream.type = info.format.type;
+            stream.quant_info = info.quant_info;
+            return stream;
+        }
+
+    private:
+        static bool is_byte(const std::string &value)
+        {
+            return !value.empty() && value.size() <= 3 && std::all_of(value.begin(), value.end(), ::isdigit) && std::stoi(value) <= 255;
+        }
+
+        static hailo_format_type_t parse_type(const std::string &type)
+        {
+            if ("uint8" == type)
+                return HAILO_FORMAT_TYPE_UINT8;
+            if ("uint16" == type)
+                return HAILO_FORMAT_TYPE_UINT16;
+            if ("float32" == type)
+                return HAILO_FORMAT_TYPE_FLOAT32;
+            return HAILO_FORMAT_TYPE_AUTO;
+        }
+
+        static void save_stream(std::ofstream &file, const char *key, const MockStreamSpec &stream)
+        {
+            const char *type = (HAILO_FORMAT_TYPE_FLOAT32 == stream.type) ? "float32" : ((HAILO_FORMAT_TYPE_UINT16 == stream.type) ? "uint16" : "uint8");
+            file << key << " " << stream.name << " " << stream.shape.height << " " << stream.shape.width << " " << stream.shape.features
+                 << " " << type << " " << stream.quant_info.qp_zp << " " << stream.quant_info.qp_scale << std::endl;
+        }
+    };
+
+    /**
+     * @brief The timing model and the outputs of the mocked device, shared by the streams of a backend.
+     *
+     * The device infers one frame at a time once all its inputs were written: frame n starts at
+     * max(its last write, start of frame n-1 + 1 / fps) and its outputs are ready latency after its start.
+     * A frame holds its place in the queues until all its outputs were read, the writes wait while an
+     * input has queue_size frames in flight, as the device does when the host doesn't read its outputs.
+     */
+    class MockDevice
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        explicit MockDevice(const MockNetworkSpec &spec)
+            : m_spec(spec), m_interval(spec.fps > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / spec.fps)) : Clock::duration(0)),
+              m_outputs(spec.outputs.size())
+        {
+            load_outputs();
+            reset();
+        }
+
+        const MockNetworkSpec &spec() const { return m_spec; }
+
+        /**
+         * @brief Start over from frame 0, for a new activation.
+         */
+        void reset()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_frames.clear();
+            m_first_frame = 0;
+            m_written.assign(m_spec.inputs.size(), 0);
+            m_last_start = Clock::time_point();
+            m_aborted = false;
+        }
+
+        /**
+         * @brief Wake up the waits, they return HAILO_STREAM_ABORTED_BY_USER.
+         */
+        void abort()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_aborted = true;
+            }
+            m_cv.notify_all();
+        }
+
+        hailo_status wait_for_room(size_t input, std::chrono::milliseconds timeout)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            bool ready = m_cv.wait_for(lock, timeout, [this, input]()
+                                       { return m_aborted || (m_written[input] - m_first_frame < m_spec.queue_size); });
+            if (m_aborted)
+                return HAILO_STREAM_ABORTED_BY_USER;
+            return ready ? HAILO_SUCCESS : HAILO_TIMEOUT;
+        }
+
+        /**
+         * @brief A frame was written to input, returns its index.
+         */
+        uint64_t submit(size_t input)
+        {
+            uint64_t frame_index;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                frame_index = m_written[input]++;
+                while (m_first_frame + m_frames.size() <= frame_index)
+                    m_frames.push_back(Frame());
+                Frame &frame = m_frames[(size_t)(frame_index - m_first_frame)];
+                if (++frame.inputs_written == m_spec.inputs.size())
+                {
+                    frame.start = std::max(Clock::now(), m_last_start + m_interval);
+                    frame.ready = frame.start + m_spec.latency;
+                    frame.scheduled = true;
+                    m_last_start = frame.start;
+                }
+            }
+            m_cv.notify_all();
+            return frame_index;
+        }
+
+        /**
+         * @brief Times of a frame, false if not all its inputs were written yet.
+         */
+        bool schedule(uint64_t frame_index, Clock::time_point &start, Clock::time_point &ready)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return schedule_locked(frame_index, start, ready);
+        }
+
+        /**
+         * @brief Wait until all the inputs of a frame were written and get the time its outputs are ready.
+         */
+        hailo_status wait_for_schedule(uint64_t frame_index, Clock::time_point &ready, std::chrono::milliseconds timeout)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            Clock::time_point start;
+            bool scheduled = m_cv.wait_for(lock, timeout, [&]()
+                                           { return m_aborted || schedule_locked(frame_index, start, ready); });
+            if (m_aborted)
+                return HAILO_STREAM_ABORTED_BY_USER;
+            return scheduled ? HAILO_SUCCESS : HAILO_TIMEOUT;
+        }
+
+        /**
+         * @brief Copy the output of a frame (the recorded ones are replayed in a loop).
+         */
+        void fill(size_t output, uint64_t frame_index, void *buffer) const
+        {
+            const std::vector<std::vector<uint8_t>> &frames = m_outputs[output];
+            const std::vector<uint8_t> &frame = frames[(size_t)(frame_index % frames.size())];
+            memcpy(buffer, frame.data(), frame.size());
+        }
+
+        /**
+         * @brief An output of a frame was read, the frame leaves the queues once all its outputs were.
+         */
+        void release(uint64_t frame_index)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_frames[(size_t)(frame_index - m_first_frame)].outputs_read++;
+                while (!m_frames.empty() && m_frames.front().outputs_read == m_spec.outputs.size())
+                {
+                    m_frames.pop_front();
+                    m_first_frame++;
+                }
+            }
+            m_cv.notify_all();
+        }
+
+    private:
+        struct Frame
+        {
+            size_t inputs_written = 0;
+            size_t outputs_read = 0;
+            bool scheduled = false;
+            Clock::time_point start;
+            Clock::time_point ready;
+        };
+
+        bool schedule_locked(uint64_t frame_index, Clock::time_point &start, Clock::time_point &ready) const
+        {
+            if (frame_index < m_first_frame || frame_index - m_first_frame >= m_frames.size())
+                return false;
+            const Frame &frame = m_frames[(size_t)(frame_index - m_first_frame)];
+            start = frame.start;
+            ready = frame.ready;
+            return frame.scheduled;
+        }
+
+        void load_outputs()
+        {
+            // synthetic outputs cycle over a few frames, enough to keep the caches from holding them all
+            static const size_t SYNTHETIC_FRAMES = 4;
+            std::mt19937 random(m_spec.seed);
+            for (size_t i = 0; i < m_spec.outputs.size(); i++)
+            {
+                const MockStreamSpec &output = m_spec.outputs[i];
+                const size_t frame_size = output.frame_size();
+                std::ifstream file(MockNetworkSpec::output_path(m_spec.dir, i), std::ios::binary);
+                if (file)
+                {
+                    std::vector<uint8_t> recorded((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+                    if (recorded.empty() || 0 != recorded.size() % frame_size)
+                        throw std::runtime_error(MockNetworkSpec::output_path(m_spec.dir, i) + " is not made of frames of " +
+                                                 output.name + " (" + std::to_string(frame_size) + " bytes)");
+                    for (size_t offset = 0; offset < recorded.size(); offset += frame_size)
+                        m_outputs[i].emplace_back(recorded.begin() + (long)offset, recorded.begin() + (long)(offset + frame_size));
+                    continue;
+                }
+
+                for (size_t k = 0; k < SYNTHETIC_FRAMES; k++)
+                {
+                    std::vector<uint8_t> frame(frame_size, 0);
+                    if ("random" != m_spec.fill)
+                        std::fill(frame.begin(), frame.end(), (uint8_t)std::stoul(m_spec.fill));
+                    else if (HAILO_FORMAT_TYPE_FLOAT32 == output.type)
+                    {
+                        std::uniform_real_distribution<float> values(0.0f, 1.0f);
+                        for (size_t j = 0; j < frame_size; j += sizeof(float))
+                        {
+                            float value = values(random);
+                            memcpy(&frame[j], &value, sizeof(value));
+                        }
+                    }
+                    else
+                    {
+                        std::uniform_int_distribution<uint32_t> values(0, 255);
+                        for (auto &value : frame)
+                            value = (uint8_t)values(random);
+                    }
+                    m_outputs[i].push_back(std::move(frame));
+                }
+            }
+        }
+
+        const MockNetworkSpec m_spec;
+        const Clock::duration m_interval;
+        std::vector<std::vector<std::vector<uint8_t>>> m_outputs; // frames of each output
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<Frame> m_frames; // frames in flight, from m_first_frame
+        uint64_t m_first_frame;
+        std::vector<uint64_t> m_written; // frames written to each input
+        Clock::time_point m_last_start;
+        bool m_aborted;
+    };
+
+    /**
+     * @brief Blocking vstreams on a MockDevice.
+     */
+    class MockVStreamBackend : public VStreamBackend
+    {
+    public:
+        explicit MockVStreamBackend(const MockNetworkSpec &spec)
+            : m_device(spec), m_read(spec.outputs.size(), 0)
+        {
+            for (auto &input : spec.inputs)
+                m_input_infos.push_back(vstream_info(input, HAILO_H2D_STREAM));
+            for (auto &output : spec.outputs)
+                m_output_infos.push_back(vstream_info(output, HAILO_D2H_STREAM));
+        }
+
+        const std::vector<hailo_vstream_info_t> &input_infos() const override { return m_input_infos; }
+        const std::vector<hailo_vstream_info_t> &output_infos() const override { return m_output_infos; }
+        size_t input_frame_size(size_t input) const override { return m_device.spec().inputs[input].frame_size(); }
+        size_t output_frame_size(size_t output) const override { return m_device.spec().outputs[output].frame_size(); }
+
+        hailo_status write(size_t input, const void *, size_t size) override
+        {
+            if (size != input_frame_size(input))
+                return HAILO_INVALID_ARGUMENT;
+            hailo_status status = m_device.wait_for_room(input, std::chrono::milliseconds(HAILO_DEFAULT_VSTREAM_TIMEOUT_MS));
+            if (HAILO_SUCCESS != status)
+                return status;
+            m_device.submit(input);
+            return HAILO_SUCCESS;
+        }
+
+        hailo_status read(size_t output, void *buffer, size_t size) override
+        {
+            if (size != output_frame_size(output))
+                return HAILO_INVALID_ARGUMENT;
+            // every output is read by a single thread, m_read[output] is its own
+            uint64_t frame_index = m_read[output];
+            MockDevice::Clock::time_point ready;
+            hailo_status status = m_device.wait_for_schedule(frame_index, ready, std::chrono::milliseconds(HAILO_DEFAULT_VSTREAM_TIMEOUT_MS));
+            if (HAILO_SUCCESS != status)
+                return status;
+            std::this_thread::sleep_until(ready);
+            m_device.fill(output, frame_index, buffer);
+            m_device.release(frame_index);
+            m_read[output]++;
+            return HAILO_SUCCESS;
+        }
+
+    private:
+        static hailo_vstream_info_t vstream_info(const MockStreamSpec &stream, hailo_stream_direction_t direction)
+        {
+            hailo_vstream_info_t info{};
+            strncpy(info.name, stream.name.c_str(), sizeof(info.name) - 1);
+            info.direction = direction;
+            info.format.type = stream.type;
+            info.format.order = HAILO_FORMAT_ORDER_NHWC;
+            info.shape = stream.shape;
+            info.quant_info = stream.quant_info;
+            return info;
+        }
+
+        MockDevice m_device;
+        std::vector<uint64_t> m_read;
+        std::vector<hailo_vstream_info_t> m_input_infos;
+        std::vector<hailo_vstream_info_t> m_output_infos;
+    };
+
+    /**
+     * @brief Async raw streams on a MockDevice, the transfers are completed by a thread of the backend:
+     * a write when its frame starts, a read when the outputs of its frame are ready.
+     */
+    class MockAsyncBackend : public AsyncBackend
+    {
+    public:
+        explicit MockAsyncBackend(const MockNetworkSpec &spec)
+            : m_device(spec), m_active(false), m_writes(spec.inputs.size()), m_reads(spec.outputs.size()), m_posted(spec.outputs.size(), 0)
+        {
+            for (size_t i = 0; i < spec.inputs.size(); i++)
+                m_input_infos.push_back(stream_info(spec.inputs[i], HAILO_H2D_STREAM, i));
+            for (size_t i = 0; i < spec.outputs.size(); i++)
+                m_output_infos.push_back(stream_info(spec.outputs[i], HAILO_D2H_STREAM, i));
+        }
+
+        ~MockAsyncBackend() { deactivate(); }
+
+        const std::vector<hailo_stream_info_t> &input_infos() const override { return m_input_infos; }
+        const std::vector<hailo_stream_info_t> &output_infos() const override { return m_output_infos; }
+        size_t input_queue_size(size_t) const override { return m_device.spec().queue_size; }
+        size_t output_queue_size(size_t) const override { return m_device.spec().queue_size; }
+
+        hailo_status activate() override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_active)
+                return HAILO_SUCCESS;
+            m_device.reset();
+            std::fill(m_posted.begin(), m_posted.end(), 0);
+            m_active = true;
+            m_thread = std::thread(&MockAsyncBackend::complete_transfers, this);
+            return HAILO_SUCCESS;
+        }
+
+        void deactivate() override
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_active)
+                    return;
+                m_active = false;
+            }
+            m_cv.notify_all();
+            m_device.abort();
+            m_thread.join();
+
+            std::vector<TransferDoneCallback> aborted;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (auto &transfers : m_writes)
+                    take(transfers, aborted);
+                for (auto &transfers : m_reads)
+                    take(transfers, aborted);
+            }
+            for (auto &done : aborted)
+                done(HAILO_STREAM_ABORTED_BY_USER);
+        }
+
+        hailo_status wait_for_write_ready(size_t input, std::chrono::milliseconds timeout) override
+        {
+            if (!is_active())
+                return HAILO_STREAM_NOT_ACTIVATED;
+            hailo_status status = m_device.wait_for_room(input, timeout);
+            return (HAILO_STREAM_ABORTED_BY_USER == status) ? HAILO_STREAM_NOT_ACTIVATED : status;
+        }
+
+        hailo_status wait_for_read_ready(size_t output, std::chrono::milliseconds timeout) override
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            bool ready = m_cv.wait_for(lock, timeout, [this, output]()
+                                       { return !m_active || m_reads[output].size() < m_device.spec().queue_size; });
+            if (!m_active)
+                return HAILO_STREAM_NOT_ACTIVATED;
+            return ready ? HAILO_SUCCESS : HAILO_TIMEOUT;
+        }
+
+        hailo_status write_async(size_t input, const void *, size_t size, TransferDoneCallback done) override
+        {
+            if (size != input_frame_size(input))
+                return HAILO_INVALID_ARGUMENT;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_active)
+                    return HAILO_STREAM_NOT_ACTIVATED;
+                m_writes[input].push_back(Transfer{nullptr, m_device.submit(input), std::move(done)});
+            }
+            m_cv.notify_all();
+            return HAILO_SUCCESS;
+        }
+
+        hailo_status read_async(size_t output, void *buffer, size_t size, TransferDoneCallback done) override
+        {
+            if (size != output_frame_size(output))
+                return HAILO_INVALID_ARGUMENT;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_active)
+                    return HAILO_STREAM_NOT_ACTIVATED;
+                m_reads[output].push_back(Transfer{buffer, m_posted[output]++, std::move(done)});
+            }
+            m_cv.notify_all();
+            return HAILO_SUCCESS;
+        }
+
+    private:
+        struct Transfer
+        {
+            void *buffer;
+            uint64_t frame;
+            TransferDoneCallback done;
+        };
+
+        struct Completion
+        {
+            size_t output; // outputs().size() for a write
+            Transfer transfer;
+        };
+
+        static hailo_stream_info_t stream_info(const MockStreamSpec &stream, hailo_stream_direction_t direction, size_t index)
+        {
+            hailo_stream_info_t info{};
+            strncpy(info.name, stream.name.c_str(), sizeof(info.name) - 1);
+            info.direction = direction;
+            info.index = (uint8_t)index;
+            info.format.type = stream.type;
+            info.format.order = HAILO_FORMAT_ORDER_NHWC;
+            info.shape = stream.shape;
+            info.hw_shape = stream.shape;
+            info.hw_data_bytes = (uint32_t)stream.element_size();
+            info.hw_frame_size = (uint32_t)stream.frame_size();
+            info.quant_info = stream.quant_info;
+            return info;
+        }
+
+        static void take(std::deque<Transfer> &transfers, std::vector<TransferDoneCallback> &callbacks)
+        {
+            for (auto &transfer : transfers)
+                callbacks.push_back(std::move(transfer.done));
+            transfers.clear();
+        }
+
+        bool is_active()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_active;
+        }
+
+        // Takes the transfers whose time came (in the order of each stream), completes them out of the lock
+        // and sleeps until the next one
+        void complete_transfers()
+        {
+            const size_t num_outputs = m_reads.size();
+            std::vector<Completion> completions;
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (m_active)
+            {
+                const MockDevice::Clock::time_point now = MockDevice::Clock::now();
+                MockDevice::Clock::time_point next = MockDevice::Clock::time_point::max();
+                MockDevice::Clock::time_point start, ready;
+                for (auto &transfers : m_writes)
+                {
+                    while (!transfers.empty() && m_device.schedule(transfers.front().frame, start, ready))
+                    {
+                        if (start > now)
+                        {
+                            next = std::min(next, start);
+                            break;
+                        }
+                        completions.push_back(Completion{num_outputs, std::move(transfers.front())});
+                        transfers.pop_front();
+                    }
+                }
+                for (size_t output = 0; output < num_outputs; output++)
+                {
+                    auto &transfers = m_reads[output];
+                    while (!transfers.empty() && m_device.schedule(transfers.front().frame, start, ready))
+                    {
+                        if (ready > now)
+                        {
+                            next = std::min(next, ready);
+                            break;
+                        }
+                        completions.push_back(Completion{output, std::move(transfers.front())});
+                        transfers.pop_front();
+                    }
+                }
+
+                if (completions.empty())
+                {
+                    if (MockDevice::Clock::time_point::max() == next)
+                        m_cv.wait(lock);
+                    else
+                        m_cv.wait_until(lock, next);
+                    continue;
+                }
+
+                lock.unlock();
+                m_cv.notify_all(); // room in the read queues
+                for (auto &completion : completions)
+                {
+                    if (completion.output < num_outputs)
+                    {
+                        m_device.fill(completion.output, completion.transfer.frame, completion.transfer.buffer);
+                        m_device.release(completion.transfer.frame);
+                    }
+                    completion.transfer.done(HAILO_SUCCESS);
+                }
+                completions.clear();
+                lock.lock();
+            }
+        }
+
+        MockDevice m_device;
+        std::vector<hailo_stream_info_t> m_input_infos;
+        std::vector<hailo_stream_info_t> m_output_infos;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        bool m_active;
+        std::thread m_thread;
+        std::vector<std::deque<Transfer>> m_writes; // pending transfers of each stream, in the order they were posted
+        std::vector<std::deque<Transfer>> m_reads;
+        std::vector<uint64_t> m_posted; // reads posted to each output, the index of the frame of the next one
+    };
+
+    /**
+     * @brief Records the outputs of a run, and the timing of the backend, as a mock spec to replay them.
+     *
+     * Wraps a VStreamBackend: the first max_frames frames of every output are written to
+     * output_<i>.bin, and when the recorder is destroyed the spec is written to streams.txt in the
+     * same directory. Its latency is the one of the first frame (the queues are empty) and its fps
+     * the rate the outputs were read at.
+     */
+    class RecordingVStreamBackend : public VStreamBackend
+    {
+    public:
+        RecordingVStreamBackend(std::unique_ptr<VStreamBackend> backend, const std::string &dir, size_t max_frames)
+            : m_backend(std::move(backend)), m_dir(dir), m_max_frames(max_frames), m_first_write_done(false),
+              m_files(m_backend->output_infos().size()), m_reads(m_backend->output_infos().size())
+        {
+            for (size_t i = 0; i < m_files.size(); i++)
+            {
+                m_files[i].open(MockNetworkSpec::output_path(m_dir, i), std::ios::binary | std::ios::trunc);
+                if (!m_files[i])
+                    throw std::runtime_error("Can't write " + MockNetworkSpec::output_path(m_dir, i));
+            }
+        }
+
+        ~RecordingVStreamBackend()
+        {
+            MockNetworkSpec spec;
+            for (auto &input : input_infos())
+                spec.inputs.push_back(MockNetworkSpec::stream_of(input));
+            for (auto &output : output_infos())
+                spec.outputs.push_back(MockNetworkSpec::stream_of(output));
+            Clock::time_point first_read, last_read;
+            uint64_t frames = UINT64_MAX;
+            for (auto &reads : m_reads)
+            {
+                first_read = std::max(first_read, reads.first);
+                last_read = std::max(last_read, reads.last);
+                frames = std::min(frames, reads.count);
+            }
+            if (m_first_write_done && frames > 0)
+                spec.latency = std::chrono::duration_cast<std::chrono::microseconds>(first_read - m_first_write);
+            if (frames > 1 && last_read > first_read)
+                spec.fps = (double)(frames - 1) / std::chrono::duration<double>(last_read - first_read).count();
+            try
+            {
+                spec.save(m_dir + "/streams.txt");
+                std::cout << "-I- Recorded " << std::min<uint64_t>(frames, m_max_frames) << " frames to " << m_dir << std::endl;
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << e.what() << std::endl;
+            }
+        }
+
+        const std::vector<hailo_vstream_info_t> &input_infos() const override { return m_backend->input_infos(); }
+        const std::vector<hailo_vstream_info_t> &output_infos() const override { return m_backend->output_infos(); }
+        size_t input_frame_size(size_t input) const override { return m_backend->input_frame_size(input); }
+        size_t output_frame_size(size_t output) const override { return m_backend->output_frame_size(output); }
+
+        hailo_status write(size_t input, const void *buffer, size_t size) override
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_first_write_done)
+                {
+                    m_first_write = Clock::now();
+                    m_first_write_done = true;
+                }
+            }
+            return m_backend->write(input, buffer, size);
+        }
+
+        hailo_status read(size_t output, void *buffer, size_t size) override
+        {
+            hailo_status status = m_backend->read(output, buffer, size);
+            if (HAILO_SUCCESS != status)
+                return status;
+            // every output is read by a single thread, its file and counters are its own
+            Reads &reads = m_reads[output];
+            reads.last = Clock::now();
+            if (0 == reads.count++)
+                reads.first = reads.last;
+            if (reads.count <= m_max_frames)
+                m_files[output].write(static_cast<const char *>(buffer), (std::streamsize)size);
+            return HAILO_SUCCESS;
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Reads
+        {
+            uint64_t count = 0;
+            Clock::time_point first;
+            Clock::time_point last;
+        };
+
+        std::unique_ptr<VStreamBackend> m_backend;
+        std::string m_dir;
+        size_t m_max_frames;
+        std::mutex m_mutex;
+        bool m_first_write_done;
+        Clock::time_point m_first_write;
+        std::vector<std::ofstream> m_files;
+        std::vector<Reads> m_reads;
+    };
+}
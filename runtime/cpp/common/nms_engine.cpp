@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file nms_engine.cpp
+ * @brief NMS passes of the engine, compiled once with the SIMD flags of the post-processing library.
+ **/
+#include "nms_engine.hpp"
+
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define NMS_ENGINE_NEON
+#endif
+
+namespace common
+{
+    const std::vector<uint32_t> &NmsEngine::nms(float iou_thr, bool cross_classes, size_t top_k)
+    {
+        m_keep.clear();
+        sort_by_score();
+        reset_kept_sets(cross_classes);
+
+        for (uint32_t index : m_order)
+        {
+            KeptSet &kept = m_kept_sets[class_slot(index, cross_classes)];
+            if (kept.overlaps(m_x1[index], m_y1[index], m_x2[index], m_y2[index], iou_thr))
+                continue;
+            kept.insert(m_x1[index], m_y1[index], m_x2[index], m_y2[index]);
+            m_keep.push_back(index);
+            if (top_k != 0 && m_keep.size() >= top_k)
+                break;
+        }
+        return m_keep;
+    }
+
+    const std::vector<uint32_t> &NmsEngine::soft_nms(float iou_thr, float sigma, float score_thr, SoftNmsMethod method,
+                                                     bool cross_classes, size_t top_k)
+    {
+        m_keep.clear();
+        m_order.clear();
+        for (uint32_t index = 0; index < m_score.size(); index++)
+        {
+            if (m_score[index] >= score_thr)
+                m_order.push_back(index);
+        }
+
+        while (!m_order.empty())
+        {
+            // Pick the highest scored remaining box (lowest index on ties).
+            size_t best = 0;
+            for (size_t i = 1; i < m_order.size(); i++)
+            {
+                if (m_score[m_order[i]] > m_score[m_order[best]])
+                    best = i;
+            }
+            uint32_t picked = m_order[best];
+            m_order.erase(m_order.begin() + (long)best);
+            m_keep.push_back(picked);
+            if (top_k != 0 && m_keep.size() >= top_k)
+                break;
+
+            size_t remaining = 0;
+            for (size_t i = 0; i < m_order.size(); i++)
+            {
+                uint32_t index = m_order[i];
+                if (cross_classes || m_class_id[index] == m_class_id[picked])
+                {
+                    float iou = iou_calc(picked, index);
+                    if (SoftNmsMethod::GAUSSIAN == method)
+                        m_score[index] *= std::exp(-(iou * iou) / sigma);
+                    else if (iou > iou_thr)
+                        m_score[index] *= (1.0f - iou);
+                }
+                if (m_score[index] >= score_thr)
+                    m_order[remaining++] = index;
+            }
+            m_order.resize(remaining);
+        }
+        return m_keep;
+    }
+
+    void NmsEngine::KeptSet::insert(float x1, float y1, float x2, float y2)
+    {
+        long pos = std::upper_bound(m_x1.begin(), m_x1.end(), x1) - m_x1.begin();
+        m_x1.insert(m_x1.begin() + pos, x1);
+        m_y1.insert(m_y1.begin() + pos, y1);
+        m_x2.insert(m_x2.begin() + pos, x2);
+        m_y2.insert(m_y2.begin() + pos, y2);
+        m_area.insert(m_area.begin() + pos, (y2 - y1) * (x2 - x1));
+        m_max_width = std::max(m_max_width, x2 - x1);
+    }
+
+    bool NmsEngine::KeptSet::overlaps(float x1, float y1, float x2, float y2, float iou_thr) const
+    {
+        size_t begin = 0;
+        size_t end = m_x1.size();
+        if (iou_thr > 0.0f)
+        {
+            // Only kept boxes that overlap on the x axis can reach a positive IoU.
+            begin = (size_t)(std::lower_bound(m_x1.begin(), m_x1.end(), x1 - m_max_width) - m_x1.begin());
+            end = (size_t)(std::lower_bound(m_x1.begin() + (long)begin, m_x1.end(), x2) - m_x1.begin());
+        }
+        const float area = (y2 - y1) * (x2 - x1);
+        size_t i = begin;
+#if defined(__AVX2__)
+        const __m256 bx1 = _mm256_set1_ps(x1), by1 = _mm256_set1_ps(y1);
+        const __m256 bx2 = _mm256_set1_ps(x2), by2 = _mm256_set1_ps(y2);
+        const __m256 barea = _mm256_set1_ps(area), thr = _mm256_set1_ps(iou_thr);
+        const __m256 zero = _mm256_setzero_ps();
+        for (; i + 8 <= end; i += 8)
+        {
+            __m256 w = _mm256_sub_ps(_mm256_min_ps(_mm256_loadu_ps(&m_x2[i]), bx2), _mm256_max_ps(_mm256_loadu_ps(&m_x1[i]), bx1));
+            __m256 h = _mm256_sub_ps(_mm256_min_ps(_mm256_loadu_ps(&m_y2[i]), by2), _mm256_max_ps(_mm256_loadu_ps(&m_y1[i]), by1));
+            __m256 overlap = _mm256_mul_ps(_mm256_max_ps(w, zero), _mm256_max_ps(h, zero));
+            __m256 iou = _mm256_div_ps(overlap, _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(&m_area[i]), barea), overlap));
+            if (_mm256_movemask_ps(_mm256_cmp_ps(iou, thr, _CMP_GE_OQ)))
+                return true;
+        }
+#elif defined(NMS_ENGINE_NEON)
+        const float32x4_t bx1 = vdupq_n_f32(x1), by1 = vdupq_n_f32(y1);
+        const float32x4_t bx2 = vdupq_n_f32(x2), by2 = vdupq_n_f32(y2);
+        const float32x4_t barea = vdupq_n_f32(area), thr = vdupq_n_f32(iou_thr);
+        const float32x4_t zero = vdupq_n_f32(0.0f);
+        for (; i + 4 <= end; i += 4)
+        {
+            float32x4_t w = vsubq_f32(vminq_f32(vld1q_f32(&m_x2[i]), bx2), vmaxq_f32(vld1q_f32(&m_x1[i]), bx1));
+            float32x4_t h = vsubq_f32(vminq_f32(vld1q_f32(&m_y2[i]), by2), vmaxq_f32(vld1q_f32(&m_y1[i]), by1));
+            float32x4_t overlap = vmulq_f32(vmaxq_f32(w, zero), vmaxq_f32(h, zero));
+            float32x4_t iou = vdivq_f32(overlap, vsubq_f32(vaddq_f32(vld1q_f32(&m_area[i]), barea), overlap));
+            if (vmaxvq_u32(vcgeq_f32(iou, thr)))
+                return true;
+        }
+#endif
+        for (; i < end; i++)
+        {
+            const float w = std::min(m_x2[i], x2) - std::max(m_x1[i], x1);
+            const float h = std::min(m_y2[i], y2) - std::max(m_y1[i], y1);
+            const float overlap = std::max(w, 0.0f) * std::max(h, 0.0f);
+            if (overlap / (m_area[i] + area - overlap) >= iou_thr)
+                return true;
+        }
+        return false;
+    }
+
+    void NmsEngine::sort_by_score()
+    {
+        m_order.resize(m_score.size());
+        for (uint32_t index = 0; index < m_order.size(); index++)
+            m_order[index] = index;
+        std::sort(m_order.begin(), m_order.end(),
+                  [this](uint32_t a, uint32_t b)
+                  { return (m_score[a] > m_score[b]) || (m_score[a] == m_score[b] && a < b); });
+    }
+
+    void NmsEngine::reset_kept_sets(bool cross_classes)
+    {
+        size_t num_slots = cross_classes ? 1 : (size_t)std::max(m_max_class_id, -1) + 2;
+        if (m_kept_sets.size() < num_slots)
+            m_kept_sets.resize(num_slots);
+        for (size_t slot = 0; slot < num_slots; slot++)
+            m_kept_sets[slot].clear();
+    }
+}
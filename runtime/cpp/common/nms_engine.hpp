@@ -0,0 +1,230 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file nms_engine.hpp
+ * @brief Allocation free NMS over a compact structure-of-arrays box buffer.
+ **/
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace common
+{
+    enum class SoftNmsMethod
+    {
+        LINEAR = 0,
+        GAUSSIAN = 1,
+    };
+
+    /**
+     * @brief NMS engine working on a structure-of-arrays box buffer (x1, y1, x2, y2, score, class).
+     *
+     * Boxes are visited once in score order, and each one is checked only against the boxes already
+     * kept for its class. The kept boxes of every class are held sorted by x1 (sort-and-sweep), so a
+     * candidate is compared only to the kept boxes that can overlap it on the x axis, with a SIMD IoU
+     * over that slice. All buffers are kept between runs, so a reused engine does not allocate once
+     * it has seen its largest frame.
+     */
+    class NmsEngine
+    {
+    public:
+        NmsEngine() : m_max_class_id(-1){};
+
+        /**
+         * @brief Remove all the boxes, keeping the allocated buffers.
+         */
+        void clear()
+        {
+            m_x1.clear();
+            m_y1.clear();
+            m_x2.clear();
+            m_y2.clear();
+            m_score.clear();
+            m_class_id.clear();
+            m_keep.clear();
+            m_max_class_id = -1;
+        }
+
+        void reserve(size_t num_boxes)
+        {
+            m_x1.reserve(num_boxes);
+            m_y1.reserve(num_boxes);
+            m_x2.reserve(num_boxes);
+            m_y2.reserve(num_boxes);
+            m_score.reserve(num_boxes);
+            m_class_id.reserve(num_boxes);
+            m_order.reserve(num_boxes);
+            m_keep.reserve(num_boxes);
+        }
+
+        /**
+         * @brief Add a candidate box.
+         *
+         * @param x1 Left edge.
+         * @param y1 Top edge.
+         * @param x2 Right edge.
+         * @param y2 Bottom edge.
+         * @param score Box score.
+         * @param class_id Box class, negative ids are bucketed together.
+         */
+        void add_box(float x1, float y1, float x2, float y2, float score, int class_id)
+        {
+            m_x1.push_back(x1);
+            m_y1.push_back(y1);
+            m_x2.push_back(x2);
+            m_y2.push_back(y2);
+            m_score.push_back(score);
+            m_class_id.push_back(class_id);
+            m_max_class_id = std::max(m_max_class_id, class_id);
+        }
+
+        size_t size() const { return m_score.size(); }
+        float x1(uint32_t index) const { return m_x1[index]; }
+        float y1(uint32_t index) const { return m_y1[index]; }
+        float x2(uint32_t index) const { return m_x2[index]; }
+        float y2(uint32_t index) const { return m_y2[index]; }
+        float score(uint32_t index) const { return m_score[index]; }
+        int class_id(uint32_t index) const { return m_class_id[index]; }
+
+        /**
+         * @brief Get the indices of the boxes kept by the last run, ordered by descending score.
+         */
+        const std::vector<uint32_t> &keep() const { return m_keep; }
+
+        /**
+         * @brief Run greedy (hard) NMS.
+         *
+         * @param iou_thr A box is suppressed by a higher scored box when their IoU is >= iou_thr.
+         * @param cross_classes If true, then apply NMS regardless of class differences.
+         * @param top_k Stop after keeping top_k boxes, 0 means no limit.
+         * @return const std::vector<uint32_t>& indices of the kept boxes, ordered by descending score.
+         */
+        const std::vector<uint32_t> &nms(float iou_thr, bool cross_classes = false, size_t top_k = 0);
+
+        /**
+         * @brief Run soft-NMS, decaying the scores of overlapping boxes instead of removing them.
+         *
+         * @param iou_thr Linear method only - boxes with IoU above iou_thr are decayed by (1 - IoU).
+         * @param sigma Gaussian method only - scores are decayed by exp(-IoU^2 / sigma).
+         * @param score_thr Boxes whose decayed score drops below score_thr are removed.
+         * @param method SoftNmsMethod::LINEAR or SoftNmsMethod::GAUSSIAN.
+         * @param cross_classes If true, then apply NMS regardless of class differences.
+         * @param top_k Stop after keeping top_k boxes, 0 means no limit.
+         * @return const std::vector<uint32_t>& indices of the kept boxes, ordered by descending decayed score.
+         * @note The decayed scores are available through score().
+         */
+        const std::vector<uint32_t> &soft_nms(float iou_thr, float sigma, float score_thr, SoftNmsMethod method,
+                                              bool cross_classes = false, size_t top_k = 0);
+
+        /**
+         * @brief Calculate the IoU of two boxes in the buffer.
+         */
+        float iou_calc(uint32_t first, uint32_t second) const
+        {
+            const float width_of_overlap_area = std::min(m_x2[first], m_x2[second]) - std::max(m_x1[first], m_x1[second]);
+            const float height_of_overlap_area = std::min(m_y2[first], m_y2[second]) - std::max(m_y1[first], m_y1[second]);
+            const float area_of_overlap = std::max(width_of_overlap_area, 0.0f) * std::max(height_of_overlap_area, 0.0f);
+            const float first_area = (m_y2[first] - m_y1[first]) * (m_x2[first] - m_x1[first]);
+            const float second_area = (m_y2[second] - m_y1[second]) * (m_x2[second] - m_x1[second]);
+            return area_of_overlap / (first_area + second_area - area_of_overlap);
+        }
+
+    private:
+        /**
+         * @brief The kept boxes of one class, sorted by x1.
+         */
+        class KeptSet
+        {
+        public:
+            KeptSet() : m_max_width(0.0f){};
+
+            void clear()
+            {
+                m_x1.clear();
+                m_y1.clear();
+                m_x2.clear();
+                m_y2.clear();
+                m_area.clear();
+                m_max_width = 0.0f;
+            }
+
+            void insert(float x1, float y1, float x2, float y2);
+
+            /**
+             * @brief Check if any kept box has IoU >= iou_thr with the given box.
+             */
+            bool overlaps(float x1, float y1, float x2, float y2, float iou_thr) const;
+
+        private:
+            std::vector<float> m_x1;
+            std::vector<float> m_y1;
+            std::vector<float> m_x2;
+            std::vector<float> m_y2;
+            std::vector<float> m_area;
+            float m_max_width;
+        };
+
+        void sort_by_score();
+
+        size_t class_slot(uint32_t index, bool cross_classes) const
+        {
+            if (cross_classes || m_class_id[index] < 0)
+                return 0;
+            return (size_t)m_class_id[index] + 1;
+        }
+
+        void reset_kept_sets(bool cross_classes);
+
+        std::vector<float> m_x1;
+        std::vector<float> m_y1;
+        std::vector<float> m_x2;
+        std::vector<float> m_y2;
+        std::vector<float> m_score;
+        std::vector<int> m_class_id;
+        int m_max_class_id;
+
+        std::vector<uint32_t> m_order;
+        std::vector<uint32_t> m_keep;
+        std::vector<KeptSet> m_kept_sets;
+    };
+
+    /**
+     * @brief Keep only the given elements of a vector, in the given order, without copying the kept elements.
+     *
+     * @param objects The vector to compact.
+     * @param keep Indices (into objects) of the elements to keep.
+     * @param positions Scratch buffer, reused between calls.
+     */
+    template <typename T>
+    void keep_by_indices(std::vector<T> &objects, const std::vector<uint32_t> &keep, std::vector<uint32_t> &positions)
+    {
+        // positions[0..n) - current position of each original element, positions[n..2n) - original element at each position.
+        const size_t n = objects.size();
+        positions.resize(2 * n);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            positions[i] = i;
+            positions[n + i] = i;
+        }
+        for (uint32_t target = 0; target < keep.size(); target++)
+        {
+            uint32_t source = positions[keep[target]];
+            if (source != target)
+            {
+                std::swap(objects[target], objects[source]);
+                uint32_t displaced = positions[n + target];
+                positions[displaced] = source;
+                positions[n + source] = displaced;
+                positions[keep[target]] = target;
+                positions[n + target] = keep[target];
+            }
+        }
+        objects.erase(objects.begin() + (long)keep.size(), objects.end());
+    }
+}
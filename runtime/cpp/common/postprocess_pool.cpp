@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file postprocess_pool.cpp
+ * @brief Workers of the work-stealing post-processing pool.
+ **/
+#include "postprocess_pool.hpp"
+
+namespace common
+{
+    WorkStealingPool::WorkStealingPool(size_t num_threads) : m_pending(0), m_next(0), m_stop(false)
+    {
+        if (num_threads == 0)
+            num_threads = 1;
+        for (size_t i = 0; i < num_threads; i++)
+            m_queues.emplace_back(new Queue());
+        for (size_t i = 0; i < num_threads; i++)
+            m_threads.emplace_back(&WorkStealingPool::worker, this, i);
+    }
+
+    WorkStealingPool::~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        for (auto &thread : m_threads)
+            thread.join();
+    }
+
+    void WorkStealingPool::submit(std::function<void()> task)
+    {
+        {
+            Queue &queue = *m_queues[m_next++ % m_queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending++;
+        }
+        m_cv.notify_one();
+    }
+
+    bool WorkStealingPool::pop(size_t index, std::function<void()> &task)
+    {
+        for (size_t i = 0; i < m_queues.size(); i++)
+        {
+            Queue &queue = *m_queues[(index + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+            if (i == 0)
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            else
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void WorkStealingPool::worker(size_t index)
+    {
+        std::function<void()> task;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [this]
+                          { return m_pending > 0 || m_stop; });
+                if (m_pending == 0)
+                    return;
+                m_pending--;
+            }
+            // A claimed task is always in one of the queues, it may just have been stolen from
+            // the queue we looked at first by a worker that claimed another task.
+            while (!pop(index, task))
+                std::this_thread::yield();
+            task();
+            task = nullptr;
+        }
+    }
+}
@@ -0,0 +1,240 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file postprocess_pool.hpp
+ * @brief Post-processing of several frames at once on a work-stealing thread pool, with results emitted in frame order.
+ **/
+#pragma once
+
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace common
+{
+    /**
+     * @brief Pool of worker threads, each with its own task queue.
+     *
+     * Tasks are spread round robin over the queues, a worker runs its own queue oldest first and
+     * when it is empty steals the newest task of another worker, so a slow frame doesn't hold back
+     * the frames queued behind it on the same worker.
+     */
+    class WorkStealingPool
+    {
+    public:
+        explicit WorkStealingPool(size_t num_threads);
+
+        /**
+         * @brief Runs the queued tasks, then joins the workers.
+         */
+        ~WorkStealingPool();
+
+        WorkStealingPool(const WorkStealingPool &) = delete;
+        WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+        size_t size() const { return m_threads.size(); }
+
+        void submit(std::function<void()> task);
+
+    private:
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        std::vector<std::unique_ptr<Queue>> m_queues;
+        std::vector<std::thread> m_threads;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        size_t m_pending; // tasks queued and not yet claimed by a worker
+        size_t m_next;    // only used by the submitting thread
+        bool m_stop;
+
+        bool pop(size_t index, std::function<void()> &task);
+        void worker(size_t index);
+    };
+
+    /**
+     * @brief Settings of the post-processing stage.
+     */
+    struct PostProcessOptions
+    {
+        size_t num_threads;   // workers of the pool
+        size_t max_in_flight; // frames submitted and not yet emitted
+
+        PostProcessOptions(size_t threads = 0, size_t in_flight = 0)
+        {
+            num_threads = (threads != 0) ? threads : std::thread::hardware_concurrency();
+            if (num_threads == 0)
+                num_threads = 1;
+            max_in_flight = (in_flight != 0) ? in_flight : 2 * num_threads;
+        }
+    };
+
+    /**
+     * @brief Post-process frames concurrently and get their results back in frame order.
+     *
+     * The calling thread submits frames one after the other; each one is processed on the pool and
+     * its result is put in a reorder buffer, from which the results are emitted in submission order
+     * on the calling thread. At most max_in_flight frames are between submission and emission, so
+     * per-frame buffers can be kept in max_in_flight slots and reused (see next_slot()).
+     *
+     * The slots must outlive the processor: if wait_for_slot() or drain() rethrows the exception of a
+     * frame, the destructor still waits for the other frames, which keep using their slots.
+     *
+     * @tparam R The result of a frame.
+     */
+    template <typename R>
+    class OrderedPostProcessor
+    {
+    public:
+        explicit OrderedPostProcessor(const PostProcessOptions &options = PostProcessOptions())
+            : m_entries(options.max_in_flight != 0 ? options.max_in_flight : 1), m_submitted(0), m_emitted(0),
+              m_pool(new WorkStealingPool(options.num_threads)){};
+
+        /**
+         * @brief Waits for the frames still in flight, their results are dropped.
+         */
+        ~OrderedPostProcessor()
+        {
+            m_pool.reset();
+        }
+
+        OrderedPostProcessor(const OrderedPostProcessor &) = delete;
+        OrderedPostProcessor &operator=(const OrderedPostProcessor &) = delete;
+
+        size_t max_in_flight() const { return m_entries.size(); }
+        size_t num_threads() const { return m_pool->size(); }
+
+        /**
+         * @brief Slot of the next frame to submit, the slot is free once wait_for_slot() returned.
+         */
+        size_t next_slot() const { return m_submitted % m_entries.size(); }
+
+        /**
+         * @brief Emit the finished results in order, and block until the next frame can be submitted.
+         *
+         * @param emit Called with (frame index, result) on the calling thread.
+         */
+        template <typename Emit>
+        void wait_for_slot(Emit emit)
+        {
+            emit_ready(emit);
+            while (m_submitted - m_emitted >= m_entries.size())
+                emit_next(emit);
+        }
+
+        /**
+         * @brief Submit the next frame, call wait_for_slot() first.
+         *
+         * @param work Callable returning the result of the frame, run on the pool. An exception it
+         *             throws is rethrown by the call that emits this frame.
+         */
+        template <typename Work>
+        void submit(Work work)
+        {
+            const size_t frame = m_submitted++;
+            m_pool->submit([this, frame, work]() mutable
+                           { finish(frame, work); });
+        }
+
+        /**
+         * @brief Emit the results that are ready, in order, without blocking.
+         */
+        template <typename Emit>
+        void emit_ready(Emit emit)
+        {
+            while (m_emitted < m_submitted)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (!m_entries[m_emitted % m_entries.size()].ready)
+                        return;
+                }
+                emit_next(emit);
+            }
+        }
+
+        /**
+         * @brief Emit all the remaining results, in order.
+         */
+        template <typename Emit>
+        void drain(Emit emit)
+        {
+            while (m_emitted < m_submitted)
+                emit_next(emit);
+        }
+
+    private:
+        struct Entry
+        {
+            R result;
+            std::exception_ptr error;
+            bool ready = false;
+        };
+
+        std::vector<Entry> m_entries; // reorder buffer, frame i is in entry i % max_in_flight
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        size_t m_submitted; // only used by the calling thread
+        size_t m_emitted;   // only used by the calling thread
+        // Declared last, so the workers are joined before the members they use are destroyed.
+        std::unique_ptr<WorkStealingPool> m_pool;
+
+        template <typename Work>
+        void finish(size_t frame, Work &work)
+        {
+            R result = R();
+            std::exception_ptr error;
+            try
+            {
+                result = work();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                Entry &entry = m_entries[frame % m_entries.size()];
+                entry.result = std::move(result);
+                // moved, so the exception is only released by the emitting thread
+                entry.error = std::move(error);
+                entry.ready = true;
+            }
+            m_cv.notify_all();
+        }
+
+        template <typename Emit>
+        void emit_next(Emit &emit)
+        {
+            const size_t frame = m_emitted;
+            Entry &entry = m_entries[frame % m_entries.size()];
+            R result;
+            std::exception_ptr error;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [&entry]
+                          { return entry.ready; });
+                result = std::move(entry.result);
+                error = entry.error;
+                entry.error = nullptr;
+                entry.ready = false;
+            }
+            m_emitted++;
+            if (error)
+                std::rethrow_exception(error);
+            emit(frame, result);
+        }
+    };
+}
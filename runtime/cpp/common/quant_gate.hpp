@@ -0,0 +1,228 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file quant_gate.hpp
+ * @brief Score threshold applied in the quantized domain, before anything is dequantized.
+ **/
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define QUANT_GATE_NEON
+#endif
+
+namespace common
+{
+    /**
+     * @brief Get the smallest quantized value that passes a monotonic predicate.
+     *
+     * The predicate is evaluated on quantized values, so it is the exact float comparison the
+     * decoder would do after dequantization (and activation).
+     *
+     * @param passes Predicate on a quantized value, false for all values below the cutoff and true from it on.
+     * @return uint32_t the quantized cutoff, max(T) + 1 when no value can pass.
+     */
+    template <typename T, typename Predicate>
+    uint32_t quantized_cutoff(Predicate passes)
+    {
+        uint32_t low = 0;
+        uint32_t high = (uint32_t)std::numeric_limits<T>::max() + 1;
+        while (low < high)
+        {
+            uint32_t mid = low + (high - low) / 2;
+            if (passes((T)mid))
+                high = mid;
+            else
+                low = mid + 1;
+        }
+        return low;
+    }
+
+    /**
+     * @brief Quantized threshold gate of a score tensor.
+     *
+     * The threshold is turned into a quantized cutoff once per tensor, then the raw buffer is
+     * scanned with integer compares only (SIMD compare + movemask on contiguous runs), and just the
+     * candidate indices are left for the decoder to dequantize.
+     *
+     * @tparam T The quantized type (uint8_t / uint16_t).
+     * @note The cutoff assumes a positive qp_scale (dequantization is monotonic).
+     */
+    template <typename T>
+    class QuantizedGate
+    {
+    public:
+        explicit QuantizedGate(uint32_t cutoff) : m_cutoff(cutoff){};
+
+        /**
+         * @brief Gate of dequantized score >= threshold.
+         */
+        static QuantizedGate at_least(float threshold, float qp_scale, float qp_zp)
+        {
+            return QuantizedGate(quantized_cutoff<T>([&](T q)
+                                                     { return (float(q) - qp_zp) * qp_scale >= threshold; }));
+        }
+
+        /**
+         * @brief Gate of table[q] >= threshold, for a monotonic dequantization (+ activation) table of T.
+         */
+        static QuantizedGate at_least(float threshold, const float *table)
+        {
+            return QuantizedGate(quantized_cutoff<T>([&](T q)
+                                                     { return table[q] >= threshold; }));
+        }
+
+        /**
+         * @brief Gate of any monotonic predicate on the quantized value.
+         */
+        template <typename Predicate>
+        static QuantizedGate from_predicate(Predicate passes)
+        {
+            return QuantizedGate(quantized_cutoff<T>(passes));
+        }
+
+        uint32_t cutoff() const { return m_cutoff; }
+
+        /**
+         * @brief Whether no quantized value can pass, so the whole tensor can be skipped.
+         */
+        bool closed() const { return m_cutoff > std::numeric_limits<T>::max(); }
+
+        bool passes(T value) const { return value >= m_cutoff; }
+
+        /**
+         * @brief Append the indices of the values that pass the gate.
+         *
+         * @param data Contiguous quantized values.
+         * @param count Number of values.
+         * @param[out] indices Indices into data, appended in ascending order.
+         * @return size_t Number of indices appended.
+         */
+        size_t scan(const T *data, size_t count, std::vector<uint32_t> &indices) const
+        {
+            const size_t initial_size = indices.size();
+            if (closed())
+                return 0;
+            size_t i = scan_simd(data, count, indices);
+            for (; i < count; i++)
+            {
+                if (data[i] >= m_cutoff)
+                    indices.push_back((uint32_t)i);
+            }
+            return indices.size() - initial_size;
+        }
+
+        /**
+         * @brief Append the indices of the strided values that pass the gate, such as the objectness
+         *        channel of every anchor. Index i refers to data[i * stride].
+         *
+         * @param data First quantized value.
+         * @param count Number of values.
+         * @param stride Distance between two values, in elements.
+         * @param[out] indices Indices of the passing values, appended in ascending order.
+         * @return size_t Number of indices appended.
+         */
+        size_t scan_strided(const T *data, size_t count, size_t stride, std::vector<uint32_t> &indices) const
+        {
+            if (stride == 1)
+                return scan(data, count, indices);
+            const size_t initial_size = indices.size();
+            if (closed())
+                return 0;
+            for (size_t i = 0; i < count; i++)
+            {
+                if (data[i * stride] >= m_cutoff)
+                    indices.push_back((uint32_t)i);
+            }
+            return indices.size() - initial_size;
+        }
+
+    private:
+        uint32_t m_cutoff;
+
+        /**
+         * @brief Scan the vector-sized blocks of data, return the number of values scanned.
+         */
+        size_t scan_simd(const uint8_t *data, size_t count, std::vector<uint32_t> &indices) const
+        {
+            size_t i = 0;
+#if defined(__AVX2__)
+            // Unsigned q >= cutoff <=> max(q, cutoff) == q
+            const __m256i vcutoff = _mm256_set1_epi8((char)m_cutoff);
+            for (; i + 32 <= count; i += 32)
+            {
+                __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+                uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(values, vcutoff), values));
+                while (mask)
+                {
+                    indices.push_back((uint32_t)(i + __builtin_ctz(mask)));
+                    mask &= mask - 1;
+                }
+            }
+#elif defined(QUANT_GATE_NEON)
+            const uint8x16_t vcutoff = vdupq_n_u8((uint8_t)m_cutoff);
+            for (; i + 16 <= count; i += 16)
+            {
+                // No movemask on NEON, blocks without any candidate are skipped with a horizontal max
+                if (vmaxvq_u8(vcgeq_u8(vld1q_u8(data + i), vcutoff)) == 0)
+                    continue;
+                for (size_t j = i; j < i + 16; j++)
+                {
+                    if (data[j] >= m_cutoff)
+                        indices.push_back((uint32_t)j);
+                }
+            }
+#else
+            (void)data;
+            (void)count;
+            (void)indices;
+#endif
+            return i;
+        }
+
+        size_t scan_simd(const uint16_t *data, size_t count, std::vector<uint32_t> &indices) const
+        {
+            size_t i = 0;
+#if defined(__AVX2__)
+            const __m256i vcutoff = _mm256_set1_epi16((short)m_cutoff);
+            for (; i + 16 <= count; i += 16)
+            {
+                __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+                // movemask gives 2 bits per 16 bit lane, keep the low one
+                uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_max_epu16(values, vcutoff), values)) & 0x55555555u;
+                while (mask)
+                {
+                    indices.push_back((uint32_t)(i + (__builtin_ctz(mask) >> 1)));
+                    mask &= mask - 1;
+                }
+            }
+#elif defined(QUANT_GATE_NEON)
+            const uint16x8_t vcutoff = vdupq_n_u16((uint16_t)m_cutoff);
+            for (; i + 8 <= count; i += 8)
+            {
+                if (vmaxvq_u16(vcgeq_u16(vld1q_u16(data + i), vcutoff)) == 0)
+                    continue;
+                for (size_t j = i; j < i + 8; j++)
+                {
+                    if (data[j] >= m_cutoff)
+                        indices.push_back((uint32_t)j);
+                }
+            }
+#else
+            (void)data;
+            (void)count;
+            (void)indices;
+#endif
+            return i;
+        }
+    };
+}
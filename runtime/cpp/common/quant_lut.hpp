@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file quant_lut.hpp
+ * @brief Lookup tables fusing dequantization with an activation, for 8/16 bit outputs.
+ **/
+#pragma once
+
+#include <stdint.h>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+namespace common
+{
+    enum class LutActivation
+    {
+        NONE,
+        SIGMOID,
+        EXP,
+        SOFTPLUS
+    };
+
+    /**
+     * @brief Apply an activation on a dequantized value.
+     */
+    inline float lut_activation(float x, LutActivation activation)
+    {
+        switch (activation)
+        {
+        case LutActivation::SIGMOID:
+            // returns the value of the sigmoid function f(x) = 1/(1 + e^-x)
+            return 1.0f / (1.0f + expf(-x));
+        case LutActivation::EXP:
+            return expf(x);
+        case LutActivation::SOFTPLUS:
+            return log1pf(expf(x));
+        default:
+            return x;
+        }
+    }
+
+    /**
+     * @brief Table of activation((q - zp) * scale) for every quantized value q of T.
+     *
+     * For uint8 outputs this is 256 floats (1KB), for uint16 65536 floats (256KB).
+     * The table entries are computed with the same float arithmetic as the per-element code they
+     * replace, so a lookup gives the exact same result.
+     *
+     * @tparam T The quantized type (uint8_t / uint16_t).
+     */
+    template <typename T>
+    class DequantLut
+    {
+    public:
+        static const size_t SIZE = (size_t)std::numeric_limits<T>::max() + 1;
+
+        DequantLut(float qp_scale, float qp_zp, LutActivation activation = LutActivation::NONE)
+            : m_table(SIZE), m_qp_scale(qp_scale), m_qp_zp(qp_zp), m_activation(activation)
+        {
+            for (size_t q = 0; q < SIZE; q++)
+            {
+                m_table[q] = lut_activation((float(q) - qp_zp) * qp_scale, activation);
+            }
+        }
+
+        /**
+         * @brief Build a table of a custom function of the dequantized value, for post-processing
+         *        chains that are fully elementwise.
+         */
+        template <typename Func>
+        DequantLut(float qp_scale, float qp_zp, Func func)
+            : m_table(SIZE), m_qp_scale(qp_scale), m_qp_zp(qp_zp), m_activation(LutActivation::NONE)
+        {
+            for (size_t q = 0; q < SIZE; q++)
+            {
+                m_table[q] = func((float(q) - qp_zp) * qp_scale);
+            }
+        }
+
+        float operator[](T q) const { return m_table[q]; }
+        const float *data() const { return m_table.data(); }
+        float qp_scale() const { return m_qp_scale; }
+        float qp_zp() const { return m_qp_zp; }
+        LutActivation activation() const { return m_activation; }
+
+        /**
+         * @brief Map a buffer of quantized values through the table.
+         *
+         * @param src Quantized values.
+         * @param count Number of values.
+         * @param[out] dst Buffer of at least count floats.
+         */
+        void apply(const T *src, size_t count, float *dst) const
+        {
+            const float *table = m_table.data();
+            for (size_t i = 0; i < count; i++)
+            {
+                dst[i] = table[src[i]];
+            }
+        }
+
+    private:
+        std::vector<float> m_table;
+        float m_qp_scale;
+        float m_qp_zp;
+        LutActivation m_activation;
+    };
+
+    template <typename T>
+    using DequantLutPtr = std::shared_ptr<const DequantLut<T>>;
+
+    /**
+     * @brief Get the table of (qp_scale, qp_zp, activation) from a process wide cache, building it on first use.
+     *        After the first build a call is a locked map lookup, so get the table once per tensor, not per element.
+     *
+     * @return DequantLutPtr<T> shared immutable table.
+     */
+    template <typename T>
+    DequantLutPtr<T> get_dequant_lut(float qp_scale, float qp_zp, LutActivation activation)
+    {
+        static std::mutex mutex;
+        static std::map<std::tuple<uint32_t, uint32_t, int>, DequantLutPtr<T>> cache;
+
+        // Key by the exact bit patterns, two tensors share a table only if their quant params are identical.
+        uint32_t scale_bits, zp_bits;
+        std::memcpy(&scale_bits, &qp_scale, sizeof(scale_bits));
+        std::memcpy(&zp_bits, &qp_zp, sizeof(zp_bits));
+        auto key = std::make_tuple(scale_bits, zp_bits, (int)activation);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = cache.find(key);
+        if (it == cache.end())
+        {
+            it = cache.emplace(key, std::make_shared<const DequantLut<T>>(qp_scale, qp_zp, activation)).first;
+        }
+        return it->second;
+    }
+}
@@ -0,0 +1,256 @@
+/**
+ * Copyright 2020 (C) Hailo Technologies Ltd.
+ * All rights reserved.
+ *
+ * Hailo Technologies Ltd. ("Hailo") disclaims any warranties, including, but not limited to,
+ * the implied warranties of merchantability and fitness for a particular purpose.
+ * This software is provided on an "AS IS" basis, and Hailo has no obligation to provide maintenance,
+ * support, updates, enhancements, or modifications.
+ *
+ * You may use this software in the development of any project.
+ * You shall not reproduce, modify or distribute this software without prior written permission.
+ **/
+/**
+ * @file ring_buffer.hpp
+ * @brief Lock-free single producer single consumer ring of output buffers, with the DoubleBuffer API
+ **/
+
+#ifndef _HAILO_RING_BUFFER_HPP_
+#define _HAILO_RING_BUFFER_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+enum class RingBufferWait {
+    // Busy-wait with pauses and yields, lowest wake up latency, keeps a core busy while waiting
+    SPIN = 0,
+    // Spin a short while, then sleep in the kernel (futex on Linux) until the other side releases a buffer
+    SPIN_THEN_FUTEX = 1,
+};
+
+/**
+ * A ring of slots buffers written by one thread (e.g. a vstream reader) and read in the same order by another
+ * (e.g. the post-processing). The writer can run up to slots buffers ahead of the reader, each side only blocks
+ * when the ring is full or empty. There is no lock: the two indices are atomics, each on its own cache line,
+ * published with release stores and observed with acquire loads.
+ *
+ * The API is the one of DoubleBuffer: get_*_buffer() waits for a buffer, release_*_buffer() hands it over.
+ * The reader can also hold several buffers at once with hold_read_buffer(), e.g. one per frame in post-processing.
+ **/
+template <typename T>
+class RingBuffer {
+public:
+    static constexpr uint32_t DEFAULT_SLOTS = 4;
+
+    /**
+     * first_index is the running count both indices start from, the tests start it next to the wrap around.
+     **/
+    RingBuffer(uint32_t size, uint32_t slots = DEFAULT_SLOTS, RingBufferWait wait = RingBufferWait::SPIN_THEN_FUTEX,
+               uint32_t first_index = 0) :
+        m_slots(slots), m_wait(wait)
+    {
+        if ((0 == slots) || (slots > MAX_SLOTS)) {
+            throw std::invalid_argument("RingBuffer slots must be in [1, 2^31]");
+        }
+        for (auto &slot : m_slots) {
+            slot.buffer.resize(size);
+        }
+        m_write_index.value.store(first_index, std::memory_order_relaxed);
+        m_read_index.value.store(first_index, std::memory_order_relaxed);
+    }
+
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    uint32_t slots() const
+    {
+        return static_cast<uint32_t>(m_slots.size());
+    }
+
+    /**
+     * Number of buffers written and not yet released by the reader.
+     **/
+    uint32_t size() const
+    {
+        return m_write_index.value.load(std::memory_order_acquire) - m_read_index.value.load(std::memory_order_acquire);
+    }
+
+    std::vector<T> &get_write_buffer()
+    {
+        const uint32_t write_index = m_write_index.value.load(std::memory_order_relaxed);
+        // Wait for the reader to release the buffer written slots frames ago
+        wait_until(m_read_index, m_writer_waiting, [write_index, this](uint32_t read_index) {
+            return (write_index - read_index) < slots();
+        });
+        return m_slots[m_write_index.slot].buffer;
+    }
+
+    void release_write_buffer()
+    {
+        next_slot(m_write_index);
+        advance(m_write_index, m_reader_waiting);
+    }
+
+    std::vector<T> &get_read_buffer()
+    {
+        const uint32_t read_index = m_read_index.value.load(std::memory_order_relaxed);
+        wait_until(m_write_index, m_reader_waiting, [read_index](uint32_t write_index) {
+            return write_index != read_index;
+        });
+        return m_slots[m_read_index.slot].buffer;
+    }
+
+    /**
+     * Waits for the buffer after the ones the reader already holds, and holds it too. The held buffers are released
+     * oldest first by release_read_buffer(), get_read_buffer() returns the oldest. Holding slots buffers stalls the writer.
+     **/
+    std::vector<T> &hold_read_buffer()
+    {
+        const uint32_t held_index = m_read_index.value.load(std::memory_order_relaxed) + m_read_index.held;
+        wait_until(m_write_index, m_reader_waiting, [held_index](uint32_t write_index) {
+            return write_index != held_index;
+        });
+        // Less than slots buffers are held here, the writer is at most slots buffers ahead of the reader
+        uint32_t slot = m_read_index.slot + m_read_index.held;
+        if (slot >= m_slots.size()) {
+            slot -= static_cast<uint32_t>(m_slots.size());
+        }
+        m_read_index.held++;
+        return m_slots[slot].buffer;
+    }
+
+    void release_read_buffer()
+    {
+        if (0 != m_read_index.held) {
+            m_read_index.held--;
+        }
+        next_slot(m_read_index);
+        advance(m_read_index, m_writer_waiting);
+    }
+
+private:
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+    static constexpr uint32_t MAX_SLOTS = 1u << 31;
+    static constexpr int SPIN_COUNT = 256;
+    static constexpr int PAUSES_BEFORE_YIELD = 64;
+
+    // Running count of the buffers released by one side, wraps around (the differences are still correct). 2^32 isn't
+    // a multiple of every slot count, so the slot of the side's next buffer is a cursor of its own, only used by that side
+    struct alignas(CACHE_LINE_SIZE) PaddedIndex {
+        std::atomic<uint32_t> value{0};
+        uint32_t slot = 0;
+        uint32_t held = 0; // buffers held past the index, only by the reader with hold_read_buffer()
+    };
+
+    struct alignas(CACHE_LINE_SIZE) PaddedFlag {
+        std::atomic<uint32_t> value{0};
+    };
+
+    // The slot headers are aligned too, so the buffers the writer and the reader hold never share a line
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        std::vector<T> buffer;
+    };
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex needs a plain 32 bits word");
+
+    std::vector<Slot> m_slots;
+    RingBufferWait m_wait;
+    PaddedIndex m_write_index; // written by the writer only
+    PaddedIndex m_read_index;  // written by the reader only
+    PaddedFlag m_writer_waiting;
+    PaddedFlag m_reader_waiting;
+
+    static void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield" ::: "memory");
+#endif
+    }
+
+    void next_slot(PaddedIndex &index)
+    {
+        index.slot = (index.slot + 1 == m_slots.size()) ? 0 : index.slot + 1;
+    }
+
+    void advance(PaddedIndex &index, PaddedFlag &other_waiting)
+    {
+        const uint32_t next = index.value.load(std::memory_order_relaxed) + 1;
+        if (RingBufferWait::SPIN == m_wait) {
+            index.value.store(next, std::memory_order_release);
+            return;
+        }
+        // Sequentially consistent with wait_until(): either the other side sees the new index, or it is seen waiting
+        index.value.store(next, std::memory_order_seq_cst);
+        if (0 != other_waiting.value.load(std::memory_order_seq_cst)) {
+            futex_wake(index.value);
+        }
+    }
+
+    template <typename Ready>
+    void wait_until(PaddedIndex &other_index, PaddedFlag &waiting, Ready ready)
+    {
+        uint32_t observed = other_index.value.load(std::memory_order_acquire);
+        for (int spin = 0; !ready(observed); spin++) {
+            if (spin < SPIN_COUNT) {
+                if (spin < PAUSES_BEFORE_YIELD) {
+                    cpu_relax();
+                } else {
+                    std::this_thread::yield();
+                }
+            } else if (RingBufferWait::SPIN == m_wait) {
+                std::this_thread::yield();
+            } else {
+                waiting.value.store(1, std::memory_order_seq_cst);
+                // The futex returns at once if the index moved since observed, so a release in between isn't missed
+                if (other_index.value.load(std::memory_order_seq_cst) == observed) {
+                    futex_wait(other_index.value, observed);
+                }
+                waiting.value.store(0, std::memory_order_relaxed);
+            }
+            observed = other_index.value.load(std::memory_order_acquire);
+        }
+    }
+
+    static void futex_wait(std::atomic<uint32_t> &word, uint32_t observed)
+    {
+#if defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT_PRIVATE, observed, nullptr, nullptr, 0);
+#elif defined(__cpp_lib_atomic_wait)
+        word.wait(observed, std::memory_order_relaxed);
+#else
+        (void)word;
+        (void)observed;
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+    }
+
+    static void futex_wake(std::atomic<uint32_t> &word)
+    {
+#if defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#elif defined(__cpp_lib_atomic_wait)
+        word.notify_one();
+#else
+        (void)word;
+#endif
+    }
+};
+
+#endif /* _HAILO_RING_BUFFER_HPP_ */
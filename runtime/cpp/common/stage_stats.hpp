@@ -0,0 +1,265 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file stage_stats.hpp
+ * @brief Per-stage latency histograms of a pipeline run, reported as FPS, p50 / p99 latencies and utilization.
+ **/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace common
+{
+    /**
+     * @brief Latency samples of the stages of a pipeline, added by the threads running them.
+     *
+     * Every stage keeps a histogram of its samples, in buckets a 32nd of a power of two wide (about 3%),
+     * so its memory doesn't grow with the length of the run and adding a sample takes no lock. The count,
+     * mean and max are exact, the percentiles are the middle of their bucket.
+     */
+    class StageStats
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        class Stage
+        {
+        public:
+            static const int SUB_BUCKET_BITS = 5;
+            static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+            static const int MAX_SHIFT = 37; // samples up to 2^43 ns, about 2.4 hours
+            static const int BUCKETS = (MAX_SHIFT + 2) * SUB_BUCKETS;
+
+            explicit Stage(const std::string &name, size_t workers = 1)
+                : m_name(name), m_workers(workers), m_count(0), m_sum_ns(0), m_max_ns(0)
+            {
+                for (auto &bucket : m_buckets)
+                    bucket.store(0, std::memory_order_relaxed);
+            }
+
+            const std::string &name() const { return m_name; }
+
+            /**
+             * @brief Threads running the stage, its samples are spread over them.
+             */
+            size_t workers() const { return m_workers; }
+            void set_workers(size_t workers) { m_workers = workers != 0 ? workers : 1; }
+
+            void add(Clock::duration duration)
+            {
+                int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+                uint64_t value = ns > 0 ? (uint64_t)ns : 0;
+                m_buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+                m_count.fetch_add(1, std::memory_order_relaxed);
+                m_sum_ns.fetch_add(value, std::memory_order_relaxed);
+                uint64_t max = m_max_ns.load(std::memory_order_relaxed);
+                while (value > max && !m_max_ns.compare_exchange_weak(max, value, std::memory_order_relaxed))
+                {
+                }
+            }
+
+            void add(Clock::time_point begin, Clock::time_point end) { add(end - begin); }
+
+            size_t count() const { return (size_t)m_count.load(std::memory_order_relaxed); }
+            double total_ms() const { return (double)m_sum_ns.load(std::memory_order_relaxed) / 1e6; }
+            double mean_ms() const { return count() != 0 ? total_ms() / (double)count() : 0.0; }
+            double max_ms() const { return (double)m_max_ns.load(std::memory_order_relaxed) / 1e6; }
+
+            /**
+             * @brief Nearest-rank percentile of the samples, in milliseconds.
+             */
+            double percentile_ms(double p) const
+            {
+                const uint64_t samples = m_count.load(std::memory_order_relaxed);
+                if (samples == 0)
+                    return 0.0;
+                uint64_t rank = (uint64_t)(p / 100.0 * (double)samples + 0.5);
+                rank = std::min(std::max(rank, (uint64_t)1), samples);
+                uint64_t seen = 0;
+                for (int index = 0; index < BUCKETS; index++)
+                {
+                    seen += m_buckets[index].load(std::memory_order_relaxed);
+                    if (seen >= rank)
+                        return std::min(middle(index), max_ms());
+                }
+                return max_ms();
+            }
+
+        private:
+            std::string m_name;
+            size_t m_workers;
+            std::atomic<uint64_t> m_count;
+            std::atomic<uint64_t> m_sum_ns;
+            std::atomic<uint64_t> m_max_ns;
+            std::atomic<uint64_t> m_buckets[BUCKETS];
+
+            // Values below SUB_BUCKETS have a bucket each, above a power of two 2^k is split in SUB_BUCKETS buckets
+            static int bucket(uint64_t value)
+            {
+                if (value < (uint64_t)SUB_BUCKETS)
+                    return (int)value;
+                int msb = 63;
+                while ((value >> msb) == 0)
+                    msb--;
+                int shift = msb - SUB_BUCKET_BITS;
+                if (shift > MAX_SHIFT)
+                    return BUCKETS - 1;
+                return (shift + 1) * SUB_BUCKETS + (int)(value >> shift) - SUB_BUCKETS;
+            }
+
+            static double middle(int index)
+            {
+                if (index < SUB_BUCKETS)
+                    return (double)index / 1e6;
+                int shift = index / SUB_BUCKETS - 1;
+                double lower = (double)((uint64_t)(index % SUB_BUCKETS + SUB_BUCKETS) << shift);
+                return (lower + (double)((uint64_t)1 << shift) / 2.0) / 1e6;
+            }
+        };
+
+        /**
+         * @brief RAII sample of a stage: from its construction to its destruction.
+         */
+        class Scope
+        {
+        public:
+            explicit Scope(Stage &stage) : m_stage(stage), m_begin(Clock::now()) {}
+            ~Scope() { m_stage.add(m_begin, Clock::now()); }
+
+        private:
+            Stage &m_stage;
+            Clock::time_point m_begin;
+        };
+
+        /**
+         * @brief Add a stage, stages are reported in the order they were added. Call before the run starts.
+         */
+        Stage &stage(const std::string &name, size_t workers = 1)
+        {
+            m_stages.push_back(std::unique_ptr<Stage>(new Stage(name, workers)));
+            return *m_stages.back();
+        }
+
+        /**
+         * @brief Print the FPS of the run (frames over wall_time) and the latencies of every stage.
+         */
+        void print(std::ostream &out, size_t frames, Clock::duration wall_time) const
+        {
+            double seconds = std::chrono::duration<double>(wall_time).count();
+            out << "-I- Frames: " << frames << ", FPS: " << std::fixed << std::setprecision(1)
+                << (seconds > 0 ? (double)frames / seconds : 0.0) << std::endl;
+            out << "-I- " << std::left << std::setw(24) << "Stage (ms)" << std::right << std::setw(8) << "count"
+                << std::setw(9) << "mean" << std::setw(9) << "p50" << std::setw(9) << "p99" << std::setw(9) << "max" << std::endl;
+            out << std::setprecision(2);
+            for (auto &stage : m_stages)
+            {
+                out << "-I- " << std::left << std::setw(24) << stage->name() << std::right << std::setw(8) << stage->count()
+                    << std::setw(9) << stage->mean_ms() << std::setw(9) << stage->percentile_ms(50.0)
+                    << std::setw(9) << stage->percentile_ms(99.0) << std::setw(9) << stage->max_ms() << std::endl;
+            }
+            out << std::defaultfloat << std::setprecision(6);
+        }
+
+        /**
+         * @brief Print the share of wall_time every stage was busy, its samples over wall_time times its workers.
+         *        Meaningful for stages whose samples are the busy time of their threads (not waits or latencies
+         *        across stages). The busiest stage is the one limiting the throughput of the pipeline.
+         */
+        void print_utilization(std::ostream &out, Clock::duration wall_time) const
+        {
+            double wall_ms = std::chrono::duration<double, std::milli>(wall_time).count();
+            out << "-I- " << std::left << std::setw(24) << "Stage utilization" << std::right << std::setw(8) << "workers"
+                << std::setw(9) << "busy %" << std::endl;
+            out << std::fixed << std::setprecision(1);
+            const Stage *busiest = nullptr;
+            double busiest_share = -1.0;
+            for (auto &stage : m_stages)
+            {
+                double share = wall_ms > 0 ? 100.0 * stage->total_ms() / (wall_ms * (double)stage->workers()) : 0.0;
+                out << "-I- " << std::left << std::setw(24) << stage->name() << std::right << std::setw(8) << stage->workers()
+                    << std::setw(9) << share << std::endl;
+                if (share > busiest_share)
+                {
+                    busiest_share = share;
+                    busiest = stage.get();
+                }
+            }
+            if (busiest != nullptr)
+                out << "-I- Busiest stage: " << busiest->name() << std::endl;
+            out << std::defaultfloat << std::setprecision(6);
+        }
+
+    private:
+        std::vector<std::unique_ptr<Stage>> m_stages;
+    };
+
+    /**
+     * @brief Latency of frames across threads: from begin() on one thread to the last of `parties` end() calls,
+     *        e.g. from the write of a frame to the read of its last output.
+     *
+     * The frames in progress are kept in a ring indexed by frame % window, so the window must be larger than
+     * the frames between begin() and the last end(). begin() of a frame is called before any of its end().
+     */
+    class LatencyWindow
+    {
+    public:
+        LatencyWindow(StageStats::Stage &stage, size_t window, size_t parties)
+            : m_stage(stage), m_slots(window != 0 ? window : 1), m_parties(parties != 0 ? parties : 1)
+        {
+        }
+
+        void begin(size_t frame, StageStats::Clock::time_point time)
+        {
+            Slot &slot = m_slots[frame % m_slots.size()];
+            slot.begin = time;
+            slot.end.store(StageStats::Clock::time_point::min().time_since_epoch().count(), std::memory_order_relaxed);
+            slot.pending.store(m_parties, std::memory_order_relaxed);
+            slot.frame.store(frame, std::memory_order_release);
+        }
+
+        /**
+         * @brief The frame is done for one party, the last one adds its latency to the stage.
+         *        Frames whose slot was reused meanwhile are dropped.
+         */
+        void end(size_t frame, StageStats::Clock::time_point time)
+        {
+            Slot &slot = m_slots[frame % m_slots.size()];
+            if (slot.frame.load(std::memory_order_acquire) != frame)
+                return;
+            StageStats::Clock::rep ticks = time.time_since_epoch().count();
+            StageStats::Clock::rep end = slot.end.load(std::memory_order_relaxed);
+            while (ticks > end && !slot.end.compare_exchange_weak(end, ticks, std::memory_order_relaxed))
+            {
+            }
+            if (slot.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                StageStats::Clock::time_point last(StageStats::Clock::duration(slot.end.load(std::memory_order_relaxed)));
+                m_stage.add(slot.begin, last);
+            }
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<size_t> frame{(size_t)-1};
+            StageStats::Clock::time_point begin;
+            std::atomic<StageStats::Clock::rep> end{0};
+            std::atomic<size_t> pending{0};
+        };
+
+        StageStats::Stage &m_stage;
+        std::vector<Slot> m_slots;
+        size_t m_parties;
+    };
+}
@@ -0,0 +1,232 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file tensor_view.hpp
+ * @brief Typed, zero-copy view over the buffer of an output tensor.
+ *
+ * The examples each have their own HailoTensor (hailo_tensors.hpp), so the views are made from any tensor type
+ * with the data(), height(), width(), features(), name() and vstream_info() of HailoTensor.
+ **/
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <stdexcept>
+#include <string>
+
+#include "hailo/hailort.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define TENSOR_VIEW_NEON
+#endif
+
+namespace common
+{
+    /**
+     * @brief A contiguous run of tensor values (a row or the channels of a cell).
+     */
+    template <typename T>
+    struct TensorSpan
+    {
+        const T *ptr;
+        size_t count;
+
+        const T *data() const { return ptr; }
+        size_t size() const { return count; }
+        const T *begin() const { return ptr; }
+        const T *end() const { return ptr + count; }
+        const T &operator[](size_t index) const { return ptr[index]; }
+    };
+
+    /**
+     * @brief Dequantize a run of values, (q - zp) * scale - same arithmetic as HailoTensor::fix_scale.
+     */
+    inline void dequantize_span(const uint8_t *src, size_t count, float qp_scale, float qp_zp, float *dst)
+    {
+        size_t i = 0;
+#if defined(__AVX2__)
+        const __m256 vscale = _mm256_set1_ps(qp_scale);
+        const __m256 vzp = _mm256_set1_ps(qp_zp);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i q = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + i)));
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(q), vzp), vscale));
+        }
+#elif defined(TENSOR_VIEW_NEON)
+        const float32x4_t vscale = vdupq_n_f32(qp_scale);
+        const float32x4_t vzp = vdupq_n_f32(qp_zp);
+        for (; i + 8 <= count; i += 8)
+        {
+            uint16x8_t q = vmovl_u8(vld1_u8(src + i));
+            float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(q)));
+            float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(q)));
+            vst1q_f32(dst + i, vmulq_f32(vsubq_f32(lo, vzp), vscale));
+            vst1q_f32(dst + i + 4, vmulq_f32(vsubq_f32(hi, vzp), vscale));
+        }
+#endif
+        for (; i < count; i++)
+        {
+            dst[i] = (float(src[i]) - qp_zp) * qp_scale;
+        }
+    }
+
+    inline void dequantize_span(const uint16_t *src, size_t count, float qp_scale, float qp_zp, float *dst)
+    {
+        size_t i = 0;
+#if defined(__AVX2__)
+        const __m256 vscale = _mm256_set1_ps(qp_scale);
+        const __m256 vzp = _mm256_set1_ps(qp_zp);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i q = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)));
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(q), vzp), vscale));
+        }
+#elif defined(TENSOR_VIEW_NEON)
+        const float32x4_t vscale = vdupq_n_f32(qp_scale);
+        const float32x4_t vzp = vdupq_n_f32(qp_zp);
+        for (; i + 4 <= count; i += 4)
+        {
+            float32x4_t v = vcvtq_f32_u32(vmovl_u16(vld1_u16(src + i)));
+            vst1q_f32(dst + i, vmulq_f32(vsubq_f32(v, vzp), vscale));
+        }
+#endif
+        for (; i < count; i++)
+        {
+            dst[i] = (float(src[i]) - qp_zp) * qp_scale;
+        }
+    }
+
+    /**
+     * @brief Zero-copy view over an HWC tensor buffer with a compile-time element type.
+     *
+     * The strides and quantization params are read once at construction, so element access is
+     * a multiply-add with no data type branching. Use visit_tensor() to pick T from the
+     * tensor's vstream info.
+     *
+     * @tparam T The quantized element type (uint8_t / uint16_t).
+     */
+    template <typename T>
+    class TensorView
+    {
+    public:
+        TensorView(const T *data, uint height, uint width, uint features, float qp_scale, float qp_zp)
+            : m_data(data), m_height(height), m_width(width), m_features(features),
+              m_row_stride((size_t)width * features), m_qp_scale(qp_scale), m_qp_zp(qp_zp){};
+
+        const T *data() const { return m_data; }
+        uint height() const { return m_height; }
+        uint width() const { return m_width; }
+        uint features() const { return m_features; }
+        size_t size() const { return m_row_stride * m_height; }
+        size_t row_stride() const { return m_row_stride; }
+        size_t col_stride() const { return m_features; }
+        float qp_scale() const { return m_qp_scale; }
+        float qp_zp() const { return m_qp_zp; }
+
+        /**
+         * @brief Get the quantized value of a cell channel.
+         */
+        T at(uint row, uint col, uint channel) const
+        {
+            return m_data[m_row_stride * row + (size_t)m_features * col + channel];
+        }
+
+        /**
+         * @brief Get the dequantized value of a cell channel.
+         */
+        float at_float(uint row, uint col, uint channel) const
+        {
+            return dequantize(at(row, col, channel));
+        }
+
+        float dequantize(T value) const
+        {
+            return (float(value) - m_qp_zp) * m_qp_scale;
+        }
+
+        /**
+         * @brief Get all the values of a row (width * features).
+         */
+        TensorSpan<T> row(uint row) const
+        {
+            return TensorSpan<T>{m_data + m_row_stride * row, m_row_stride};
+        }
+
+        /**
+         * @brief Get the channels of a single cell.
+         */
+        TensorSpan<T> channels(uint row, uint col) const
+        {
+            return TensorSpan<T>{m_data + m_row_stride * row + (size_t)m_features * col, m_features};
+        }
+
+        /**
+         * @brief Dequantize a span of this tensor into a float buffer.
+         *
+         * @param span A span of this tensor.
+         * @param[out] dst Buffer of at least span.size() floats.
+         */
+        void dequantize(const TensorSpan<T> &span, float *dst) const
+        {
+            dequantize_span(span.data(), span.size(), m_qp_scale, m_qp_zp, dst);
+        }
+
+        /**
+         * @brief Dequantize the whole tensor into a float buffer.
+         *
+         * @param[out] dst Buffer of at least size() floats.
+         */
+        void dequantize(float *dst) const
+        {
+            dequantize_span(m_data, size(), m_qp_scale, m_qp_zp, dst);
+        }
+
+    private:
+        const T *m_data;
+        uint m_height;
+        uint m_width;
+        uint m_features;
+        size_t m_row_stride;
+        float m_qp_scale;
+        float m_qp_zp;
+    };
+
+    /**
+     * @brief View the buffer of a tensor as values of type T, with the shape and quantization of its vstream info.
+     *
+     * @param tensor A HailoTensor.
+     */
+    template <typename T, typename Tensor>
+    TensorView<T> view_tensor(Tensor &tensor)
+    {
+        return TensorView<T>(reinterpret_cast<const T *>(tensor.data()), tensor.height(), tensor.width(), tensor.features(),
+                             tensor.vstream_info().quant_info.qp_scale, tensor.vstream_info().quant_info.qp_zp);
+    }
+
+    /**
+     * @brief Call func with a TensorView of the tensor's data type (TensorView<uint8_t> or TensorView<uint16_t>).
+     *        The type is dispatched once, the kernel in func is compiled per type.
+     *
+     * @param tensor The tensor to view, a HailoTensor.
+     * @param func Callable taking a TensorView of either type.
+     * @return The return value of func.
+     */
+    template <typename Tensor, typename Func>
+    auto visit_tensor(Tensor &tensor, Func &&func) -> decltype(func(view_tensor<uint8_t>(tensor)))
+    {
+        switch (tensor.vstream_info().format.type)
+        {
+        case HAILO_FORMAT_TYPE_UINT16:
+            return func(view_tensor<uint16_t>(tensor));
+        case HAILO_FORMAT_TYPE_FLOAT32:
+            throw std::invalid_argument("Output tensor " + tensor.name() + " is float32, a quantized tensor is expected");
+        default:
+            return func(view_tensor<uint8_t>(tensor));
+        }
+    }
+}
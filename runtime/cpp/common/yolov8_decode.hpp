@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file yolov8_decode.hpp
+ * @brief YOLOv8 box decoding straight from the quantized regression bins, with anchor centers built once per network shape.
+ **/
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "detection_record.hpp"
+#include "tensor_view.hpp"
+#include "yolov8_geometry.hpp"
+
+namespace common
+{
+    /**
+     * @brief Anchor centers of one output level.
+     */
+    struct Yolov8Level
+    {
+        uint stride;
+        uint width;
+        uint height;
+        std::vector<float> centers; // (x, y) of every cell in network input pixels, row major
+    };
+
+    /**
+     * @brief Anchor centers of all the output levels of a network shape.
+     */
+    class Yolov8AnchorTable
+    {
+    public:
+        Yolov8AnchorTable(uint network_width, uint network_height, const std::vector<int> &strides)
+            : m_network_width(network_width), m_network_height(network_height)
+        {
+            for (int stride : strides)
+            {
+                if (stride <= 0)
+                    throw std::invalid_argument("YOLOv8 strides must be positive");
+                Yolov8Level level;
+                level.stride = (uint)stride;
+                level.width = network_width / level.stride;
+                level.height = network_height / level.stride;
+                level.centers.resize((size_t)level.width * level.height * 2);
+                float *center = level.centers.data();
+                for (uint row = 0; row < level.height; row++)
+                {
+                    for (uint col = 0; col < level.width; col++)
+                    {
+                        *center++ = ((float)col + 0.5f) * (float)level.stride;
+                        *center++ = ((float)row + 0.5f) * (float)level.stride;
+                    }
+                }
+                m_levels.push_back(std::move(level));
+            }
+        }
+
+        uint network_width() const { return m_network_width; }
+        uint network_height() const { return m_network_height; }
+        size_t size() const { return m_levels.size(); }
+        const Yolov8Level &level(size_t index) const { return m_levels[index]; }
+
+    private:
+        uint m_network_width;
+        uint m_network_height;
+        std::vector<Yolov8Level> m_levels;
+    };
+
+    /**
+     * @brief Distribution focal loss decode of one proposal, fused with its dequantization.
+     *
+     * Each of the 4 sides is a softmax over num_bins bins, the distance is its expected bin index.
+     * The softmax of dequantized values only depends on the quantized differences to the side maximum,
+     * softmax_k = exp((q_k - q_max) * qp_scale) / sum, so exp_table[d] = exp(-d * qp_scale) replaces
+     * both the dequantization and the exp.
+     *
+     * @param bins The 4 * num_bins quantized bins of the proposal, side by side.
+     * @param num_bins Number of bins of a side (regression_length + 1).
+     * @param exp_table Table of exp(-d * qp_scale) for every d in [0, max(T)].
+     * @param[out] distances Distances of the left, top, right and bottom sides, in strides.
+     */
+    template <typename T>
+    inline void dfl_distances(const T *bins, uint num_bins, const float *exp_table, float distances[4])
+    {
+        for (uint side = 0; side < 4; side++)
+        {
+            const T *side_bins = bins + (size_t)side * num_bins;
+            T max = side_bins[0];
+            for (uint k = 1; k < num_bins; k++)
+            {
+                if (side_bins[k] > max)
+                    max = side_bins[k];
+            }
+            float sum = 0.0f;
+            float weighted_sum = 0.0f;
+            for (uint k = 0; k < num_bins; k++)
+            {
+                float probability = exp_table[max - side_bins[k]];
+                sum += probability;
+                weighted_sum += probability * (float)k;
+            }
+            distances[side] = weighted_sum / sum;
+        }
+    }
+
+    /**
+     * @brief YOLOv8 box decoder of a network shape.
+     *
+     * The anchor centers are built once, and the DFL exp tables once per level and quantization scale,
+     * so decoding a proposal is a few table lookups with no allocation. Keep one decoder per thread.
+     */
+    class Yolov8BoxDecoder
+    {
+    public:
+        Yolov8BoxDecoder(uint network_width, uint network_height, const std::vector<int> &strides, uint regression_length)
+            : m_anchors(network_width, network_height, strides), m_num_bins(regression_length + 1), m_exp_tables(strides.size()){};
+
+        /**
+         * @brief Decoder of a model geometry, the DFL tables of its boxes outputs are built here rather than on the first frame.
+         */
+        explicit Yolov8BoxDecoder(const Yolov8Geometry &geometry)
+            : Yolov8BoxDecoder(geometry.network_width, geometry.network_height, geometry.strides(), geometry.regression_length)
+        {
+            for (size_t level = 0; level < geometry.levels.size(); level++)
+            {
+                if (geometry.levels[level].boxes_type == HAILO_FORMAT_TYPE_UINT16)
+                    exp_table<uint16_t>(level, geometry.levels[level].boxes_qp_scale);
+                else
+                    exp_table<uint8_t>(level, geometry.levels[level].boxes_qp_scale);
+            }
+        }
+
+        const Yolov8AnchorTable &anchors() const { return m_anchors; }
+        uint num_bins() const { return m_num_bins; }
+
+        /**
+         * @brief Decode the box of a proposal and append its record.
+         *
+         * @param boxes View of the boxes output of the level, 4 * num_bins channels per cell.
+         * @param level Index of the level, in the order of the strides.
+         * @param cell Index of the proposal cell, row * width + col.
+         * @param class_index Index of the best class, the label is class_index + 1.
+         * @param confidence Score of the best class.
+         * @param[out] records The decoded record is appended here.
+         */
+        template <typename T>
+        void decode(const TensorView<T> &boxes, size_t level, uint cell, int class_index, float confidence, std::vector<DetectionRecord> &records)
+        {
+            if (boxes.features() != 4 * m_num_bins)
+                throw std::invalid_argument("YOLOv8 boxes output has " + std::to_string(boxes.features()) + " channels, " +
+                                            std::to_string(4 * m_num_bins) + " expected");
+            const Yolov8Level &anchors = m_anchors.level(level);
+            if (boxes.width() != anchors.width || boxes.height() != anchors.height)
+                throw std::invalid_argument("YOLOv8 boxes output shape doesn't match the network input size and strides");
+            const uint row = cell / boxes.width();
+            const uint col = cell % boxes.width();
+
+            float distances[4];
+            dfl_distances(boxes.channels(row, col).data(), m_num_bins, exp_table<T>(level, boxes.qp_scale()), distances);
+
+            const float *center = anchors.centers.data() + ((size_t)row * anchors.width + col) * 2;
+            const float stride = (float)anchors.stride;
+            const float xmin = center[0] - distances[0] * stride;
+            const float ymin = center[1] - distances[1] * stride;
+            const float xmax = center[0] + distances[2] * stride;
+            const float ymax = center[1] + distances[3] * stride;
+            const float network_width = (float)m_anchors.network_width();
+            const float network_height = (float)m_anchors.network_height();
+            records.push_back(DetectionRecord{xmin / network_width, ymin / network_height,
+                                              (xmax - xmin) / network_width, (ymax - ymin) / network_height,
+                                              confidence, class_index, class_index + 1});
+        }
+
+    private:
+        struct ExpTable
+        {
+            float qp_scale = 0.0f;
+            size_t type_size = 0;
+            std::vector<float> table;
+        };
+
+        Yolov8AnchorTable m_anchors;
+        uint m_num_bins;
+        std::vector<ExpTable> m_exp_tables; // per level, rebuilt only if the quantization scale changes
+
+        template <typename T>
+        const float *exp_table(size_t level, float qp_scale)
+        {
+            ExpTable &exp_table = m_exp_tables[level];
+            if (exp_table.type_size != sizeof(T) || exp_table.qp_scale != qp_scale)
+            {
+                exp_table.table.resize((size_t)std::numeric_limits<T>::max() + 1);
+                for (size_t d = 0; d < exp_table.table.size(); d++)
+                    exp_table.table[d] = std::exp(-((float)d * qp_scale));
+                exp_table.qp_scale = qp_scale;
+                exp_table.type_size = sizeof(T);
+            }
+            return exp_table.table.data();
+        }
+    };
+}
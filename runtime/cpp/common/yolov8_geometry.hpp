@@ -0,0 +1,162 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file yolov8_geometry.hpp
+ * @brief YOLOv8 model geometry (input size, classes, regression bins, strides) read from the vstream infos of the network.
+ **/
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "hailo/hailort.h"
+
+namespace common
+{
+    /**
+     * @brief The boxes and scores outputs of one stride.
+     */
+    struct Yolov8OutputLevel
+    {
+        uint stride;
+        uint width;
+        uint height;
+        std::string boxes_name;
+        std::string scores_name;
+        hailo_format_type_t boxes_type;
+        float boxes_qp_scale;
+    };
+
+    /**
+     * @brief Geometry of a YOLOv8 model, everything the decoder needs to size its buffers.
+     */
+    struct Yolov8Geometry
+    {
+        uint network_width;
+        uint network_height;
+        uint num_classes;
+        uint regression_length;               // bins of a box side minus one
+        std::vector<Yolov8OutputLevel> levels; // by increasing stride
+
+        std::vector<int> strides() const
+        {
+            std::vector<int> strides;
+            for (const auto &level : levels)
+                strides.push_back((int)level.stride);
+            return strides;
+        }
+
+        /**
+         * @brief Number of proposals (cells) of all the levels.
+         */
+        size_t max_proposals() const
+        {
+            size_t proposals = 0;
+            for (const auto &level : levels)
+                proposals += (size_t)level.width * level.height;
+            return proposals;
+        }
+
+        /**
+         * @brief Infer the geometry from the vstream infos of the configured network group.
+         *
+         * Each stride has two outputs of the same spatial shape: the scores, one channel per class,
+         * and the boxes, 4 * (regression_length + 1) channels. The boxes are the output whose channels
+         * are a multiple of 4; when both are (e.g. 16 or 64 classes), the one with the default 64 channels,
+         * otherwise the first in the vstream order.
+         *
+         * @param input_info The input vstream info, gives the network input size.
+         * @param output_infos The output vstream infos, in any order.
+         * @return Yolov8Geometry
+         */
+        static Yolov8Geometry from_vstream_infos(const hailo_vstream_info_t &input_info, const std::vector<hailo_vstream_info_t> &output_infos)
+        {
+            static const uint DEFAULT_BOX_CHANNELS = 64;
+
+            Yolov8Geometry geometry;
+            geometry.network_width = input_info.shape.width;
+            geometry.network_height = input_info.shape.height;
+            geometry.num_classes = 0;
+            geometry.regression_length = 0;
+            if (geometry.network_width == 0 || geometry.network_height == 0)
+                throw std::invalid_argument("YOLOv8 input vstream " + std::string(input_info.name) + " has an empty shape");
+            if (output_infos.empty() || output_infos.size() % 2 != 0)
+                throw std::invalid_argument("YOLOv8 expects a boxes and a scores output per stride, got " +
+                                            std::to_string(output_infos.size()) + " outputs");
+
+            std::vector<bool> paired(output_infos.size(), false);
+            for (size_t i = 0; i < output_infos.size(); i++)
+            {
+                if (paired[i])
+                    continue;
+                const hailo_vstream_info_t &first = output_infos[i];
+                if (first.format.order == HAILO_FORMAT_ORDER_HAILO_NMS)
+                    throw std::invalid_argument("YOLOv8 output " + std::string(first.name) + " is an on-chip NMS output, raw outputs are expected");
+                size_t j = i + 1;
+                while (j < output_infos.size() &&
+                       (paired[j] || output_infos[j].shape.width != first.shape.width || output_infos[j].shape.height != first.shape.height))
+                    j++;
+                if (j == output_infos.size())
+                    throw std::invalid_argument("YOLOv8 output " + std::string(first.name) + " has no output of the same shape to pair with");
+                paired[i] = paired[j] = true;
+                const hailo_vstream_info_t &second = output_infos[j];
+
+                bool first_is_boxes = is_boxes_candidate(first);
+                bool second_is_boxes = is_boxes_candidate(second);
+                if (first_is_boxes && second_is_boxes && first.shape.features != second.shape.features)
+                    first_is_boxes = (first.shape.features == DEFAULT_BOX_CHANNELS || second.shape.features != DEFAULT_BOX_CHANNELS);
+                else if (!first_is_boxes && !second_is_boxes)
+                    throw std::invalid_argument("YOLOv8 outputs " + std::string(first.name) + " and " + std::string(second.name) +
+                                                " have no boxes output (4 * bins channels)");
+                const hailo_vstream_info_t &boxes = first_is_boxes ? first : second;
+                const hailo_vstream_info_t &scores = first_is_boxes ? second : first;
+
+                Yolov8OutputLevel level;
+                level.width = boxes.shape.width;
+                level.height = boxes.shape.height;
+                if (level.width == 0 || level.height == 0 || geometry.network_width % level.width != 0 ||
+                    geometry.network_width / level.width != geometry.network_height / level.height)
+                    throw std::invalid_argument("YOLOv8 output " + std::string(boxes.name) + " shape doesn't divide the input size by an integer stride");
+                level.stride = geometry.network_width / level.width;
+                level.boxes_name = boxes.name;
+                level.scores_name = scores.name;
+                level.boxes_type = boxes.format.type;
+                level.boxes_qp_scale = boxes.quant_info.qp_scale;
+
+                const uint num_classes = scores.shape.features;
+                const uint regression_length = boxes.shape.features / 4 - 1;
+                if (geometry.levels.empty())
+                {
+                    geometry.num_classes = num_classes;
+                    geometry.regression_length = regression_length;
+                }
+                else if (num_classes != geometry.num_classes || regression_length != geometry.regression_length)
+                    throw std::invalid_argument("YOLOv8 outputs " + std::string(boxes.name) + " and " + std::string(scores.name) +
+                                                " don't have the classes and bins of the other strides");
+                geometry.levels.push_back(level);
+            }
+
+            std::sort(geometry.levels.begin(), geometry.levels.end(), [](const Yolov8OutputLevel &a, const Yolov8OutputLevel &b)
+                      { return a.stride < b.stride; });
+            for (size_t i = 1; i < geometry.levels.size(); i++)
+            {
+                if (geometry.levels[i].stride == geometry.levels[i - 1].stride)
+                    throw std::invalid_argument("YOLOv8 has two output pairs of stride " + std::to_string(geometry.levels[i].stride));
+            }
+            return geometry;
+        }
+
+    private:
+        static bool is_boxes_candidate(const hailo_vstream_info_t &info)
+        {
+            // At least 2 bins per side
+            return info.shape.features >= 8 && info.shape.features % 4 == 0;
+        }
+    };
+}
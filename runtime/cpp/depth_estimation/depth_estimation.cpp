@@ -16,6 +16,7 @@
  **/
 
 #include "hailo/hailort.hpp"
+#include "quant_lut.hpp"
 #include <opencv2/opencv.hpp>
 
 #include <chrono>
@@ -108,16 +109,19 @@ template <typename T> hailo_status write_all(std::vector<InputVStream> &input, s
     return HAILO_SUCCESS;
 }
 
-template <typename T> cv::Mat scdepth_post_process(std::vector<T>& logits, int height, int width) {
+// The whole post-process up to the normalization is elementwise: depth = 1 / (sigmoid(x) * 10 + 0.009)
+float scdepth_value(float x) {
+    float sigmoid = 1.0f / (1.0f + expf(-x));
+    return (float)(1.0 / (sigmoid * 10.0 + 0.009));
+}
+
+template <typename T> cv::Mat scdepth_post_process(std::vector<T>& logits, const common::DequantLut<T> &depth_lut, int height, int width) {
     double min;
     double max;
     
-    cv::Mat output(height, width, CV_32F, cv::Scalar(0));
-    cv::Mat input(height, width, CV_32F, logits.data());
-
-    cv::exp(-input, output);
-    output = 1 / (1 + output);
-    output = 1 / (output * 10 + 0.009);
+    // one table lookup per pixel instead of dequantize + exp + two divisions
+    cv::Mat output(height, width, CV_32F);
+    depth_lut.apply(logits.data(), (size_t)height * width, output.ptr<float>());
     
     cv::minMaxIdx(output, &min, &max);
     output.convertTo(output, CV_8U, 255 / (max-min), -min);
@@ -127,17 +131,20 @@ template <typename T> cv::Mat scdepth_post_process(std::vector<T>& logits, int h
 }
 
 template <typename T> hailo_status read_all(std::vector<OutputVStream> &output, std::string &video_path, int height, int width, int frame_count) {
-    std::vector<T> data(output[0].get_frame_size());
+    std::vector<T> data(output[0].get_frame_size() / sizeof(T));
+    auto quant_info = output[0].get_info().quant_info;
+    // built once for the output vstream, covers every possible quantized value
+    common::DequantLut<T> depth_lut(quant_info.qp_scale, quant_info.qp_zp, scdepth_value);
     std::vector<cv::String> file_names;
     std::cout << "-I- Started read thread " << video_path << std::endl;
     cv::VideoWriter video("./output_video.mp4",cv::VideoWriter::fourcc('m','p','4','v'),30, cv::Size(width,height));
 
     for (int i = 0; i < frame_count; i++) {
-        auto status = output[0].read(MemoryView(data.data(), data.size()));
+        auto status = output[0].read(MemoryView(data.data(), data.size() * sizeof(T)));
         if (HAILO_SUCCESS != status){
             return status;
         }
-        auto postprocessed_output = scdepth_post_process<T>(data, height, width);
+        auto postprocessed_output = scdepth_post_process<T>(data, depth_lut, height, width);
         video.write(postprocessed_output);
     }
     video.release();
@@ -185,8 +192,12 @@ template <typename IN_T, typename OUT_T> hailo_status infer(std::vector<InputVSt
     
     int output_height = outputs.front().get_info().shape.height;
     int output_width = outputs.front().get_info().shape.width;
-    std::thread output_thread([&outputs, &video_path, &output_height, &output_width, &output_status, &frame_count]() { 
-                            output_status = read_all<OUT_T>(outputs, video_path, output_height, output_width, frame_count); 
+    bool output_uint16 = (outputs.front().get_info().format.type == HAILO_FORMAT_TYPE_UINT16);
+    std::thread output_thread([&outputs, &video_path, &output_height, &output_width, &output_status, &frame_count, output_uint16]() { 
+                            if (output_uint16)
+                                output_status = read_all<uint16_t>(outputs, video_path, output_height, output_width, frame_count);
+                            else
+                                output_status = read_all<OUT_T>(outputs, video_path, output_height, output_width, frame_count); 
                             });
 
 
@@ -228,7 +239,8 @@ int main(int argc, char** argv) {
         return input_vstream_params.status();
     }
 
-    auto output_vstream_params = network_group.value()->make_output_vstream_params(false, HAILO_FORMAT_TYPE_FLOAT32, HAILO_DEFAULT_VSTREAM_TIMEOUT_MS, HAILO_DEFAULT_VSTREAM_QUEUE_SIZE);
+    // keep the output quantized, the post-process dequantizes through a lookup table
+    auto output_vstream_params = network_group.value()->make_output_vstream_params(true, HAILO_FORMAT_TYPE_AUTO, HAILO_DEFAULT_VSTREAM_TIMEOUT_MS, HAILO_DEFAULT_VSTREAM_QUEUE_SIZE);
     if (!output_vstream_params){
         std::cerr << "-E- Failed make_output_vstream_params " << output_vstream_params.status() << std::endl;
         return output_vstream_params.status();
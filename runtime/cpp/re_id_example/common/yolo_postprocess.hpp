@@ -8,6 +8,8 @@
 #include "hailo_common.hpp"
 #include "yolo_output.hpp"
 
+#include <memory>
+
 __BEGIN_DECLS
 
 class YoloParams
@@ -22,7 +24,7 @@ public:
     std::string output_activation; // can be "none" or "sigmoid"
     int label_offset;             
     YoloParams() : iou_threshold(0.45f), detection_threshold(0.35f), output_activation("none"), label_offset(1) {}
-    void check_params_logic(uint num_classes_tensors);
+    void check_params_logic(uint num_classes_tensors) const;
 };
 YoloParams *init(std::string config_path);
 void free_resources(void *params_void_ptr);
@@ -41,4 +43,24 @@ void yolov5_personface(HailoROIPtr roi, void *params_void_ptr);
 void yolov5_adas(HailoROIPtr roi, void *params_void_ptr);
 
 __END_DECLS
+
+using YoloParamsPtr = std::shared_ptr<const YoloParams>;
+
+/**
+ * @brief Get the cached params of a config file, see common::ConfigRegistry.
+ *
+ * The config is loaded and validated once per process (through init()), and reloaded only
+ * when the file changes. Safe to call on every frame.
+ *
+ * @param config_path Path to the JSON config file.
+ * @return YoloParamsPtr shared immutable params.
+ */
+YoloParamsPtr get_yolo_params(const std::string &config_path);
+
+/**
+ * @brief Person and face detection of yolov5_personface() on params that are only read,
+ *        e.g. the shared ones of get_yolo_params().
+ */
+void yolov5_personface(HailoROIPtr roi, const YoloParams *params);
+
 #endif
\ No newline at end of file
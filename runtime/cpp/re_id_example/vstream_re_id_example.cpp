@@ -130,10 +130,9 @@ void print_inference_statistics(std::size_t num_of_frames, double elapsed_time)
  * @return hailo_status
  */
 hailo_status post_process(HailoROIPtr& roi, cv::Mat &image) {
-    YoloParams* init_params;
-    init_params = init(CONFIG_FILE);
- 
-    yolov5_personface(roi, init_params);
+    YoloParamsPtr init_params = get_yolo_params(CONFIG_FILE);
+
+    yolov5_personface(roi, init_params.get());
 
     // call the filter for the person & face bbox drawings
     filter(roi, image);
@@ -12,6 +12,7 @@
 #include "common/nms.hpp"
 #include "common/labels/coco_eighty.hpp"
 #include "common/json_config.hpp"
+#include "config_registry.hpp"
 
 #include "document.h"
 #include "stringbuffer.h"
@@ -113,8 +114,11 @@ void YoloPost::extract_boxes(std::shared_ptr<YoloOutputLayer> layer,
 class Yolov5 : public YoloPost
 {
 public:
-    Yolov5(HailoROIPtr roi, YoloParams *params)
-        : YoloPost(params->labels, params->detection_threshold, params->iou_threshold, params->max_boxes), _tensors(roi->get_tensors())
+    Yolov5(HailoROIPtr roi, const YoloParams *params)
+        : Yolov5(roi, params, params->detection_threshold){};
+
+    Yolov5(HailoROIPtr roi, const YoloParams *params, float detection_threshold)
+        : YoloPost(params->labels, detection_threshold, params->iou_threshold, params->max_boxes), _tensors(roi->get_tensors())
     {
         bool sigmoid = (params->output_activation == "sigmoid");
         yolov5_init(params->anchors_vec, sigmoid, params->label_offset);
@@ -165,7 +169,7 @@ protected:
 class Yolov3 : public YoloSplitted
 {
 public:
-    Yolov3(HailoROIPtr roi, YoloParams *params)
+    Yolov3(HailoROIPtr roi, const YoloParams *params)
         : YoloSplitted(roi, params->labels, params->anchors_vec, params->detection_threshold, params->iou_threshold, params->max_boxes)
     {
         if (roi->has_tensors())
@@ -191,7 +195,7 @@ public:
 class Yolov4 : public YoloSplitted
 {
 public:
-    Yolov4(HailoROIPtr roi, YoloParams *params)
+    Yolov4(HailoROIPtr roi, const YoloParams *params)
         : YoloSplitted(roi, params->labels, params->anchors_vec, params->detection_threshold, params->iou_threshold, params->max_boxes)
     {
         if (_roi->has_tensors())
@@ -218,7 +222,7 @@ public:
 class TinyYolov4LicensePlates : public YoloSplitted
 {
 public:
-    TinyYolov4LicensePlates(HailoROIPtr roi, YoloParams *params)
+    TinyYolov4LicensePlates(HailoROIPtr roi, const YoloParams *params)
         : YoloSplitted(roi, params->labels, params->anchors_vec, params->detection_threshold, params->iou_threshold, params->max_boxes)
     {
         if (_roi->has_tensors())
@@ -242,7 +246,7 @@ public:
 class YoloX : public YoloPost
 {
 public:
-    YoloX(HailoROIPtr roi, YoloParams *params)
+    YoloX(HailoROIPtr roi, const YoloParams *params)
         : YoloPost(params->labels, params->detection_threshold, params->iou_threshold, params->max_boxes), _roi(roi)
     {
         if (_roi->has_tensors())
@@ -267,7 +271,7 @@ protected:
 
 void yolov5_no_persons(HailoROIPtr roi, void *params_void_ptr)
 {
-    YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
+    const YoloParams *params = reinterpret_cast<const YoloParams *>(params_void_ptr);
     auto post = Yolov5(roi, params);
     auto detections = post.decode();
     int person_class_id = 1;
@@ -280,7 +284,11 @@ void yolov5_no_persons(HailoROIPtr roi, void *params_void_ptr)
 
 void yolov5_personface(HailoROIPtr roi, void *params_void_ptr)
 {
-    YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
+    yolov5_personface(roi, reinterpret_cast<const YoloParams *>(params_void_ptr));
+}
+
+void yolov5_personface(HailoROIPtr roi, const YoloParams *params)
+{
     HailoBBox roi_bbox = hailo_common::create_flattened_bbox(roi->get_bbox(), roi->get_scaling_bbox());
 
     // Yolov5 Postprocess for faces
@@ -311,8 +319,7 @@ void yolov5_personface(HailoROIPtr roi, void *params_void_ptr)
     // Yolov5 Postprocess for persons
     float person_detection_thr = 0.5f;
     auto person_class_id = 1;
-    params->detection_threshold = person_detection_thr;
-    auto persons_post = Yolov5(roi, params);
+    auto persons_post = Yolov5(roi, params, person_detection_thr);
     auto person_detections = persons_post.decode();
  //   std::cout << "person detections size is: " << person_detections.size() << std::endl;
     
@@ -346,7 +353,7 @@ void yolov5_personface(HailoROIPtr roi, void *params_void_ptr)
 
 void yolov5_vehicles_only(HailoROIPtr roi, void *params_void_ptr)
 {
-    YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
+    const YoloParams *params = reinterpret_cast<const YoloParams *>(params_void_ptr);
     auto post = Yolov5(roi, params);
     auto detections = post.decode();
     hailo_common::add_detections(roi, detections);
@@ -354,7 +361,7 @@ void yolov5_vehicles_only(HailoROIPtr roi, void *params_void_ptr)
 
 void yolov5(HailoROIPtr roi, void *params_void_ptr)
 {
-    YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
+    const YoloParams *params = reinterpret_cast<const YoloParams *>(params_void_ptr);
     auto post = Yolov5(roi, params);
     auto detections = post.decode();
     hailo_common::add_detections(roi, detections);
@@ -362,7 +369,7 @@ void yolov5(HailoROIPtr roi, void *params_void_ptr)
 
 void yolov3(HailoROIPtr roi, void *params_void_ptr)
 {
-    YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
+    const YoloParams *params = reinterpret_cast<const YoloParams *>(params_void_ptr);
     auto post = Yolov3(roi, params);
     auto detections = post.decode();
     hailo_common::add_detections(roi, detections);
@@ -370,7 +377,7 @@ void yolov3(HailoROIPtr roi, void *params_void_ptr)
 
 void yolov4(HailoROIPtr roi, void *params_void_ptr)
 {
-    YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
+    const YoloParams *params = reinterpret_cast<const YoloParams *>(params_void_ptr);
     auto post = Yolov4(roi, params);
     auto detections = post.decode();
     hailo_common::add_detections(roi, detections);
@@ -378,7 +385,7 @@ void yolov4(HailoROIPtr roi, void *params_void_ptr)
 
 void tiny_yolov4_license_plates(HailoROIPtr roi, void *params_void_ptr)
 {
-    YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
+    const YoloParams *params = reinterpret_cast<const YoloParams *>(params_void_ptr);
     auto post = TinyYolov4LicensePlates(roi, params);
     auto detections = post.decode();
     hailo_common::add_detections(roi, detections);
@@ -386,7 +393,7 @@ void tiny_yolov4_license_plates(HailoROIPtr roi, void *params_void_ptr)
 
 void yolox(HailoROIPtr roi, void *params_void_ptr)
 {
-    YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
+    const YoloParams *params = reinterpret_cast<const YoloParams *>(params_void_ptr);
     auto post = YoloX(roi, params);
     auto detections = post.decode();
     hailo_common::add_detections(roi, detections);
@@ -394,8 +401,7 @@ void yolox(HailoROIPtr roi, void *params_void_ptr)
 
 void filter(HailoROIPtr roi, void *params_void_ptr)
 {
-    YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
-    yolov5(roi, params);
+    yolov5(roi, params_void_ptr);
 }
 
 YoloParams *init(const std::string config_path)
@@ -514,7 +520,7 @@ YoloParams *init(const std::string config_path)
     return params;
 }
 
-void YoloParams::check_params_logic(uint num_classes_tensors)
+void YoloParams::check_params_logic(uint num_classes_tensors) const
 {
     if (labels.size() - 1 != num_classes_tensors)
     {
@@ -525,6 +531,13 @@ void YoloParams::check_params_logic(uint num_classes_tensors)
     }
 }
 
+YoloParamsPtr get_yolo_params(const std::string &config_path)
+{
+    static common::ConfigRegistry<YoloParams> registry([](const std::string &path, const std::string &)
+                                                       { return init(path); });
+    return registry.get(config_path, config_path);
+}
+
 void free_resources(void *params_void_ptr)
 {
     YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
@@ -1,5 +1,7 @@
 #include "hailo/hailort.hpp"
 #include "ssd_post_processing.hpp"
+#include "postprocess_pool.hpp"
+#include "frame_ring.hpp"
 
 #include <iostream>
 #include <chrono>
@@ -13,6 +15,9 @@
 #include <opencv2/imgcodecs.hpp>
 
 std::mutex m;
+common::PostProcessOptions pp_options;
+// Frames the capture can be ahead of the drawing, on top of the frames being post-processed
+constexpr size_t FRAME_RING_SLACK = 4;
 
 using namespace hailort;
 
@@ -53,7 +58,7 @@ std::string info_to_str(hailo_vstream_info_t vstream_info) {
 
 
 hailo_status post_processing_all(std::vector<std::shared_ptr<FeatureData>> &features, double frame_count, 
-                                std::chrono::duration<double>& postprocess_time, std::vector<cv::Mat>& frames, double org_height, double org_width, bool show)
+                                std::chrono::duration<double>& postprocess_time, common::FrameRing<cv::Mat>& frames, double org_height, double org_width, bool show)
 {
     auto status = HAILO_SUCCESS;   
 
@@ -66,45 +71,77 @@ hailo_status post_processing_all(std::vector<std::shared_ptr<FeatureData>> &feat
 
     std::cout << YELLOW << "\n-I- Starting postprocessing\n" << std::endl << RESET;
 
-    for (size_t idx_frame = 0; idx_frame < (size_t)frame_count; idx_frame++){
-        std::vector<std::pair<OutTensor,OutTensor>> tensors;
-        for(size_t i = 0; i < features.size(); i += 2){
-
-            OutTensor reg_tensor(features[i]->m_buffers.get_read_buffer().data(), 
-            features[i]->m_qp_zp, features[i]->m_qp_scale, 
-            features[i]->m_height, features[i]->m_width, features[i]->m_channels);
-
-            OutTensor cls_tensor(features[i+1]->m_buffers.get_read_buffer().data(), 
-            features[i+1]->m_qp_zp, features[i+1]->m_qp_scale, 
-            features[i+1]->m_height, features[i+1]->m_width, features[i+1]->m_channels);
+    // Build the dequantization tables once: plain dequantization for the box regression, dequantization + sigmoid for the class scores
+    std::vector<common::DequantLutPtr<uint8_t>> luts;
+    for(size_t i = 0; i < features.size(); i++){
+        auto activation = (i % 2 == 0) ? common::LutActivation::NONE : common::LutActivation::SIGMOID;
+        luts.push_back(common::get_dequant_lut<uint8_t>(features[i]->m_qp_scale, features[i]->m_qp_zp, activation));
+    }
 
-            tensors.push_back(std::pair(reg_tensor, cls_tensor));
-        }
+    // Frames are decoded on the post-processing pool, several at a time. Each frame in flight holds its output
+    // buffers in the rings of the read threads until it is drawn. Drawing and printing stay in frame order.
+    // The rings outlive the post-processor, which joins the workers still using them if an exception is thrown
+    common::OrderedPostProcessor<std::vector<DetectionObject>> post_processor(pp_options);
 
-        auto detections = post_processing(tensors);
-    
+    // Frames are drawn on a copy at the original size, so their slot in the ring keeps its storage for the next frames
+    cv::Mat display;
+    auto draw_frame = [&](size_t, std::vector<DetectionObject> &detections) {
+        // Frames are emitted in order, so the oldest held buffers are the ones of this frame
         for (auto &feature : features) {
             feature->m_buffers.release_read_buffer();
         }
+        cv::Mat *frame = frames.acquire_read();
+        if (frame == nullptr) {
+            return;
+        }
         if (show) {
+            cv::resize(*frame, display, cv::Size((int)org_width, (int)org_height), 1);
             for (auto &detection : detections) {
                 if (detection.confidence <= 0.f) { // means it was removed in nms
                     continue;
                 }
 
-                cv::resize(frames[idx_frame], frames[idx_frame], cv::Size((int)org_width, (int)org_height), 1);
-                cv::rectangle(frames[idx_frame], cv::Point2f(float(detection.xmin * float(org_width)), float(detection.ymin * float(org_height))),
+                cv::rectangle(display, cv::Point2f(float(detection.xmin * float(org_width)), float(detection.ymin * float(org_height))),
                             cv::Point2f(float(detection.xmax * float(org_width)), float(detection.ymax * float(org_height))), 
                             cv::Scalar(0, 0, 255), 1);
 
                 std::cout << "Detection: " << get_coco17_name_from_int(detection.class_id) << ", Confidence: " << std::fixed << std::setprecision(2) << detection.confidence * 100.0 << "%" << std::endl;
             }
-            cv::imshow("Display window", frames[idx_frame]);
+            cv::imshow("Display window", display);
             cv::waitKey(0);
         }
         // Uncomment if you want to save the annotated video
-        // video.write(frames[i]);
+        // video.write(display);
+        frames.release_read();
+    };
+
+    for (size_t idx_frame = 0; idx_frame < (size_t)frame_count; idx_frame++){
+        post_processor.wait_for_slot(draw_frame);
+
+        std::vector<uint8_t *> buffers(features.size());
+        for (size_t i = 0; i < features.size(); i++) {
+            buffers[i] = features[i]->m_buffers.hold_read_buffer().data();
+        }
+
+        post_processor.submit([&features, buffers, &luts]() {
+            std::vector<std::pair<OutTensor,OutTensor>> tensors;
+            for(size_t i = 0; i < features.size(); i += 2){
+
+                OutTensor reg_tensor(buffers[i], 
+                features[i]->m_qp_zp, features[i]->m_qp_scale, 
+                features[i]->m_height, features[i]->m_width, features[i]->m_channels, luts[i]);
+
+                OutTensor cls_tensor(buffers[i+1], 
+                features[i+1]->m_qp_zp, features[i+1]->m_qp_scale, 
+                features[i+1]->m_height, features[i+1]->m_width, features[i+1]->m_channels, luts[i+1]);
+
+                tensors.push_back(std::pair(reg_tensor, cls_tensor));
+            }
+
+            return post_processing(tensors);
+        });
     }
+    post_processor.drain(draw_frame);
     std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::high_resolution_clock::now();
     postprocess_time = t_end - t_start;
     // Uncomment if you want to save the annotated video
@@ -137,7 +174,7 @@ hailo_status read_all(OutputVStream& output_vstream, std::shared_ptr<FeatureData
 }
 
 hailo_status write_all(InputVStream& input_vstream, std::string video_path, 
-                        std::chrono::time_point<std::chrono::system_clock>& write_time_vec, std::vector<cv::Mat>& frames) {
+                        std::chrono::time_point<std::chrono::system_clock>& write_time_vec, common::FrameRing<cv::Mat>& frames) {
     m.lock();
     std::cout << CYAN << "-I- Started write thread: " << info_to_str(input_vstream.get_info()) << std::endl << RESET;
     m.unlock();
@@ -150,10 +187,11 @@ hailo_status write_all(InputVStream& input_vstream, std::string video_path,
 
 
     cv::VideoCapture capture(video_path);
-    if(!capture.isOpened())
+    if(!capture.isOpened()) {
+        frames.close();
         throw "Unable to read video file";
+    }
     
-    int i = 0;
     cv::Mat org_frame;
 
     write_time_vec = std::chrono::high_resolution_clock::now();
@@ -163,14 +201,19 @@ hailo_status write_all(InputVStream& input_vstream, std::string video_path,
             break;
         }
 
-        cv::resize(org_frame, frames[i], cv::Size(height, width), 1);
+        // Waits while the ring is full, so the capture never runs more than its capacity ahead of the drawing
+        cv::Mat &frame = frames.acquire_write();
+        cv::resize(org_frame, frame, cv::Size(height, width), 1);
 
-        input_vstream.write(MemoryView(frames[i].data, input_vstream.get_frame_size()));
-        if (HAILO_SUCCESS != status)
+        status = input_vstream.write(MemoryView(frame.data, input_vstream.get_frame_size()));
+        frames.release_write();
+        if (HAILO_SUCCESS != status) {
+            frames.close();
             return status;
-        i++;
+        }
     }
 
+    frames.close();
     capture.release();
     return HAILO_SUCCESS;
 }
@@ -178,7 +221,9 @@ hailo_status write_all(InputVStream& input_vstream, std::string video_path,
 
 hailo_status create_feature(hailo_vstream_info_t vstream_info, size_t output_frame_size, std::shared_ptr<FeatureData> &feature) {
     feature = std::make_shared<FeatureData>(static_cast<uint32_t>(output_frame_size), vstream_info.quant_info.qp_zp,
-        vstream_info.quant_info.qp_scale, vstream_info.shape.height, vstream_info.shape.width, vstream_info.shape.features);
+        vstream_info.quant_info.qp_scale, vstream_info.shape.height, vstream_info.shape.width, vstream_info.shape.features,
+        // The frames in flight hold their buffers in the ring, the read thread keeps the default slots to write in
+        static_cast<uint32_t>(pp_options.max_in_flight) + RingBuffer<uint8_t>::DEFAULT_SLOTS);
 
     return HAILO_SUCCESS;
 }
@@ -203,7 +248,12 @@ hailo_status run_inference(std::vector<InputVStream>& input_vstream, std::vector
         }
         features.emplace_back(feature);
     }
-    std::vector<cv::Mat> frames(static_cast<size_t>(frame_count));
+    // Only the frames between the capture and the drawing are kept, whatever the length of the video
+    common::FrameRing<cv::Mat> frames(pp_options.max_in_flight + FRAME_RING_SLACK);
+    auto input_shape = input_vstream[0].get_info().shape;
+    frames.preallocate([&input_shape](cv::Mat &frame) {
+        frame.create(cv::Size((int)input_shape.height, (int)input_shape.width), CV_8UC3);
+    });
 
     auto input_thread(std::async(write_all, std::ref(input_vstream[0]), video_path, std::ref(write_time_vec), std::ref(frames)));
 
@@ -327,6 +377,10 @@ int main(int argc, char** argv) {
 
     const std::string ssd_hef      = getCmdOption(argc, argv, "-hef=");
     const std::string video_path   = getCmdOption(argc, argv, "-video=");
+    const std::string pp_threads   = getCmdOption(argc, argv, "-pp-threads=");
+    const std::string pp_in_flight = getCmdOption(argc, argv, "-pp-in-flight=");
+    pp_options = common::PostProcessOptions(pp_threads.empty() ? 0 : std::stoul(pp_threads),
+                                            pp_in_flight.empty() ? 0 : std::stoul(pp_in_flight));
     const bool show                = getBoolCmdOption(argc, argv, "-show");
 
     std::chrono::time_point<std::chrono::system_clock> write_time_vec;
@@ -16,6 +16,8 @@
  **/
 
 #include "ssd_post_processing.hpp"
+#include "nms_engine.hpp"
+#include "quant_gate.hpp"
 
 #include <algorithm>
 #include <cmath>
@@ -24,29 +26,11 @@
 #include <stdint.h>
 
 
-float fix_scale(uint8_t& input, float &qp_scale, float &qp_zp)
+static common::DequantLutPtr<uint8_t> tensor_lut(const OutTensor &tensor, common::LutActivation activation)
 {
-    /* Quantized to Native*/
-    return (float(input) - qp_zp) * qp_scale;
-}
-
-float iou_calc(const DetectionObject &box_1, const DetectionObject &box_2)
-{
-    const float width_of_overlap_area = std::min(box_1.xmax, box_2.xmax) - std::max(box_1.xmin, box_2.xmin);
-    const float height_of_overlap_area = std::min(box_1.ymax, box_2.ymax) - std::max(box_1.ymin, box_2.ymin);
-    const float positive_width_of_overlap_area = std::max(width_of_overlap_area, 0.0f);
-    const float positive_height_of_overlap_area = std::max(height_of_overlap_area, 0.0f);
-    const float area_of_overlap = positive_width_of_overlap_area * positive_height_of_overlap_area;
-    const float box_1_area = (box_1.ymax - box_1.ymin)  * (box_1.xmax - box_1.xmin);
-    const float box_2_area = (box_2.ymax - box_2.ymin)  * (box_2.xmax - box_2.xmin);
-    return area_of_overlap / (box_1_area + box_2_area - area_of_overlap);
-}
-
-
-static float sigmoid(const float x)
-{
-    /* returns the value of the sigmoid function f(x) = 1/(1 + e^-x) */
-    return 1.0f / (1.0f + expf(-x));
+    if (tensor.lut && tensor.lut->activation() == activation)
+        return tensor.lut;
+    return common::get_dequant_lut<uint8_t>(tensor.qp_scale, tensor.qp_zp, activation);
 }
 
 
@@ -55,64 +39,78 @@ void ssd_extract_boxes(std::pair<OutTensor,OutTensor> &tensors,
 {
     // OutTensor reg_tensor = tensors.first; // in default ssd, 12 or 24
     // OutTensor cls_tensor = tensors.second; // in default ssd, 273 or 546
-    int feature_map_width = tensors.first.width;
-    int feature_map_height = tensors.first.height;
+    const auto reg_view = tensors.first.view();
+    const auto cls_view = tensors.second.view();
+    int feature_map_width = reg_view.width();
     int num_anchors = int(branch_anchors.size()/2);
-    int num_classes = int(tensors.second.channels / num_anchors);
-
-    for (int row = 0; row < feature_map_height; ++row) {
-        for (int col = 0; col < feature_map_width; ++col) {
-            for (int idx_anchor = 0; idx_anchor < num_anchors; ++idx_anchor) {
-                std::pair<uint32_t, float32_t> max_id_score_pair = {0, -1.f};
-                for (int idx_class = 1; idx_class < num_classes; ++idx_class){ // starting without background class.
-                    // access index for class
-                    uint32_t access_cls = (col * num_anchors * num_classes) + (row * feature_map_height * num_anchors * num_classes) + (idx_anchor * num_classes) + idx_class;
-                    auto class_confidence = fix_scale(tensors.second.m_data[access_cls], tensors.second.qp_scale, tensors.second.qp_zp);
-                    class_confidence = sigmoid(class_confidence);
-                    if (class_confidence > max_id_score_pair.second) { 
-                        max_id_score_pair.first = idx_class;
-                        max_id_score_pair.second = class_confidence;
-                    }
-                }
-
-                // access index for bbox
-                uint32_t access_bbox = (col * num_anchors * 4) + (row * feature_map_height * num_anchors * 4) + (idx_anchor * 4);
-
-                if (max_id_score_pair.second >= thr) {
-                    const auto &ha = branch_anchors[idx_anchor * 2];
-                    const auto &wa = branch_anchors[idx_anchor * 2 + 1];
-
-                    const auto xcenter_a = (static_cast<float32_t>(col) + 0.5f) / static_cast<float32_t>(tensors.first.width);
-                    const auto ycenter_a = (static_cast<float32_t>(row) + 0.5f) / static_cast<float32_t>(tensors.first.height);
-
-                    auto ty = fix_scale(tensors.first.m_data[access_bbox], tensors.first.qp_scale, tensors.first.qp_zp); 
-                    auto tx = fix_scale(tensors.first.m_data[access_bbox+1], tensors.first.qp_scale, tensors.first.qp_zp);
-                    auto th = fix_scale(tensors.first.m_data[access_bbox+2], tensors.first.qp_scale, tensors.first.qp_zp);
-                    auto tw = fix_scale(tensors.first.m_data[access_bbox+3], tensors.first.qp_scale, tensors.first.qp_zp);
-
-                    // scale factor
-                    ty /= BOX_CODER_SCALE[0];
-                    tx /= BOX_CODER_SCALE[1];
-                    th /= BOX_CODER_SCALE[2];
-                    tw /= BOX_CODER_SCALE[3];
-
-                    float w = static_cast<float32_t>(exp(tw)) * wa;
-                    float h = static_cast<float32_t>(exp(th)) * ha;
-                    auto x_center = tx * wa + xcenter_a;
-                    auto y_center = ty * ha + ycenter_a;
-
-                    auto x_min = std::max((x_center - (w / 2.0f)) , 0.0f); 
-                    auto y_min = std::max((y_center - (h / 2.0f)) , 0.0f);
-                    auto x_max = std::min((x_center + (w / 2.0f)), 1.f);
-                    auto y_max = std::min((y_center + (h / 2.0f)), 1.f);
-
-                    if (objects.size() < MAX_BOXES){
-                        objects.push_back(DetectionObject(y_min, x_min, y_max, x_max, max_id_score_pair.second, max_id_score_pair.first));
-                    }
-                    else return;
-                }
+    int num_classes = int(cls_view.features() / num_anchors);
+    // dequantize (+ sigmoid for the class scores) by table lookup
+    const auto reg_lut = tensor_lut(tensors.first, common::LutActivation::NONE);
+    const auto cls_lut = tensor_lut(tensors.second, common::LutActivation::SIGMOID);
+
+    // Only the anchors with a class score above the threshold are decoded, found by a scan of the raw class scores.
+    // The candidates buffer is kept per thread, so its capacity is reused across branches and frames.
+    static thread_local std::vector<uint32_t> candidates;
+    candidates.clear();
+    const auto cls_gate = common::QuantizedGate<uint8_t>::at_least(thr, cls_lut->data());
+    cls_gate.scan(cls_view.data(), cls_view.size(), candidates);
+
+    int last_slot = -1;
+    for (uint32_t candidate : candidates) {
+        int slot = int(candidate / num_classes);
+        if (slot == last_slot || (candidate % num_classes) == 0) // already decoded, or the background class
+            continue;
+        last_slot = slot;
+        int idx_anchor = slot % num_anchors;
+        int col = (slot / num_anchors) % feature_map_width;
+        int row = (slot / num_anchors) / feature_map_width;
+
+        // the class scores and the box of the anchor, in the channels of its cell
+        const uint8_t *cls = cls_view.channels(row, col).data() + idx_anchor * num_classes;
+        const uint8_t *bbox = reg_view.channels(row, col).data() + idx_anchor * 4;
+
+        std::pair<uint32_t, float32_t> max_id_score_pair = {0, -1.f};
+        for (int idx_class = 1; idx_class < num_classes; ++idx_class){ // starting without background class.
+            auto class_confidence = (*cls_lut)[cls[idx_class]];
+            if (class_confidence > max_id_score_pair.second) { 
+                max_id_score_pair.first = idx_class;
+                max_id_score_pair.second = class_confidence;
             }
         }
+
+        if (max_id_score_pair.second >= thr) {
+            const auto &ha = branch_anchors[idx_anchor * 2];
+            const auto &wa = branch_anchors[idx_anchor * 2 + 1];
+
+            const auto xcenter_a = (static_cast<float32_t>(col) + 0.5f) / static_cast<float32_t>(reg_view.width());
+            const auto ycenter_a = (static_cast<float32_t>(row) + 0.5f) / static_cast<float32_t>(reg_view.height());
+
+            auto ty = (*reg_lut)[bbox[0]];
+            auto tx = (*reg_lut)[bbox[1]];
+            auto th = (*reg_lut)[bbox[2]];
+            auto tw = (*reg_lut)[bbox[3]];
+
+            // scale factor
+            ty /= BOX_CODER_SCALE[0];
+            tx /= BOX_CODER_SCALE[1];
+            th /= BOX_CODER_SCALE[2];
+            tw /= BOX_CODER_SCALE[3];
+
+            float w = static_cast<float32_t>(exp(tw)) * wa;
+            float h = static_cast<float32_t>(exp(th)) * ha;
+            auto x_center = tx * wa + xcenter_a;
+            auto y_center = ty * ha + ycenter_a;
+
+            auto x_min = std::max((x_center - (w / 2.0f)) , 0.0f); 
+            auto y_min = std::max((y_center - (h / 2.0f)) , 0.0f);
+            auto x_max = std::min((x_center + (w / 2.0f)), 1.f);
+            auto y_max = std::min((y_center + (h / 2.0f)), 1.f);
+
+            if (objects.size() < MAX_BOXES){
+                objects.push_back(DetectionObject(y_min, x_min, y_max, x_max, max_id_score_pair.second, max_id_score_pair.first));
+            }
+            else return;
+        }
     }
 }
 
@@ -126,23 +124,23 @@ std::vector<DetectionObject> ssd_decode(std::vector<std::pair<OutTensor,OutTenso
     for(size_t i = 0; i < tensors.size(); i++){
         ssd_extract_boxes(tensors[i], anchors[i], objects, thr);
     }
-    size_t num_boxes = objects.size();
-
     // filter by overlapping boxes
     if(objects.size() > 0) {
         std::sort(objects.begin(), objects.end());
-        for (unsigned int i = 0; i < objects.size(); ++i) {
-            if (objects[i].confidence <= thr) {
+        static thread_local common::NmsEngine engine;
+        engine.clear();
+        for (const auto &object : objects) {
+            engine.add_box(object.xmin, object.ymin, object.xmax, object.ymax, object.confidence, (int)object.class_id);
+        }
+        // objects are already sorted, so the kept indices come back in ascending order
+        const std::vector<uint32_t> &keep = engine.nms(IOU_THRESHOLD);
+        size_t next_kept = 0;
+        for (uint32_t i = 0; i < objects.size(); ++i) {
+            if (next_kept < keep.size() && keep[next_kept] == i) {
+                next_kept++;
                 continue;
             }
-            for (unsigned int j = i + 1; j < objects.size(); ++j) {
-                if ((objects[i].class_id == objects[j].class_id) && (objects[j].confidence >= thr)) {
-                    if (iou_calc(objects[i], objects[j]) >= IOU_THRESHOLD) {
-                        objects[j].confidence = -1.f;
-                        num_boxes -= 1;
-                    }
-                }
-            }
+            objects[i].confidence = -1.f;
         }
     }
     return objects;
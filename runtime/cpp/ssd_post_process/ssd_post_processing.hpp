@@ -24,6 +24,8 @@
 #include <memory>
 #include <iostream>
 #include "common.h"
+#include "quant_lut.hpp"
+#include "tensor_view.hpp"
 
 // === CONFIGURATION =======================================================================================
 #define CONFIDENCE_THRESHOLD 0.4f
@@ -59,6 +61,7 @@ public:
     int height;
     int width;
     int channels;
+    common::DequantLutPtr<uint8_t> lut; // dequantize + activation table, looked up from the qp params when not set
 
     OutTensor() : m_data(nullptr), qp_zp(-1.f), qp_scale(-1.f), height(-1.f), width(-1.f), channels(-1.f)
     {}
@@ -69,6 +72,15 @@ public:
     OutTensor(uint8_t* m_data, float qp_zp, float qp_scale, int height, int width, int channels) : m_data(m_data), qp_zp(qp_zp), qp_scale(qp_scale), height(height), width(width), channels(channels)
     {}
 
+    OutTensor(uint8_t* m_data, float qp_zp, float qp_scale, int height, int width, int channels, common::DequantLutPtr<uint8_t> lut) :
+        m_data(m_data), qp_zp(qp_zp), qp_scale(qp_scale), height(height), width(width), channels(channels), lut(lut)
+    {}
+
+    // the HWC layout of the buffer, the qp params are the ones of the table when it is set
+    common::TensorView<uint8_t> view() const {
+        return common::TensorView<uint8_t>(m_data, height, width, channels, qp_scale, qp_zp);
+    }
+
     friend std::ostream& operator<<(std::ostream& os, const OutTensor& t) {
         os << MAGENTA << "OutTensor: h " << t.height << ", w " << t.width << ", c " << t.channels << RESET;
         return os;
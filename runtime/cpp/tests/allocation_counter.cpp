@@ -0,0 +1,39 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file allocation_counter.cpp
+ * @brief A replaced operator new that counts the allocations of the executable it is linked into.
+ **/
+#include "allocation_counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<size_t> g_allocations(0);
+}
+
+// All the allocations of the executable, from every thread, are counted
+void *operator new(size_t size)
+{
+    g_allocations++;
+    void *pointer = std::malloc(size != 0 ? size : 1);
+    if (pointer == nullptr)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { std::free(pointer); }
+
+namespace test
+{
+    size_t allocations()
+    {
+        return g_allocations.load();
+    }
+}
@@ -0,0 +1,20 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file allocation_counter.hpp
+ * @brief The heap allocations of a test executable, counted by the operator new of allocation_counter.cpp.
+ *        Link allocation_counter.cpp into the executables that include this header.
+ **/
+#pragma once
+
+#include <cstddef>
+
+namespace test
+{
+    /**
+     * @brief The operator new calls of the executable so far, from every thread.
+     */
+    size_t allocations();
+}
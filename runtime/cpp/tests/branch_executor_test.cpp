@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file branch_executor_test.cpp
+ * @brief The yolov5seg BranchExecutor, and the threads and copies per frame against the std::async branches it replaced.
+ **/
+#include "test_harness.hpp"
+
+#include "branch_executor.hpp"
+
+#include <atomic>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    std::atomic<size_t> g_bytes_copied(0);
+
+    /**
+     * @brief A grid of a branch, which counts the bytes of its copies.
+     */
+    struct Grid
+    {
+        std::vector<float> values;
+
+        Grid(size_t size, float value) : values(size, value){};
+        Grid(const Grid &other) : values(other.values) { g_bytes_copied += values.size() * sizeof(float); }
+        Grid &operator=(const Grid &other) = delete;
+    };
+
+    // The grids and anchor grids of the 80x80, 40x40 and 20x20 branches of yolov5seg, 3 anchors of {x, y}
+    const size_t BRANCH_SIZES[] = {80, 40, 20};
+    const size_t NUM_BRANCHES = 3;
+
+    std::vector<Grid> make_grids()
+    {
+        std::vector<Grid> grids;
+        for (size_t size : BRANCH_SIZES)
+            grids.emplace_back(size * size * 3 * 2, 0.5f);
+        return grids;
+    }
+
+    // A stand-in for the decoding of a branch: reads its grids
+    double decode_branch(const size_t index, const std::vector<Grid> &grids, const std::vector<Grid> &anchor_grids)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < grids[index].values.size(); i += 16)
+            sum += grids[index].values[i] * anchor_grids[index].values[i];
+        return sum;
+    }
+
+    // The old yolov5seg_post() signature: the params of all the branches by value
+    double decode_branch_by_value(const size_t index, std::vector<Grid> grids, std::vector<Grid> anchor_grids)
+    {
+        return decode_branch(index, grids, anchor_grids);
+    }
+}
+
+TEST_CASE(branch_executor, every_task_runs_once_across_callers)
+{
+    common::BranchExecutor executor(3, false);
+    const size_t callers = 4;
+    const size_t batches = 500;
+    const size_t tasks = 1 + NUM_BRANCHES;
+    std::vector<std::atomic<size_t>> runs(callers * tasks);
+    for (auto &count : runs)
+        count = 0;
+    std::vector<size_t> wrong_sums(callers, 0);
+
+    std::vector<std::thread> threads;
+    for (size_t caller = 0; caller < callers; caller++)
+    {
+        threads.emplace_back([&, caller]
+                             {
+                                 for (size_t batch = 0; batch < batches; batch++)
+                                 {
+                                     size_t results[tasks] = {};
+                                     executor.run(tasks, [&](size_t task)
+                                                  {
+                                                      results[task] = task + 1;
+                                                      runs[caller * tasks + task]++; });
+                                     size_t sum = 0;
+                                     for (size_t result : results)
+                                         sum += result;
+                                     wrong_sums[caller] += sum != tasks * (tasks + 1) / 2;
+                                 } });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    for (size_t caller = 0; caller < callers; caller++)
+    {
+        CHECK_EQ(wrong_sums[caller], (size_t)0);
+        for (size_t task = 0; task < tasks; task++)
+            CHECK_EQ(runs[caller * tasks + task].load(), batches);
+    }
+    auto stats = executor.stats();
+    CHECK_EQ(stats.threads_created, (size_t)3);
+    CHECK_EQ(stats.batches, callers * batches);
+    CHECK_EQ(stats.tasks, callers * batches * tasks);
+}
+
+TEST_CASE(branch_executor, first_exception_is_rethrown_after_all_tasks)
+{
+    common::BranchExecutor executor(2, false);
+    std::atomic<size_t> ran(0);
+    CHECK_THROWS(executor.run(8, [&](size_t task)
+                              {
+                                  ran++;
+                                  if (task % 3 == 1)
+                                      throw std::runtime_error("task " + std::to_string(task)); }),
+                 std::runtime_error);
+    CHECK_EQ(ran.load(), (size_t)8);
+
+    // The executor is still usable, and an empty batch returns at once
+    ran = 0;
+    executor.run(4, [&](size_t)
+                 { ran++; });
+    executor.run(0, [&](size_t)
+                 { ran++; });
+    CHECK_EQ(ran.load(), (size_t)4);
+    CHECK_EQ(executor.stats().batches, (size_t)2);
+}
+
+BENCHMARK(branch_executor, threads_and_copies_per_frame)
+{
+    const size_t frames = test::scale<size_t>(1000, 50);
+    const std::vector<Grid> grids = make_grids();
+    const std::vector<Grid> anchor_grids = make_grids();
+    double expected = 0;
+    for (size_t index = 0; index < NUM_BRANCHES; index++)
+        expected += decode_branch(index, grids, anchor_grids);
+
+    // Before: a std::launch::async task per branch, each runs on a new thread and gets copies of all the grids
+    size_t async_threads = 0;
+    size_t wrong_frames = 0;
+    g_bytes_copied = 0;
+    double async_us = test::median_us(frames, [&]
+                                      {
+                                          std::future<double> results[NUM_BRANCHES];
+                                          for (size_t index = 0; index < NUM_BRANCHES; index++)
+                                          {
+                                              results[index] = std::async(std::launch::async, decode_branch_by_value, index, grids, anchor_grids);
+                                              async_threads++;
+                                          }
+                                          double sum = 0;
+                                          for (auto &result : results)
+                                              sum += result.get();
+                                          wrong_frames += sum != expected; });
+    const size_t async_bytes = g_bytes_copied.load();
+
+    // After: the branches of a frame on the long-lived workers, the grids by reference
+    g_bytes_copied = 0;
+    common::BranchExecutor executor(NUM_BRANCHES, false);
+    double executor_us = test::median_us(frames, [&]
+                                         {
+                                             double results[NUM_BRANCHES] = {};
+                                             executor.run(NUM_BRANCHES, [&](size_t index)
+                                                          { results[index] = decode_branch(index, grids, anchor_grids); });
+                                             double sum = 0;
+                                             for (double result : results)
+                                                 sum += result;
+                                             wrong_frames += sum != expected; });
+    const size_t executor_bytes = g_bytes_copied.load();
+    const size_t executor_threads = executor.stats().threads_created;
+
+    CHECK_EQ(wrong_frames, (size_t)0);
+    CHECK_EQ(executor_bytes, (size_t)0);
+    CHECK_EQ(executor.stats().tasks, frames * NUM_BRANCHES);
+    test::report("std::async per branch, params by value",
+                 test::format(async_us, 1) + " us/frame, " + test::format((double)async_threads / (double)frames, 1) +
+                     " threads/frame, " + test::format((double)async_bytes / (double)frames / 1024, 1) + " KiB copied/frame");
+    test::report("BranchExecutor, params by reference",
+                 test::format(executor_us, 1) + " us/frame, " + std::to_string(executor_threads) + " threads in " +
+                     std::to_string(frames) + " frames, " + test::format((double)executor_bytes / (double)frames / 1024, 1) +
+                     " KiB copied/frame");
+}
@@ -0,0 +1,303 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file dma_buffer_pool_test.cpp
+ * @brief The async_yolov5 DmaBufferPool makes no memory mapping once warmed up, with its mmap/munmap calls counted.
+ **/
+#include "test_harness.hpp"
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    std::atomic<size_t> g_mmaps(0);
+    std::atomic<size_t> g_munmaps(0);
+}
+
+// Declared before the pool, its unqualified mmap/munmap calls find these counting wrappers of the libc functions
+namespace common
+{
+    void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+    {
+        g_mmaps++;
+        return ::mmap(addr, length, prot, flags, fd, offset);
+    }
+
+    int munmap(void *addr, size_t length)
+    {
+        g_munmaps++;
+        return ::munmap(addr, length);
+    }
+}
+
+#include "dma_buffer_pool.hpp"
+
+namespace
+{
+    /**
+     * @brief The buffers of a frame: the input, and one buffer per output stream.
+     */
+    struct Frame
+    {
+        uint32_t id;
+        std::shared_ptr<uint8_t> input;
+        std::vector<std::shared_ptr<uint8_t>> outputs;
+    };
+
+    /**
+     * @brief Stand-in for the device: its own thread completes the transfers of the submitted frames, in order,
+     *        as HailoRT calls the write_async() / read_async() callbacks. At most window frames are in flight.
+     */
+    class StandInDevice
+    {
+    public:
+        explicit StandInDevice(size_t window) : m_window(window), m_in_flight(0), m_stop(false), m_thread(&StandInDevice::complete, this){};
+
+        ~StandInDevice()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cv.notify_all();
+            m_thread.join();
+        }
+
+        void submit(Frame frame)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this]
+                      { return m_in_flight < m_window; });
+            m_in_flight++;
+            m_submitted.push_back(std::move(frame));
+            lock.unlock();
+            m_cv.notify_all();
+        }
+
+        std::vector<Frame> completed()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::vector<Frame> frames;
+            for (auto &frame : m_completed)
+                frames.push_back(std::move(frame));
+            m_completed.clear();
+            return frames;
+        }
+
+        // Waits for the transfers in flight, and returns the completed frames
+        std::vector<Frame> drain()
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [this]
+                          { return m_in_flight == 0; });
+            }
+            return completed();
+        }
+
+    private:
+        size_t m_window;
+        size_t m_in_flight; // submitted and not completed
+        bool m_stop;
+        std::deque<Frame> m_submitted;
+        std::deque<Frame> m_completed;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::thread m_thread;
+
+        void complete()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            for (;;)
+            {
+                m_cv.wait(lock, [this]
+                          { return m_stop || !m_submitted.empty(); });
+                if (m_stop)
+                    return;
+                Frame frame = std::move(m_submitted.front());
+                m_submitted.pop_front();
+                lock.unlock();
+                // the transfer: the device writes the outputs of the frame
+                for (auto &output : frame.outputs)
+                    std::memcpy(output.get(), &frame.id, sizeof(frame.id));
+                std::this_thread::yield();
+                lock.lock();
+                m_completed.push_back(std::move(frame));
+                m_in_flight--;
+                m_cv.notify_all();
+            }
+        }
+    };
+
+    bool intact(const Frame &frame)
+    {
+        uint32_t id;
+        std::memcpy(&id, frame.input.get(), sizeof(id));
+        bool same = id == frame.id;
+        for (auto &output : frame.outputs)
+        {
+            std::memcpy(&id, output.get(), sizeof(id));
+            same = same && id == frame.id;
+        }
+        return same;
+    }
+}
+
+TEST_CASE(dma_buffer_pool, no_mapping_after_warm_up)
+{
+    // As multi_async: pools of capacity + 2 buffers, window frames in flight, the post-process holds hold frames
+    const size_t window = 4;
+    const size_t hold = 3;
+    const size_t capacity = window + hold;
+    const uint32_t warm_up = 50;
+    const uint32_t frames = 5000;
+    auto input_pool = common::DmaBufferPool::create(640 * 640 * 3, capacity + 2);
+    std::vector<std::shared_ptr<common::DmaBufferPool>> output_pools;
+    for (size_t size : {80 * 80 * 255, 40 * 40 * 255, 20 * 20 * 255})
+        output_pools.push_back(common::DmaBufferPool::create(size, capacity + 2));
+
+    size_t mmaps_after_warm_up = 0;
+    size_t munmaps_after_warm_up = 0;
+    size_t damaged = 0;
+    {
+        StandInDevice device(window);
+        std::deque<Frame> post_processing;
+        for (uint32_t id = 0; id < warm_up + frames; id++)
+        {
+            if (id == warm_up)
+            {
+                mmaps_after_warm_up = g_mmaps.load();
+                munmaps_after_warm_up = g_munmaps.load();
+            }
+            Frame frame;
+            frame.id = id;
+            frame.input = input_pool->acquire();
+            std::memcpy(frame.input.get(), &id, sizeof(id));
+            for (auto &pool : output_pools)
+                frame.outputs.push_back(pool->acquire());
+            device.submit(std::move(frame));
+
+            for (auto &completed : device.completed())
+                post_processing.push_back(std::move(completed));
+            while (post_processing.size() > hold)
+            {
+                damaged += !intact(post_processing.front());
+                post_processing.pop_front();
+            }
+        }
+        for (auto &frame : post_processing)
+            damaged += !intact(frame);
+        for (auto &frame : device.drain())
+            damaged += !intact(frame);
+    }
+    CHECK_EQ(g_mmaps.load() - mmaps_after_warm_up, (size_t)0);
+    CHECK_EQ(g_munmaps.load() - munmaps_after_warm_up, (size_t)0);
+    CHECK_EQ(damaged, (size_t)0);
+    for (auto *pool : {input_pool.get(), output_pools[0].get(), output_pools[1].get(), output_pools[2].get()})
+    {
+        auto stats = pool->stats();
+        CHECK_EQ(stats.acquires, (size_t)(warm_up + frames));
+        CHECK_EQ(stats.exhausted, (size_t)0);
+        CHECK_EQ(stats.mappings, (size_t)1);
+        CHECK(stats.in_use_high_water <= capacity + 1);
+    }
+}
+
+TEST_CASE(dma_buffer_pool, exhausted_pool_maps_one_off_buffers)
+{
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t mmaps = g_mmaps.load();
+    const size_t munmaps = g_munmaps.load();
+    auto pool = common::DmaBufferPool::create(1000, 2);
+    CHECK_EQ(g_mmaps.load() - mmaps, (size_t)1);
+
+    auto first = pool->acquire();
+    auto second = pool->acquire();
+    CHECK(first.get() != second.get());
+    CHECK_EQ((uintptr_t)first.get() % page_size, (uintptr_t)0);
+    CHECK_EQ((uintptr_t)second.get() % page_size, (uintptr_t)0);
+    CHECK_EQ(g_mmaps.load() - mmaps, (size_t)1);
+
+    // the pool is empty, a one-off buffer is mapped, and unmapped on release
+    auto one_off = pool->acquire();
+    CHECK_EQ(g_mmaps.load() - mmaps, (size_t)2);
+    std::memset(one_off.get(), 1, pool->buffer_size());
+    one_off.reset();
+    CHECK_EQ(g_munmaps.load() - munmaps, (size_t)1);
+    CHECK_EQ(pool->stats().exhausted, (size_t)1);
+    CHECK_EQ(pool->stats().mappings, (size_t)2);
+    CHECK_EQ(pool->stats().in_use_high_water, (size_t)3);
+
+    // a released buffer is handed out again, and the buffers keep the pool alive
+    uint8_t *released = second.get();
+    second.reset();
+    second = pool->acquire();
+    CHECK(second.get() == released);
+    pool.reset();
+    std::memset(first.get(), 2, 1000);
+    first.reset();
+    CHECK_EQ(g_munmaps.load() - munmaps, (size_t)1);
+    second.reset();
+    CHECK_EQ(g_munmaps.load() - munmaps, (size_t)2);
+}
+
+TEST_CASE(dma_buffer_pool, concurrent_release)
+{
+    // Buffers acquired on one thread and released on another, the free list never hands out a held buffer
+    auto pool = common::DmaBufferPool::create(64, 8);
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::shared_ptr<uint8_t>> handed_over;
+    bool done = false;
+    std::thread releaser([&]
+                         {
+                             std::unique_lock<std::mutex> lock(mutex);
+                             for (;;)
+                             {
+                                 cv.wait(lock, [&]
+                                         { return done || !handed_over.empty(); });
+                                 if (handed_over.empty())
+                                     return;
+                                 auto buffer = std::move(handed_over.front());
+                                 handed_over.pop_front();
+                                 lock.unlock();
+                                 buffer.reset();
+                                 lock.lock();
+                             } });
+    size_t shared = 0;
+    std::set<uint8_t *> held;
+    for (int i = 0; i < 20000; i++)
+    {
+        auto buffer = pool->acquire();
+        std::lock_guard<std::mutex> lock(mutex);
+        held.clear();
+        for (auto &other : handed_over)
+            held.insert(other.get());
+        shared += held.count(buffer.get());
+        if (handed_over.size() < 6)
+            handed_over.push_back(std::move(buffer));
+        cv.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    cv.notify_all();
+    releaser.join();
+    CHECK_EQ(shared, (size_t)0);
+    CHECK_EQ(pool->stats().exhausted, (size_t)0);
+}
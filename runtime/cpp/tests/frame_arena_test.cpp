@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file frame_arena_test.cpp
+ * @brief FrameArena growth, rewind and steady-state counters, and its allocator.
+ **/
+#include "test_harness.hpp"
+
+#include "frame_arena.hpp"
+
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace
+{
+    struct Object
+    {
+        std::string name;
+        int value;
+        Object(int value) : name("object"), value(value){};
+    };
+
+    /**
+     * @brief The temporaries of a frame with the given number of detections.
+     */
+    void run_frame(common::FrameArena &arena, size_t detections)
+    {
+        common::arena_vector<float> boxes{common::ArenaAllocator<float>(arena)};
+        for (size_t i = 0; i < 6 * detections; i++)
+            boxes.push_back((float)i);
+        {
+            common::FrameArenaScope inner(arena);
+            auto object = std::allocate_shared<Object>(common::ArenaAllocator<Object>(arena), 5);
+            common::arena_vector<double> scratch(1000, 1.0, common::ArenaAllocator<double>(arena));
+            CHECK_EQ(object->value, 5);
+            CHECK_EQ(scratch[999], 1.0);
+        }
+        CHECK_EQ(boxes[6 * detections - 1], (float)(6 * detections - 1));
+    }
+}
+
+TEST_CASE(frame_arena, steady_state_makes_no_system_allocations)
+{
+    common::FrameArena arena(64 * 1024);
+    CHECK_EQ(arena.stats().system_allocations, (size_t)1);
+
+    // Growing frames take blocks from the system
+    size_t growth = 0;
+    for (size_t frame = 0; frame < 3; frame++)
+    {
+        common::FrameArenaScope scope(arena);
+        run_frame(arena, 20000 * (frame + 1));
+        growth += scope.system_allocations();
+    }
+    CHECK(growth > 0);
+
+    // The blocks are merged once, then frames up to the largest one seen are served from it
+    const size_t capacity = arena.stats().capacity;
+    const size_t system_allocations = arena.stats().system_allocations;
+    for (size_t frame = 0; frame < 50; frame++)
+    {
+        common::FrameArenaScope scope(arena);
+        run_frame(arena, 1000 + (frame * 7919) % 59000);
+        CHECK_EQ(scope.system_allocations(), (size_t)0);
+    }
+    auto stats = arena.stats();
+    CHECK_EQ(stats.system_allocations, system_allocations);
+    CHECK_EQ(stats.capacity, capacity);
+    CHECK_EQ(stats.bytes_in_use, (size_t)0);
+    CHECK(stats.high_water <= stats.capacity);
+}
+
+TEST_CASE(frame_arena, rewind_to_marker)
+{
+    common::FrameArena arena(1024);
+    void *first = arena.allocate(100);
+    auto marker = arena.mark();
+    void *second = arena.allocate(200, 64);
+    CHECK_EQ((uintptr_t)second % 64, (uintptr_t)0);
+    arena.rewind(marker);
+    CHECK(arena.allocate(200, 64) == second);
+    CHECK(first != second);
+
+    // An allocation larger than the block takes a new one, released at the next full reset
+    void *large = arena.allocate(4096);
+    CHECK(large != nullptr);
+    CHECK_EQ(arena.stats().system_allocations, (size_t)2);
+    arena.reset();
+    CHECK_EQ(arena.stats().bytes_in_use, (size_t)0);
+    CHECK(arena.stats().capacity >= 1024 + 4096);
+    CHECK_EQ(arena.stats().system_allocations, (size_t)3); // the merged block
+}
+
+TEST_CASE(frame_arena, one_arena_per_thread)
+{
+    common::FrameArena *main_arena = &common::frame_arena();
+    common::FrameArena *other_arena = nullptr;
+    std::thread other([&other_arena]
+                      { other_arena = &common::frame_arena(); });
+    other.join();
+    CHECK(other_arena != nullptr);
+    CHECK(main_arena != other_arena);
+    CHECK(common::ArenaAllocator<int>().arena() == main_arena);
+    CHECK(common::ArenaAllocator<int>() == common::ArenaAllocator<float>());
+}
@@ -0,0 +1,325 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file frame_joiner_test.cpp
+ * @brief The async_yolov5 FrameJoiner between stand-in streams whose outputs complete in shuffled order, and the
+ *        throughput of the window of transfers in flight.
+ **/
+#include "test_harness.hpp"
+
+#include "tensors_buffers.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    AlignedBuffer make_buffer(uint64_t value)
+    {
+        AlignedBuffer buffer(new uint8_t[sizeof(value)], std::default_delete<uint8_t[]>());
+        std::memcpy(buffer.get(), &value, sizeof(value));
+        return buffer;
+    }
+
+    uint64_t value_of(const AlignedBuffer &buffer)
+    {
+        uint64_t value = 0;
+        if (buffer)
+            std::memcpy(&value, buffer.get(), sizeof(value));
+        return value;
+    }
+
+    // The value the read of output i of frame seq writes to its buffer
+    uint64_t output_value(uint64_t seq, size_t i)
+    {
+        return seq * 16 + i;
+    }
+
+    struct Timing
+    {
+        uint32_t latency_us; // from the write of a frame to its completion
+        uint32_t jitter_us;  // the read of an output completes up to jitter_us after the write of its frame
+        uint32_t compute_us; // post-process of a frame
+    };
+
+    struct Result
+    {
+        uint64_t popped;
+        uint64_t misordered;        // frames popped out of order, or with the buffers of another frame
+        size_t writes_high_water;   // most writes in flight
+        size_t reads_high_water;    // most reads in flight of an output
+        size_t frames_high_water;   // FrameJoiner::in_flight_high_water()
+        hailo_status status;
+        double seconds;
+    };
+
+    /**
+     * @brief Stand-in for the streams of the device, threaded as multi_async: an input thread writes the frames,
+     *        a thread per output posts the reads through FrameJoiner::wait_for_read(), and the post-process pops
+     *        the frames. The transfers complete on device threads: a write latency_us after it was posted, the
+     *        read of output i of a frame a random delay after the write of the frame, so the outputs complete
+     *        in shuffled order (each output in order). Reads posted past the last frame are aborted.
+     */
+    class StandInStreams
+    {
+    public:
+        StandInStreams(size_t num_outputs, size_t window, Timing timing)
+            : m_num_outputs(num_outputs), m_timing(timing), m_joiner(num_outputs, 2 * window + 2, window),
+              m_written(0), m_writes_done(0), m_writes_closed(false), m_reads(num_outputs), m_reads_closed(num_outputs, false),
+              m_reads_in_flight(num_outputs, 0), m_writes_high_water(0), m_reads_high_water(0), m_fail_frame(UINT64_MAX){};
+
+        // The read of output 0 of frame seq fails
+        void fail_at(uint64_t seq) { m_fail_frame = seq; }
+
+        Result run(uint64_t frames)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            std::vector<std::thread> threads;
+            threads.emplace_back(&StandInStreams::complete_writes, this);
+            for (size_t i = 0; i < m_num_outputs; i++)
+            {
+                threads.emplace_back(&StandInStreams::complete_reads, this, i);
+                threads.emplace_back(&StandInStreams::post_reads, this, i);
+            }
+            threads.emplace_back(&StandInStreams::write, this, frames);
+
+            Result result = {};
+            InputFrame input;
+            std::vector<AlignedBuffer> outputs;
+            while (m_joiner.pop(input, outputs))
+            {
+                bool same_frame = value_of(input.buffer) == result.popped && outputs.size() == m_num_outputs;
+                for (size_t i = 0; i < outputs.size(); i++)
+                    same_frame = same_frame && value_of(outputs[i]) == output_value(result.popped, i);
+                result.misordered += !same_frame;
+                if (m_timing.compute_us != 0)
+                    std::this_thread::sleep_for(std::chrono::microseconds(m_timing.compute_us));
+                input.buffer.reset();
+                for (auto &output : outputs)
+                    output.reset();
+                result.popped++;
+            }
+            for (auto &thread : threads)
+                thread.join();
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            result.writes_high_water = m_writes_high_water;
+            result.reads_high_water = m_reads_high_water;
+            result.frames_high_water = m_joiner.in_flight_high_water();
+            result.status = m_joiner.status();
+            return result;
+        }
+
+    private:
+        struct Transfer
+        {
+            uint64_t seq;
+            AlignedBuffer buffer;
+            std::chrono::steady_clock::time_point posted;
+        };
+
+        size_t m_num_outputs;
+        Timing m_timing;
+        FrameJoiner m_joiner;
+        // the device
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<Transfer> m_writes;
+        uint64_t m_written;
+        uint64_t m_writes_done;
+        bool m_writes_closed; // the input thread is done, m_written frames were written
+        std::vector<std::deque<Transfer>> m_reads;
+        std::vector<bool> m_reads_closed;
+        std::vector<size_t> m_reads_in_flight;
+        size_t m_writes_high_water;
+        size_t m_reads_high_water;
+        uint64_t m_fail_frame;
+
+        void write(uint64_t frames)
+        {
+            for (uint64_t seq = 0; seq < frames && HAILO_SUCCESS == m_joiner.status(); seq++)
+            {
+                InputFrame frame;
+                frame.buffer = make_buffer(seq);
+                m_joiner.add_input(std::move(frame));
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_writes.push_back(Transfer{seq, nullptr, std::chrono::steady_clock::now()});
+                m_written++;
+                m_writes_high_water = std::max(m_writes_high_water, (size_t)(m_written - m_writes_done));
+                m_cv.notify_all();
+            }
+            m_joiner.finish();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_writes_closed = true;
+            m_cv.notify_all();
+        }
+
+        void post_reads(size_t i)
+        {
+            for (uint64_t seq = 0; m_joiner.wait_for_read(i, seq); seq++)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_reads[i].push_back(Transfer{seq, make_buffer(0), std::chrono::steady_clock::now()});
+                m_reads_high_water = std::max(m_reads_high_water, ++m_reads_in_flight[i]);
+                m_cv.notify_all();
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_reads_closed[i] = true;
+            m_cv.notify_all();
+        }
+
+        void complete_writes()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            for (;;)
+            {
+                m_cv.wait(lock, [this]
+                          { return !m_writes.empty() || m_writes_closed; });
+                if (m_writes.empty())
+                    return;
+                auto completion = m_writes.front().posted + std::chrono::microseconds(m_timing.latency_us);
+                lock.unlock();
+                std::this_thread::sleep_until(completion);
+                lock.lock();
+                m_writes.pop_front();
+                m_writes_done++;
+                m_cv.notify_all();
+                lock.unlock();
+                m_joiner.input_done();
+                lock.lock();
+            }
+        }
+
+        void complete_reads(size_t i)
+        {
+            std::mt19937 random((uint32_t)i + 1);
+            std::unique_lock<std::mutex> lock(m_mutex);
+            for (;;)
+            {
+                m_cv.wait(lock, [this, i]
+                          { return !m_reads[i].empty() || m_reads_closed[i]; });
+                if (m_reads[i].empty())
+                    return;
+                const uint64_t seq = m_reads[i].front().seq;
+                // the device reads out a frame once it was written, or aborts the reads past the last frame
+                m_cv.wait(lock, [this, seq]
+                          { return seq < m_writes_done || (m_writes_closed && seq >= m_written); });
+                Transfer read = std::move(m_reads[i].front());
+                m_reads[i].pop_front();
+                m_reads_in_flight[i]--;
+                const bool aborted = seq >= m_writes_done;
+                lock.unlock();
+
+                hailo_status status = HAILO_SUCCESS;
+                if (aborted)
+                    status = HAILO_STREAM_ABORTED_BY_USER;
+                else if (0 == i && seq == m_fail_frame)
+                    status = HAILO_INTERNAL_FAILURE;
+                else
+                {
+                    if (m_timing.jitter_us != 0)
+                        std::this_thread::sleep_for(std::chrono::microseconds(random() % m_timing.jitter_us));
+                    const uint64_t value = output_value(seq, i);
+                    std::memcpy(read.buffer.get(), &value, sizeof(value));
+                }
+                m_joiner.output_done(seq, i, std::move(read.buffer), status);
+                lock.lock();
+            }
+        }
+    };
+}
+
+TEST_CASE(frame_joiner, shuffled_outputs_are_joined_in_frame_order)
+{
+    const uint64_t frames = 500;
+    for (size_t num_outputs : {1, 3, 4, 6})
+    {
+        StandInStreams streams(num_outputs, 4, Timing{50, 200, 0});
+        Result result = streams.run(frames);
+        CHECK_EQ(result.status, HAILO_SUCCESS);
+        CHECK_EQ(result.popped, frames);
+        CHECK_EQ(result.misordered, (uint64_t)0);
+    }
+}
+
+TEST_CASE(frame_joiner, failed_read_stops_the_frames)
+{
+    StandInStreams streams(3, 4, Timing{50, 100, 0});
+    streams.fail_at(100);
+    Result result = streams.run(500);
+    CHECK_EQ(result.status, HAILO_INTERNAL_FAILURE);
+    CHECK(result.popped <= 100);
+    CHECK_EQ(result.misordered, (uint64_t)0);
+}
+
+TEST_CASE(frame_joiner, reads_past_the_last_frame_are_ignored)
+{
+    FrameJoiner joiner(2, 4, 4);
+    InputFrame input;
+    input.buffer = make_buffer(0);
+    joiner.add_input(std::move(input));
+    joiner.input_done();
+    // reads posted ahead, for frames 0 to 3, before the input finished
+    for (uint64_t seq = 0; seq < 4; seq++)
+        CHECK(joiner.wait_for_read(1, seq));
+    joiner.finish();
+    CHECK(!joiner.wait_for_read(0, 1));
+
+    // frame 0 completes in the reverse order of the outputs, the reads of the frames that never came are aborted
+    joiner.output_done(0, 1, make_buffer(output_value(0, 1)), HAILO_SUCCESS);
+    joiner.output_done(1, 1, make_buffer(0), HAILO_STREAM_ABORTED_BY_USER);
+    joiner.output_done(0, 0, make_buffer(output_value(0, 0)), HAILO_SUCCESS);
+    joiner.output_done(2, 1, make_buffer(0), HAILO_STREAM_ABORTED_BY_USER);
+
+    std::vector<AlignedBuffer> outputs;
+    CHECK(joiner.pop(input, outputs));
+    CHECK_EQ(value_of(input.buffer), (uint64_t)0);
+    CHECK_EQ(outputs.size(), (size_t)2);
+    CHECK_EQ(value_of(outputs[0]), output_value(0, 0));
+    CHECK_EQ(value_of(outputs[1]), output_value(0, 1));
+    CHECK(!joiner.pop(input, outputs));
+    CHECK_EQ(joiner.status(), HAILO_SUCCESS);
+}
+
+TEST_CASE(frame_joiner, transfers_in_flight_stay_in_the_window)
+{
+    const uint64_t frames = 300;
+    for (size_t window : {1, 3, 4})
+    {
+        for (size_t num_outputs : {1, 3, 4, 6})
+        {
+            StandInStreams streams(num_outputs, window, Timing{50, 200, 0});
+            Result result = streams.run(frames);
+            CHECK_EQ(result.status, HAILO_SUCCESS);
+            CHECK_EQ(result.popped, frames);
+            CHECK_EQ(result.misordered, (uint64_t)0);
+            CHECK(result.writes_high_water <= window);
+            CHECK(result.reads_high_water <= window);
+            CHECK(result.frames_high_water <= 2 * window + 2);
+        }
+    }
+}
+
+BENCHMARK(frame_joiner, window_sweep)
+{
+    // Transfers of 2 ms and a post-process of 0.5 ms: the throughput grows with the window up to the post-process bound
+    const uint64_t frames = test::scale<uint64_t>(600, 30);
+    for (size_t window : {1, 2, 4, 8, 16})
+    {
+        StandInStreams streams(3, window, Timing{2000, 0, 500});
+        Result result = streams.run(frames);
+        CHECK_EQ(result.popped, frames);
+        CHECK_EQ(result.misordered, (uint64_t)0);
+        test::report("window " + std::to_string(window) + ", 2 ms transfers, 0.5 ms post-process",
+                     test::format((double)frames / result.seconds, 0) + " FPS (" + std::to_string(result.frames_high_water) +
+                         " frames in flight at most)");
+    }
+}
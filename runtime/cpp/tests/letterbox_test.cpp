@@ -0,0 +1,231 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file letterbox_test.cpp
+ * @brief The async_yolov5 LetterboxResizer against cv::resize(INTER_LINEAR) followed by the padding and the
+ *        channel swap, on odd, upscaled, downscaled and non-square frames.
+ **/
+#include "test_harness.hpp"
+
+#include <opencv2/opencv.hpp>
+#include "letterbox.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct FrameSize
+    {
+        int src_width;
+        int src_height;
+        int dst_width;
+        int dst_height;
+    };
+
+    const FrameSize FRAME_SIZES[] = {
+        {641, 479, 640, 640},   // odd source, slightly downscaled
+        {320, 240, 640, 640},   // upscaled
+        {1920, 1080, 640, 640}, // downscaled by 3, padded above and below
+        {1080, 1920, 640, 640}, // portrait, padded left and right
+        {1280, 720, 640, 384},  // non-square network input
+        {333, 517, 416, 256},   // upscaled on one axis, downscaled on the other when stretched
+    };
+
+    cv::Mat random_frame(std::mt19937 &random, int width, int height)
+    {
+        cv::Mat frame(height, width, CV_8UC3);
+        for (int y = 0; y < height; y++)
+        {
+            uint8_t *row = frame.ptr<uint8_t>(y);
+            for (int x = 0; x < width * 3; x++)
+                row[x] = (uint8_t)(random() % 256);
+        }
+        return frame;
+    }
+
+    /**
+     * @brief The preprocessing the resizer replaces: cv::resize of the frame to the image size of the letterbox,
+     *        copied at the pad offsets into a network input filled with the pad value, channels swapped if asked.
+     */
+    std::vector<uint8_t> reference_input(const cv::Mat &frame, const common::Letterbox &letterbox, bool swap_rb, uint8_t pad_value)
+    {
+        cv::Mat resized;
+        cv::resize(frame, resized, cv::Size(letterbox.image_width, letterbox.image_height), 0, 0, cv::INTER_LINEAR);
+        std::vector<uint8_t> input((size_t)letterbox.dst_width * letterbox.dst_height * 3, pad_value);
+        for (int y = 0; y < letterbox.image_height; y++)
+        {
+            const uint8_t *in = resized.ptr<uint8_t>(y);
+            uint8_t *out = input.data() + ((size_t)(y + letterbox.pad_top) * letterbox.dst_width + letterbox.pad_left) * 3;
+            for (int x = 0; x < letterbox.image_width; x++)
+            {
+                out[3 * x] = in[3 * x + (swap_rb ? 2 : 0)];
+                out[3 * x + 1] = in[3 * x + 1];
+                out[3 * x + 2] = in[3 * x + (swap_rb ? 0 : 2)];
+            }
+        }
+        return input;
+    }
+
+    bool in_image(const common::Letterbox &letterbox, int x, int y)
+    {
+        return x >= letterbox.pad_left && x < letterbox.pad_left + letterbox.image_width &&
+               y >= letterbox.pad_top && y < letterbox.pad_top + letterbox.image_height;
+    }
+
+    void check_against_reference(const FrameSize &size, common::ResizeMode mode, bool swap_rb)
+    {
+        std::mt19937 random(size.src_width * 7 + size.src_height);
+        const uint8_t pad_value = common::LetterboxResizer::DEFAULT_PAD_VALUE;
+        cv::Mat frame = random_frame(random, size.src_width, size.src_height);
+        const common::Letterbox letterbox = common::Letterbox::compute(size.src_width, size.src_height, size.dst_width, size.dst_height, mode);
+        common::LetterboxResizer resizer(letterbox, swap_rb);
+        // the input starts with a value that is neither the pad nor likely in the image, so unwritten bytes show
+        std::vector<uint8_t> input((size_t)size.dst_width * size.dst_height * 3, (uint8_t)(pad_value + 1));
+        resizer.run(frame.data, frame.step, input.data(), (size_t)size.dst_width * 3);
+        const std::vector<uint8_t> expected = reference_input(frame, letterbox, swap_rb, pad_value);
+
+        size_t off_by_more = 0;
+        size_t bad_pad = 0;
+        int max_difference = 0;
+        for (int y = 0; y < size.dst_height; y++)
+        {
+            for (int x = 0; x < size.dst_width; x++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    const size_t i = ((size_t)y * size.dst_width + x) * 3 + c;
+                    if (!in_image(letterbox, x, y))
+                    {
+                        bad_pad += input[i] != pad_value;
+                        continue;
+                    }
+                    const int difference = std::abs((int)input[i] - (int)expected[i]);
+                    max_difference = std::max(max_difference, difference);
+                    off_by_more += difference > 1;
+                }
+            }
+        }
+        if (off_by_more != 0 || bad_pad != 0)
+        {
+            test::report(std::to_string(size.src_width) + "x" + std::to_string(size.src_height) + (swap_rb ? " swapped" : "") +
+                             (common::ResizeMode::LETTERBOX == mode ? " letterboxed" : " stretched"),
+                         "max difference " + std::to_string(max_difference));
+        }
+        CHECK_EQ(off_by_more, (size_t)0);
+        CHECK_EQ(bad_pad, (size_t)0);
+    }
+}
+
+TEST_CASE(letterbox, offsets_and_scales)
+{
+    // 1920x1080 into 640x640: scaled by a third to 640x360, 140 rows of pad above and below
+    common::Letterbox wide = common::Letterbox::compute(1920, 1080, 640, 640, common::ResizeMode::LETTERBOX);
+    CHECK_EQ(wide.image_width, 640);
+    CHECK_EQ(wide.image_height, 360);
+    CHECK_EQ(wide.pad_left, 0);
+    CHECK_EQ(wide.pad_top, 140);
+    CHECK_NEAR(wide.scale_x, 1.0 / 3, 1e-6);
+    CHECK_NEAR(wide.scale_y, 1.0 / 3, 1e-6);
+    CHECK_NEAR(wide.to_source_x(320.f), 960.f, 1e-3);
+    CHECK_NEAR(wide.to_source_y(320.f), 540.f, 1e-3);
+    CHECK_EQ(wide.to_source_y(0.f), 0.f); // in the pad, clamped to the frame
+    CHECK_EQ(wide.to_source_y(639.f), 1079.f);
+
+    // 641x479: the odd height is rounded, the odd pad is one row larger below
+    common::Letterbox odd = common::Letterbox::compute(641, 479, 640, 640, common::ResizeMode::LETTERBOX);
+    CHECK_EQ(odd.image_width, 640);
+    CHECK_EQ(odd.image_height, 478);
+    CHECK_EQ(odd.pad_left, 0);
+    CHECK_EQ(odd.pad_top, 81);
+    CHECK_EQ(640 - odd.pad_top - odd.image_height, 81);
+
+    common::Letterbox portrait = common::Letterbox::compute(1080, 1920, 640, 384, common::ResizeMode::LETTERBOX);
+    CHECK_EQ(portrait.image_width, 216);
+    CHECK_EQ(portrait.image_height, 384);
+    CHECK_EQ(portrait.pad_left, 212);
+    CHECK_EQ(portrait.pad_top, 0);
+
+    common::Letterbox stretched = common::Letterbox::compute(1280, 720, 640, 384, common::ResizeMode::STRETCH);
+    CHECK_EQ(stretched.image_width, 640);
+    CHECK_EQ(stretched.image_height, 384);
+    CHECK_EQ(stretched.pad_left, 0);
+    CHECK_EQ(stretched.pad_top, 0);
+    CHECK_NEAR(stretched.scale_x, 0.5, 1e-6);
+    CHECK_NEAR(stretched.scale_y, 384.0 / 720, 1e-6);
+
+    CHECK(common::Letterbox::compute(640, 640, 640, 640, common::ResizeMode::LETTERBOX).identity());
+    CHECK(!wide.identity());
+}
+
+TEST_CASE(letterbox, matches_cv_resize_within_one)
+{
+    for (const FrameSize &size : FRAME_SIZES)
+    {
+        for (common::ResizeMode mode : {common::ResizeMode::LETTERBOX, common::ResizeMode::STRETCH})
+        {
+            check_against_reference(size, mode, false);
+            check_against_reference(size, mode, true);
+        }
+    }
+}
+
+TEST_CASE(letterbox, custom_pad_value)
+{
+    std::mt19937 random(11);
+    cv::Mat frame = random_frame(random, 1280, 720);
+    const common::Letterbox letterbox = common::Letterbox::compute(1280, 720, 640, 640, common::ResizeMode::LETTERBOX);
+    common::LetterboxResizer resizer(letterbox, false, 0);
+    std::vector<uint8_t> input((size_t)640 * 640 * 3, 1);
+    resizer.run(frame.data, frame.step, input.data(), (size_t)640 * 3);
+    size_t bad_pad = 0;
+    for (int y = 0; y < 640; y++)
+    {
+        for (int x = 0; x < 640; x++)
+        {
+            for (int c = 0; c < 3 && !in_image(letterbox, x, y); c++)
+                bad_pad += input[((size_t)y * 640 + x) * 3 + c] != 0;
+        }
+    }
+    CHECK_EQ(letterbox.pad_top, 140);
+    CHECK_EQ(bad_pad, (size_t)0);
+}
+
+TEST_CASE(letterbox, identity_only_swaps)
+{
+    std::mt19937 random(13);
+    cv::Mat frame = random_frame(random, 320, 320);
+    common::LetterboxResizer resizer(common::Letterbox(320, 320), true);
+    std::vector<uint8_t> input((size_t)320 * 320 * 3);
+    resizer.run(frame.data, frame.step, input.data(), (size_t)320 * 3);
+    size_t mismatches = 0;
+    for (size_t pixel = 0; pixel < (size_t)320 * 320; pixel++)
+    {
+        mismatches += input[3 * pixel] != frame.data[3 * pixel + 2];
+        mismatches += input[3 * pixel + 1] != frame.data[3 * pixel + 1];
+        mismatches += input[3 * pixel + 2] != frame.data[3 * pixel];
+    }
+    CHECK_EQ(mismatches, (size_t)0);
+}
+
+TEST_CASE(letterbox, rows_split_like_a_single_run)
+{
+    // the rows of a frame split among threads, in uneven ranges that cut through the pad and the image
+    std::mt19937 random(17);
+    cv::Mat frame = random_frame(random, 1920, 1080);
+    const common::Letterbox letterbox = common::Letterbox::compute(1920, 1080, 640, 640, common::ResizeMode::LETTERBOX);
+    common::LetterboxResizer resizer(letterbox, true);
+    const size_t step = (size_t)640 * 3;
+    std::vector<uint8_t> whole(step * 640);
+    std::vector<uint8_t> split(step * 640);
+    resizer.run(frame.data, frame.step, whole.data(), step);
+    const int bounds[] = {0, 1, 139, 140, 141, 300, 499, 500, 640};
+    for (size_t i = 0; i + 1 < sizeof(bounds) / sizeof(bounds[0]); i++)
+        resizer.run_rows(frame.data, frame.step, split.data(), step, bounds[i], bounds[i + 1]);
+    CHECK(whole == split);
+}
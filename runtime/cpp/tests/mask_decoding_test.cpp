@@ -0,0 +1,369 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file mask_decoding_test.cpp
+ * @brief The yolov5seg mask decoding against the per-instance decoding it replaced, at 1, 10 and 100 instances, and
+ *        its binary outputs (run-length encoded masks, contours) against the float masks.
+ **/
+#include "test_harness.hpp"
+
+#include "yolov5seg.hpp"
+#include "hailo_common.hpp"
+#include "mask_decoding.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const int PROTO_SIZE = 160;
+    const int PROTO_CHANNELS = 32;
+
+    /**
+     * @brief A quantized proto output, and its dequantized HWC values.
+     *        Random values, or smooth waves as the prototypes of a trained model, whose masks are blobs.
+     */
+    struct Proto
+    {
+        std::vector<uint8_t> quantized;
+        std::vector<float> hwc;
+        HailoTensorPtr tensor;
+
+        explicit Proto(std::mt19937 &random, bool smooth = false) : quantized((size_t)PROTO_SIZE * PROTO_SIZE * PROTO_CHANNELS), hwc(quantized.size())
+        {
+            const float qp_scale = 0.02f;
+            const float qp_zp = 120.0f;
+            std::uniform_real_distribution<float> frequency(0.01f, 0.1f);
+            std::uniform_real_distribution<float> phase(0.0f, 6.28f);
+            std::vector<float> waves(PROTO_CHANNELS * 4);
+            for (size_t i = 0; smooth && i < waves.size(); i++)
+                waves[i] = i % 2 == 0 ? frequency(random) : phase(random);
+            for (size_t i = 0; i < quantized.size(); i++)
+            {
+                if (smooth)
+                {
+                    const size_t channel = i % PROTO_CHANNELS;
+                    const size_t pixel = i / PROTO_CHANNELS;
+                    const float *wave = &waves[channel * 4];
+                    float value = std::sin(wave[0] * (float)(pixel % PROTO_SIZE) + wave[1]) * std::sin(wave[2] * (float)(pixel / PROTO_SIZE) + wave[3]);
+                    quantized[i] = (uint8_t)(qp_zp + 100.0f * value);
+                }
+                else
+                {
+                    quantized[i] = (uint8_t)(random() & 0xff);
+                }
+                hwc[i] = ((float)quantized[i] - qp_zp) * qp_scale;
+            }
+            hailo_vstream_info_t info{};
+            std::strcpy(info.name, "yolov5n_seg/conv63");
+            info.shape.height = PROTO_SIZE;
+            info.shape.width = PROTO_SIZE;
+            info.shape.features = PROTO_CHANNELS;
+            info.format.type = HAILO_FORMAT_TYPE_UINT8;
+            info.quant_info.qp_scale = qp_scale;
+            info.quant_info.qp_zp = qp_zp;
+            tensor = std::make_shared<HailoTensor>(reinterpret_cast<uint16_t *>(quantized.data()), info);
+        }
+    };
+
+    /**
+     * @brief Detections of random boxes, each with its mask coefficients attached as a HailoMatrix.
+     */
+    std::vector<HailoDetection> random_detections(std::mt19937 &random, size_t count)
+    {
+        std::uniform_real_distribution<float> position(0.0f, 0.9f);
+        std::uniform_real_distribution<float> size(0.05f, 0.5f);
+        std::uniform_real_distribution<float> coefficient(-1.0f, 1.0f);
+        std::vector<HailoDetection> detections;
+        for (size_t i = 0; i < count; i++)
+        {
+            const float xmin = position(random);
+            const float ymin = position(random);
+            HailoDetection detection(HailoBBox(xmin, ymin, size(random), size(random)), (int)(i % 80), "object", 0.9f);
+            std::vector<float> coefficients(PROTO_CHANNELS);
+            for (auto &value : coefficients)
+                value = coefficient(random);
+            detection.add_object(std::make_shared<HailoMatrix>(std::move(coefficients), PROTO_CHANNELS, 1));
+            detections.push_back(detection);
+        }
+        return detections;
+    }
+
+    // The detections with copies of their coefficients: decode_masks replaces them with the masks
+    std::vector<HailoDetection> copy_detections(const std::vector<HailoDetection> &detections)
+    {
+        std::vector<HailoDetection> copies = detections;
+        for (auto &copy : copies)
+        {
+            auto matrix = std::dynamic_pointer_cast<HailoMatrix>(copy.get_objects()[0]);
+            copy.remove_object(matrix);
+            copy.add_object(std::make_shared<HailoMatrix>(*matrix));
+        }
+        return copies;
+    }
+
+    struct Box
+    {
+        int xmin, ymin, width, height;
+    };
+
+    Box proto_box(HailoDetection &detection)
+    {
+        HailoBBox bbox = detection.get_bbox();
+        int xmin = CLAMP(bbox.xmin() * PROTO_SIZE, 0, PROTO_SIZE);
+        int xmax = CLAMP(bbox.xmax() * PROTO_SIZE, 0, PROTO_SIZE);
+        int ymin = CLAMP(bbox.ymin() * PROTO_SIZE, 0, PROTO_SIZE);
+        int ymax = CLAMP(bbox.ymax() * PROTO_SIZE, 0, PROTO_SIZE);
+        return Box{xmin, ymin, xmax - xmin, ymax - ymin};
+    }
+
+    /**
+     * The previous decoding of an instance: a copy of the prototypes of its box, the product with its coefficients
+     * by a triple loop, the transpose to column major, the sigmoid, and the copy into the storage of the mask.
+     */
+    std::vector<float> previous_decode(const std::vector<float> &hwc, const float *coefficients, const Box &box)
+    {
+        std::vector<float> cropped((size_t)box.height * box.width * PROTO_CHANNELS);
+        for (int y = 0; y < box.height; y++)
+            std::memcpy(&cropped[(size_t)y * box.width * PROTO_CHANNELS],
+                        &hwc[((size_t)(box.ymin + y) * PROTO_SIZE + box.xmin) * PROTO_CHANNELS],
+                        sizeof(float) * box.width * PROTO_CHANNELS);
+        std::vector<float> product((size_t)box.height * box.width);
+        for (int i = 0; i < box.height; i++)
+        {
+            for (int j = 0; j < box.width; j++)
+            {
+                float row_sum = 0.0f;
+                for (int k = 0; k < PROTO_CHANNELS; k++)
+                    row_sum += cropped[((size_t)i * box.width + j) * PROTO_CHANNELS + k] * coefficients[k];
+                product[(size_t)i * box.width + j] = row_sum;
+            }
+        }
+        // the transpose of (height, width) to column major keeps the row major order of the product
+        std::vector<float> transposed((size_t)box.height * box.width);
+        for (int j = 0; j < box.width; j++)
+            for (int i = 0; i < box.height; i++)
+                transposed[(size_t)i * box.width + j] = product[(size_t)i * box.width + j];
+        for (auto &value : transposed)
+            value = sigmoid(value);
+        std::vector<float> data(transposed.size());
+        std::memcpy(data.data(), transposed.data(), sizeof(float) * data.size());
+        return data;
+    }
+
+    // The binary mask of a HailoRleMask: its runs alternate background and mask pixels, background first
+    std::vector<uint8_t> expand_runs(const std::vector<uint32_t> &runs, size_t size)
+    {
+        std::vector<uint8_t> bits;
+        bits.reserve(size);
+        bool inside = false;
+        for (uint32_t run : runs)
+        {
+            bits.insert(bits.end(), run, inside);
+            inside = !inside;
+        }
+        return bits;
+    }
+
+    /**
+     * @brief The bytes of the masks attached to the detections of a frame.
+     */
+    size_t mask_bytes(std::vector<HailoDetection> &detections)
+    {
+        size_t bytes = 0;
+        for (auto &detection : detections)
+        {
+            for (auto &obj : detection.get_objects())
+            {
+                if (obj->get_type() == HAILO_CONF_CLASS_MASK)
+                    bytes += std::dynamic_pointer_cast<HailoConfClassMask>(obj)->get_data().size() * sizeof(float);
+                else if (obj->get_type() == HAILO_RLE_MASK)
+                    bytes += std::dynamic_pointer_cast<HailoRleMask>(obj)->get_runs().size() * sizeof(uint32_t);
+                else if (obj->get_type() == HAILO_LANDMARKS)
+                {
+                    auto contour = std::dynamic_pointer_cast<HailoLandmarks>(obj);
+                    bytes += contour->get_points().size() * sizeof(HailoPoint) + contour->get_pairs().size() * sizeof(std::pair<int, int>);
+                }
+            }
+        }
+        return bytes;
+    }
+
+    const char *const OUTPUT_NAMES[] = {"float", "rle", "contour"};
+}
+
+TEST_CASE(mask_decoding, matches_the_previous_decoding)
+{
+    std::mt19937 random(7);
+    Proto proto(random);
+    MaskPrototypes prototypes;
+    dequantize_prototypes(proto.tensor, prototypes);
+    CHECK_EQ(prototypes.height, PROTO_SIZE);
+    CHECK_EQ(prototypes.channels, PROTO_CHANNELS);
+
+    for (size_t count : {1, 10, 100})
+    {
+        std::vector<HailoDetection> detections = random_detections(random, count);
+        std::vector<HailoDetection> decoded = copy_detections(detections);
+        decode_masks(decoded, prototypes);
+        double max_error = 0.0;
+        for (size_t i = 0; i < count; i++)
+        {
+            CHECK_EQ(decoded[i].get_objects().size(), (size_t)1);
+            auto mask = std::dynamic_pointer_cast<HailoConfClassMask>(decoded[i].get_objects()[0]);
+            CHECK(mask != nullptr);
+            Box box = proto_box(detections[i]);
+            auto matrix = std::dynamic_pointer_cast<HailoMatrix>(detections[i].get_objects()[0]);
+            std::vector<float> expected = previous_decode(proto.hwc, matrix->get_data().data(), box);
+            CHECK_EQ(mask->get_width(), box.width);
+            CHECK_EQ(mask->get_height(), box.height);
+            CHECK_EQ(mask->get_class_id(), detections[i].get_class_id());
+            CHECK_EQ(mask->get_data().size(), expected.size());
+            for (size_t pixel = 0; pixel < expected.size() && pixel < mask->get_data().size(); pixel++)
+                max_error = std::max(max_error, (double)std::fabs(expected[pixel] - mask->get_data()[pixel]));
+        }
+        CHECK(max_error < 1e-5);
+    }
+}
+
+TEST_CASE(mask_decoding, mismatched_coefficients_throw)
+{
+    std::mt19937 random(3);
+    Proto proto(random);
+    MaskPrototypes prototypes;
+    dequantize_prototypes(proto.tensor, prototypes);
+    std::vector<HailoDetection> detections = random_detections(random, 1);
+    detections[0].remove_objects_typed(HAILO_MATRIX);
+    detections[0].add_object(std::make_shared<HailoMatrix>(std::vector<float>(16, 0.0f), 16, 1));
+    CHECK_THROWS(decode_masks(detections, prototypes), std::invalid_argument);
+}
+
+TEST_CASE(mask_decoding, binary_outputs_match_the_float_masks)
+{
+    std::mt19937 random(5);
+    Proto proto(random, true);
+    MaskPrototypes prototypes;
+    dequantize_prototypes(proto.tensor, prototypes);
+    std::vector<HailoDetection> detections = random_detections(random, 10);
+    std::vector<HailoDetection> masks = copy_detections(detections);
+    std::vector<HailoDetection> encoded = copy_detections(detections);
+    std::vector<HailoDetection> contours = copy_detections(detections);
+    decode_masks(masks, prototypes, MASK_OUTPUT_FLOAT);
+    decode_masks(encoded, prototypes, MASK_OUTPUT_RLE);
+    decode_masks(contours, prototypes, MASK_OUTPUT_CONTOUR, 1.0f);
+
+    size_t contours_found = 0;
+    for (size_t i = 0; i < detections.size(); i++)
+    {
+        auto mask = std::dynamic_pointer_cast<HailoConfClassMask>(masks[i].get_objects()[0]);
+        const std::vector<float> &confidences = mask->get_data();
+        const int width = mask->get_width();
+        const int height = mask->get_height();
+
+        // a pixel is in the binary mask when its confidence is above 0.5, up to the rounding of the sigmoid
+        CHECK_EQ(encoded[i].get_objects().size(), (size_t)1);
+        auto rle = std::dynamic_pointer_cast<HailoRleMask>(encoded[i].get_objects()[0]);
+        CHECK(rle != nullptr);
+        CHECK_EQ(rle->get_width(), width);
+        CHECK_EQ(rle->get_height(), height);
+        size_t total = 0;
+        for (uint32_t run : rle->get_runs())
+            total += run;
+        CHECK_EQ(total, confidences.size());
+        std::vector<uint8_t> bits = expand_runs(rle->get_runs(), confidences.size());
+        size_t mismatched = 0;
+        for (size_t pixel = 0; pixel < bits.size() && pixel < confidences.size(); pixel++)
+            mismatched += (bool)bits[pixel] != (confidences[pixel] > 0.5f) && std::fabs(confidences[pixel] - 0.5f) > 1e-6f;
+        CHECK_EQ(mismatched, (size_t)0);
+
+        // the points of the simplified contours are mask pixels, relative to the box
+        for (auto &obj : contours[i].get_objects())
+        {
+            CHECK(obj->get_type() == HAILO_LANDMARKS);
+            auto contour = std::dynamic_pointer_cast<HailoLandmarks>(obj);
+            CHECK_EQ(contour->get_landmarks_type(), std::string("contour"));
+            CHECK(contour->get_points().size() >= 3);
+            CHECK_EQ(contour->get_pairs().size(), contour->get_points().size());
+            for (auto &point : contour->get_points())
+            {
+                int x = (int)std::floor(point.x() * width);
+                int y = (int)std::floor(point.y() * height);
+                CHECK(x >= 0 && x < width && y >= 0 && y < height);
+                if (x >= 0 && x < width && y >= 0 && y < height)
+                    CHECK(bits[(size_t)y * width + x]);
+            }
+            contours_found++;
+        }
+    }
+    CHECK(contours_found >= detections.size() / 2);
+}
+
+BENCHMARK(mask_decoding, instances)
+{
+    std::mt19937 random(11);
+    Proto proto(random);
+    MaskPrototypes prototypes;
+    double dequantize_us = test::median_us(test::scale<size_t>(100, 5), [&]
+                                           { dequantize_prototypes(proto.tensor, prototypes); });
+    test::report("dequantize the 160x160x32 prototypes", test::format(dequantize_us, 1) + " us/frame");
+
+    for (size_t count : {1, 10, 100})
+    {
+        std::vector<HailoDetection> detections = random_detections(random, count);
+        std::vector<Box> boxes;
+        size_t pixels = 0;
+        for (auto &detection : detections)
+        {
+            boxes.push_back(proto_box(detection));
+            pixels += (size_t)boxes.back().width * boxes.back().height;
+        }
+        const size_t repeats = test::scale<size_t>(count == 100 ? 30 : 200, 3);
+        double previous_us = test::median_us(repeats, [&]
+                                             {
+                                                 for (size_t i = 0; i < count; i++)
+                                                 {
+                                                     auto matrix = std::dynamic_pointer_cast<HailoMatrix>(detections[i].get_objects()[0]);
+                                                     std::vector<float> mask = previous_decode(proto.hwc, matrix->get_data().data(), boxes[i]);
+                                                     CHECK_EQ(mask.size(), (size_t)boxes[i].width * boxes[i].height);
+                                                 } });
+        // the copies of the detections are made outside of the measure
+        std::vector<std::vector<HailoDetection>> frames;
+        for (size_t i = 0; i < repeats; i++)
+            frames.push_back(copy_detections(detections));
+        size_t frame = 0;
+        double decode_us = test::median_us(repeats, [&]
+                                           { decode_masks(frames[frame++], prototypes); });
+        test::report(std::to_string(count) + " instances, " + std::to_string(pixels) + " mask pixels",
+                     test::format(decode_us, 1) + " us/frame (previous decoding " + test::format(previous_us, 1) + " us)");
+    }
+}
+
+BENCHMARK(mask_decoding, outputs)
+{
+    // The binary outputs against the float masks: the CPU of the decoding, and the bytes attached to the frame
+    std::mt19937 random(13);
+    Proto proto(random, true);
+    MaskPrototypes prototypes;
+    dequantize_prototypes(proto.tensor, prototypes);
+    for (size_t count : {1, 10, 100})
+    {
+        std::vector<HailoDetection> detections = random_detections(random, count);
+        const size_t repeats = test::scale<size_t>(count == 100 ? 30 : 200, 3);
+        for (mask_output_t output : {MASK_OUTPUT_FLOAT, MASK_OUTPUT_RLE, MASK_OUTPUT_CONTOUR})
+        {
+            std::vector<std::vector<HailoDetection>> frames;
+            for (size_t i = 0; i < repeats; i++)
+                frames.push_back(copy_detections(detections));
+            size_t frame = 0;
+            double decode_us = test::median_us(repeats, [&]
+                                               { decode_masks(frames[frame++], prototypes, output); });
+            test::report(std::to_string(count) + " instances, " + OUTPUT_NAMES[output],
+                         test::format(decode_us, 1) + " us/frame, " + test::format((double)mask_bytes(frames[0]) / 1024, 1) + " KiB/frame");
+        }
+    }
+}
@@ -0,0 +1,222 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file nms_engine_test.cpp
+ * @brief NmsEngine against a plain greedy NMS, keep_by_indices, and the scaling of NMS with the number of boxes.
+ **/
+#include "test_harness.hpp"
+
+#include "nms_engine.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct Box
+    {
+        float x1, y1, x2, y2, score;
+        int class_id;
+    };
+
+    float reference_iou(const Box &a, const Box &b)
+    {
+        const float width_of_overlap_area = std::min(a.x2, b.x2) - std::max(a.x1, b.x1);
+        const float height_of_overlap_area = std::min(a.y2, b.y2) - std::max(a.y1, b.y1);
+        const float area_of_overlap = std::max(width_of_overlap_area, 0.0f) * std::max(height_of_overlap_area, 0.0f);
+        const float a_area = (a.y2 - a.y1) * (a.x2 - a.x1);
+        const float b_area = (b.y2 - b.y1) * (b.x2 - b.x1);
+        return area_of_overlap / (a_area + b_area - area_of_overlap);
+    }
+
+    /**
+     * The textbook greedy NMS: every box, by descending score, against every box kept before it.
+     */
+    std::vector<uint32_t> reference_nms(const std::vector<Box> &boxes, float iou_thr, bool cross_classes, size_t top_k)
+    {
+        std::vector<uint32_t> order(boxes.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&boxes](uint32_t a, uint32_t b)
+                         { return boxes[a].score > boxes[b].score; });
+        std::vector<uint32_t> keep;
+        for (uint32_t index : order)
+        {
+            bool suppressed = false;
+            for (uint32_t kept : keep)
+            {
+                bool same_class = boxes[kept].class_id == boxes[index].class_id ||
+                                  (boxes[kept].class_id < 0 && boxes[index].class_id < 0);
+                if ((cross_classes || same_class) && reference_iou(boxes[kept], boxes[index]) >= iou_thr)
+                {
+                    suppressed = true;
+                    break;
+                }
+            }
+            if (suppressed)
+                continue;
+            keep.push_back(index);
+            if (top_k != 0 && keep.size() >= top_k)
+                break;
+        }
+        return keep;
+    }
+
+    /**
+     * Boxes around a few cluster centers, as the candidates of a detector, with some duplicated scores.
+     */
+    std::vector<Box> random_boxes(std::mt19937 &random, size_t count, int num_classes, float image_size)
+    {
+        std::uniform_real_distribution<float> position(0.0f, image_size);
+        std::uniform_real_distribution<float> jitter(-6.0f, 6.0f);
+        std::uniform_real_distribution<float> size(4.0f, image_size / 6);
+        std::uniform_int_distribution<int> score(1, 200);
+        std::uniform_int_distribution<int> class_id(-1, num_classes - 1);
+        std::vector<Box> centers(std::max<size_t>(count / 8, 1));
+        for (auto &center : centers)
+        {
+            center.x1 = position(random);
+            center.y1 = position(random);
+            center.x2 = center.x1 + size(random);
+            center.y2 = center.y1 + size(random);
+        }
+        std::vector<Box> boxes(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const Box &center = centers[i % centers.size()];
+            boxes[i].x1 = center.x1 + jitter(random);
+            boxes[i].y1 = center.y1 + jitter(random);
+            boxes[i].x2 = std::max(center.x2 + jitter(random), boxes[i].x1 + 1.0f);
+            boxes[i].y2 = std::max(center.y2 + jitter(random), boxes[i].y1 + 1.0f);
+            boxes[i].score = (float)score(random) / 200.0f;
+            boxes[i].class_id = class_id(random);
+        }
+        return boxes;
+    }
+
+    void load(common::NmsEngine &engine, const std::vector<Box> &boxes)
+    {
+        engine.clear();
+        for (auto &box : boxes)
+            engine.add_box(box.x1, box.y1, box.x2, box.y2, box.score, box.class_id);
+    }
+}
+
+TEST_CASE(nms_engine, matches_greedy_reference)
+{
+    std::mt19937 random(7);
+    common::NmsEngine engine;
+    for (int trial = 0; trial < 300; trial++)
+    {
+        auto boxes = random_boxes(random, (size_t)(trial % 60) * 7, 1 + trial % 5, 640.0f);
+        const float iou_thr = 0.2f + 0.1f * (float)(trial % 6);
+        const bool cross_classes = trial % 3 == 0;
+        const size_t top_k = trial % 4 == 0 ? 5 : 0;
+        load(engine, boxes);
+        std::vector<uint32_t> keep = engine.nms(iou_thr, cross_classes, top_k);
+        CHECK_EQ(keep, reference_nms(boxes, iou_thr, cross_classes, top_k));
+        CHECK(engine.keep() == keep);
+    }
+}
+
+TEST_CASE(nms_engine, reused_engine_after_a_larger_frame)
+{
+    // The kept sets of the classes of a previous, larger frame must not leak into the next one.
+    std::mt19937 random(11);
+    common::NmsEngine engine;
+    auto large = random_boxes(random, 2000, 80, 1280.0f);
+    load(engine, large);
+    CHECK_EQ(engine.nms(0.45f), reference_nms(large, 0.45f, false, 0));
+    auto small = random_boxes(random, 30, 2, 1280.0f);
+    load(engine, small);
+    CHECK_EQ(engine.nms(0.45f), reference_nms(small, 0.45f, false, 0));
+    CHECK_EQ(engine.size(), small.size());
+}
+
+TEST_CASE(nms_engine, threshold_is_inclusive)
+{
+    // Two boxes with IoU exactly 0.5: suppressed at iou_thr 0.5, both kept above it.
+    common::NmsEngine engine;
+    engine.add_box(0.0f, 0.0f, 2.0f, 1.0f, 0.9f, 0);
+    engine.add_box(0.0f, 0.0f, 1.0f, 1.0f, 0.8f, 0);
+    CHECK_EQ(engine.iou_calc(0, 1), 0.5f);
+    CHECK_EQ(engine.nms(0.5f), std::vector<uint32_t>({0}));
+    CHECK_EQ(engine.nms(0.51f), std::vector<uint32_t>({0, 1}));
+    // Other classes are not suppressed unless cross_classes is set
+    engine.add_box(0.0f, 0.0f, 2.0f, 1.0f, 0.7f, 1);
+    CHECK_EQ(engine.nms(0.5f), std::vector<uint32_t>({0, 2}));
+    CHECK_EQ(engine.nms(0.5f, true), std::vector<uint32_t>({0}));
+}
+
+TEST_CASE(nms_engine, soft_nms_decays_overlapping_scores)
+{
+    common::NmsEngine engine;
+    engine.add_box(0.0f, 0.0f, 2.0f, 1.0f, 0.9f, 0);
+    engine.add_box(0.0f, 0.0f, 1.0f, 1.0f, 0.8f, 0);   // IoU 0.5 with the first box
+    engine.add_box(10.0f, 0.0f, 11.0f, 1.0f, 0.5f, 0); // no overlap
+    auto keep = engine.soft_nms(0.3f, 0.5f, 0.1f, common::SoftNmsMethod::LINEAR);
+    CHECK_EQ(keep, std::vector<uint32_t>({0, 2, 1}));
+    CHECK_NEAR(engine.score(1), 0.8f * 0.5f, 1e-6);
+    CHECK_NEAR(engine.score(2), 0.5f, 1e-6);
+
+    load(engine, {{0.0f, 0.0f, 2.0f, 1.0f, 0.9f, 0}, {0.0f, 0.0f, 1.0f, 1.0f, 0.8f, 0}});
+    keep = engine.soft_nms(0.3f, 0.5f, 0.1f, common::SoftNmsMethod::GAUSSIAN);
+    CHECK_EQ(keep, std::vector<uint32_t>({0, 1}));
+    CHECK_NEAR(engine.score(1), 0.8f * std::exp(-0.25f / 0.5f), 1e-6);
+
+    // A decayed score below score_thr removes the box
+    load(engine, {{0.0f, 0.0f, 2.0f, 1.0f, 0.9f, 0}, {0.0f, 0.0f, 1.0f, 1.0f, 0.3f, 0}});
+    CHECK_EQ(engine.soft_nms(0.3f, 0.5f, 0.2f, common::SoftNmsMethod::LINEAR), std::vector<uint32_t>({0}));
+}
+
+TEST_CASE(nms_engine, keep_by_indices)
+{
+    std::mt19937 random(3);
+    std::vector<uint32_t> positions;
+    for (int trial = 0; trial < 200; trial++)
+    {
+        const size_t count = (size_t)(trial % 40);
+        std::vector<std::string> objects(count);
+        for (size_t i = 0; i < count; i++)
+            objects[i] = "object " + std::to_string(i);
+        std::vector<uint32_t> keep(count);
+        std::iota(keep.begin(), keep.end(), 0);
+        std::shuffle(keep.begin(), keep.end(), random);
+        keep.resize(count / 2);
+
+        common::keep_by_indices(objects, keep, positions);
+        CHECK_EQ(objects.size(), keep.size());
+        for (size_t i = 0; i < keep.size(); i++)
+            CHECK_EQ(objects[i], "object " + std::to_string(keep[i]));
+    }
+}
+
+BENCHMARK(nms_engine, scaling_with_candidates)
+{
+    std::vector<size_t> counts = test::quick() ? std::vector<size_t>({100, 1000}) : std::vector<size_t>({100, 1000, 5000, 20000});
+    common::NmsEngine engine;
+    for (bool cross_classes : {false, true})
+    {
+        for (size_t count : counts)
+        {
+            std::mt19937 random((uint32_t)count);
+            auto boxes = random_boxes(random, count, 80, 1280.0f);
+            const size_t repeats = count >= 5000 ? 3 : 20;
+            std::vector<uint32_t> expected;
+            double reference_us = test::median_us(repeats, [&]
+                                                  { expected = reference_nms(boxes, 0.45f, cross_classes, 0); });
+            double engine_us = test::median_us(repeats, [&]
+                                               {
+                                                   load(engine, boxes);
+                                                   engine.nms(0.45f, cross_classes); });
+            CHECK_EQ(engine.keep(), expected);
+            test::report(std::to_string(count) + " boxes" + (cross_classes ? ", cross classes" : ", 80 classes"),
+                         test::format(engine_us, 1) + " us (greedy reference " + test::format(reference_us, 1) + " us, " +
+                             std::to_string(expected.size()) + " kept)");
+        }
+    }
+}
@@ -0,0 +1,238 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file overlay_test.cpp
+ * @brief The yolov5seg mask compositor against the per-mask drawing it replaced, on 1080p and 4K frames.
+ **/
+#include "test_harness.hpp"
+
+#include <opencv2/opencv.hpp>
+#include "overlay.hpp"
+#include "overlay_utils.hpp"
+#include "hailo_common.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    /**
+     * @brief The previous drawing of a mask: every pixel of the mask resized to its region of interest.
+     */
+    class PreviousConfMaskDrawing : public cv::ParallelLoopBody
+    {
+    private:
+        cv::Vec3b *p;
+        const float *mask_data;
+        float transparency;
+        int image_cols;
+        int roi_cols;
+        cv::Scalar mask_color;
+
+    public:
+        PreviousConfMaskDrawing(uint8_t *ptr, const float *mask_data, float transparency, int image_cols, int roi_cols, cv::Scalar mask_color)
+            : p((cv::Vec3b *)ptr), mask_data(mask_data), transparency(transparency), image_cols(image_cols), roi_cols(roi_cols), mask_color(mask_color) {}
+
+        virtual void operator()(const cv::Range &r) const
+        {
+            for (int i = r.start; i != r.end; ++i)
+            {
+                if (mask_data[i] > CONFIDENCE)
+                {
+                    int index = i / roi_cols * image_cols + i % roi_cols;
+                    p[index][0] = p[index][0] * (1 - transparency) + mask_color[0] * transparency;
+                    p[index][1] = p[index][1] * (1 - transparency) + mask_color[1] * transparency;
+                    p[index][2] = p[index][2] * (1 - transparency) + mask_color[2] * transparency;
+                }
+            }
+        }
+    };
+
+    cv::Rect region_of_interest(const cv::Mat &image, HailoDetectionPtr detection)
+    {
+        HailoBBox bbox = detection->get_bbox();
+        int xmin = std::clamp((int)(bbox.xmin() * image.cols), 0, image.cols);
+        int ymin = std::clamp((int)(bbox.ymin() * image.rows), 0, image.rows);
+        int width = std::clamp((int)(image.cols * bbox.width()), 0, image.cols - xmin);
+        int height = std::clamp((int)(image.rows * bbox.height()), 0, image.rows - ymin);
+        return cv::Rect(xmin, ymin, width, height);
+    }
+
+    // The previous draw_all: per mask, a cv::resize of the mask to its region and a pass over all the region
+    void previous_draw_all_masks(cv::Mat &image, const std::vector<HailoDetectionPtr> &detections)
+    {
+        for (auto &detection : detections)
+        {
+            for (auto &obj : detection->get_objects())
+            {
+                if (obj->get_type() != HAILO_CONF_CLASS_MASK)
+                    continue;
+                HailoConfClassMaskPtr mask = std::dynamic_pointer_cast<HailoConfClassMask>(obj);
+                cv::Rect rect = region_of_interest(image, detection);
+                if (rect.width == 0 || rect.height == 0)
+                    continue;
+                cv::Mat mask_mat(mask->get_height(), mask->get_width(), CV_32F, (uint8_t *)mask->get_data().data());
+                cv::Mat resized;
+                cv::resize(mask_mat, resized, cv::Size(rect.width, rect.height), 0, 0, cv::INTER_LINEAR);
+                cv::Mat destination = image(rect);
+                cv::parallel_for_(cv::Range(0, rect.width * rect.height),
+                                  PreviousConfMaskDrawing(destination.data, (const float *)resized.data, mask->get_transparency(),
+                                                          image.cols, rect.width, indexToColor(mask->get_class_id())));
+            }
+        }
+    }
+
+    /**
+     * @brief Detections with a confidence mask of a blob at the proto resolution, some of them partly outside of the frame.
+     */
+    std::vector<HailoDetectionPtr> random_detections(std::mt19937 &random, size_t count)
+    {
+        std::uniform_real_distribution<float> position(-0.05f, 0.9f);
+        std::uniform_real_distribution<float> size(0.03f, 0.35f);
+        std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+        std::vector<HailoDetectionPtr> detections;
+        for (size_t i = 0; i < count; i++)
+        {
+            const float xmin = position(random);
+            const float ymin = position(random);
+            auto detection = std::make_shared<HailoDetection>(HailoBBox(xmin, ymin, size(random), size(random)), (int)(i % 80), "object", 0.9f);
+            const int mask_width = 4 + (int)(random() % 50);
+            const int mask_height = 4 + (int)(random() % 50);
+            const float cx = mask_width * 0.5f;
+            const float cy = mask_height * 0.5f;
+            std::vector<float> data((size_t)mask_width * mask_height);
+            for (int y = 0; y < mask_height; y++)
+            {
+                for (int x = 0; x < mask_width; x++)
+                {
+                    float distance = (x - cx) * (x - cx) / (cx * cx) + (y - cy) * (y - cy) / (cy * cy);
+                    data[(size_t)y * mask_width + x] = 1.0f / (1.0f + std::exp((distance - 0.6f) * 6.0f + noise(random)));
+                }
+            }
+            detection->add_object(std::make_shared<HailoConfClassMask>(std::move(data), mask_width, mask_height, 0.3f, (int)(i % 80)));
+            detections.push_back(detection);
+        }
+        return detections;
+    }
+
+    cv::Mat random_frame(std::mt19937 &random, int width, int height)
+    {
+        cv::Mat frame(height, width, CV_8UC3);
+        for (int y = 0; y < height; y++)
+        {
+            uint8_t *row = frame.ptr<uint8_t>(y);
+            for (int x = 0; x < width * 3; x++)
+                row[x] = (uint8_t)(random() & 0xff);
+        }
+        return frame;
+    }
+
+    // The fixed-point blending rounds where the float blending truncated: 1 per blend, at most 3 under overlapping
+    // masks as each blend keeps 0.7 of the difference before it
+    const int MAX_ROUNDING_DIFFERENCE = 3;
+
+    struct Difference
+    {
+        size_t pixels;          // the channels that differ
+        size_t beyond_rounding; // and differ by more than the rounding of the blending
+        size_t outside;         // the channels that differ outside of all the regions of interest
+    };
+
+    Difference compare(const cv::Mat &a, const cv::Mat &b, const std::vector<cv::Rect> &rects)
+    {
+        Difference difference = {0, 0, 0};
+        for (int y = 0; y < a.rows; y++)
+        {
+            const uint8_t *row_a = a.ptr<uint8_t>(y);
+            const uint8_t *row_b = b.ptr<uint8_t>(y);
+            for (int x = 0; x < a.cols; x++)
+            {
+                bool inside = std::any_of(rects.begin(), rects.end(), [x, y](const cv::Rect &rect)
+                                          { return x >= rect.x && x < rect.x + rect.width && y >= rect.y && y < rect.y + rect.height; });
+                for (int channel = 0; channel < 3; channel++)
+                {
+                    int delta = std::abs((int)row_a[x * 3 + channel] - (int)row_b[x * 3 + channel]);
+                    difference.pixels += delta != 0;
+                    difference.beyond_rounding += delta > MAX_ROUNDING_DIFFERENCE;
+                    difference.outside += delta != 0 && !inside;
+                }
+            }
+        }
+        return difference;
+    }
+}
+
+TEST_CASE(overlay, matches_the_per_mask_drawing)
+{
+    std::mt19937 random(3);
+    const cv::Mat frame = random_frame(random, 640, 480);
+    for (size_t count : {1, 5, 20})
+    {
+        std::vector<HailoDetectionPtr> detections = random_detections(random, count);
+        std::vector<cv::Rect> rects;
+        size_t area = 0;
+        for (auto &detection : detections)
+        {
+            rects.push_back(region_of_interest(frame, detection));
+            area += (size_t)rects.back().width * rects.back().height * 3;
+        }
+        cv::Mat previous = frame.clone();
+        previous_draw_all_masks(previous, detections);
+        cv::Mat composited = frame.clone();
+        CHECK_EQ(draw_all_masks(composited, detections), OVERLAY_STATUS_OK);
+
+        // a few pixels may differ at the threshold, where the upsampling is rounded differently
+        Difference difference = compare(previous, composited, rects);
+        CHECK_EQ(difference.outside, (size_t)0);
+        CHECK(compare(frame, composited, rects).pixels > 0);
+        CHECK(difference.beyond_rounding * 1000 <= area);
+
+        // the stripes of the threads draw the same image
+        cv::Mat threaded = frame.clone();
+        draw_all_masks(threaded, detections, 4);
+        CHECK_EQ(compare(composited, threaded, rects).pixels, (size_t)0);
+    }
+}
+
+TEST_CASE(overlay, regions_outside_the_frame_are_skipped)
+{
+    std::mt19937 random(5);
+    const cv::Mat frame = random_frame(random, 320, 240);
+    std::vector<HailoDetectionPtr> detections;
+    for (auto bbox : {HailoBBox(1.2f, 0.1f, 0.2f, 0.2f), HailoBBox(0.1f, 1.0f, 0.2f, 0.3f), HailoBBox(0.5f, 0.5f, 0.0f, 0.2f)})
+    {
+        auto detection = std::make_shared<HailoDetection>(bbox, 0, "object", 0.9f);
+        detection->add_object(std::make_shared<HailoConfClassMask>(std::vector<float>(16, 1.0f), 4, 4, 0.3f, 0));
+        detections.push_back(detection);
+    }
+    cv::Mat composited = frame.clone();
+    CHECK_EQ(draw_all_masks(composited, detections), OVERLAY_STATUS_OK);
+    CHECK_EQ(compare(frame, composited, {}).pixels, (size_t)0);
+}
+
+BENCHMARK(overlay, compositing)
+{
+    std::mt19937 random(7);
+    std::vector<cv::Size> sizes = {cv::Size(1920, 1080), cv::Size(3840, 2160)};
+    std::vector<size_t> counts = test::quick() ? std::vector<size_t>({5, 50}) : std::vector<size_t>({5, 10, 20, 50});
+    for (const cv::Size &size : sizes)
+    {
+        cv::Mat frame = random_frame(random, size.width, size.height);
+        for (size_t count : counts)
+        {
+            std::vector<HailoDetectionPtr> detections = random_detections(random, count);
+            const size_t repeats = test::scale<size_t>(20, 2);
+            double previous_us = test::median_us(repeats, [&]
+                                                 { previous_draw_all_masks(frame, detections); });
+            double composited_us = test::median_us(repeats, [&]
+                                                   { draw_all_masks(frame, detections); });
+            test::report(std::to_string(size.width) + "x" + std::to_string(size.height) + ", " + std::to_string(count) + " instances",
+                         test::format(composited_us / 1000, 2) + " ms/frame (per-mask drawing " + test::format(previous_us / 1000, 2) + " ms)");
+        }
+    }
+}
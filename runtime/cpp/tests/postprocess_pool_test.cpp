@@ -0,0 +1,197 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file postprocess_pool_test.cpp
+ * @brief OrderedPostProcessor: frame order, slot reuse and exceptions of the frames, and its throughput.
+ **/
+#include "test_harness.hpp"
+
+#include "postprocess_pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    /**
+     * @brief A frame of uneven cost, so the frames finish out of order.
+     */
+    double work_unit(size_t frame, size_t iterations)
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < iterations; i++)
+            sum += std::sin((double)(i + frame));
+        return sum;
+    }
+}
+
+TEST_CASE(postprocess_pool, results_in_frame_order)
+{
+    for (size_t threads : {1, 2, 4, 8})
+    {
+        const size_t frames = 500;
+        // Declared before the processor, see OrderedPostProcessor
+        std::vector<size_t> slots(2 * threads);
+        common::OrderedPostProcessor<size_t> post_processor(common::PostProcessOptions(threads, slots.size()));
+        CHECK_EQ(post_processor.num_threads(), threads);
+        CHECK_EQ(post_processor.max_in_flight(), slots.size());
+
+        std::atomic<size_t> in_flight(0);
+        std::atomic<size_t> max_in_flight(0);
+        std::atomic<size_t> slot_overwrites(0);
+        std::vector<size_t> emitted;
+        auto emit = [&emitted](size_t frame, size_t result)
+        {
+            emitted.push_back(frame);
+            emitted.push_back(result);
+        };
+        std::mt19937 random((uint32_t)threads);
+        for (size_t frame = 0; frame < frames; frame++)
+        {
+            post_processor.wait_for_slot(emit);
+            size_t &slot = slots[post_processor.next_slot()];
+            slot = frame;
+            const size_t iterations = random() % 8 == 0 ? 20000 : 200;
+            post_processor.submit([&, frame, iterations]() -> size_t
+                                  {
+                                      size_t current = ++in_flight;
+                                      size_t seen = max_in_flight.load();
+                                      while (current > seen && !max_in_flight.compare_exchange_weak(seen, current))
+                                      {
+                                      }
+                                      volatile double sink = work_unit(frame, iterations);
+                                      (void)sink;
+                                      if (slot != frame)
+                                          slot_overwrites++;
+                                      in_flight--;
+                                      return frame * 10; });
+        }
+        post_processor.drain(emit);
+
+        CHECK_EQ(emitted.size(), 2 * frames);
+        for (size_t frame = 0; frame < frames; frame++)
+        {
+            CHECK_EQ(emitted[2 * frame], frame);
+            CHECK_EQ(emitted[2 * frame + 1], frame * 10);
+        }
+        CHECK_EQ(slot_overwrites.load(), (size_t)0);
+        CHECK(max_in_flight.load() <= std::min(threads, slots.size()));
+    }
+}
+
+TEST_CASE(postprocess_pool, exception_of_a_frame_is_rethrown_in_order)
+{
+    std::vector<std::vector<int>> slots(4, std::vector<int>(1024));
+    common::OrderedPostProcessor<int> post_processor(common::PostProcessOptions(2, slots.size()));
+    std::vector<size_t> emitted;
+    auto emit = [&emitted](size_t frame, int)
+    { emitted.push_back(frame); };
+
+    const size_t frames = 20;
+    const size_t failing_frame = 5;
+    std::string error;
+    size_t frame = 0;
+    try
+    {
+        for (; frame < frames; frame++)
+        {
+            post_processor.wait_for_slot(emit);
+            auto &slot = slots[post_processor.next_slot()];
+            post_processor.submit([&slot, frame]() -> int
+                                  {
+                                      if (frame == failing_frame)
+                                          throw std::runtime_error("frame " + std::to_string(frame));
+                                      // keep using the slot, as an example frame does with its buffers
+                                      for (auto &value : slot)
+                                          value = (int)frame;
+                                      std::this_thread::sleep_for(std::chrono::microseconds(200));
+                                      return (int)frame; });
+        }
+        post_processor.drain(emit);
+    }
+    catch (const std::runtime_error &e)
+    {
+        error = e.what();
+    }
+    CHECK_EQ(error, std::string("frame 5"));
+    // The frames before the failing one were emitted, none after it
+    CHECK_EQ(emitted, std::vector<size_t>({0, 1, 2, 3, 4}));
+    CHECK(frame < frames);
+
+    // The failing frame is consumed, the following frames can still be emitted
+    post_processor.drain(emit);
+    std::vector<size_t> expected({0, 1, 2, 3, 4});
+    for (size_t next = failing_frame + 1; next < frame; next++)
+        expected.push_back(next);
+    CHECK_EQ(emitted, expected);
+}
+
+TEST_CASE(postprocess_pool, destroyed_while_frames_are_in_flight)
+{
+    // Unwinding from a rethrown exception: the destructor waits for the frames still running, which
+    // write into slots declared before the processor.
+    for (int trial = 0; trial < 20; trial++)
+    {
+        std::atomic<size_t> finished(0);
+        size_t submitted = 0;
+        try
+        {
+            std::vector<std::vector<int>> slots(8, std::vector<int>(4096));
+            common::OrderedPostProcessor<int> post_processor(common::PostProcessOptions(4, slots.size()));
+            for (size_t frame = 0; frame < 64; frame++)
+            {
+                post_processor.wait_for_slot([](size_t, int) {});
+                auto &slot = slots[post_processor.next_slot()];
+                post_processor.submit([&slot, &finished, frame]() -> int
+                                      {
+                                          if (frame == 1)
+                                              throw std::runtime_error("failed frame");
+                                          std::this_thread::sleep_for(std::chrono::microseconds(100));
+                                          for (auto &value : slot)
+                                              value = (int)frame;
+                                          finished++;
+                                          return 0; });
+                submitted++;
+            }
+            post_processor.drain([](size_t, int) {});
+        }
+        catch (const std::runtime_error &)
+        {
+        }
+        // All the other frames submitted before the rethrow ran to completion before the slots were freed
+        CHECK(submitted >= 2);
+        CHECK_EQ(finished.load(), submitted - 1);
+    }
+}
+
+BENCHMARK(postprocess_pool, frames_per_second)
+{
+    const size_t frames = test::scale<size_t>(400, 40);
+    const size_t iterations = test::scale<size_t>(200000, 20000);
+    for (size_t threads : {1, 2, 4, 8})
+    {
+        common::OrderedPostProcessor<double> post_processor(common::PostProcessOptions(threads, 0));
+        size_t emitted = 0;
+        auto emit = [&emitted](size_t, double)
+        { emitted++; };
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t frame = 0; frame < frames; frame++)
+        {
+            post_processor.wait_for_slot(emit);
+            post_processor.submit([frame, iterations]
+                                  { return work_unit(frame, iterations); });
+        }
+        post_processor.drain(emit);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        CHECK_EQ(emitted, frames);
+        test::report(std::to_string(threads) + " threads", test::format((double)frames / seconds, 1) + " frames/s");
+    }
+}
@@ -0,0 +1,140 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file quant_test.cpp
+ * @brief QuantizedGate against the float threshold it replaces, and DequantLut against the per-element math.
+ **/
+#include "test_harness.hpp"
+
+#include "quant_gate.hpp"
+#include "quant_lut.hpp"
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace
+{
+    template <typename T>
+    void check_gate_matches_float_threshold()
+    {
+        std::mt19937 random(5);
+        std::uniform_int_distribution<uint32_t> value(0, std::numeric_limits<T>::max());
+        for (int trial = 0; trial < 300; trial++)
+        {
+            // sizes around the 16/32 element SIMD blocks, and their tails
+            const size_t count = (size_t)(random() % 1000);
+            std::vector<T> data(count);
+            for (auto &element : data)
+                element = (T)value(random);
+            const float qp_scale = 0.001f + (float)(random() % 1000) / 10000.0f;
+            const float qp_zp = (float)(random() % 200);
+            const float threshold = (float)(random() % 100) / 50.0f - 0.5f;
+            auto gate = common::QuantizedGate<T>::at_least(threshold, qp_scale, qp_zp);
+
+            std::vector<uint32_t> indices, expected;
+            gate.scan(data.data(), count, indices);
+            for (size_t i = 0; i < count; i++)
+            {
+                if ((float(data[i]) - qp_zp) * qp_scale >= threshold)
+                    expected.push_back((uint32_t)i);
+            }
+            CHECK_EQ(indices, expected);
+
+            const size_t stride = 1 + (size_t)(trial % 4);
+            indices.clear();
+            expected.clear();
+            gate.scan_strided(data.data(), count / stride, stride, indices);
+            for (size_t i = 0; i < count / stride; i++)
+            {
+                if ((float(data[i * stride]) - qp_zp) * qp_scale >= threshold)
+                    expected.push_back((uint32_t)i);
+            }
+            CHECK_EQ(indices, expected);
+        }
+    }
+}
+
+TEST_CASE(quant, gate_matches_float_threshold_uint8)
+{
+    check_gate_matches_float_threshold<uint8_t>();
+}
+
+TEST_CASE(quant, gate_matches_float_threshold_uint16)
+{
+    check_gate_matches_float_threshold<uint16_t>();
+}
+
+TEST_CASE(quant, gate_open_and_closed)
+{
+    // A threshold above the largest dequantized value closes the gate, one below the smallest opens it
+    auto closed = common::QuantizedGate<uint8_t>::at_least(10.0f, 0.01f, 0.0f);
+    CHECK(closed.closed());
+    std::vector<uint8_t> data(100, 255);
+    std::vector<uint32_t> indices;
+    CHECK_EQ(closed.scan(data.data(), data.size(), indices), (size_t)0);
+    CHECK(indices.empty());
+
+    auto open = common::QuantizedGate<uint8_t>::at_least(-1.0f, 0.01f, 0.0f);
+    CHECK_EQ(open.cutoff(), 0u);
+    data.assign(100, 0);
+    CHECK_EQ(open.scan(data.data(), data.size(), indices), (size_t)100);
+
+    // through a sigmoid table
+    common::DequantLut<uint8_t> sigmoid(0.05f, 128.0f, common::LutActivation::SIGMOID);
+    auto gate = common::QuantizedGate<uint8_t>::at_least(0.5f, sigmoid.data());
+    CHECK_EQ(gate.cutoff(), 128u);
+    CHECK(sigmoid[127] < 0.5f);
+    CHECK(sigmoid[128] >= 0.5f);
+}
+
+TEST_CASE(quant, lut_matches_per_element_math)
+{
+    const float qp_scale = 0.0371f;
+    const float qp_zp = 117.0f;
+    auto custom = [](float x)
+    {
+        float sigmoid = 1.0f / (1.0f + std::exp(-x));
+        return (float)(1.0 / (sigmoid * 10.0 + 0.009));
+    };
+    common::DequantLut<uint8_t> none(qp_scale, qp_zp);
+    common::DequantLut<uint8_t> sigmoid(qp_scale, qp_zp, common::LutActivation::SIGMOID);
+    common::DequantLut<uint8_t> exp(qp_scale, qp_zp, common::LutActivation::EXP);
+    common::DequantLut<uint16_t> function(qp_scale, qp_zp, custom);
+    const size_t table_size = common::DequantLut<uint16_t>::SIZE;
+    CHECK_EQ(table_size, (size_t)65536);
+
+    size_t mismatches = 0;
+    for (int q = 0; q < 256; q++)
+    {
+        // The same float expressions as the decoders, so the tables are exact, not approximations
+        const float x = (float(q) - qp_zp) * qp_scale;
+        mismatches += none[(uint8_t)q] != x;
+        mismatches += sigmoid[(uint8_t)q] != 1.0f / (1.0f + expf(-x));
+        mismatches += exp[(uint8_t)q] != expf(x);
+    }
+    for (int q = 0; q < 65536; q += 7)
+        mismatches += function[(uint16_t)q] != custom((float(q) - qp_zp) * qp_scale);
+    CHECK_EQ(mismatches, (size_t)0);
+
+    std::vector<uint8_t> source({0, 17, 117, 255});
+    std::vector<float> mapped(source.size());
+    sigmoid.apply(source.data(), source.size(), mapped.data());
+    for (size_t i = 0; i < source.size(); i++)
+        CHECK_EQ(mapped[i], sigmoid[source[i]]);
+}
+
+TEST_CASE(quant, lut_cache_shares_tables)
+{
+    auto first = common::get_dequant_lut<uint8_t>(0.0371f, 117.0f, common::LutActivation::SIGMOID);
+    auto second = common::get_dequant_lut<uint8_t>(0.0371f, 117.0f, common::LutActivation::SIGMOID);
+    auto other_activation = common::get_dequant_lut<uint8_t>(0.0371f, 117.0f, common::LutActivation::NONE);
+    auto other_scale = common::get_dequant_lut<uint8_t>(0.0372f, 117.0f, common::LutActivation::SIGMOID);
+    CHECK(first == second);
+    CHECK(first != other_activation);
+    CHECK(first != other_scale);
+    CHECK_EQ(first->qp_zp(), 117.0f);
+}
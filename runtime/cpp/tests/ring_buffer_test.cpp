@@ -0,0 +1,399 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file ring_buffer_test.cpp
+ * @brief RingBuffer (vstream outputs) and FrameRing (captured frames) between two threads, and the contention of
+ *        RingBuffer against the mutex DoubleBuffer it replaced.
+ **/
+#include "test_harness.hpp"
+
+#include "frame_ring.hpp"
+#include "ring_buffer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    /**
+     * @brief The former DoubleBuffer of the examples: two slots, each with a mutex and a condition variable.
+     */
+    template <typename T>
+    class MutexDoubleBuffer
+    {
+    public:
+        MutexDoubleBuffer(uint32_t size) : m_first_buffer(size), m_second_buffer(size), m_read_ptr(&m_first_buffer), m_write_ptr(&m_first_buffer){};
+
+        std::vector<T> &get_write_buffer() { return m_write_ptr->acquire(State::WRITE); }
+
+        void release_write_buffer()
+        {
+            m_write_ptr->release();
+            m_write_ptr = (m_write_ptr == &m_first_buffer) ? &m_second_buffer : &m_first_buffer;
+        }
+
+        std::vector<T> &get_read_buffer() { return m_read_ptr->acquire(State::READ); }
+
+        void release_read_buffer()
+        {
+            m_read_ptr->release();
+            m_read_ptr = (m_read_ptr == &m_first_buffer) ? &m_second_buffer : &m_first_buffer;
+        }
+
+    private:
+        enum class State
+        {
+            READ,
+            WRITE,
+        };
+
+        class SafeBuffer
+        {
+        public:
+            SafeBuffer(uint32_t size) : m_state(State::WRITE), m_buffer(size){};
+
+            std::vector<T> &acquire(State state)
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [this, state]
+                          { return m_state == state; });
+                return m_buffer;
+            }
+
+            void release()
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_state = (State::WRITE == m_state) ? State::READ : State::WRITE;
+                m_cv.notify_one();
+            }
+
+        private:
+            State m_state;
+            std::condition_variable m_cv;
+            std::mutex m_mutex;
+            std::vector<T> m_buffer;
+        };
+
+        SafeBuffer m_first_buffer;
+        SafeBuffer m_second_buffer;
+        SafeBuffer *m_read_ptr;
+        SafeBuffer *m_write_ptr;
+    };
+
+    // Busy work of an exponentially distributed duration, as the reads of a device and the post-processing
+    void work(std::mt19937 &random, double mean_us)
+    {
+        if (mean_us == 0)
+            return;
+        std::exponential_distribution<double> duration(1.0 / mean_us);
+        auto until = std::chrono::steady_clock::now() + std::chrono::microseconds((int64_t)duration(random));
+        while (std::chrono::steady_clock::now() < until)
+        {
+        }
+    }
+
+    /**
+     * @brief Seconds to pass frames from a writer thread to a reader thread, both working mean_us per frame.
+     */
+    template <typename Buffer>
+    double transfer_seconds(Buffer &buffer, uint32_t frames, double mean_us, uint32_t &mismatches)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        std::thread writer([&]
+                           {
+                               std::mt19937 random(1);
+                               for (uint32_t frame = 0; frame < frames; frame++)
+                               {
+                                   auto &slot = buffer.get_write_buffer();
+                                   work(random, mean_us);
+                                   std::memcpy(slot.data(), &frame, sizeof(frame));
+                                   buffer.release_write_buffer();
+                               } });
+        std::mt19937 random(2);
+        for (uint32_t frame = 0; frame < frames; frame++)
+        {
+            auto &slot = buffer.get_read_buffer();
+            uint32_t written;
+            std::memcpy(&written, slot.data(), sizeof(written));
+            mismatches += written != frame;
+            work(random, mean_us);
+            buffer.release_read_buffer();
+        }
+        writer.join();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    void check_ring_order(RingBufferWait wait, uint32_t slots, uint32_t frames, uint32_t first_index = 0)
+    {
+        const uint32_t size = 1024;
+        RingBuffer<uint8_t> ring(size, slots, wait, first_index);
+        std::thread writer([&]
+                           {
+                               for (uint32_t frame = 0; frame < frames; frame++)
+                               {
+                                   auto &buffer = ring.get_write_buffer();
+                                   std::memcpy(buffer.data(), &frame, sizeof(frame));
+                                   buffer[size - 1] = (uint8_t)frame;
+                                   ring.release_write_buffer();
+                               } });
+        std::set<const uint8_t *> storage;
+        uint32_t mismatches = 0;
+        uint32_t max_size = 0;
+        for (uint32_t frame = 0; frame < frames; frame++)
+        {
+            auto &buffer = ring.get_read_buffer();
+            uint32_t written;
+            std::memcpy(&written, buffer.data(), sizeof(written));
+            if (written != frame || buffer[size - 1] != (uint8_t)frame || buffer.size() != size)
+                mismatches++;
+            storage.insert(buffer.data());
+            max_size = std::max(max_size, ring.size());
+            if (frame % 97 == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(20)); // let the writer fill the ring
+            ring.release_read_buffer();
+        }
+        writer.join();
+        CHECK_EQ(mismatches, 0u);
+        CHECK_EQ(storage.size(), (size_t)slots);
+        CHECK(max_size <= slots);
+        CHECK_EQ(ring.size(), 0u);
+    }
+}
+
+TEST_CASE(ring_buffer, order_spin_then_futex)
+{
+    check_ring_order(RingBufferWait::SPIN_THEN_FUTEX, 4, 20000);
+    check_ring_order(RingBufferWait::SPIN_THEN_FUTEX, 1, 5000);
+}
+
+TEST_CASE(ring_buffer, order_spin)
+{
+    check_ring_order(RingBufferWait::SPIN, 4, 20000);
+    check_ring_order(RingBufferWait::SPIN, 3, 5000);
+}
+
+TEST_CASE(ring_buffer, indices_wrap_around)
+{
+    // 2^32 isn't a multiple of 3: index 2^32 - 1 and the index 0 after it must still be on different slots
+    const uint32_t slots = 3;
+    RingBuffer<uint32_t> ring(1, slots, RingBufferWait::SPIN, UINT32_MAX - 7);
+    std::deque<const uint32_t *> written; // the buffers written and not released by the reader yet, oldest first
+    uint32_t next_write = 0;
+    uint32_t next_read = 0;
+    uint32_t mismatches = 0;
+    size_t overwritten = 0;
+    for (int step = 0; step < 30; step++)
+    {
+        // fill the ring, then read one or two buffers
+        while (ring.size() < slots)
+        {
+            auto &buffer = ring.get_write_buffer();
+            overwritten += std::count(written.begin(), written.end(), buffer.data());
+            buffer[0] = next_write++;
+            written.push_back(buffer.data());
+            ring.release_write_buffer();
+        }
+        for (int read = 0; read < 1 + step % 2; read++)
+        {
+            auto &buffer = ring.get_read_buffer();
+            mismatches += buffer[0] != next_read++;
+            mismatches += buffer.data() != written.front();
+            written.pop_front();
+            ring.release_read_buffer();
+        }
+    }
+    CHECK_EQ(overwritten, (size_t)0);
+    CHECK_EQ(mismatches, 0u);
+    CHECK(next_read > 8); // past the wrap around
+    check_ring_order(RingBufferWait::SPIN_THEN_FUTEX, slots, 5000, UINT32_MAX - 100);
+}
+
+TEST_CASE(ring_buffer, held_buffers_are_not_overwritten)
+{
+    // The reader holds up to slots buffers at once, as the examples do with a frame per post-processing task, and
+    // releases the oldest one; a writer on another thread keeps the ring full
+    for (uint32_t first_index : {0u, UINT32_MAX - 50})
+    {
+        const uint32_t slots = 3;
+        const uint32_t frames = 3000;
+        RingBuffer<uint32_t> ring(4, slots, RingBufferWait::SPIN_THEN_FUTEX, first_index);
+        std::thread writer([&]
+                           {
+                               for (uint32_t frame = 0; frame < frames; frame++)
+                               {
+                                   auto &buffer = ring.get_write_buffer();
+                                   std::fill(buffer.begin(), buffer.end(), frame);
+                                   ring.release_write_buffer();
+                               } });
+        std::deque<std::pair<uint32_t, const std::vector<uint32_t> *>> held; // frame and buffer, oldest first
+        std::mt19937 random(4);
+        uint32_t mismatches = 0;
+        uint32_t next_hold = 0;
+        for (uint32_t released = 0; released < frames;)
+        {
+            if (next_hold < frames && held.size() < slots && random() % 2 == 0)
+            {
+                const std::vector<uint32_t> &buffer = ring.hold_read_buffer();
+                mismatches += buffer[0] != next_hold;
+                held.emplace_back(next_hold++, &buffer);
+                continue;
+            }
+            if (held.empty())
+                continue;
+            if (random() % 8 == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(20)); // let the writer wait on the held slots
+            // the writer must not have touched any of the held buffers
+            for (auto &frame : held)
+                mismatches += std::count(frame.second->begin(), frame.second->end(), frame.first) != 4;
+            mismatches += &ring.get_read_buffer() != held.front().second;
+            held.pop_front();
+            ring.release_read_buffer();
+            released++;
+        }
+        writer.join();
+        CHECK_EQ(mismatches, 0u);
+        CHECK_EQ(ring.size(), 0u);
+    }
+}
+
+TEST_CASE(ring_buffer, invalid_slots)
+{
+    CHECK_THROWS(RingBuffer<uint8_t>(16, 0), std::invalid_argument);
+    RingBuffer<float> ring(16, 2);
+    CHECK_EQ(ring.slots(), 2u);
+    CHECK_EQ(ring.get_write_buffer().size(), (size_t)16);
+}
+
+TEST_CASE(frame_ring, order_and_bounded_storage)
+{
+    const size_t frames = 20000;
+    const size_t capacity = 8;
+    const size_t frame_size = 64 * 48 * 3;
+    common::FrameRing<std::vector<uint8_t>> ring(capacity);
+    ring.preallocate([&](std::vector<uint8_t> &frame)
+                     { frame.resize(frame_size); });
+    std::thread writer([&]
+                       {
+                           for (size_t i = 0; i < frames; i++)
+                           {
+                               auto &frame = ring.acquire_write();
+                               frame.resize(frame_size); // same size, the storage of the slot is reused
+                               std::memcpy(frame.data(), &i, sizeof(i));
+                               ring.release_write();
+                           }
+                           ring.close(); });
+    std::set<const uint8_t *> storage;
+    size_t read = 0;
+    size_t mismatches = 0;
+    while (auto *frame = ring.acquire_read())
+    {
+        size_t written;
+        std::memcpy(&written, frame->data(), sizeof(written));
+        if (written != read)
+            mismatches++;
+        storage.insert(frame->data());
+        if (read % 97 == 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(20)); // a slow frame now and then
+        ring.release_read();
+        read++;
+    }
+    writer.join();
+
+    auto stats = ring.stats();
+    CHECK_EQ(mismatches, (size_t)0);
+    CHECK_EQ(read, frames);
+    CHECK_EQ(stats.frames, frames);
+    CHECK(stats.high_water <= capacity);
+    CHECK_EQ(storage.size(), capacity);
+    CHECK_EQ(ring.size(), (size_t)0);
+}
+
+TEST_CASE(frame_ring, close_wakes_the_reader)
+{
+    common::FrameRing<int> ring(2);
+    std::thread closer([&]
+                       {
+                           std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                           ring.acquire_write() = 42;
+                           ring.release_write();
+                           ring.close(); });
+    std::vector<int> read;
+    while (int *frame = ring.acquire_read())
+    {
+        read.push_back(*frame);
+        ring.release_read();
+    }
+    const bool closed = ring.acquire_read() == nullptr;
+    closer.join();
+    CHECK_EQ(read, std::vector<int>({42}));
+    CHECK(closed);
+}
+
+TEST_CASE(frame_ring, writer_waits_when_full)
+{
+    common::FrameRing<int> ring(2);
+    for (int i = 0; i < 2; i++)
+    {
+        ring.acquire_write() = i;
+        ring.release_write();
+    }
+    std::thread writer([&]
+                       {
+                           ring.acquire_write() = 2; // waits for the reader
+                           ring.release_write(); });
+    while (ring.stats().writer_waits == 0)
+        std::this_thread::yield();
+    const size_t size_while_waiting = ring.size();
+    std::vector<int> read;
+    for (int i = 0; i < 3; i++)
+    {
+        int *frame = ring.acquire_read();
+        read.push_back(frame != nullptr ? *frame : -1);
+        ring.release_read();
+    }
+    writer.join();
+    CHECK_EQ(size_while_waiting, (size_t)2);
+    CHECK_EQ(read, std::vector<int>({0, 1, 2}));
+    CHECK_EQ(ring.stats().writer_waits, (size_t)1);
+    CHECK_EQ(ring.stats().high_water, (size_t)2);
+}
+
+BENCHMARK(ring_buffer, contention_against_double_buffer)
+{
+    struct Load
+    {
+        uint32_t frames;
+        double mean_us;
+    };
+    const Load loads[] = {{test::scale<uint32_t>(200000, 2000), 0.0}, {test::scale<uint32_t>(20000, 200), 20.0}};
+    uint32_t mismatches = 0;
+    for (const Load &load : loads)
+    {
+        const std::string what = std::to_string(load.frames) + " frames, " + test::format(load.mean_us, 0) + " us of work, ";
+        MutexDoubleBuffer<uint8_t> double_buffer(64);
+        const double double_buffer_s = transfer_seconds(double_buffer, load.frames, load.mean_us, mismatches);
+        test::report(what + "DoubleBuffer (mutex)", test::format(double_buffer_s, 3) + " s");
+        for (uint32_t slots : {2u, 4u, 8u})
+        {
+            for (RingBufferWait wait : {RingBufferWait::SPIN_THEN_FUTEX, RingBufferWait::SPIN})
+            {
+                RingBuffer<uint8_t> ring(64, slots, wait);
+                const double ring_s = transfer_seconds(ring, load.frames, load.mean_us, mismatches);
+                test::report(what + "RingBuffer " + std::to_string(slots) + " slots" + (wait == RingBufferWait::SPIN ? ", spin" : ", futex"),
+                             test::format(ring_s, 3) + " s (" + test::format(double_buffer_s / ring_s, 1) + "x)");
+            }
+        }
+    }
+    CHECK_EQ(mismatches, 0u);
+}
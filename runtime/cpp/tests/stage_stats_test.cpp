@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file stage_stats_test.cpp
+ * @brief Latency histograms of the pipeline stages, and the write to read latency window.
+ **/
+#include "test_harness.hpp"
+
+#include "stage_stats.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+TEST_CASE(stage_stats, histogram_percentiles)
+{
+    common::StageStats stats;
+    auto &stage = stats.stage("decode");
+    for (int us = 1; us <= 1000; us++)
+        stage.add(std::chrono::microseconds(us));
+    CHECK_EQ(stage.count(), (size_t)1000);
+    CHECK_NEAR(stage.total_ms(), 500.5, 1e-9);
+    CHECK_NEAR(stage.mean_ms(), 0.5005, 1e-9);
+    CHECK_NEAR(stage.max_ms(), 1.0, 1e-9);
+    // The buckets have 32 sub-buckets per power of two, so about 3% of relative error
+    CHECK_NEAR(stage.percentile_ms(50), 0.5, 0.5 * 0.04);
+    CHECK_NEAR(stage.percentile_ms(99), 0.99, 0.99 * 0.04);
+    CHECK(stage.percentile_ms(100) <= stage.max_ms());
+
+    auto &empty = stats.stage("empty");
+    CHECK_EQ(empty.count(), (size_t)0);
+    CHECK_EQ(empty.mean_ms(), 0.0);
+    CHECK_EQ(empty.percentile_ms(50), 0.0);
+}
+
+TEST_CASE(stage_stats, concurrent_samples)
+{
+    common::StageStats stats;
+    auto &stage = stats.stage("post-process", 4);
+    std::vector<std::thread> workers;
+    for (int worker = 0; worker < 4; worker++)
+    {
+        workers.emplace_back([&stage]
+                             {
+                                 for (int i = 1; i <= 5000; i++)
+                                     stage.add(std::chrono::microseconds(i % 1000 + 1)); });
+    }
+    for (auto &worker : workers)
+        worker.join();
+    CHECK_EQ(stage.count(), (size_t)20000);
+    CHECK_NEAR(stage.max_ms(), 1.0, 1e-9);
+    CHECK_EQ(stage.workers(), (size_t)4);
+
+    std::ostringstream out;
+    stats.print(out, 20000, std::chrono::seconds(1));
+    stats.print_utilization(out, std::chrono::seconds(1));
+    CHECK(out.str().find("post-process") != std::string::npos);
+}
+
+TEST_CASE(stage_stats, latency_window_across_threads)
+{
+    // A writer begins the frames, three readers end them, at most 8 frames apart
+    common::StageStats stats;
+    auto &latency = stats.stage("inference");
+    const size_t frames = 5000;
+    const size_t readers = 3;
+    common::LatencyWindow window(latency, 16, readers);
+    std::atomic<size_t> written(0);
+    std::vector<std::atomic<size_t>> done(readers);
+    for (auto &count : done)
+        count = 0;
+
+    std::thread writer([&]
+                       {
+                           for (size_t frame = 0; frame < frames; frame++)
+                           {
+                               for (auto &count : done)
+                               {
+                                   while (frame >= count.load() + 8)
+                                       std::this_thread::yield();
+                               }
+                               window.begin(frame, common::StageStats::Clock::now());
+                               written.store(frame + 1, std::memory_order_release);
+                           } });
+    std::vector<std::thread> reader_threads;
+    for (size_t reader = 0; reader < readers; reader++)
+    {
+        reader_threads.emplace_back([&, reader]
+                                    {
+                                        for (size_t frame = 0; frame < frames; frame++)
+                                        {
+                                            while (written.load(std::memory_order_acquire) <= frame)
+                                                std::this_thread::yield();
+                                            window.end(frame, common::StageStats::Clock::now());
+                                            done[reader].store(frame + 1);
+                                        } });
+    }
+    writer.join();
+    for (auto &reader : reader_threads)
+        reader.join();
+    CHECK_EQ(latency.count(), frames);
+}
+
+TEST_CASE(stage_stats, latency_window_last_end_wins)
+{
+    common::StageStats stats;
+    auto &latency = stats.stage("inference");
+    common::LatencyWindow window(latency, 4, 2);
+    common::StageStats::Clock::time_point begin;
+    window.begin(0, begin);
+    window.end(0, begin + std::chrono::milliseconds(3));
+    CHECK_EQ(latency.count(), (size_t)0);
+    window.end(0, begin + std::chrono::milliseconds(2));
+    CHECK_EQ(latency.count(), (size_t)1);
+    CHECK_NEAR(latency.max_ms(), 3.0, 1e-9);
+
+    // A frame whose slot was taken by a later frame is dropped
+    window.begin(1, begin);
+    window.begin(5, begin);
+    window.end(1, begin + std::chrono::milliseconds(1));
+    window.end(1, begin + std::chrono::milliseconds(1));
+    CHECK_EQ(latency.count(), (size_t)1);
+}
@@ -0,0 +1,184 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file test_harness.hpp
+ * @brief Registration, checks and timing of the unit tests and microbenchmarks of hailo_postprocess_tests.
+ **/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace test
+{
+    /**
+     * @brief A failed check, thrown to end the test case.
+     */
+    class Failure : public std::runtime_error
+    {
+    public:
+        explicit Failure(const std::string &message) : std::runtime_error(message){};
+    };
+
+    struct Case
+    {
+        std::string name; // <suite>.<case>
+        void (*run)();
+        bool benchmark;
+    };
+
+    inline std::vector<Case> &cases()
+    {
+        static std::vector<Case> registered;
+        return registered;
+    }
+
+    struct Registrar
+    {
+        Registrar(const char *suite, const char *name, void (*run)(), bool benchmark)
+        {
+            cases().push_back(Case{std::string(suite) + "." + name, run, benchmark});
+        }
+    };
+
+    /**
+     * @brief Whether the benchmarks run a short version (--quick), as ctest does to keep them working.
+     */
+    inline bool &quick()
+    {
+        static bool value = false;
+        return value;
+    }
+
+    /**
+     * @brief Size of a benchmark: full, or quick_size under --quick.
+     */
+    template <typename T>
+    T scale(T full, T quick_size)
+    {
+        return quick() ? quick_size : full;
+    }
+
+    /**
+     * @brief Median wall time of repeats calls of run, in microseconds.
+     */
+    template <typename Run>
+    double median_us(size_t repeats, Run run)
+    {
+        std::vector<double> times(repeats != 0 ? repeats : 1);
+        for (auto &time : times)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            run();
+            time = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+        }
+        std::nth_element(times.begin(), times.begin() + (long)(times.size() / 2), times.end());
+        return times[times.size() / 2];
+    }
+
+    /**
+     * @brief Print one result line of a benchmark.
+     */
+    inline void report(const std::string &what, const std::string &result)
+    {
+        std::cout << "    " << std::left << std::setw(56) << what << result << std::endl;
+    }
+
+    inline std::string format(double value, int precision = 2)
+    {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(precision) << value;
+        return out.str();
+    }
+
+    template <typename T>
+    std::string describe(const T &value)
+    {
+        std::ostringstream out;
+        out << value;
+        return out.str();
+    }
+
+    inline std::string describe(uint8_t value) { return std::to_string((int)value); }
+
+    template <typename T>
+    std::string describe(const std::vector<T> &values)
+    {
+        std::string text = "[";
+        for (size_t i = 0; i < values.size() && i < 16; i++)
+            text += (i != 0 ? ", " : "") + describe(values[i]);
+        return text + (values.size() > 16 ? ", ... (" + std::to_string(values.size()) + ")]" : "]");
+    }
+
+    [[noreturn]] inline void fail(const char *file, int line, const std::string &message)
+    {
+        throw Failure(std::string(file) + ":" + std::to_string(line) + ": " + message);
+    }
+
+    template <typename A, typename B>
+    void check_eq(const A &a, const B &b, const char *a_text, const char *b_text, const char *file, int line)
+    {
+        if (!(a == b))
+            fail(file, line, std::string("CHECK_EQ(") + a_text + ", " + b_text + "): " + describe(a) + " != " + describe(b));
+    }
+
+    inline void check_near(double a, double b, double tolerance, const char *a_text, const char *b_text, const char *file, int line)
+    {
+        if (!(std::fabs(a - b) <= tolerance))
+            fail(file, line, std::string("CHECK_NEAR(") + a_text + ", " + b_text + "): " + describe(a) + " and " + describe(b) +
+                                 " differ by more than " + describe(tolerance));
+    }
+}
+
+#define TEST_REGISTER_(suite, name, benchmark)                                                       \
+    static void suite##_##name();                                                                    \
+    static test::Registrar suite##_##name##_registrar(#suite, #name, &suite##_##name, benchmark); \
+    static void suite##_##name()
+
+/**
+ * A unit test, run by default. The suite name is also the ctest name (see tests/CMakeLists.txt).
+ */
+#define TEST_CASE(suite, name) TEST_REGISTER_(suite, name, false)
+
+/**
+ * A microbenchmark, run with --bench. It prints its results with test::report() and may check them.
+ */
+#define BENCHMARK(suite, name) TEST_REGISTER_(suite, name, true)
+
+#define CHECK(condition)                                                     \
+    do                                                                       \
+    {                                                                        \
+        if (!(condition))                                                    \
+            test::fail(__FILE__, __LINE__, "CHECK(" #condition ") failed"); \
+    } while (0)
+
+#define CHECK_EQ(a, b) test::check_eq((a), (b), #a, #b, __FILE__, __LINE__)
+
+#define CHECK_NEAR(a, b, tolerance) test::check_near((double)(a), (double)(b), (double)(tolerance), #a, #b, __FILE__, __LINE__)
+
+#define CHECK_THROWS(statement, exception)                                                     \
+    do                                                                                         \
+    {                                                                                          \
+        bool thrown = false;                                                                   \
+        try                                                                                    \
+        {                                                                                      \
+            statement;                                                                         \
+        }                                                                                      \
+        catch (const exception &)                                                              \
+        {                                                                                      \
+            thrown = true;                                                                     \
+        }                                                                                      \
+        if (!thrown)                                                                           \
+            test::fail(__FILE__, __LINE__, "CHECK_THROWS(" #statement ", " #exception ") failed"); \
+    } while (0)
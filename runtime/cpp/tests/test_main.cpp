@@ -0,0 +1,105 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file test_main.cpp
+ * @brief Runner of the unit tests and microbenchmarks of the post-processing library, no Hailo device needed.
+ *
+ * hailo_postprocess_tests [--bench] [--quick] [--list] [<suite>|<suite>.<case> ...]
+ *   --bench  run the microbenchmarks instead of the unit tests
+ *   --quick  short benchmarks, to check they still run
+ *   --list   print the names of the tests (or benchmarks) and exit
+ **/
+#include "test_harness.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static bool selected(const std::string &name, const std::vector<std::string> &filters)
+{
+    if (filters.empty())
+        return true;
+    for (auto &filter : filters)
+    {
+        if (name == filter || name.compare(0, filter.size() + 1, filter + ".") == 0)
+            return true;
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    bool benchmarks = false;
+    bool list = false;
+    std::vector<std::string> filters;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--bench") == 0)
+            benchmarks = true;
+        else if (std::strcmp(argv[i], "--quick") == 0)
+            test::quick() = true;
+        else if (std::strcmp(argv[i], "--list") == 0)
+            list = true;
+        else if (argv[i][0] == '-')
+        {
+            std::cerr << "-E- Unknown option " << argv[i] << std::endl
+                      << "usage: " << argv[0] << " [--bench] [--quick] [--list] [<suite>|<suite>.<case> ...]" << std::endl;
+            return 2;
+        }
+        else
+            filters.push_back(argv[i]);
+    }
+
+    size_t run = 0;
+    size_t failed = 0;
+    for (auto &test_case : test::cases())
+    {
+        if (test_case.benchmark != benchmarks || !selected(test_case.name, filters))
+            continue;
+        run++;
+        if (list)
+        {
+            std::cout << test_case.name << std::endl;
+            continue;
+        }
+
+        std::cout << "[ RUN      ] " << test_case.name << std::endl;
+        auto begin = std::chrono::steady_clock::now();
+        std::string error;
+        try
+        {
+            test_case.run();
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+        }
+        catch (...)
+        {
+            error = "unknown exception";
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+        if (error.empty())
+            std::cout << "[       OK ] " << test_case.name << " (" << ms << " ms)" << std::endl;
+        else
+        {
+            failed++;
+            std::cout << "[  FAILED  ] " << test_case.name << ": " << error << std::endl;
+        }
+    }
+
+    // Some executables have no benchmarks (e.g. without the dependencies of an example), only a filter has to match
+    if (run == 0 && !filters.empty())
+    {
+        std::cerr << "-E- No " << (benchmarks ? "benchmark" : "test") << " matches the filter" << std::endl;
+        return 1;
+    }
+    if (!list)
+        std::cout << run - failed << "/" << run << (benchmarks ? " benchmarks" : " tests") << " passed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
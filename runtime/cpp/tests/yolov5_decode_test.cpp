@@ -0,0 +1,285 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file yolov5_decode_test.cpp
+ * @brief The batched quantized YOLOv5 decoder (yolov5_decode) against the per-cell YoloOutputLayer path, and the
+ *        allocations of a frame with flat detection records against the HailoDetection objects they replaced.
+ **/
+#include "test_harness.hpp"
+#include "allocation_counter.hpp"
+
+#include "yolo_output.hpp"
+#include "nms.hpp"
+#include "hailo_common.hpp"
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const uint IMAGE_SIZE = 640;
+    const uint FEATURES = 255; // 3 anchors of 4 box + 1 objectness + 80 classes
+
+    /**
+     * @brief A synthetic output layer: low values everywhere, with a few high (objectness and class) values,
+     *        as a network output has.
+     */
+    struct SyntheticLayer
+    {
+        std::vector<uint8_t> buffer;
+        HailoTensorPtr tensor;
+        std::vector<int> anchors;
+
+        template <typename T>
+        static SyntheticLayer make(std::mt19937 &random, uint size, std::vector<int> anchors)
+        {
+            SyntheticLayer layer;
+            const size_t count = (size_t)size * size * FEATURES;
+            layer.buffer.resize(count * sizeof(T));
+            T *data = reinterpret_cast<T *>(layer.buffer.data());
+            const uint32_t max = std::numeric_limits<T>::max();
+            for (size_t i = 0; i < count; i++)
+                data[i] = (T)(random() % 250 != 0 ? random() % (max / 2) : max - random() % (max / 4));
+
+            hailo_vstream_info_t info;
+            std::memset(&info, 0, sizeof(info));
+            std::string name = "yolov5m/conv" + std::to_string(size);
+            std::strncpy(info.name, name.c_str(), sizeof(info.name) - 1);
+            info.format.type = sizeof(T) == 2 ? HAILO_FORMAT_TYPE_UINT16 : HAILO_FORMAT_TYPE_UINT8;
+            info.format.order = HAILO_FORMAT_ORDER_NHWC;
+            info.shape.height = size;
+            info.shape.width = size;
+            info.shape.features = FEATURES;
+            info.quant_info.qp_scale = sizeof(T) == 2 ? 0.0000153f : 0.0039f;
+            info.quant_info.qp_zp = sizeof(T) == 2 ? 1200.0f : 3.0f;
+            layer.tensor = std::make_shared<HailoTensor>(layer.buffer.data(), info);
+            layer.anchors = anchors;
+            return layer;
+        }
+    };
+
+    template <typename T>
+    std::vector<SyntheticLayer> make_layers(uint32_t seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<SyntheticLayer> layers;
+        layers.push_back(SyntheticLayer::make<T>(random, 80, {10, 13, 16, 30, 33, 23}));
+        layers.push_back(SyntheticLayer::make<T>(random, 40, {30, 61, 62, 45, 59, 119}));
+        layers.push_back(SyntheticLayer::make<T>(random, 20, {116, 90, 156, 198, 373, 326}));
+        return layers;
+    }
+
+    std::map<uint8_t, std::string> coco_labels()
+    {
+        std::map<uint8_t, std::string> labels;
+        for (int i = 0; i <= 80; i++)
+            labels[(uint8_t)i] = "class_" + std::to_string(i);
+        return labels;
+    }
+
+    const float DETECTION_THRESHOLD = 0.3f;
+    const float IOU_THRESHOLD = 0.45f;
+    const uint MAX_BOXES = 200;
+
+    /**
+     * @brief The detections of a frame before the records: a copy of the labels and a box vector for the
+     *        YoloPost made per frame, a HailoDetection per candidate, the NMS on them, and a shared
+     *        HailoDetection per kept detection added to the ROI.
+     */
+    void previous_detections(std::vector<std::unique_ptr<Yolov5OL>> &outputs, const std::map<uint8_t, std::string> &labels, HailoROIPtr roi)
+    {
+        std::map<uint8_t, std::string> dataset = labels;
+        std::vector<common::DetectionRecord> boxes;
+        std::vector<HailoDetection> objects;
+        objects.reserve(MAX_BOXES);
+        for (auto &output : outputs)
+        {
+            boxes.clear();
+            output->decode_boxes(DETECTION_THRESHOLD, IMAGE_SIZE, IMAGE_SIZE, boxes);
+            for (auto &box : boxes)
+                objects.push_back(HailoDetection(HailoBBox(box.xmin, box.ymin, box.width, box.height), box.class_id, dataset[(uint8_t)box.class_id], box.confidence));
+        }
+        common::nms(objects, IOU_THRESHOLD);
+        if (objects.size() > MAX_BOXES)
+            objects.resize(MAX_BOXES, HailoDetection(HailoBBox(0, 0, 1, 1), "None", 0.0f));
+        hailo_common::add_detections(roi, objects);
+    }
+
+    /**
+     * @brief The detections of a frame as records in the arena of its slot, drawn from the records.
+     */
+    void record_detections(std::vector<std::unique_ptr<Yolov5OL>> &outputs, common::DetectionArena &arena)
+    {
+        arena.reset();
+        for (auto &output : outputs)
+            output->decode_boxes(DETECTION_THRESHOLD, IMAGE_SIZE, IMAGE_SIZE, arena.records());
+        common::nms(arena.records(), IOU_THRESHOLD);
+        if (arena.size() > MAX_BOXES)
+            arena.records().resize(MAX_BOXES);
+    }
+
+    /**
+     * @brief A Yolov5OL that applies the sigmoid to the objectness and the class scores. The Yolov5OL constructor
+     *        always passes false to YoloOutputLayer (as upstream does), so the flag is set here.
+     */
+    class SigmoidYolov5OL : public Yolov5OL
+    {
+    public:
+        SigmoidYolov5OL(HailoTensorPtr tensor, std::vector<int> anchors, int label_offset)
+            : Yolov5OL(tensor, anchors, true, label_offset)
+        {
+            _perform_sigmoid = true;
+        }
+    };
+
+    bool same_record(const common::DetectionRecord &a, const common::DetectionRecord &b)
+    {
+        return a.xmin == b.xmin && a.ymin == b.ymin && a.width == b.width && a.height == b.height &&
+               a.confidence == b.confidence && a.class_id == b.class_id && a.label_index == b.label_index;
+    }
+
+    template <typename T>
+    void check_equivalence(float threshold, int label_offset, bool perform_sigmoid = false)
+    {
+        for (uint32_t seed = 1; seed <= 3; seed++)
+        {
+            auto layers = make_layers<T>(seed);
+            std::vector<common::DetectionRecord> batched, per_cell;
+            for (auto &synthetic : layers)
+            {
+                std::unique_ptr<Yolov5OL> layer;
+                if (perform_sigmoid)
+                    layer.reset(new SigmoidYolov5OL(synthetic.tensor, synthetic.anchors, label_offset));
+                else
+                    layer.reset(new Yolov5OL(synthetic.tensor, synthetic.anchors, false, label_offset));
+                layer->decode_boxes(threshold, IMAGE_SIZE, IMAGE_SIZE, batched);
+                layer->YoloOutputLayer::decode_boxes(threshold, IMAGE_SIZE, IMAGE_SIZE, per_cell);
+            }
+            CHECK(!per_cell.empty());
+            CHECK_EQ(batched.size(), per_cell.size());
+            for (size_t i = 0; i < batched.size(); i++)
+            {
+                if (!same_record(batched[i], per_cell[i]))
+                    test::fail(__FILE__, __LINE__, "box " + std::to_string(i) + " differs, seed " + std::to_string(seed));
+            }
+        }
+    }
+}
+
+TEST_CASE(yolov5_decode, matches_per_cell_path_uint8)
+{
+    check_equivalence<uint8_t>(0.3f, 1);
+    check_equivalence<uint8_t>(0.1f, 0);
+}
+
+TEST_CASE(yolov5_decode, matches_per_cell_path_uint16)
+{
+    check_equivalence<uint16_t>(0.3f, 1);
+    check_equivalence<uint16_t>(0.1f, 0);
+}
+
+TEST_CASE(yolov5_decode, matches_per_cell_path_with_sigmoid)
+{
+    // the sigmoid of the scores is in about [0.5, 0.73]: the product of two of them passes 0.5 only when both scores
+    // are high (tens of boxes a frame), and 0.4 for most high objectness scores (thousands of boxes)
+    check_equivalence<uint8_t>(0.5f, 1, true);
+    check_equivalence<uint8_t>(0.4f, 0, true);
+    check_equivalence<uint16_t>(0.5f, 1, true);
+    check_equivalence<uint16_t>(0.4f, 0, true);
+}
+
+TEST_CASE(yolov5_decode, argmax_takes_the_first_maximum)
+{
+    for (uint count : {1u, 7u, 16u, 31u, 32u, 33u, 80u})
+    {
+        std::vector<uint8_t> values(count, 3);
+        std::vector<uint16_t> wide(count, 3);
+        values[count / 2] = 200;
+        values[count - 1] = 200;
+        wide[count / 2] = 60000;
+        wide[count - 1] = 60000;
+        CHECK_EQ(common::argmax(values.data(), count).first, count / 2);
+        CHECK_EQ((uint)common::argmax(values.data(), count).second, 200u);
+        CHECK_EQ(common::argmax(wide.data(), count).first, count / 2);
+        CHECK_EQ((uint)common::argmax(wide.data(), count).second, 60000u);
+    }
+}
+
+BENCHMARK(yolov5_decode, frame_of_three_layers)
+{
+    const size_t repeats = test::scale<size_t>(50, 2);
+    auto layers = make_layers<uint8_t>(1);
+    std::vector<common::DetectionRecord> boxes;
+    boxes.reserve(4096);
+    std::vector<std::unique_ptr<Yolov5OL>> outputs;
+    for (auto &synthetic : layers)
+        outputs.emplace_back(new Yolov5OL(synthetic.tensor, synthetic.anchors, false, 1));
+
+    double per_cell_us = test::median_us(repeats, [&]
+                                         {
+                                             boxes.clear();
+                                             for (auto &output : outputs)
+                                                 output->YoloOutputLayer::decode_boxes(0.3f, IMAGE_SIZE, IMAGE_SIZE, boxes); });
+    size_t per_cell_boxes = boxes.size();
+    double batched_us = test::median_us(repeats, [&]
+                                        {
+                                            boxes.clear();
+                                            for (auto &output : outputs)
+                                                output->decode_boxes(0.3f, IMAGE_SIZE, IMAGE_SIZE, boxes); });
+    CHECK_EQ(boxes.size(), per_cell_boxes);
+    test::report("80x80/40x40/20x20x255 uint8, per-cell path", test::format(per_cell_us, 1) + " us/frame");
+    test::report("80x80/40x40/20x20x255 uint8, batched decoder", test::format(batched_us, 1) + " us/frame (" +
+                                                                     test::format(per_cell_us / batched_us, 1) + "x, " +
+                                                                     std::to_string(boxes.size()) + " boxes)");
+}
+
+BENCHMARK(yolov5_decode, allocations_per_frame)
+{
+    const size_t frames = test::scale<size_t>(50, 3);
+    const size_t warm_up = 3;
+    const std::map<uint8_t, std::string> labels = coco_labels();
+    for (uint32_t seed : {1u, 2u})
+    {
+        auto layers = make_layers<uint8_t>(seed);
+        std::vector<std::unique_ptr<Yolov5OL>> outputs;
+        for (auto &synthetic : layers)
+            outputs.emplace_back(new Yolov5OL(synthetic.tensor, synthetic.anchors, false, 1));
+        std::vector<HailoROIPtr> rois;
+        for (size_t i = 0; i < warm_up + frames; i++)
+            rois.push_back(std::make_shared<HailoROI>(HailoBBox(0.0f, 0.0f, 1.0f, 1.0f)));
+
+        size_t index = 0;
+        size_t previous_allocations = 0;
+        double previous_us = test::median_us(warm_up + frames, [&]
+                                             {
+                                                 const size_t before = test::allocations();
+                                                 previous_detections(outputs, labels, rois[index]);
+                                                 if (index++ >= warm_up)
+                                                     previous_allocations += test::allocations() - before; });
+        const size_t kept = rois.back()->get_objects_typed(HAILO_DETECTION).size();
+
+        common::DetectionArena arena;
+        index = 0;
+        size_t record_allocations = 0;
+        double record_us = test::median_us(warm_up + frames, [&]
+                                           {
+                                               const size_t before = test::allocations();
+                                               record_detections(outputs, arena);
+                                               if (index++ >= warm_up)
+                                                   record_allocations += test::allocations() - before; });
+        CHECK_EQ(arena.size(), kept);
+        CHECK_EQ(record_allocations, (size_t)0);
+
+        const std::string frame = "seed " + std::to_string(seed) + ", " + std::to_string(kept) + " kept, ";
+        test::report(frame + "HailoDetection objects",
+                     test::format(previous_us, 1) + " us/frame, " + test::format((double)previous_allocations / (double)frames, 1) + " allocations/frame");
+        test::report(frame + "DetectionRecord arena",
+                     test::format(record_us, 1) + " us/frame, " + test::format((double)record_allocations / (double)frames, 1) + " allocations/frame");
+    }
+}
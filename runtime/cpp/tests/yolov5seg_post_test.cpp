@@ -0,0 +1,192 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file yolov5seg_post_test.cpp
+ * @brief The heap allocations of the yolov5seg post-process in steady state, counted by a replaced operator new
+ *        (allocation_counter.cpp).
+ **/
+#include "test_harness.hpp"
+#include "allocation_counter.hpp"
+
+#include "yolov5seg.hpp"
+#include "hailo_common.hpp"
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+void yolov5seg_post(HailoROIPtr roi, const Yolov5segParams &params, std::vector<HailoDetection> &detections);
+
+namespace
+{
+    const int PROTO_SIZE = 160;
+    const int PROTO_CHANNELS = 32;
+    const int ROW_SIZE = 117; // {x, y, w, h, is_object, 80 class scores, 32 mask coefficients}
+    const int NUM_ANCHORS = 3;
+
+    // The allocations of a candidate: its HailoDetection (the mutexes of HailoObject and HailoMainObject, the vector
+    // of its sub-objects), and its mask coefficients with their HailoMatrix (the object and its mutex)
+    const size_t ALLOCATIONS_PER_CANDIDATE = 6;
+    // and of the float mask of a detection kept by the NMS: its HailoConfClassMask (the object and its mutex) and the
+    // copy of the sub-objects the coefficients are looked up in, plus its data unless its box is empty in the prototypes
+    const size_t ALLOCATIONS_PER_FLOAT_MASK = 3;
+
+    /**
+     * @brief The outputs of a frame: the prototypes, and the branches of strides 32, 16 and 8.
+     *        is_object is high in about hot rows per thousand, low in the others.
+     */
+    template <typename T>
+    struct SyntheticFrame
+    {
+        std::vector<std::vector<T>> buffers;
+        std::vector<hailo_vstream_info_t> infos;
+
+        SyntheticFrame(std::mt19937 &random, const Yolov5segParams &params, int hot)
+        {
+            const int top = sizeof(T) == 2 ? 65535 : 255;
+            add_output(random, params.outputs_name[0], PROTO_SIZE, PROTO_CHANNELS, top);
+            // outputs_name[3] is the branch of stride 32, outputs_name[1] the one of stride 8
+            for (int branch = 0; branch < 3; branch++)
+            {
+                const int size = params.outputs_size[branch];
+                std::vector<T> &rows = add_output(random, params.outputs_name[3 - branch], size, NUM_ANCHORS * ROW_SIZE, top);
+                for (size_t row = 0; row < (size_t)size * size * NUM_ANCHORS; row++)
+                {
+                    const bool object = (int)(random() % 1000) < hot;
+                    rows[row * ROW_SIZE + 4] = object ? (T)(top * 3 / 4 + random() % (top / 4)) : (T)(random() % (top / 3));
+                }
+            }
+        }
+
+        std::vector<T> &add_output(std::mt19937 &random, const std::string &name, int size, int features, int top)
+        {
+            hailo_vstream_info_t info{};
+            std::strncpy(info.name, name.c_str(), sizeof(info.name) - 1);
+            info.shape.height = size;
+            info.shape.width = size;
+            info.shape.features = features;
+            info.format.type = sizeof(T) == 2 ? HAILO_FORMAT_TYPE_UINT16 : HAILO_FORMAT_TYPE_UINT8;
+            info.quant_info.qp_zp = (float)(top / 2);
+            info.quant_info.qp_scale = 8.0f / top;
+            infos.push_back(info);
+            buffers.emplace_back((size_t)size * size * features);
+            for (auto &value : buffers.back())
+                value = (T)(random() % (top + 1));
+            return buffers.back();
+        }
+
+        HailoROIPtr roi()
+        {
+            HailoROIPtr roi = std::make_shared<HailoROI>(HailoBBox(0.0f, 0.0f, 1.0f, 1.0f));
+            for (size_t i = 0; i < buffers.size(); i++)
+                roi->add_tensor(std::make_shared<HailoTensor>(reinterpret_cast<uint16_t *>(buffers[i].data()), infos[i]));
+            return roi;
+        }
+    };
+
+    struct Counts
+    {
+        size_t allocations;
+        size_t detections;
+        size_t mask_data; // the float masks with data
+    };
+
+    // The allocations of the post-process of the frames after the warm up, the ROIs are made outside of the count
+    template <typename T>
+    Counts count_allocations(SyntheticFrame<T> &frame, const Yolov5segParams &params, size_t warm_up, size_t frames)
+    {
+        Counts counts = {0, 0, 0};
+        std::vector<HailoDetection> detections;
+        for (size_t i = 0; i < warm_up + frames; i++)
+        {
+            HailoROIPtr roi = frame.roi();
+            detections.clear();
+            const size_t before = test::allocations();
+            yolov5seg_post(roi, params, detections);
+            if (i >= warm_up)
+            {
+                counts.allocations += test::allocations() - before;
+                counts.detections += detections.size();
+                for (auto &detection : detections)
+                {
+                    for (auto &mask : detection.get_objects_typed(HAILO_CONF_CLASS_MASK))
+                        counts.mask_data += !std::dynamic_pointer_cast<HailoConfClassMask>(mask)->get_data().empty();
+                }
+            }
+        }
+        return counts;
+    }
+
+    template <typename T>
+    void check_frames_without_detections()
+    {
+        std::mt19937 random(3);
+        Yolov5segParams *params = init("", "yolov5seg");
+        SyntheticFrame<T> frame(random, *params, 0);
+        Counts counts = count_allocations(frame, *params, 3, 20);
+        CHECK_EQ(counts.detections, (size_t)0);
+        CHECK_EQ(counts.allocations, (size_t)0);
+        free_resources(params);
+    }
+
+    template <typename T>
+    void check_allocations_per_detection()
+    {
+        std::mt19937 random(5);
+        Yolov5segParams *params = init("", "yolov5seg");
+        params->iou_threshold = 1.1f; // the NMS keeps all the candidates
+        SyntheticFrame<T> frame(random, *params, 5);
+        Counts counts = count_allocations(frame, *params, 3, 20);
+        CHECK(counts.detections > 0);
+        CHECK(counts.mask_data > 0);
+        CHECK_EQ(counts.allocations, counts.detections * (ALLOCATIONS_PER_CANDIDATE + ALLOCATIONS_PER_FLOAT_MASK) + counts.mask_data);
+        free_resources(params);
+    }
+}
+
+TEST_CASE(yolov5seg_post, frames_without_detections_make_no_allocations)
+{
+    check_frames_without_detections<uint8_t>();
+    check_frames_without_detections<uint16_t>();
+}
+
+TEST_CASE(yolov5seg_post, allocations_per_detection)
+{
+    check_allocations_per_detection<uint8_t>();
+    check_allocations_per_detection<uint16_t>();
+}
+
+BENCHMARK(yolov5seg_post, allocations_and_time_per_frame)
+{
+    std::mt19937 random(7);
+    Yolov5segParams *params = init("", "yolov5seg");
+    const size_t frames = test::scale<size_t>(50, 3);
+    for (int hot : {0, 1, 10})
+    {
+        SyntheticFrame<uint8_t> frame(random, *params, hot);
+        std::vector<HailoDetection> detections;
+        std::vector<HailoROIPtr> rois;
+        for (size_t i = 0; i < frames + 3; i++)
+            rois.push_back(frame.roi());
+        size_t index = 0;
+        size_t allocations = 0;
+        size_t kept = 0;
+        double frame_us = test::median_us(frames + 3, [&]
+                                          {
+                                              detections.clear();
+                                              const size_t before = test::allocations();
+                                              yolov5seg_post(rois[index++], *params, detections);
+                                              if (index > 3)
+                                              {
+                                                  allocations += test::allocations() - before;
+                                                  kept += detections.size();
+                                              } });
+        test::report("is_object high in " + std::to_string(hot) + " rows per thousand",
+                     test::format(frame_us, 1) + " us/frame, " + test::format((double)kept / (double)frames, 1) + " detections, " +
+                         test::format((double)allocations / (double)frames, 1) + " allocations/frame");
+    }
+    free_resources(params);
+}
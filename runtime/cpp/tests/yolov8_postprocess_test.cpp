@@ -0,0 +1,491 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file yolov8_postprocess_test.cpp
+ * @brief The YOLOv8 geometry read from synthetic vstream infos, init()/filter() on synthetic outputs, and the DFL box
+ *        decoder against the float softmax decode it replaced, at 640x640 and 1280x1280.
+ **/
+#include "test_harness.hpp"
+
+#include "yolov8_postprocess.hpp"
+#include "yolov8_decode.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const uint NUM_BINS = 16;
+    const uint STRIDES[] = {8, 16, 32};
+
+    hailo_vstream_info_t vstream_info(const std::string &name, uint height, uint width, uint features,
+                                      hailo_format_type_t type = HAILO_FORMAT_TYPE_UINT8, float qp_scale = 1.0f, float qp_zp = 0.0f)
+    {
+        hailo_vstream_info_t info;
+        std::memset(&info, 0, sizeof(info));
+        std::strncpy(info.name, name.c_str(), sizeof(info.name) - 1);
+        info.format.type = type;
+        info.format.order = HAILO_FORMAT_ORDER_NHWC;
+        info.shape.height = height;
+        info.shape.width = width;
+        info.shape.features = features;
+        info.quant_info.qp_scale = qp_scale;
+        info.quant_info.qp_zp = qp_zp;
+        return info;
+    }
+
+    /**
+     * @brief The vstream infos of a yolov8 model: per stride, a boxes output ("conv<i>") and a scores output ("conv<i + 1>").
+     *        The boxes are dequantized with a scale of 1 (the DFL softmax of one high bin is then exact), the scores to [0, 1].
+     */
+    struct SyntheticModel
+    {
+        hailo_vstream_info_t input;
+        std::vector<hailo_vstream_info_t> outputs;
+
+        SyntheticModel(uint size, uint num_classes, hailo_format_type_t type)
+        {
+            input = vstream_info("yolov8/input_layer1", size, size, 3);
+            const float score_scale = type == HAILO_FORMAT_TYPE_UINT16 ? 1.0f / 65535.0f : 1.0f / 255.0f;
+            int conv = 41;
+            for (uint stride : STRIDES)
+            {
+                outputs.push_back(vstream_info("yolov8/conv" + std::to_string(conv), size / stride, size / stride, 4 * NUM_BINS, type, 1.0f));
+                outputs.push_back(vstream_info("yolov8/conv" + std::to_string(conv + 1), size / stride, size / stride, num_classes, type, score_scale));
+                conv += 10;
+            }
+        }
+    };
+
+    void check_geometry(const common::Yolov8Geometry &geometry, const SyntheticModel &model, uint num_classes)
+    {
+        CHECK_EQ(geometry.network_width, model.input.shape.width);
+        CHECK_EQ(geometry.network_height, model.input.shape.height);
+        CHECK_EQ(geometry.num_classes, num_classes);
+        CHECK_EQ(geometry.regression_length, NUM_BINS - 1);
+        CHECK_EQ(geometry.strides(), std::vector<int>({8, 16, 32}));
+        CHECK_EQ(geometry.levels.size(), (size_t)3);
+        size_t proposals = 0;
+        for (size_t i = 0; i < geometry.levels.size(); i++)
+        {
+            // the model outputs are in stride order, boxes then scores
+            const common::Yolov8OutputLevel &level = geometry.levels[i];
+            const hailo_vstream_info_t &boxes = model.outputs[i * 2];
+            const hailo_vstream_info_t &scores = model.outputs[i * 2 + 1];
+            CHECK_EQ(level.width, boxes.shape.width);
+            CHECK_EQ(level.height, boxes.shape.height);
+            CHECK_EQ(level.boxes_name, std::string(boxes.name));
+            CHECK_EQ(level.scores_name, std::string(scores.name));
+            CHECK(level.boxes_type == boxes.format.type);
+            CHECK_EQ(level.boxes_qp_scale, boxes.quant_info.qp_scale);
+            proposals += (size_t)level.width * level.height;
+        }
+        CHECK_EQ(geometry.max_proposals(), proposals);
+    }
+
+    /**
+     * @brief Output buffers of a frame with a single object: one cell of one level above the score threshold,
+     *        whose box sides are bins[side] strides away from the cell center.
+     */
+    template <typename T>
+    struct SyntheticFrame
+    {
+        std::vector<std::vector<T>> buffers;
+        std::vector<std::string> buffers_names;
+        HailoROIPtr roi;
+
+        SyntheticFrame(const SyntheticModel &model, size_t level, uint row, uint col, uint class_index, T score, const uint bins[4])
+        {
+            roi = std::make_shared<HailoROI>(HailoBBox(0.0f, 0.0f, 1.0f, 1.0f));
+            for (size_t i = 0; i < model.outputs.size(); i++)
+            {
+                const hailo_vstream_info_t &info = model.outputs[i];
+                buffers.emplace_back((size_t)info.shape.height * info.shape.width * info.shape.features, (T)0);
+                buffers_names.emplace_back(info.name);
+                if (i / 2 == level)
+                {
+                    T *cell = buffers.back().data() + ((size_t)row * info.shape.width + col) * info.shape.features;
+                    if (i % 2 == 0)
+                    {
+                        for (uint side = 0; side < 4; side++)
+                            cell[side * NUM_BINS + bins[side]] = std::numeric_limits<T>::max();
+                    }
+                    else
+                        cell[class_index] = score;
+                }
+                roi->add_tensor(std::make_shared<HailoTensor>(reinterpret_cast<uint8_t *>(buffers.back().data()), info));
+            }
+        }
+
+        /**
+         * @brief Raise the score of a random class in count random cells of every level.
+         */
+        void add_proposals(std::mt19937 &random, size_t count, T score)
+        {
+            for (size_t i = 1; i < buffers.size(); i += 2)
+            {
+                const hailo_vstream_info_t &info = roi->get_tensor(buffers_names[i])->vstream_info();
+                for (size_t proposal = 0; proposal < count; proposal++)
+                {
+                    size_t cell = random() % ((size_t)info.shape.height * info.shape.width);
+                    buffers[i][cell * info.shape.features + random() % info.shape.features] = score;
+                }
+            }
+        }
+
+        std::vector<HailoDetectionPtr> detections()
+        {
+            std::vector<HailoDetectionPtr> detections;
+            for (auto &object : roi->get_objects_typed(HAILO_DETECTION))
+                detections.push_back(std::dynamic_pointer_cast<HailoDetection>(object));
+            return detections;
+        }
+    };
+
+    /**
+     * @brief Boxes outputs of all the levels with every bin random, dequantized to about [-10, 10].
+     */
+    template <typename T>
+    struct RandomBoxes
+    {
+        common::Yolov8Geometry geometry;
+        std::vector<std::vector<T>> buffers;
+        float qp_zp;
+
+        RandomBoxes(std::mt19937 &random, uint size)
+        {
+            const hailo_format_type_t type = sizeof(T) == 2 ? HAILO_FORMAT_TYPE_UINT16 : HAILO_FORMAT_TYPE_UINT8;
+            SyntheticModel model(size, 80, type);
+            const float top = (float)std::numeric_limits<T>::max();
+            qp_zp = std::floor(top / 2);
+            for (size_t i = 0; i < model.outputs.size(); i += 2)
+            {
+                model.outputs[i].quant_info.qp_scale = 20.0f / top;
+                model.outputs[i].quant_info.qp_zp = qp_zp;
+            }
+            geometry = common::Yolov8Geometry::from_vstream_infos(model.input, model.outputs);
+            for (const auto &level : geometry.levels)
+            {
+                buffers.emplace_back((size_t)level.width * level.height * 4 * NUM_BINS);
+                for (auto &bin : buffers.back())
+                    bin = (T)(random() % ((size_t)std::numeric_limits<T>::max() + 1));
+            }
+        }
+
+        common::TensorView<T> view(size_t level) const
+        {
+            const common::Yolov8OutputLevel &output = geometry.levels[level];
+            return common::TensorView<T>(buffers[level].data(), output.height, output.width, 4 * NUM_BINS,
+                                         output.boxes_qp_scale, qp_zp);
+        }
+    };
+
+    struct DetectionBox
+    {
+        float xmin;
+        float ymin;
+        float width;
+        float height;
+    };
+
+    /**
+     * @brief The previous decode of a box: the bins dequantized, common::softmax_2D over the 4 sides (the exp of the
+     *        values, without the maximum subtracted), the expected bin index, and the xtensor meshgrid of the centers
+     *        (in double) at (col + 0.5, row + 0.5) * stride.
+     */
+    template <typename T>
+    DetectionBox reference_box(const common::TensorView<T> &boxes, uint row, uint col, uint stride, uint size)
+    {
+        float box[4 * NUM_BINS];
+        const T *bins = boxes.channels(row, col).data();
+        for (uint k = 0; k < 4 * NUM_BINS; k++)
+            box[k] = (float(bins[k]) - boxes.qp_zp()) * boxes.qp_scale();
+        float distances[4];
+        for (uint side = 0; side < 4; side++)
+        {
+            float *side_bins = box + side * NUM_BINS;
+            float sum = 0;
+            for (uint k = 0; k < NUM_BINS; k++)
+                sum += std::exp(side_bins[k]);
+            distances[side] = 0;
+            for (uint k = 0; k < NUM_BINS; k++)
+                distances[side] += std::exp(side_bins[k]) / sum * (float)k;
+            distances[side] *= (float)stride;
+        }
+        const double center_x = (col + 0.5) * stride;
+        const double center_y = (row + 0.5) * stride;
+        const double xmin = center_x - distances[0];
+        const double ymin = center_y - distances[1];
+        const double xmax = center_x + distances[2];
+        const double ymax = center_y + distances[3];
+        return DetectionBox{(float)(xmin / size), (float)(ymin / size), (float)((xmax - xmin) / size), (float)((ymax - ymin) / size)};
+    }
+
+    template <typename T>
+    void check_decoder_against_reference(std::mt19937 &random, uint size)
+    {
+        RandomBoxes<T> outputs(random, size);
+        common::Yolov8BoxDecoder decoder(outputs.geometry);
+        std::vector<common::DetectionRecord> records;
+        float max_difference = 0.0f;
+        size_t boxes = 0;
+        for (size_t level = 0; level < outputs.geometry.levels.size(); level++)
+        {
+            const common::TensorView<T> view = outputs.view(level);
+            const uint stride = outputs.geometry.levels[level].stride;
+            for (uint cell = 0; cell < view.width() * view.height(); cell++)
+            {
+                records.clear();
+                decoder.decode(view, level, cell, 3, 0.5f, records);
+                const DetectionBox expected = reference_box(view, cell / view.width(), cell % view.width(), stride, size);
+                const common::DetectionRecord &record = records[0];
+                for (float difference : {record.xmin - expected.xmin, record.ymin - expected.ymin,
+                                         record.width - expected.width, record.height - expected.height})
+                    max_difference = std::max(max_difference, std::fabs(difference));
+                boxes++;
+            }
+        }
+        CHECK_EQ(boxes, outputs.geometry.max_proposals());
+        CHECK(max_difference <= 1e-4f);
+    }
+
+    template <typename T>
+    void check_filter(uint size, uint num_classes, const std::string &label)
+    {
+        const hailo_format_type_t type = sizeof(T) == 2 ? HAILO_FORMAT_TYPE_UINT16 : HAILO_FORMAT_TYPE_UINT8;
+        SyntheticModel model(size, num_classes, type);
+        std::mt19937 random(size + num_classes);
+        std::shuffle(model.outputs.begin(), model.outputs.end(), random);
+        std::unique_ptr<Yolov8Params> params(init(model.input, model.outputs));
+        SyntheticModel ordered(size, num_classes, type);
+
+        // An object on the 16 stride level, at the cell of row 5 and column 7
+        const uint bins[4] = {1, 2, 3, 4};
+        const T score = (T)(std::numeric_limits<T>::max() * 9 / 10);
+        SyntheticFrame<T> frame(ordered, 1, 5, 7, num_classes - 1, score, bins);
+        filter(frame.roi, params.get());
+        auto detections = frame.detections();
+        CHECK_EQ(detections.size(), (size_t)1);
+        const float center_x = (7 + 0.5f) * 16;
+        const float center_y = (5 + 0.5f) * 16;
+        HailoBBox bbox = detections[0]->get_bbox();
+        CHECK_NEAR(bbox.xmin(), (center_x - bins[0] * 16) / size, 1e-5);
+        CHECK_NEAR(bbox.ymin(), (center_y - bins[1] * 16) / size, 1e-5);
+        CHECK_NEAR(bbox.width(), (float)(bins[0] + bins[2]) * 16 / size, 1e-5);
+        CHECK_NEAR(bbox.height(), (float)(bins[1] + bins[3]) * 16 / size, 1e-5);
+        CHECK_NEAR(detections[0]->get_confidence(), (float)score / std::numeric_limits<T>::max(), 1e-6);
+        CHECK_EQ(detections[0]->get_class_id(), (int)num_classes - 1);
+        CHECK_EQ(detections[0]->get_label(), label);
+
+        // A new threshold applies to the next frame
+        params->set_score_threshold(0.95f);
+        SyntheticFrame<T> next(ordered, 1, 5, 7, num_classes - 1, score, bins);
+        filter(next.roi, params.get());
+        CHECK(next.detections().empty());
+    }
+}
+
+TEST_CASE(yolov8_postprocess, outputs_in_any_order)
+{
+    std::mt19937 random(1);
+    for (uint size : {640u, 1280u})
+    {
+        // 16 classes: both outputs have channels of a multiple of 4, the 64 channels one is the boxes
+        for (uint num_classes : {1u, 16u, 80u})
+        {
+            for (hailo_format_type_t type : {HAILO_FORMAT_TYPE_UINT8, HAILO_FORMAT_TYPE_UINT16})
+            {
+                SyntheticModel model(size, num_classes, type);
+                SyntheticModel shuffled(size, num_classes, type);
+                for (int trial = 0; trial < 8; trial++)
+                {
+                    check_geometry(common::Yolov8Geometry::from_vstream_infos(shuffled.input, shuffled.outputs), model, num_classes);
+                    std::shuffle(shuffled.outputs.begin(), shuffled.outputs.end(), random);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE(yolov8_postprocess, boxes_quantization_per_level)
+{
+    SyntheticModel model(640, 80, HAILO_FORMAT_TYPE_UINT8);
+    model.outputs[0].format.type = HAILO_FORMAT_TYPE_UINT16;
+    model.outputs[2].quant_info.qp_scale = 0.125f;
+    model.outputs[4].quant_info.qp_scale = 0.0625f;
+    auto geometry = common::Yolov8Geometry::from_vstream_infos(model.input, model.outputs);
+    check_geometry(geometry, model, 80);
+    CHECK(geometry.levels[0].boxes_type == HAILO_FORMAT_TYPE_UINT16);
+    CHECK(geometry.levels[1].boxes_type == HAILO_FORMAT_TYPE_UINT8);
+    CHECK_EQ(geometry.levels[1].boxes_qp_scale, 0.125f);
+    CHECK_EQ(geometry.levels[2].boxes_qp_scale, 0.0625f);
+}
+
+TEST_CASE(yolov8_postprocess, malformed_layouts_throw)
+{
+    auto geometry_of = [](const SyntheticModel &model)
+    { return common::Yolov8Geometry::from_vstream_infos(model.input, model.outputs); };
+    const SyntheticModel valid(640, 80, HAILO_FORMAT_TYPE_UINT8);
+
+    SyntheticModel model = valid;
+    model.input.shape.width = 0;
+    CHECK_THROWS(geometry_of(model), std::invalid_argument);
+
+    model = valid;
+    model.outputs.pop_back();
+    CHECK_THROWS(geometry_of(model), std::invalid_argument);
+
+    model = valid;
+    model.outputs.clear();
+    CHECK_THROWS(geometry_of(model), std::invalid_argument);
+
+    model = valid;
+    model.outputs[0].format.order = HAILO_FORMAT_ORDER_HAILO_NMS;
+    CHECK_THROWS(geometry_of(model), std::invalid_argument);
+
+    // no output of the same shape to pair with
+    model = valid;
+    model.outputs[1].shape.width = model.outputs[1].shape.height = 41;
+    CHECK_THROWS(geometry_of(model), std::invalid_argument);
+
+    // no boxes output
+    model = valid;
+    model.outputs[0].shape.features = 5;
+    model.outputs[1].shape.features = 3;
+    CHECK_THROWS(geometry_of(model), std::invalid_argument);
+
+    // a shape which doesn't divide the input size
+    model = valid;
+    model.outputs[4].shape.width = model.outputs[5].shape.width = 30;
+    model.outputs[4].shape.height = model.outputs[5].shape.height = 30;
+    CHECK_THROWS(geometry_of(model), std::invalid_argument);
+
+    // strides with other classes or bins
+    model = valid;
+    model.outputs[3].shape.features = 81;
+    CHECK_THROWS(geometry_of(model), std::invalid_argument);
+    model = valid;
+    model.outputs[2].shape.features = 4 * 8;
+    CHECK_THROWS(geometry_of(model), std::invalid_argument);
+
+    // two pairs of the same stride
+    model = valid;
+    model.outputs[4].shape = model.outputs[5].shape = model.outputs[2].shape;
+    CHECK_THROWS(geometry_of(model), std::invalid_argument);
+
+    CHECK_EQ(geometry_of(valid).levels.size(), (size_t)3);
+}
+
+TEST_CASE(yolov8_postprocess, filter_decodes_with_the_quantization_of_the_outputs)
+{
+    check_filter<uint8_t>(640, 80, "toothbrush");
+    check_filter<uint16_t>(640, 80, "toothbrush");
+    check_filter<uint8_t>(1280, 1, "class_0");
+    check_filter<uint16_t>(1280, 16, "class_15");
+}
+
+TEST_CASE(yolov8_postprocess, decoder_matches_the_float_softmax_decode)
+{
+    std::mt19937 random(9);
+    for (uint size : {640u, 1280u})
+    {
+        check_decoder_against_reference<uint8_t>(random, size);
+        check_decoder_against_reference<uint16_t>(random, size);
+    }
+}
+
+TEST_CASE(yolov8_postprocess, class_count_fits_the_labels)
+{
+    // the last class has the last uint8_t label
+    check_filter<uint8_t>(640, Yolov8Params::MAX_CLASSES, "class_254");
+    SyntheticModel model(640, Yolov8Params::MAX_CLASSES + 1, HAILO_FORMAT_TYPE_UINT8);
+    CHECK_THROWS(std::unique_ptr<Yolov8Params>(init(model.input, model.outputs)), std::invalid_argument);
+}
+
+TEST_CASE(yolov8_postprocess, thresholds_are_validated)
+{
+    SyntheticModel model(640, 80, HAILO_FORMAT_TYPE_UINT8);
+    std::unique_ptr<Yolov8Params> params(init(model.input, model.outputs));
+    const float default_score_threshold = Yolov8Params::DEFAULT_SCORE_THRESHOLD;
+    const float default_iou_threshold = Yolov8Params::DEFAULT_IOU_THRESHOLD;
+    CHECK_EQ(params->score_threshold(), default_score_threshold);
+    CHECK_EQ(params->iou_threshold(), default_iou_threshold);
+    CHECK_THROWS(params->set_score_threshold(1.5f), std::invalid_argument);
+    CHECK_THROWS(params->set_iou_threshold(-0.1f), std::invalid_argument);
+    params->set_iou_threshold(0.5f);
+    CHECK_EQ(params->iou_threshold(), 0.5f);
+}
+
+BENCHMARK(yolov8_postprocess, filter_per_frame)
+{
+    const size_t repeats = test::scale<size_t>(200, 5);
+    const uint bins[4] = {1, 2, 3, 4};
+    std::mt19937 random(3);
+    for (uint size : {640u, 1280u})
+    {
+        SyntheticModel model(size, 80, HAILO_FORMAT_TYPE_UINT8);
+        std::unique_ptr<Yolov8Params> params(init(model.input, model.outputs));
+        for (size_t proposals : {0, 10, 100})
+        {
+            // the single object of the frame is below the threshold, only the added proposals pass
+            SyntheticFrame<uint8_t> frame(model, 1, 5, 7, 0, 10, bins);
+            frame.add_proposals(random, proposals, 240);
+            size_t detections = 0;
+            double us = test::median_us(repeats, [&]
+                                        {
+                                            frame.roi->remove_objects_typed(HAILO_DETECTION);
+                                            filter(frame.roi, params.get());
+                                            detections = frame.detections().size(); });
+            CHECK(detections <= proposals * 3);
+            test::report(std::to_string(size) + "x" + std::to_string(size) + ", 80 classes, " + std::to_string(proposals * 3) + " proposals",
+                         test::format(us, 1) + " us/frame (" + std::to_string(detections) + " detections after NMS)");
+        }
+    }
+}
+
+BENCHMARK(yolov8_postprocess, box_decode)
+{
+    // every cell of every level decoded, random bins
+    const size_t repeats = test::scale<size_t>(20, 2);
+    std::mt19937 random(5);
+    for (uint size : {640u, 1280u})
+    {
+        RandomBoxes<uint8_t> outputs(random, size);
+        common::Yolov8BoxDecoder decoder(outputs.geometry);
+        std::vector<common::DetectionRecord> records;
+        records.reserve(outputs.geometry.max_proposals());
+        float sink = 0.0f;
+        double decoder_us = test::median_us(repeats, [&]
+                                            {
+                                                records.clear();
+                                                for (size_t level = 0; level < outputs.geometry.levels.size(); level++)
+                                                {
+                                                    const common::TensorView<uint8_t> view = outputs.view(level);
+                                                    for (uint cell = 0; cell < view.width() * view.height(); cell++)
+                                                        decoder.decode(view, level, cell, 0, 0.5f, records);
+                                                } });
+        double reference_us = test::median_us(repeats, [&]
+                                              {
+                                                  for (size_t level = 0; level < outputs.geometry.levels.size(); level++)
+                                                  {
+                                                      const common::TensorView<uint8_t> view = outputs.view(level);
+                                                      const uint stride = outputs.geometry.levels[level].stride;
+                                                      for (uint cell = 0; cell < view.width() * view.height(); cell++)
+                                                          sink += reference_box(view, cell / view.width(), cell % view.width(), stride, size).width;
+                                                  } });
+        CHECK(sink > 0.0f);
+        const double boxes = (double)outputs.geometry.max_proposals();
+        test::report(std::to_string(size) + "x" + std::to_string(size) + ", " + std::to_string((size_t)boxes) + " boxes",
+                     test::format(decoder_us * 1000 / boxes, 1) + " ns/box (float softmax decode " +
+                         test::format(reference_us * 1000 / boxes, 1) + " ns/box)");
+    }
+}
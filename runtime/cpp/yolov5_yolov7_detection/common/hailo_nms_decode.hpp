@@ -9,6 +9,7 @@
 
 #include "hailo_objects.hpp"
 #include "structures.hpp"
+#include "detection_objects.hpp"
 #include "labels/coco_ninety.hpp"
 
 static const int DEFAULT_MAX_BOXES = 100;
@@ -18,7 +19,7 @@ class HailoNMSDecode
 {
 private:
     HailoTensorPtr _nms_output_tensor;
-    std::map<uint8_t, std::string> labels_dict;
+    const std::map<uint8_t, std::string> &labels_dict;
     float _detection_thr;
     uint _max_boxes;
     bool _filter_by_score;
@@ -37,7 +38,7 @@ private:
         return dequant_bbox;
     }
 
-    void parse_bbox_to_detection_object(auto dequant_bbox, uint32_t class_index, std::vector<HailoDetection> &_objects)
+    void parse_bbox_to_detection_record(auto dequant_bbox, uint32_t class_index, std::vector<common::DetectionRecord> &records)
     {
         float confidence = CLAMP(dequant_bbox.score, 0.0f, 1.0f);
         // filter score by detection threshold if needed.
@@ -46,8 +47,8 @@ private:
             float32_t w, h = 0.0f;
             // parse width and height of the box
             std::tie(w, h) = get_shape(&dequant_bbox);
-            // create new detection object and add it to the vector of detections
-            _objects.push_back(HailoDetection(HailoBBox(dequant_bbox.x_min, dequant_bbox.y_min, w, h), class_index, labels_dict[(unsigned char)class_index], confidence));
+            // create new detection record and add it to the vector of records
+            records.push_back(common::DetectionRecord{dequant_bbox.x_min, dequant_bbox.y_min, w, h, confidence, (int)class_index, (int)(unsigned char)class_index});
         }
     }
 
@@ -59,7 +60,7 @@ private:
     }
 
 public:
-    HailoNMSDecode(HailoTensorPtr tensor, std::map<uint8_t, std::string> &labels_dict, float detection_thr = DEFAULT_THRESHOLD, uint max_boxes = DEFAULT_MAX_BOXES, bool filter_by_score = false)
+    HailoNMSDecode(HailoTensorPtr tensor, const std::map<uint8_t, std::string> &labels_dict, float detection_thr = DEFAULT_THRESHOLD, uint max_boxes = DEFAULT_MAX_BOXES, bool filter_by_score = false)
         : _nms_output_tensor(tensor), labels_dict(labels_dict), _detection_thr(detection_thr), _max_boxes(max_boxes), _filter_by_score(filter_by_score), _vstream_info(tensor->vstream_info())
     {
         // making sure that the network's output is indeed an NMS type, by checking the order type value included in the metadata
@@ -67,6 +68,58 @@ public:
             throw std::invalid_argument("Output tensor " + _nms_output_tensor->name() + " is not an NMS type");
     };
 
+    /**
+     * @brief Decode the NMS buffer into flat detection records, see decode() for the buffer layout.
+     *
+     * @param[out] records Decoded records are appended here.
+     */
+    template <typename T, typename BBoxType>
+    void decode_records(std::vector<common::DetectionRecord> &records)
+    {
+        if (!_nms_output_tensor)
+            return;
+
+        uint8_t *src_ptr = _nms_output_tensor->data();
+        uint32_t actual_frame_size = 0;
+
+        uint32_t num_of_classes = _vstream_info.nms_shape.number_of_classes;
+        uint32_t max_bboxes_per_class = _vstream_info.nms_shape.max_bboxes_per_class;
+
+        for (uint32_t class_index = 1; class_index <= num_of_classes; class_index++)
+        {
+            T bbox_count = *reinterpret_cast<const T *>(src_ptr + actual_frame_size);
+
+            if ((int)bbox_count > max_bboxes_per_class)
+                throw std::runtime_error(("Runtime error - Got more than the maximum bboxes per class in the nms buffer"));
+
+            if (bbox_count > 0)
+            {
+                uint8_t *class_ptr = src_ptr + actual_frame_size + sizeof(bbox_count);
+
+                // iterate over the boxes and parse each box to common::hailo_bbox_t
+                for (uint8_t box_index = 0; box_index < bbox_count; box_index++)
+                {
+                    BBoxType *bbox_struct = (BBoxType *)(class_ptr + (box_index * sizeof(BBoxType)));
+
+                    if (std::is_same<T, uint16_t>::value)
+                    {
+                        // output type (T) is uint16, so we need to do dequantization before parsing
+                        common::hailo_bbox_float32_t dequant_bbox = dequantize_hailo_bbox(bbox_struct);
+                        parse_bbox_to_detection_record(dequant_bbox, class_index, records);
+                    }
+                    else
+                    {
+                        parse_bbox_to_detection_record(*bbox_struct, class_index, records);
+                    }
+                }
+            }
+
+            // calculate the frame size of the class - sums up the size of the output during iteration
+            T class_frame_size = static_cast<T>(sizeof(bbox_count) + bbox_count * sizeof(BBoxType));
+            actual_frame_size += static_cast<uint32_t>(class_frame_size);
+        }
+    }
+
     template <typename T, typename BBoxType>
     std::vector<HailoDetection> decode()
     {
@@ -107,47 +160,15 @@ public:
         if (!_nms_output_tensor)
             return _objects;
 
-        _objects.reserve(_max_boxes);
-        uint8_t *src_ptr = _nms_output_tensor->data();
-        uint32_t actual_frame_size = 0;
-
-        uint32_t num_of_classes = _vstream_info.nms_shape.number_of_classes;
-        uint32_t max_bboxes_per_class = _vstream_info.nms_shape.max_bboxes_per_class;
+        std::vector<common::DetectionRecord> records;
+        records.reserve(_max_boxes);
+        decode_records<T, BBoxType>(records);
 
-        for (uint32_t class_index = 1; class_index <= num_of_classes; class_index++)
+        _objects.reserve(records.size());
+        for (const auto &record : records)
         {
-            T bbox_count = *reinterpret_cast<const T *>(src_ptr + actual_frame_size);
-
-            if ((int)bbox_count > max_bboxes_per_class)
-                throw std::runtime_error(("Runtime error - Got more than the maximum bboxes per class in the nms buffer"));
-
-            if (bbox_count > 0)
-            {
-                uint8_t *class_ptr = src_ptr + actual_frame_size + sizeof(bbox_count);
-
-                // iterate over the boxes and parse each box to common::hailo_bbox_t
-                for (uint8_t box_index = 0; box_index < bbox_count; box_index++)
-                {
-                    BBoxType *bbox_struct = (BBoxType *)(class_ptr + (box_index * sizeof(BBoxType)));
-
-                    if (std::is_same<T, uint16_t>::value)
-                    {
-                        // output type (T) is uint16, so we need to do dequantization before parsing
-                        common::hailo_bbox_float32_t dequant_bbox = dequantize_hailo_bbox(bbox_struct);
-                        parse_bbox_to_detection_object(dequant_bbox, class_index, _objects);
-                    }
-                    else
-                    {
-                        parse_bbox_to_detection_object(*bbox_struct, class_index, _objects);
-                    }
-                }
-            }
-
-            // calculate the frame size of the class - sums up the size of the output during iteration
-            T class_frame_size = static_cast<T>(sizeof(bbox_count) + bbox_count * sizeof(BBoxType));
-            actual_frame_size += static_cast<uint32_t>(class_frame_size);
+            _objects.push_back(common::to_detection(record, labels_dict));
         }
-
         return _objects;
     }
 };
@@ -23,8 +23,16 @@ namespace common
 
     xt::xarray<uint16_t> get_xtensor(HailoTensorPtr &tensor)
     {
-        // Adapt a HailoTensorPtr to an xarray (quantized)
-        xt::xarray<uint16_t> xtensor = xt::adapt(tensor->data(), tensor->size(), xt::no_ownership(), tensor->shape());
+        // Adapt a HailoTensorPtr to an xarray (quantized), reading the buffer with the tensor's own data type.
+        // 8 bit tensors are widened to uint16.
+        if (HAILO_FORMAT_TYPE_UINT16 == tensor->vstream_info().format.type)
+        {
+            uint16_t *data = reinterpret_cast<uint16_t *>(tensor->data());
+            xt::xarray<uint16_t> xtensor = xt::adapt(data, tensor->size(), xt::no_ownership(), tensor->shape());
+            return xtensor;
+        }
+        uint8_t *data = reinterpret_cast<uint8_t *>(tensor->data());
+        xt::xarray<uint16_t> xtensor = xt::adapt(data, tensor->size(), xt::no_ownership(), tensor->shape());
         return xtensor;
     }
 
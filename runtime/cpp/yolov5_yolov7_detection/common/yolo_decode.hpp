@@ -0,0 +1,232 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file yolo_decode.hpp
+ * @brief Batched decode kernels for YOLO anchor outputs, working directly on the quantized feature maps.
+ **/
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "detection_record.hpp"
+#include "quant_gate.hpp"
+#include "tensor_view.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define YOLO_DECODE_NEON
+#endif
+
+namespace common
+{
+    /**
+     * @brief Decoding params of one YOLO anchor output layer, the geometry and quantization come from its TensorView.
+     */
+    struct YoloLayerInfo
+    {
+        uint num_anchors;
+        uint num_classes;
+        int label_offset;
+        bool perform_sigmoid;
+    };
+
+    /**
+     * @brief Dequantize a single value, same arithmetic as HailoTensor::fix_scale.
+     */
+    template <typename T>
+    inline float dequantize_value(T num, float qp_scale, float qp_zp)
+    {
+        return (float(num) - qp_zp) * qp_scale;
+    }
+
+    inline float sigmoid_value(float x)
+    {
+        // returns the value of the sigmoid function f(x) = 1/(1 + e^-x)
+        return 1.0f / (1.0f + expf(-x));
+    }
+
+    /**
+     * @brief Gate of the objectness channel, passes when the (sigmoid of the) dequantized value is >= threshold.
+     */
+    template <typename T>
+    QuantizedGate<T> objectness_gate(float threshold, float qp_scale, float qp_zp, bool perform_sigmoid)
+    {
+        if (!perform_sigmoid)
+            return QuantizedGate<T>::at_least(threshold, qp_scale, qp_zp);
+        return QuantizedGate<T>::from_predicate([&](T q)
+                                                { return sigmoid_value(dequantize_value(q, qp_scale, qp_zp)) >= threshold; });
+    }
+
+    /**
+     * @brief Get the maximal value of a contiguous run of channels.
+     */
+    inline uint8_t max_value(const uint8_t *data, uint count)
+    {
+        uint i = 0;
+        uint8_t max = 0;
+#if defined(__AVX2__)
+        if (count >= 32)
+        {
+            __m256i vmax = _mm256_setzero_si256();
+            for (; i + 32 <= count; i += 32)
+                vmax = _mm256_max_epu8(vmax, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)));
+            __m128i m = _mm_max_epu8(_mm256_castsi256_si128(vmax), _mm256_extracti128_si256(vmax, 1));
+            m = _mm_max_epu8(m, _mm_srli_si128(m, 8));
+            m = _mm_max_epu8(m, _mm_srli_si128(m, 4));
+            m = _mm_max_epu8(m, _mm_srli_si128(m, 2));
+            m = _mm_max_epu8(m, _mm_srli_si128(m, 1));
+            max = (uint8_t)(_mm_cvtsi128_si32(m) & 0xFF);
+        }
+#elif defined(YOLO_DECODE_NEON)
+        if (count >= 16)
+        {
+            uint8x16_t vmax = vdupq_n_u8(0);
+            for (; i + 16 <= count; i += 16)
+                vmax = vmaxq_u8(vmax, vld1q_u8(data + i));
+            max = vmaxvq_u8(vmax);
+        }
+#endif
+        for (; i < count; i++)
+        {
+            if (data[i] > max)
+                max = data[i];
+        }
+        return max;
+    }
+
+    inline uint16_t max_value(const uint16_t *data, uint count)
+    {
+        uint i = 0;
+        uint16_t max = 0;
+#if defined(__AVX2__)
+        if (count >= 16)
+        {
+            __m256i vmax = _mm256_setzero_si256();
+            for (; i + 16 <= count; i += 16)
+                vmax = _mm256_max_epu16(vmax, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)));
+            __m128i m = _mm_max_epu16(_mm256_castsi256_si128(vmax), _mm256_extracti128_si256(vmax, 1));
+            m = _mm_max_epu16(m, _mm_srli_si128(m, 8));
+            m = _mm_max_epu16(m, _mm_srli_si128(m, 4));
+            m = _mm_max_epu16(m, _mm_srli_si128(m, 2));
+            max = (uint16_t)(_mm_cvtsi128_si32(m) & 0xFFFF);
+        }
+#elif defined(YOLO_DECODE_NEON)
+        if (count >= 8)
+        {
+            uint16x8_t vmax = vdupq_n_u16(0);
+            for (; i + 8 <= count; i += 8)
+                vmax = vmaxq_u16(vmax, vld1q_u16(data + i));
+            max = vmaxvq_u16(vmax);
+        }
+#endif
+        for (; i < count; i++)
+        {
+            if (data[i] > max)
+                max = data[i];
+        }
+        return max;
+    }
+
+    /**
+     * @brief Get the index and value of the first maximal value of a contiguous run of channels.
+     */
+    template <typename T>
+    inline std::pair<uint, T> argmax(const T *data, uint count)
+    {
+        T max = max_value(data, count);
+        uint index = 0;
+        while (index < count && data[index] != max)
+            index++;
+        return std::pair<uint, T>(index, max);
+    }
+
+    /**
+     * @brief Decode one YOLOv5 anchor output layer straight from its quantized buffer.
+     *
+     * The objectness channel of every anchor goes through a quantized threshold gate, so most anchors
+     * are skipped with a single integer compare, and the class argmax runs over the contiguous class channels.
+     * Produces the same boxes as the per-cell YoloOutputLayer path.
+     *
+     * @param view Typed view of the output tensor (HWC).
+     * @param layer Decoding params of the layer.
+     * @param anchors Anchors of the layer, {w0, h0, w1, h1, ...}.
+     * @param detection_thr Detection threshold.
+     * @param image_width Network input width.
+     * @param image_height Network input height.
+     * @param[out] boxes Decoded boxes are appended here.
+     */
+    template <typename T>
+    void yolov5_decode(const TensorView<T> &view, const YoloLayerInfo &layer, const std::vector<int> &anchors,
+                       float detection_thr, uint image_width, uint image_height, std::vector<DetectionRecord> &boxes)
+    {
+        static const uint NUM_CENTERS = 2;
+        static const uint NUM_SCALES = 2;
+        static const uint CONF_CHANNEL_OFFSET = NUM_CENTERS + NUM_SCALES;
+        static const uint CLASS_CHANNEL_OFFSET = CONF_CHANNEL_OFFSET + 1;
+
+        const float qp_scale = view.qp_scale();
+        const float qp_zp = view.qp_zp();
+        const uint anchor_stride = view.features() / layer.num_anchors;
+        const QuantizedGate<T> gate = objectness_gate<T>(detection_thr, qp_scale, qp_zp, layer.perform_sigmoid);
+        if (gate.closed())
+            return;
+
+        // The classes scanned are label_offset..num_classes, as in YoloOutputLayer::get_class.
+        const int first_class = layer.label_offset;
+        const uint class_count = ((int)layer.num_classes >= first_class) ? (uint)((int)layer.num_classes - first_class + 1) : 0;
+        const int class_channel_shift = (int)CLASS_CHANNEL_OFFSET + first_class - 1;
+
+        // Anchor i of the tensor is cell i / num_anchors, its objectness is at i * anchor_stride + CONF_CHANNEL_OFFSET.
+        // The candidates buffer is kept per thread, so its capacity is reused across layers and frames.
+        static thread_local std::vector<uint32_t> candidates;
+        candidates.clear();
+        gate.scan_strided(view.data() + CONF_CHANNEL_OFFSET, (size_t)view.height() * view.width() * layer.num_anchors, anchor_stride, candidates);
+        for (uint32_t candidate : candidates)
+        {
+            const uint cell = candidate / layer.num_anchors;
+            const uint anchor = candidate % layer.num_anchors;
+            const uint row = cell / view.width();
+            const uint col = cell % view.width();
+            const T *anchor_ptr = view.channels(row, col).data() + anchor * anchor_stride;
+            float confidence = view.dequantize(anchor_ptr[CONF_CHANNEL_OFFSET]);
+
+            uint class_id = 1;
+            T prob_max = 0;
+            if (class_count > 0)
+            {
+                auto class_max = argmax(anchor_ptr + class_channel_shift, class_count);
+                if (class_max.second > 0)
+                {
+                    class_id = class_max.first + (uint)first_class;
+                    prob_max = class_max.second;
+                }
+            }
+            float class_confidence = dequantize_value((uint)prob_max, qp_scale, qp_zp);
+            if (layer.perform_sigmoid)
+            {
+                confidence = sigmoid_value(confidence);
+                class_confidence = sigmoid_value(class_confidence);
+            }
+            // Final confidence: box confidence * class probability
+            confidence = confidence * class_confidence;
+            if (confidence <= detection_thr)
+                continue;
+
+            float x = (float)(view.dequantize(anchor_ptr[0]) * 2.0f - 0.5f + (float)col) / (float)view.width();
+            float y = (float)(view.dequantize(anchor_ptr[1]) * 2.0f - 0.5f + (float)row) / (float)view.height();
+            float w = (float)pow(2.0f * view.dequantize(anchor_ptr[NUM_CENTERS]), 2.0f) * (float)anchors[anchor * 2] / (float)image_width;
+            float h = (float)pow(2.0f * view.dequantize(anchor_ptr[NUM_CENTERS + 1]), 2.0f) * (float)anchors[anchor * 2 + 1] / (float)image_height;
+            // Get the top left corner of the object.
+            boxes.push_back(DetectionRecord{x - (w / 2.0f), y - (h / 2.0f), w, h, confidence, (int)class_id, (int)(uint8_t)class_id});
+        }
+    }
+}
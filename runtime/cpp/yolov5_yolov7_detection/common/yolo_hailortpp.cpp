@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "hailo_nms_decode.hpp"
 #include "yolo_hailortpp.hpp"
 #include "labels/coco_eighty.hpp"
@@ -8,43 +10,48 @@ static std::map<uint8_t, std::string> yolo_vehicles_labels = {
     {0, "unlabeled"},
     {1, "car"}};
 
-void yolov5_nms(HailoROIPtr roi)
+void yolov5_nms_records(HailoROIPtr roi, common::DetectionArena &arena)
 {
     auto post = HailoNMSDecode(roi->get_tensor(DEFAULT_YOLOV5M_OUTPUT_LAYER), common::coco_eighty);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    hailo_common::add_detections(roi, detections);
+    post.decode_records<float32_t, common::hailo_bbox_float32_t>(arena.records());
+}
+
+static void nms_decode_to_roi(HailoROIPtr roi, const std::string &output_layer, const std::map<uint8_t, std::string> &labels)
+{
+    static thread_local common::DetectionArena arena;
+    arena.reset();
+    auto post = HailoNMSDecode(roi->get_tensor(output_layer), labels);
+    post.decode_records<float32_t, common::hailo_bbox_float32_t>(arena.records());
+    common::add_detections(roi, arena.records(), labels);
+}
+
+void yolov5_nms(HailoROIPtr roi)
+{
+    nms_decode_to_roi(roi, DEFAULT_YOLOV5M_OUTPUT_LAYER, common::coco_eighty);
 }
 
 void yolox(HailoROIPtr roi)
 {
-    auto post = HailoNMSDecode(roi->get_tensor("yolox_nms_postprocess"), common::coco_eighty);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    hailo_common::add_detections(roi, detections);
+    nms_decode_to_roi(roi, "yolox_nms_postprocess", common::coco_eighty);
 }
 
 void yolov5m_vehicles(HailoROIPtr roi)
 {
-    auto post = HailoNMSDecode(roi->get_tensor(DEFAULT_YOLOV5M_OUTPUT_LAYER), yolo_vehicles_labels);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    hailo_common::add_detections(roi, detections);
+    nms_decode_to_roi(roi, DEFAULT_YOLOV5M_OUTPUT_LAYER, yolo_vehicles_labels);
 }
 
 void yolov5_no_persons(HailoROIPtr roi)
 {
+    static thread_local common::DetectionArena arena;
+    arena.reset();
     auto post = HailoNMSDecode(roi->get_tensor(DEFAULT_YOLOV5M_OUTPUT_LAYER), common::coco_eighty);
-    auto detections = post.decode<float32_t, common::hailo_bbox_float32_t>();
-    for (auto it = detections.begin(); it != detections.end();)
-    {
-        if (it->get_label() == "person")
-        {
-            it = detections.erase(it);
-        }
-        else
-        {
-            ++it;
-        }
-    }
-    hailo_common::add_detections(roi, detections);
+    auto &records = arena.records();
+    post.decode_records<float32_t, common::hailo_bbox_float32_t>(records);
+    records.erase(std::remove_if(records.begin(), records.end(),
+                                 [](const common::DetectionRecord &record)
+                                 { return common::record_label(record, common::coco_eighty) == "person"; }),
+                  records.end());
+    common::add_detections(roi, records, common::coco_eighty);
 }
 
 void filter_nms(HailoROIPtr roi)
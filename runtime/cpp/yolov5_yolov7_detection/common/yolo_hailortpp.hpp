@@ -5,6 +5,7 @@
 #pragma once
 #include "hailo_objects.hpp"
 #include "hailo_common.hpp"
+#include "detection_record.hpp"
 
 
 __BEGIN_DECLS
@@ -13,4 +14,10 @@ void yolov5_nms(HailoROIPtr roi);
 void yolox(HailoROIPtr roi);
 void yolov5_no_persons(HailoROIPtr roi);
 void yolov5m_vehicles(HailoROIPtr roi);
-__END_DECLS
\ No newline at end of file
+__END_DECLS
+
+/**
+ * @brief Decode the on-chip NMS output of yolov5 into the frame's detection records,
+ *        without building HailoDetection objects.
+ */
+void yolov5_nms_records(HailoROIPtr roi, common::DetectionArena &arena);
@@ -27,25 +27,66 @@ std::pair<uint, float> YoloOutputLayer::get_class(uint row, uint col, uint ancho
 float YoloOutputLayer::get_confidence(uint row, uint col, uint anchor)
 {
     uint channel = _tensor->features() / NUM_ANCHORS * anchor + CONF_CHANNEL_OFFSET;
-    float confidence = _tensor->get_full_percision(row, col, channel, _is_uint16);
+    float confidence = get_value(row, col, channel);
     if (_perform_sigmoid)
         confidence = sigmoid(confidence);
     return confidence;
 }
 
+void YoloOutputLayer::decode_boxes(float detection_thr, uint image_width, uint image_height, std::vector<common::DetectionRecord> &boxes)
+{
+    uint class_id = 0;
+    float x, y, h, w, confidence, class_confidence = 0.0f;
+    common::visit_tensor(*_tensor, [&](const auto &view)
+                         {
+        using T = decltype(view.at(0, 0, 0));
+        // The objectness threshold is first checked on the quantized value, so most anchors are never dequantized.
+        const auto gate = common::objectness_gate<T>(detection_thr, view.qp_scale(), view.qp_zp(), _perform_sigmoid);
+        if (gate.closed())
+            return;
+        for (uint row = 0; row < _height; ++row)
+        {
+            for (uint col = 0; col < _width; ++col)
+            {
+                for (uint anchor = 0; anchor < NUM_ANCHORS; ++anchor)
+                {
+                    if (!gate.passes(view.at(row, col, _tensor->features() / NUM_ANCHORS * anchor + CONF_CHANNEL_OFFSET)))
+                        continue;
+                    confidence = get_confidence(row, col, anchor);
+                    if (confidence < detection_thr)
+                        continue;
+                    std::tie(class_id, class_confidence) = get_class(row, col, anchor);
+                    // Final confidence: box confidence * class probability
+                    confidence = confidence * class_confidence;
+                    if (confidence > detection_thr)
+                    {
+                        std::tie(x, y) = get_center(row, col, anchor);
+                        std::tie(w, h) = get_shape(row, col, anchor, image_width, image_height);
+                        // Get the top left corner of the object.
+                        boxes.push_back(common::DetectionRecord{x - (w / 2.0f), y - (h / 2.0f), w, h, confidence, (int)class_id, (int)(uint8_t)class_id});
+                    }
+                }
+            }
+        } });
+}
+
 float YoloOutputLayer::sigmoid(float x)
 {
     // returns the value of the sigmoid function f(x) = 1/(1 + e^-x)
     return 1.0f / (1.0f + expf(-x));
 }
 
+float YoloOutputLayer::get_value(uint row, uint col, uint channel)
+{
+    return common::visit_tensor(*_tensor, [&](const auto &view)
+                                { return view.at_float(row, col, channel); });
+}
+
 float YoloOutputLayer::get_class_prob(uint row, uint col, uint anchor, uint class_id)
 {
     uint channel = _tensor->features() / NUM_ANCHORS * anchor + CLASS_CHANNEL_OFFSET + class_id - 1;
-    if (_is_uint16)
-        return (float)_tensor->get_uint16(row, col, channel);
-    else
-        return (float)_tensor->get(row, col, channel);
+    return common::visit_tensor(*_tensor, [&](const auto &view)
+                                { return (float)view.at(row, col, channel); });
 }
 
 float Yolov5OL::get_class_conf(uint prob_max)
@@ -60,8 +101,8 @@ std::pair<float, float> Yolov5OL::get_center(uint row, uint col, uint anchor)
 {
     float x, y = 0.0f;
     uint channel = _tensor->features() / NUM_ANCHORS * anchor;
-    x = (float)(_tensor->get_full_percision(row, col, channel, _is_uint16) * 2.0f - 0.5f + (float)col) / (float)_width;
-    y = (float)(_tensor->get_full_percision(row, col, channel + 1, _is_uint16) * 2.0f - 0.5f + (float)row) / (float)_height;
+    x = (float)(get_value(row, col, channel) * 2.0f - 0.5f + (float)col) / (float)_width;
+    y = (float)(get_value(row, col, channel + 1) * 2.0f - 0.5f + (float)row) / (float)_height;
     return std::pair<float, float>(x, y);
 }
 
@@ -69,7 +110,15 @@ std::pair<float, float> Yolov5OL::get_shape(uint row, uint col, uint anchor, uin
 {
     float w, h = 0.0f;
     uint channel = _tensor->features() / NUM_ANCHORS * anchor + NUM_CENTERS;
-    w = (float)pow(2.0f * _tensor->get_full_percision(row, col, channel, _is_uint16), 2.0f) * (float)_anchors[anchor * 2] / (float)image_width;
-    h = (float)pow(2.0f * _tensor->get_full_percision(row, col, channel + 1, _is_uint16), 2.0f) * (float)_anchors[anchor * 2 + 1] / (float)image_height;
+    w = (float)pow(2.0f * get_value(row, col, channel), 2.0f) * (float)_anchors[anchor * 2] / (float)image_width;
+    h = (float)pow(2.0f * get_value(row, col, channel + 1), 2.0f) * (float)_anchors[anchor * 2 + 1] / (float)image_height;
     return std::pair<float, float>(w, h);
+}
+
+void Yolov5OL::decode_boxes(float detection_thr, uint image_width, uint image_height, std::vector<common::DetectionRecord> &boxes)
+{
+    common::YoloLayerInfo layer = {NUM_ANCHORS, _num_classes, label_offset, _perform_sigmoid};
+    // The data type is dispatched once per layer, the decode loop is compiled per type.
+    common::visit_tensor(*_tensor, [&](const auto &view)
+                         { common::yolov5_decode(view, layer, _anchors, detection_thr, image_width, image_height, boxes); });
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 
 #pragma once
 #include "hailo_objects.hpp"
+#include "yolo_decode.hpp"
 #include <iostream>
 
 /**
@@ -26,14 +27,12 @@ public:
                     std::vector<int> anchors,
                     bool perform_sigmoid,
                     int label_offset,
-                    bool is_uint16,
                     HailoTensorPtr tensor = nullptr) : _width(width),
                                                        _height(height),
                                                        _num_classes(num_of_classes),
                                                        _anchors(anchors),
                                                        label_offset(label_offset),
                                                        _perform_sigmoid(perform_sigmoid),
-                                                       _is_uint16(is_uint16),
                                                        _tensor(tensor){};
     virtual ~YoloOutputLayer() = default;
 
@@ -81,12 +80,29 @@ public:
      * @return std::pair<float, float> pair of w,h of the shape of this prediction.
      */
     virtual std::pair<float, float> get_shape(uint row, uint col, uint anchor, uint image_width, uint image_height) = 0;
+    /**
+     * @brief Decode all the boxes of this layer that pass the detection threshold.
+     *
+     * @param detection_thr
+     * @param image_width
+     * @param image_height
+     * @param boxes decoded boxes are appended to this vector.
+     */
+    virtual void decode_boxes(float detection_thr, uint image_width, uint image_height, std::vector<common::DetectionRecord> &boxes);
 
 protected:
     bool _perform_sigmoid;
-    bool _is_uint16;
     HailoTensorPtr _tensor;
     float sigmoid(float x);
+    /**
+     * @brief Get the dequantized value of a cell channel, whatever the tensor's data type is.
+     *
+     * @param row
+     * @param col
+     * @param channel
+     * @return float
+     */
+    float get_value(uint row, uint col, uint channel);
     /**
      * @brief Get the class channel object
      *
@@ -115,16 +131,15 @@ public:
     Yolov5OL(HailoTensorPtr tensor,
              std::vector<int> anchors,
              bool perform_sigmoid,
-             int label_offset,
-             bool is_uint16) : YoloOutputLayer(tensor->width(),
-                                               tensor->height(),
-                                               num_classes(tensor->features()),
-                                               anchors,
-                                               false,
-                                               label_offset,
-                                               is_uint16,
-                                               tensor){};
+             int label_offset) : YoloOutputLayer(tensor->width(),
+                                                 tensor->height(),
+                                                 num_classes(tensor->features()),
+                                                 anchors,
+                                                 false,
+                                                 label_offset,
+                                                 tensor){};
     virtual float get_class_conf(uint prob_max);
     virtual std::pair<float, float> get_center(uint row, uint col, uint anchor);
     virtual std::pair<float, float> get_shape(uint row, uint col, uint anchor, uint image_width, uint image_height);
+    virtual void decode_boxes(float detection_thr, uint image_width, uint image_height, std::vector<common::DetectionRecord> &boxes);
 };
\ No newline at end of file
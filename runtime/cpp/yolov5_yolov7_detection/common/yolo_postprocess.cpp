@@ -10,7 +10,9 @@
 
 #include "yolo_postprocess.hpp"
 #include "nms.hpp"
+#include "detection_objects.hpp"
 #include "json_config.hpp"
+#include "config_registry.hpp"
 
 #include "rapidjson/document.h"
 #include "rapidjson/stringbuffer.h"
@@ -35,36 +37,55 @@ protected:
     float _iou_thr;
     uint m_image_width;
     uint m_image_height;
-    std::map<uint8_t, std::string> m_dataset;
+    const std::map<uint8_t, std::string> &m_dataset;
 
 public:
     virtual ~YoloPost() = default;
-    YoloPost(std::map<uint8_t, std::string> dataset,
+    YoloPost(const std::map<uint8_t, std::string> &dataset,
              float detection_threshold,
              float iou_threshold,
              uint max_boxes)
         : _max_boxes(max_boxes), _detection_thr(detection_threshold),
           _iou_thr(iou_threshold), m_dataset(dataset){};
 
-    std::vector<HailoDetection> decode()
+    /**
+     * @brief Decode and NMS all layers into flat detection records.
+     *
+     * @param[out] records Reference to vector of records, filled with the kept records ordered by descending confidence.
+     */
+    void decode(std::vector<common::DetectionRecord> &records)
     {
-        std::vector<HailoDetection> objects;
-        objects.reserve(_max_boxes);
-        for (auto layer : _layers)
+        for (auto &layer : _layers)
         {
-            extract_boxes(layer, objects);
+            extract_boxes(layer, records);
         }
-        common::nms(objects, _iou_thr);
-        if (objects.size() > _max_boxes)
+        common::nms(records, _iou_thr);
+        if (records.size() > _max_boxes)
         {
-            HailoBBox bbox(0, 0, 1, 1);
-            HailoDetection empty_detection(bbox, "None", 0.0);
-            objects.resize(_max_boxes, empty_detection);
+            records.resize(_max_boxes);
         }
+    }
+
+    std::vector<HailoDetection> decode()
+    {
+        std::vector<common::DetectionRecord> records;
+        records.reserve(_max_boxes);
+        decode(records);
 
+        std::vector<HailoDetection> objects;
+        objects.reserve(records.size());
+        for (auto &record : records)
+        {
+            objects.push_back(common::to_detection(record, m_dataset));
+        }
         return objects;
     }
 
+    const std::map<uint8_t, std::string> &labels()
+    {
+        return m_dataset;
+    }
+
     uint get_num_classes()
     {
         return _layers[0]->_num_classes;
@@ -73,50 +94,23 @@ public:
     /**
      * @brief Extract the boxes of generic yolo output layer.
      *
-     * @param[in] image_size Network's input image width/height.
-     * @param[in] thr Postprocess threshold.
-     * @param[out] objects Reference to vector of detections.
+     * @param[in] layer The output layer to decode.
+     * @param[out] records Reference to vector of records.
      */
     void extract_boxes(std::shared_ptr<YoloOutputLayer> layer,
-                       std::vector<HailoDetection> &objects);
+                       std::vector<common::DetectionRecord> &records);
 };
 
 void YoloPost::extract_boxes(std::shared_ptr<YoloOutputLayer> layer,
-                             std::vector<HailoDetection> &objects)
+                             std::vector<common::DetectionRecord> &records)
 {
-    uint class_id = 0;
-    float x, y, h, w, confidence, class_confidence = 0.0f;
-    float xmin, ymin = 0.0f;
-    for (uint row = 0; row < layer->_height; ++row)
-    {
-        for (uint col = 0; col < layer->_width; ++col)
-        {
-            for (uint anchor = 0; anchor < layer->NUM_ANCHORS; ++anchor)
-            {
-                confidence = layer->get_confidence(row, col, anchor);
-                if (confidence < _detection_thr)
-                    continue;
-                std::tie(class_id, class_confidence) = layer->get_class(row, col, anchor);
-                // Final confidence: box confidence * class probability
-                confidence = confidence * class_confidence;
-                if (confidence > _detection_thr)
-                {
-                    std::tie(x, y) = layer->get_center(row, col, anchor);
-                    std::tie(w, h) = layer->get_shape(row, col, anchor, m_image_width, m_image_height);
-                    // Get the top left corner of the object.
-                    xmin = (x - (w / 2.0f));
-                    ymin = (y - (h / 2.0f));
-                    objects.push_back(HailoDetection(HailoBBox(xmin, ymin, w, h), class_id, m_dataset[(uint8_t)class_id], confidence));
-                }
-            }
-        }
-    }
+    layer->decode_boxes(_detection_thr, m_image_width, m_image_height, records);
 }
 
 class Yolov5 : public YoloPost
 {
 public:
-    Yolov5(HailoROIPtr roi, YoloParams *params)
+    Yolov5(HailoROIPtr roi, const YoloParams *params)
         : YoloPost(params->labels, params->detection_threshold, params->iou_threshold, params->max_boxes), _tensors(roi->get_tensors())
     {
         if (_tensors.size() > 0)
@@ -131,8 +125,7 @@ public:
             _layers.reserve(_tensors.size());
             for (std::size_t i = 0; i < _tensors.size(); i++)
             {
-                hailo_format_type_t format = _tensors[i]->vstream_info().format.type;
-                _layers.push_back(std::make_shared<Yolov5OL>(_tensors[i], params->anchors_vec[i], sigmoid, params->label_offset, format == HAILO_FORMAT_TYPE_UINT16));
+                _layers.push_back(std::make_shared<Yolov5OL>(_tensors[i], params->anchors_vec[i], sigmoid, params->label_offset));
             }
         }
         params->check_params_logic(get_num_classes());
@@ -144,18 +137,24 @@ private:
     std::vector<HailoTensorPtr> _tensors;
 };
 
-void yolov5(HailoROIPtr roi, void *params_void_ptr)
+void yolov5_records(HailoROIPtr roi, const YoloParams *params, common::DetectionArena &arena)
 {
-    YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
     auto post = Yolov5(roi, params);
-    auto detections = post.decode();
-    hailo_common::add_detections(roi, detections);
+    post.decode(arena.records());
+}
+
+void yolov5(HailoROIPtr roi, void *params_void_ptr)
+{
+    static thread_local common::DetectionArena arena;
+    const YoloParams *params = reinterpret_cast<const YoloParams *>(params_void_ptr);
+    arena.reset();
+    yolov5_records(roi, params, arena);
+    common::add_detections(roi, arena.records(), params->labels);
 }
 
 void filter(HailoROIPtr roi, void *params_void_ptr)
 {
-    YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
-    yolov5(roi, params);
+    yolov5(roi, params_void_ptr);
 }
 
 YoloParams *init(const std::string config_path, const std::string function_name)
@@ -168,7 +167,7 @@ YoloParams *init(const std::string config_path, const std::string function_name)
         {
             params = new Yolov5Params;
         }
-        if (function_name.std::string::compare("yolov7") == 0)
+        else if (function_name.std::string::compare("yolov7") == 0)
         {
             params = new Yolov7Params;
         }
@@ -286,7 +285,7 @@ YoloParams *init(const std::string config_path, const std::string function_name)
     }
     return params;
 }
-void YoloParams::check_params_logic(uint num_classes_tensors)
+void YoloParams::check_params_logic(uint num_classes_tensors) const
 {
     if (labels.size() - 1 != num_classes_tensors)
     {
@@ -297,6 +296,12 @@ void YoloParams::check_params_logic(uint num_classes_tensors)
     }
 }
 
+YoloParamsPtr get_yolo_params(const std::string &config_path, const std::string &func_name)
+{
+    static common::ConfigRegistry<YoloParams> registry(init);
+    return registry.get(func_name, config_path);
+}
+
 void free_resources(void *params_void_ptr)
 {
     YoloParams *params = reinterpret_cast<YoloParams *>(params_void_ptr);
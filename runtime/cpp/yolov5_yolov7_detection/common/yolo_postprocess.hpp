@@ -8,6 +8,9 @@
 #include "hailo_common.hpp"
 #include "yolo_output.hpp"
 #include "labels/coco_eighty.hpp"
+#include "detection_record.hpp"
+
+#include <memory>
 
 __BEGIN_DECLS
 
@@ -23,7 +26,7 @@ public:
     std::string output_activation; // can be "none" or "sigmoid"
     int label_offset;
     YoloParams() : iou_threshold(0.45f), detection_threshold(0.3f), output_activation("none"), label_offset(1) {}
-    void check_params_logic(uint num_classes_tensors);
+    void check_params_logic(uint num_classes_tensors) const;
 };
 
 class Yolov5Params : public YoloParams
@@ -61,3 +64,27 @@ void filter(HailoROIPtr roi, void *params_void_ptr);
 void yolov5(HailoROIPtr roi, void *params_void_ptr);
 
 __END_DECLS
+
+using YoloParamsPtr = std::shared_ptr<const YoloParams>;
+
+/**
+ * @brief Get the cached params of a model, see common::ConfigRegistry.
+ *
+ * The config is loaded and validated once per process (through init()), and reloaded only
+ * when the file changes. Safe to call on every frame.
+ *
+ * @param config_path Path to the JSON config file.
+ * @param func_name The model name, used as the cache key and to pick default params.
+ * @return YoloParamsPtr shared immutable params.
+ */
+YoloParamsPtr get_yolo_params(const std::string &config_path, const std::string &func_name);
+
+/**
+ * @brief Decode yolov5 outputs into the frame's detection records (decode + NMS),
+ *        without building HailoDetection objects.
+ *
+ * @param roi The ROI holding the output tensors.
+ * @param params Post-process params.
+ * @param arena The frame's detection arena, records are appended to it.
+ */
+void yolov5_records(HailoROIPtr roi, const YoloParams *params, common::DetectionArena &arena);
@@ -4,6 +4,12 @@
 #include "common/yolo_output.hpp"
 #include "common/yolo_hailortpp.hpp"
 #include "common/labels/coco_ninety.hpp"
+#include "frame_arena.hpp"
+#include "postprocess_pool.hpp"
+#include "frame_ring.hpp"
+#include "hailort_backend.hpp"
+#include "mock_backend.hpp"
+#include "stage_stats.hpp"
 
 #include <iostream>
 #include <chrono>
@@ -21,6 +27,21 @@ constexpr hailo_format_type_t FORMAT_TYPE_INPUT = HAILO_FORMAT_TYPE_AUTO;
 constexpr hailo_format_type_t FORMAT_TYPE_OUTPUT = HAILO_FORMAT_TYPE_AUTO;
 std::mutex m;
 std::string model_arch;
+std::string config_path;
+common::PostProcessOptions pp_options;
+// Frames the capture can be ahead of the drawing, on top of the frames being post-processed
+constexpr size_t FRAME_RING_SLACK = 4;
+// Frames of every output written by -record=
+constexpr size_t DEFAULT_RECORD_FRAMES = 64;
+
+// Latencies of the stages of the pipeline, printed at the end of the run
+common::StageStats stage_stats;
+common::StageStats::Stage &capture_stage = stage_stats.stage("capture + resize");
+common::StageStats::Stage &write_stage = stage_stats.stage("write");
+common::StageStats::Stage &inference_stage = stage_stats.stage("write -> read");
+common::StageStats::Stage &postprocess_stage = stage_stats.stage("postprocess");
+common::StageStats::Stage &draw_stage = stage_stats.stage("draw");
+using StageClock = common::StageStats::Clock;
 
 using namespace hailort;
 
@@ -59,19 +80,19 @@ std::string info_to_str(hailo_vstream_info_t vstream_info) {
     return result;
 }
 
-void postprocess_nms_on_hailo(HailoROIPtr& roi, bool nms_on_hailo) {
+void postprocess_nms_on_hailo(HailoROIPtr& roi, bool nms_on_hailo, common::DetectionArena &arena) {
+    arena.reset();
     if (nms_on_hailo)
-        filter_nms(roi);
+        yolov5_nms_records(roi, arena);
     else {
-        std::string config = model_arch + ".json";
-        YoloParams *init_params = init(config, model_arch);
-        filter(roi, init_params);
+        YoloParamsPtr params = get_yolo_params(config_path, model_arch);
+        yolov5_records(roi, params.get(), arena);
     }
 }
 
 template <typename T>
 hailo_status post_processing_all(std::vector<std::shared_ptr<FeatureData<T>>> &features, double frame_count, 
-                                std::chrono::duration<double>& postprocess_time, std::vector<cv::Mat>& frames, 
+                                std::chrono::duration<double>& postprocess_time, common::FrameRing<cv::Mat>& frames, 
                                 double org_height, double org_width, bool nms_on_hailo)
 {
     auto status = HAILO_SUCCESS;   
@@ -86,42 +107,68 @@ hailo_status post_processing_all(std::vector<std::shared_ptr<FeatureData<T>>> &f
     std::cout << YELLOW << "\n-I- Starting postprocessing\n" << std::endl << RESET;
     m.unlock();
 
-
-
-    for (int i = 0; i < (int)frame_count; i++){
-
-        HailoROIPtr roi = std::make_shared<HailoROI>(HailoROI(HailoBBox(0.0f, 0.0f, 1.0f, 1.0f)));
-        for (uint j = 0; j < features.size(); j++) {
-            roi->add_tensor(std::make_shared<HailoTensor>(reinterpret_cast<T *>(features[j]->m_buffers.get_read_buffer().data()), features[j]->m_vstream_info));
-        }
- 
-        postprocess_nms_on_hailo(std::ref(roi), nms_on_hailo);
-
+    // Frames are decoded on the post-processing pool, several at a time. Each frame in flight holds its output
+    // buffers in the rings of the read threads until it is drawn, and owns a slot for its detection records.
+    // Detections stay as flat records, no HailoDetection objects are built for drawing/printing.
+    // The slots outlive the post-processor, which joins the workers still using them if an exception is thrown
+    std::vector<common::DetectionArena> slot_arenas(pp_options.max_in_flight);
+    common::OrderedPostProcessor<hailo_status> post_processor(pp_options);
+
+    // Frames are drawn on a copy at the original size, so their slot in the ring keeps its storage for the next frames
+    cv::Mat display;
+    auto draw_frame = [&](size_t i, hailo_status) {
+        // Frames are emitted in order, so the oldest held buffers are the ones of this frame
         for (auto &feature : features) {
             feature->m_buffers.release_read_buffer();
         }
-
-        std::vector<HailoDetectionPtr> detections = hailo_common::get_hailo_detections(roi);
-
-        for (auto &detection : detections) {
-            if (detection->get_confidence() == 0) {
+        cv::Mat *frame = frames.acquire_read();
+        if (frame == nullptr) {
+            return;
+        }
+        common::StageStats::Scope draw_scope(draw_stage);
+        cv::resize(*frame, display, cv::Size((int)org_width, (int)org_height), 1);
+        for (auto &detection : slot_arenas[i % slot_arenas.size()].records()) {
+            if (detection.confidence == 0) {
                 continue;
             }
 
-            auto box = detection->get_bbox();
-
-            cv::resize(frames[i], frames[i], cv::Size((int)org_width, (int)org_height), 1);
-            cv::rectangle(frames[i], cv::Point2f(float(box.xmin() * float(org_width)), float(box.ymin() * float(org_height))), 
-                        cv::Point2f(float(box.xmax() * float(org_width)), float(box.ymax() * float(org_height))), 
+            cv::rectangle(display, cv::Point2f(float(detection.xmin * float(org_width)), float(detection.ymin * float(org_height))), 
+                        cv::Point2f(float((detection.xmin + detection.width) * float(org_width)), float((detection.ymin + detection.height) * float(org_height))), 
                         cv::Scalar(0, 0, 255), 1);
 
-            std::cout << "Detection: " << get_coco_name_from_int(detection->get_class_id()) << ", Confidence: " << std::fixed << std::setprecision(2) << detection->get_confidence() * 100.0 << "%" << std::endl;
+            std::cout << "Detection: " << get_coco_name_from_int(detection.class_id) << ", Confidence: " << std::fixed << std::setprecision(2) << detection.confidence * 100.0 << "%" << std::endl;
         }
-        // cv::imshow("Display window", frames[i]);
+        // cv::imshow("Display window", display);
         // cv::waitKey(0);
-        // video.write(frames[i]);
-        frames[i].release();
+        // video.write(display);
+        frames.release_read();
+    };
+
+    for (int i = 0; i < (int)frame_count; i++){
+        post_processor.wait_for_slot(draw_frame);
+        size_t slot = post_processor.next_slot();
+
+        std::vector<T *> buffers(features.size());
+        for (uint j = 0; j < features.size(); j++) {
+            buffers[j] = features[j]->m_buffers.hold_read_buffer().data();
+        }
+
+        common::DetectionArena &arena = slot_arenas[slot];
+        post_processor.submit([&features, buffers, &arena, nms_on_hailo]() {
+            // The roi and its tensors live in the frame arena of the worker, released all at once when the frame ends
+            common::StageStats::Scope postprocess_scope(postprocess_stage);
+            common::FrameArenaScope frame_scope;
+            HailoROIPtr roi = std::allocate_shared<HailoROI>(common::ArenaAllocator<HailoROI>(), HailoBBox(0.0f, 0.0f, 1.0f, 1.0f));
+            for (uint j = 0; j < features.size(); j++) {
+                roi->add_tensor(std::allocate_shared<HailoTensor>(common::ArenaAllocator<HailoTensor>(), buffers[j], features[j]->m_vstream_info));
+            }
+
+            postprocess_nms_on_hailo(std::ref(roi), nms_on_hailo, arena);
+            return HAILO_SUCCESS;
+        });
     }
+    post_processor.drain(draw_frame);
+
     std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::high_resolution_clock::now();
     postprocess_time = t_end - t_start;
     // video.release();
@@ -130,61 +177,76 @@ hailo_status post_processing_all(std::vector<std::shared_ptr<FeatureData<T>>> &f
 }
 
 template <typename T>
-hailo_status read_all(OutputVStream& output_vstream, std::shared_ptr<FeatureData<T>> feature, double frame_count, 
-                    std::chrono::time_point<std::chrono::system_clock>& read_time_vec) { 
+hailo_status read_all(common::VStreamBackend& backend, size_t output, std::shared_ptr<FeatureData<T>> feature, double frame_count, 
+                    std::chrono::time_point<std::chrono::system_clock>& read_time_vec, common::LatencyWindow& inference_latency) { 
 
     m.lock();
-    std::cout << GREEN << "-I- Started read thread: " << info_to_str(output_vstream.get_info()) << std::endl << RESET;
+    std::cout << GREEN << "-I- Started read thread: " << info_to_str(backend.output_infos()[output]) << std::endl << RESET;
     m.unlock(); 
 
     for (size_t i = 0; i < (size_t)frame_count; i++) {
         std::vector<T>& buffer = feature->m_buffers.get_write_buffer();
-        hailo_status status = output_vstream.read(MemoryView(buffer.data(), buffer.size()));
+        hailo_status status = backend.read(output, buffer.data(), buffer.size() * sizeof(T));
         feature->m_buffers.release_write_buffer();
         if (HAILO_SUCCESS != status) {
             std::cerr << "Failed reading with status = " <<  status << std::endl;
             return status;
         }
+        inference_latency.end(i, StageClock::now());
     }
 
     read_time_vec = std::chrono::high_resolution_clock::now();
     return HAILO_SUCCESS;
 }
 
-hailo_status write_all(InputVStream& input_vstream, std::string video_path, 
-                        std::chrono::time_point<std::chrono::system_clock>& write_time_vec, std::vector<cv::Mat>& frames) {
+hailo_status write_all(common::VStreamBackend& backend, std::string video_path, 
+                        std::chrono::time_point<std::chrono::system_clock>& write_time_vec, common::FrameRing<cv::Mat>& frames,
+                        common::LatencyWindow& inference_latency) {
     m.lock();
-    std::cout << CYAN << "-I- Started write thread: " << info_to_str(input_vstream.get_info()) << std::endl << RESET;
+    std::cout << CYAN << "-I- Started write thread: " << info_to_str(backend.input_infos()[0]) << std::endl << RESET;
     m.unlock();
 
     hailo_status status = HAILO_SUCCESS;
     
-    auto input_shape = input_vstream.get_info().shape;
+    auto input_shape = backend.input_infos()[0].shape;
     int height = input_shape.height;
     int width = input_shape.width;
 
     cv::VideoCapture capture(video_path);
-    if(!capture.isOpened())
+    if(!capture.isOpened()) {
+        frames.close();
         throw "Unable to read video file";
+    }
     
-    int i = 0;
     cv::Mat org_frame;
 
     write_time_vec = std::chrono::high_resolution_clock::now();
-    for(;;) {
+    for(size_t i = 0;; i++) {
+        auto capture_start = StageClock::now();
         capture >> org_frame;
         if(org_frame.empty()) {
             break;
             }
-
-        cv::resize(org_frame, frames[i], cv::Size(height, width), 1);
-
-        input_vstream.write(MemoryView(frames[i].data, input_vstream.get_frame_size())); // Writing height * width, 3 channels of uint8
-        if (HAILO_SUCCESS != status)
+        auto capture_time = StageClock::now() - capture_start;
+
+        // Waits while the ring is full, so the capture never runs more than its capacity ahead of the drawing
+        cv::Mat &frame = frames.acquire_write();
+        auto resize_start = StageClock::now();
+        cv::resize(org_frame, frame, cv::Size(height, width), 1);
+        auto write_start = StageClock::now();
+        capture_stage.add(capture_time + (write_start - resize_start));
+
+        inference_latency.begin(i, write_start);
+        status = backend.write(0, frame.data, backend.input_frame_size(0)); // Writing height * width, 3 channels of uint8
+        write_stage.add(write_start, StageClock::now());
+        frames.release_write();
+        if (HAILO_SUCCESS != status) {
+            frames.close();
             return status;
-        i++;
+        }
     }
 
+    frames.close();
     capture.release();
     return HAILO_SUCCESS;
 }
@@ -192,13 +254,15 @@ hailo_status write_all(InputVStream& input_vstream, std::string video_path,
 template <typename T>
 hailo_status create_feature(hailo_vstream_info_t vstream_info, size_t output_frame_size, std::shared_ptr<FeatureData<T>> &feature) {
     feature = std::make_shared<FeatureData<T>>(static_cast<uint32_t>(output_frame_size), vstream_info.quant_info.qp_zp,
-        vstream_info.quant_info.qp_scale, vstream_info.shape.width, vstream_info);
+        vstream_info.quant_info.qp_scale, vstream_info.shape.width, vstream_info,
+        // The frames in flight hold their buffers in the ring, the read thread keeps the default slots to write in
+        static_cast<uint32_t>(pp_options.max_in_flight) + RingBuffer<T>::DEFAULT_SLOTS);
 
     return HAILO_SUCCESS;
 }
 
 template <typename T>
-hailo_status run_inference(std::vector<InputVStream>& input_vstream, std::vector<OutputVStream>& output_vstreams, std::string video_path,
+hailo_status run_inference(common::VStreamBackend& backend, std::string video_path,
                     std::chrono::time_point<std::chrono::system_clock>& write_time_vec,
                     std::vector<std::chrono::time_point<std::chrono::system_clock>>& read_time_vec,
                     std::chrono::duration<double>& inference_time, std::chrono::duration<double>& postprocess_time, 
@@ -206,10 +270,10 @@ hailo_status run_inference(std::vector<InputVStream>& input_vstream, std::vector
 
     hailo_status status = HAILO_UNINITIALIZED;
     
-    auto output_vstreams_size = output_vstreams.size();
+    auto output_vstreams_size = backend.output_infos().size();
 
     bool nms_on_hailo = false;
-    if (output_vstreams_size == 1 && ((std::string)output_vstreams[0].get_info().name).find("nms") != std::string::npos) {
+    if (output_vstreams_size == 1 && ((std::string)backend.output_infos()[0].name).find("nms") != std::string::npos) {
         nms_on_hailo = true;
     }
 
@@ -217,7 +281,7 @@ hailo_status run_inference(std::vector<InputVStream>& input_vstream, std::vector
     features.reserve(output_vstreams_size);
     for (size_t i = 0; i < output_vstreams_size; i++) {
         std::shared_ptr<FeatureData<T>> feature(nullptr);
-        auto status = create_feature<T>(output_vstreams[i].get_info(), output_vstreams[i].get_frame_size(), feature);
+        auto status = create_feature<T>(backend.output_infos()[i], backend.output_frame_size(i), feature);
         if (HAILO_SUCCESS != status) {
             std::cerr << "Failed creating feature with status = " << status << std::endl;
             return status;
@@ -226,15 +290,24 @@ hailo_status run_inference(std::vector<InputVStream>& input_vstream, std::vector
         features.emplace_back(feature);
     }
 
-    std::vector<cv::Mat> frames((int)frame_count);
+    // Only the frames between the capture and the drawing are kept, whatever the length of the video
+    common::FrameRing<cv::Mat> frames(pp_options.max_in_flight + FRAME_RING_SLACK);
+    auto input_shape = backend.input_infos()[0].shape;
+    frames.preallocate([&input_shape](cv::Mat &frame) {
+        frame.create(cv::Size((int)input_shape.height, (int)input_shape.width), CV_8UC3);
+    });
 
-    auto input_thread(std::async(write_all, std::ref(input_vstream[0]), video_path, std::ref(write_time_vec), std::ref(frames)));
+    // Latency of every frame from its write to the read of its last output. The writer is never more than the
+    // frame ring ahead of the drawing, so a window of twice the ring holds all the frames between write and read.
+    common::LatencyWindow inference_latency(inference_stage, 2 * frames.capacity(), output_vstreams_size);
+
+    auto input_thread(std::async(write_all, std::ref(backend), video_path, std::ref(write_time_vec), std::ref(frames), std::ref(inference_latency)));
 
     // Create read threads
     std::vector<std::future<hailo_status>> output_threads;
     output_threads.reserve(output_vstreams_size);
     for (size_t i = 0; i < output_vstreams_size; i++) {
-        output_threads.emplace_back(std::async(read_all<T>, std::ref(output_vstreams[i]), features[i], frame_count, std::ref(read_time_vec[i]))); 
+        output_threads.emplace_back(std::async(read_all<T>, std::ref(backend), i, features[i], frame_count, std::ref(read_time_vec[i]), std::ref(inference_latency))); 
     }
 
     auto pp_thread(std::async(post_processing_all<T>, std::ref(features), frame_count, std::ref(postprocess_time), std::ref(frames), org_height, org_width, nms_on_hailo));
@@ -259,7 +332,7 @@ hailo_status run_inference(std::vector<InputVStream>& input_vstream, std::vector
     }
 
     inference_time = read_time_vec[0] - write_time_vec;
-    for (size_t i = 1; i < output_vstreams.size(); i++){
+    for (size_t i = 1; i < output_vstreams_size; i++){
         if (inference_time.count() < (double)(read_time_vec[i] - write_time_vec).count())
             inference_time = read_time_vec[i] - write_time_vec;
     }
@@ -271,46 +344,20 @@ hailo_status run_inference(std::vector<InputVStream>& input_vstream, std::vector
 }
 
 
-void print_net_banner(std::pair<std::vector<hailort::InputVStream>, std::vector<hailort::OutputVStream>> &vstreams) {
+void print_net_banner(const common::VStreamBackend &backend) {
     std::cout << BOLDMAGENTA << "-I-----------------------------------------------" << std::endl << RESET;
     std::cout << BOLDMAGENTA << "-I-  Network  Name                                     " << std::endl << RESET;
     std::cout << BOLDMAGENTA << "-I-----------------------------------------------" << std::endl << RESET;
-    for (auto const& value: vstreams.first) {
-        std::cout << MAGENTA << "-I-  IN:  " << value.name() <<std::endl << RESET;
+    for (auto const& value: backend.input_infos()) {
+        std::cout << MAGENTA << "-I-  IN:  " << value.name <<std::endl << RESET;
     }
     std::cout << BOLDMAGENTA << "-I-----------------------------------------------" << std::endl << RESET;
-    for (auto const& value: vstreams.second) {
-        std::cout << MAGENTA << "-I-  OUT: " << value.name() <<std::endl << RESET;
+    for (auto const& value: backend.output_infos()) {
+        std::cout << MAGENTA << "-I-  OUT: " << value.name <<std::endl << RESET;
     }
     std::cout << BOLDMAGENTA << "-I-----------------------------------------------\n" << std::endl << RESET;
 }
 
-Expected<std::shared_ptr<ConfiguredNetworkGroup>> configure_network_group(VDevice &vdevice, std::string yolov_hef)
-{
-    auto hef_exp = Hef::create(yolov_hef);
-    if (!hef_exp) {
-        return make_unexpected(hef_exp.status());
-    }
-    auto hef = hef_exp.release();
-
-    auto configure_params = hef.create_configure_params(HAILO_STREAM_INTERFACE_PCIE);
-    if (!configure_params) {
-        return make_unexpected(configure_params.status());
-    }
-
-    auto network_groups = vdevice.configure(hef, configure_params.value());
-    if (!network_groups) {
-        return make_unexpected(network_groups.status());
-    }
-
-    if (1 != network_groups->size()) {
-        std::cerr << "Invalid amount of network groups" << std::endl;
-        return make_unexpected(HAILO_INTERNAL_FAILURE);
-    }
-
-    return std::move(network_groups->at(0));
-}
-
 std::string getCmdOption(int argc, char *argv[], const std::string &option)
 {
     std::string cmd;
@@ -337,53 +384,45 @@ int main(int argc, char** argv) {
     std::string yolo_hef        = getCmdOption(argc, argv, "-hef=");
     std::string video_path      = getCmdOption(argc, argv, "-video=");
     model_arch                  = getCmdOption(argc, argv, "-arch=");
+    config_path                 = model_arch + ".json";
+    std::string pp_threads      = getCmdOption(argc, argv, "-pp-threads=");
+    std::string pp_in_flight    = getCmdOption(argc, argv, "-pp-in-flight=");
+    pp_options = common::PostProcessOptions(pp_threads.empty() ? 0 : std::stoul(pp_threads),
+                                            pp_in_flight.empty() ? 0 : std::stoul(pp_in_flight));
+    std::string mock_spec       = getCmdOption(argc, argv, "-mock=");
+    std::string record_dir      = getCmdOption(argc, argv, "-record=");
+    std::string record_frames   = getCmdOption(argc, argv, "-record-frames=");
 
     std::chrono::time_point<std::chrono::system_clock> write_time_vec;
     std::chrono::duration<double> inference_time;
     std::chrono::duration<double> postprocess_time;
 
-    auto vdevice_exp = VDevice::create();
-    if (!vdevice_exp) {
-        std::cerr << "Failed create vdevice, status = " << vdevice_exp.status() << std::endl;
-        return vdevice_exp.status();
-    }
-    auto vdevice = vdevice_exp.release();
-
-    auto network_group = configure_network_group(*vdevice, yolo_hef);
-    if (!network_group) {
-        std::cerr << "Failed to configure network group " << yolo_hef << std::endl;
-        return network_group.status();
-    }
-
-    auto input_vstreams_params = network_group.value()->make_input_vstream_params(QUANTIZED, FORMAT_TYPE_INPUT, HAILO_DEFAULT_VSTREAM_TIMEOUT_MS, HAILO_DEFAULT_VSTREAM_QUEUE_SIZE);
-    if (!input_vstreams_params) {
-        std::cerr << "Failed creating input vstreams " << input_vstreams_params.status() << std::endl;
-        return input_vstreams_params.status();
-    }
-
-    auto output_vstreams_params = network_group.value()->make_output_vstream_params(QUANTIZED, FORMAT_TYPE_OUTPUT, HAILO_DEFAULT_VSTREAM_TIMEOUT_MS, HAILO_DEFAULT_VSTREAM_QUEUE_SIZE);
-    if (!output_vstreams_params) {
-        std::cerr << "Failed creating vstreams " << output_vstreams_params.status() << std::endl;
-        return output_vstreams_params.status();
+    // The network runs on the device, or on a mock of it (see common/mock_backend.hpp) with -mock=
+    std::unique_ptr<common::VStreamBackend> backend;
+    try {
+        if (mock_spec.empty()) {
+            auto device_backend = common::HailoVStreamBackend::create(yolo_hef, QUANTIZED, FORMAT_TYPE_INPUT, FORMAT_TYPE_OUTPUT);
+            if (!device_backend) {
+                return device_backend.status();
+            }
+            backend = device_backend.release();
+        }
+        else {
+            backend.reset(new common::MockVStreamBackend(common::MockNetworkSpec::load(mock_spec)));
+        }
+        if (!record_dir.empty()) {
+            backend.reset(new common::RecordingVStreamBackend(std::move(backend), record_dir,
+                                                              record_frames.empty() ? DEFAULT_RECORD_FRAMES : std::stoul(record_frames)));
+        }
     }
-
-    auto input_vstreams = VStreamsBuilder::create_input_vstreams(*network_group.value(), *input_vstreams_params);
-    if (!input_vstreams) {
-        std::cerr << "Failed creating input vstreams " << input_vstreams.status() << std::endl;
-        return input_vstreams.status();
+    catch (const std::exception &e) {
+        std::cerr << "Failed creating the inference backend: " << e.what() << std::endl;
+        return HAILO_INVALID_ARGUMENT;
     }
 
-    auto output_vstreams = VStreamsBuilder::create_output_vstreams(*network_group.value(), *output_vstreams_params);
-    if (!output_vstreams) {
-        std::cerr << "Failed creating output vstreams " << output_vstreams.status() << std::endl;
-        return output_vstreams.status();
-    }
+    std::vector<std::chrono::time_point<std::chrono::system_clock>> read_time_vec(backend->output_infos().size());
 
-    auto vstreams = std::make_pair(input_vstreams.release(), output_vstreams.release());
-
-    std::vector<std::chrono::time_point<std::chrono::system_clock>> read_time_vec(vstreams.second.size());
-
-    print_net_banner(vstreams);
+    print_net_banner(*backend);
 
     cv::VideoCapture capture(video_path);
     if (!capture.isOpened()){
@@ -394,19 +433,26 @@ int main(int argc, char** argv) {
     double org_width = capture.get(cv::CAP_PROP_FRAME_WIDTH);
     capture.release();
 
-    status = run_inference<uint8_t>(std::ref(vstreams.first), 
-                                    std::ref(vstreams.second), 
+    auto run_start = StageClock::now();
+    status = run_inference<uint8_t>(*backend, 
                                     video_path, 
                                     write_time_vec, read_time_vec, 
                                     inference_time, postprocess_time, 
                                     frame_count, org_height, org_width);
+    auto run_time = StageClock::now() - run_start;
 
     if (HAILO_SUCCESS != status) {
         std::cerr << "Failed running inference with status = " << status << std::endl;
         return status;
     }
 
-    print_inference_statistics(inference_time, postprocess_time, yolo_hef, frame_count);
+    print_inference_statistics(inference_time, postprocess_time, mock_spec.empty() ? yolo_hef : "mock", frame_count);
+
+    std::cout << BOLDGREEN << "\n-I-----------------------------------------------" << std::endl;
+    std::cout << "-I- Pipeline stages" << (mock_spec.empty() ? "" : " (mock device)") << std::endl;
+    std::cout << "-I-----------------------------------------------" << std::endl;
+    stage_stats.print(std::cout, (size_t)frame_count, run_time);
+    std::cout << "-I-----------------------------------------------" << std::endl << RESET;
 
     std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::high_resolution_clock::now();
     total_time = t_end - t_start;
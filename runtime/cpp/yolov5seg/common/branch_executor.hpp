@@ -0,0 +1,221 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file branch_executor.hpp
+ * @brief Long-lived workers running the per-branch decoding of a frame in parallel.
+ **/
+#pragma once
+
+#include <stddef.h>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace common
+{
+    /**
+     * @brief Fork-join executor: run(count, func) calls func(0..count-1) in parallel and returns when they all finished.
+     *
+     * The workers are created once and pinned to cores, so a frame doesn't create any thread.
+     * The calling thread runs part of the tasks itself, and while it waits it helps with any queued
+     * task, so several threads (e.g. post-processing pool workers) can share one executor.
+     */
+    class BranchExecutor
+    {
+    public:
+        /**
+         * @brief Counters of the executor.
+         */
+        struct Stats
+        {
+            size_t threads_created; // worker threads created since construction
+            size_t batches;         // run() calls
+            size_t tasks;           // tasks run, by workers and callers
+        };
+
+        /**
+         * @param num_workers Number of worker threads.
+         * @param pin_workers Pin worker i to core i (modulo the number of cores), Linux only.
+         */
+        explicit BranchExecutor(size_t num_workers, bool pin_workers = true) : m_queue_head(0), m_stop(false), m_batches(0), m_tasks(0)
+        {
+            const size_t cores = std::thread::hardware_concurrency();
+            for (size_t i = 0; i < num_workers; i++)
+            {
+                m_workers.emplace_back(&BranchExecutor::worker, this);
+#if defined(__linux__)
+                if (pin_workers && cores > 1)
+                {
+                    cpu_set_t cpuset;
+                    CPU_ZERO(&cpuset);
+                    CPU_SET(i % cores, &cpuset);
+                    pthread_setaffinity_np(m_workers.back().native_handle(), sizeof(cpu_set_t), &cpuset);
+                }
+#else
+                (void)pin_workers;
+                (void)cores;
+#endif
+            }
+        }
+
+        ~BranchExecutor()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cv.notify_all();
+            for (auto &worker : m_workers)
+                worker.join();
+        }
+
+        BranchExecutor(const BranchExecutor &) = delete;
+        BranchExecutor &operator=(const BranchExecutor &) = delete;
+
+        size_t num_workers() const { return m_workers.size(); }
+
+        Stats stats()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return Stats{m_workers.size(), m_batches, m_tasks};
+        }
+
+        /**
+         * @brief Call func(i) for every i in [0, count) in parallel, and wait for all the calls.
+         *        func is taken by reference, it may capture the caller's state by reference.
+         *        If calls throw, the first exception is rethrown here once all the calls are done.
+         */
+        template <typename Func>
+        void run(size_t count, Func &&func)
+        {
+            if (count == 0)
+                return;
+            std::function<void(size_t)> call = std::ref(func);
+            Batch batch(call, count);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_batches++;
+                for (size_t i = 1; i < count; i++)
+                    m_queue.push_back(Task{&batch, i});
+            }
+            m_cv.notify_all();
+
+            execute(Task{&batch, 0});
+            // Help with the queued tasks (of this batch or of another caller's) until this batch is done
+            for (;;)
+            {
+                Task task;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    if (batch.remaining == 0)
+                        break;
+                    if (!queued())
+                    {
+                        m_done_cv.wait(lock, [&batch, this]
+                                       { return batch.remaining == 0 || queued(); });
+                        continue;
+                    }
+                    task = pop_task();
+                }
+                execute(task);
+            }
+            if (batch.error)
+                std::rethrow_exception(batch.error);
+        }
+
+    private:
+        struct Batch
+        {
+            Batch(std::function<void(size_t)> &func, size_t count) : func(func), remaining(count){};
+            std::function<void(size_t)> &func;
+            size_t remaining; // guarded by the executor mutex
+            std::exception_ptr error;
+        };
+
+        struct Task
+        {
+            Batch *batch;
+            size_t index;
+        };
+
+        std::vector<std::thread> m_workers;
+        std::vector<Task> m_queue; // the tasks from m_queue_head on are queued, the capacity is reused by the next batches
+        size_t m_queue_head;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;      // workers wait for tasks
+        std::condition_variable m_done_cv; // callers wait for their batch
+        bool m_stop;
+        size_t m_batches;
+        size_t m_tasks;
+
+        bool queued() const
+        {
+            return m_queue_head < m_queue.size();
+        }
+
+        // Called with the mutex held and a queued task
+        Task pop_task()
+        {
+            Task task = m_queue[m_queue_head++];
+            if (m_queue_head == m_queue.size())
+            {
+                m_queue.clear();
+                m_queue_head = 0;
+            }
+            else if (m_queue_head * 2 >= m_queue.size())
+            {
+                // Several callers keep the queue busy, drop the popped tasks so it doesn't grow
+                m_queue.erase(m_queue.begin(), m_queue.begin() + m_queue_head);
+                m_queue_head = 0;
+            }
+            return task;
+        }
+
+        void execute(const Task &task)
+        {
+            std::exception_ptr error;
+            try
+            {
+                task.batch->func(task.index);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks++;
+            if (error && !task.batch->error)
+                task.batch->error = error;
+            // Notified under the lock: once the caller sees remaining == 0 the batch is gone.
+            if (--task.batch->remaining == 0)
+                m_done_cv.notify_all();
+        }
+
+        void worker()
+        {
+            for (;;)
+            {
+                Task task;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_cv.wait(lock, [this]
+                              { return queued() || m_stop; });
+                    if (!queued())
+                        return;
+                    task = pop_task();
+                }
+                execute(task);
+            }
+        }
+    };
+}
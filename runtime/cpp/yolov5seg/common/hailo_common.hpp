@@ -54,9 +54,9 @@ namespace hailo_common
         return detection;
     }
 
-    inline void add_detections(HailoROIPtr roi, std::vector<HailoDetection> detections)
+    inline void add_detections(HailoROIPtr roi, const std::vector<HailoDetection> &detections)
     {
-        for (auto det : detections)
+        for (const auto &det : detections)
         {
             add_object(roi, std::make_shared<HailoDetection>(det));
         }
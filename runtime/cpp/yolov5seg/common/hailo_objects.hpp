@@ -34,7 +34,8 @@ typedef enum
     HAILO_DEPTH_MASK,
     HAILO_CLASS_MASK,
     HAILO_CONF_CLASS_MASK,
-    HAILO_USER_META
+    HAILO_USER_META,
+    HAILO_RLE_MASK
 } hailo_object_t;
 
 static std::map<std::string, hailo_object_t> hailo_object_map = {
@@ -49,6 +50,7 @@ static std::map<std::string, hailo_object_t> hailo_object_map = {
     {"hailo_class_mask", HAILO_CLASS_MASK},
     {"hailo_conf_class_mask", HAILO_CONF_CLASS_MASK},
     {"hailo_user_meta", HAILO_USER_META},
+    {"hailo_rle_mask", HAILO_RLE_MASK},
 };
 
 inline hailo_object_t hailo_object_type_from_string(const std::string &lower_case_str)
@@ -205,7 +207,14 @@ public:
     HailoMainObject(HailoMainObject &&other) noexcept : HailoObject(other), m_sub_objects(std::move(other.m_sub_objects)){};
     HailoMainObject(const HailoMainObject &other) : HailoObject(other), m_sub_objects(other.m_sub_objects){};
     HailoMainObject &operator=(const HailoMainObject &other) = default;
-    HailoMainObject &operator=(HailoMainObject &&other) noexcept = default;
+    // The mutex is shared as in the copy, a moved-from object stays usable
+    HailoMainObject &operator=(HailoMainObject &&other) noexcept
+    {
+        HailoObject::operator=(other);
+        m_sub_objects = std::move(other.m_sub_objects);
+        m_tensors = std::move(other.m_tensors);
+        return *this;
+    };
 
     /**
      * @brief Add an object to the main object.
@@ -259,7 +268,7 @@ public:
      * @param name Tensor's name to get,
      * @return HailoTensorPtr - A tensor.
      */
-    HailoTensorPtr get_tensor(std::string name)
+    HailoTensorPtr get_tensor(const std::string &name)
     {
         std::lock_guard<std::mutex> lock(*mutex);
         auto itr = m_tensors.find(name);
@@ -379,7 +388,7 @@ protected:
 public:
     HailoROI(HailoBBox bbox, std::string stream_id = "") : m_bbox(bbox), m_scaling_bbox(HailoBBox(0.0, 0.0, 1.0, 1.0)), m_stream_id(stream_id){};
     virtual ~HailoROI() = default;
-    HailoROI(HailoROI &&other) noexcept : HailoMainObject(other), m_bbox(std::move(other.m_bbox)), m_scaling_bbox(std::move(other.m_scaling_bbox)), m_stream_id(std::move(other.m_stream_id)){};
+    HailoROI(HailoROI &&other) noexcept : HailoMainObject(std::move(other)), m_bbox(std::move(other.m_bbox)), m_scaling_bbox(std::move(other.m_scaling_bbox)), m_stream_id(std::move(other.m_stream_id)){};
     HailoROI(const HailoROI &other) : HailoMainObject(other), m_bbox(other.m_bbox), m_scaling_bbox(std::move(other.m_scaling_bbox)), m_stream_id(std::move(other.m_stream_id)){};
     HailoROI &operator=(const HailoROI &other) = default;
     HailoROI &operator=(HailoROI &&other) noexcept = default;
@@ -602,7 +611,7 @@ public:
     HailoDetection(HailoBBox bbox, int class_id, const std::string &label, float confidence) : HailoROI(bbox), m_confidence(assure_normal(confidence)), m_label(label), m_class_id(class_id){};
 
     // Move constructor
-    HailoDetection(HailoDetection &&other) noexcept : HailoROI(other),
+    HailoDetection(HailoDetection &&other) noexcept : HailoROI(std::move(other)),
                                                       m_confidence(assure_normal(other.m_confidence)),
                                                       m_label(std::move(other.m_label)),
                                                       m_class_id(other.m_class_id){};
@@ -618,7 +627,7 @@ public:
     {
         if (this != &other)
         {
-            HailoROI::operator=(other);
+            HailoROI::operator=(std::move(other));
             m_confidence = assure_normal(other.m_confidence);
             m_class_id = other.m_class_id;
             m_label = std::move(other.m_label);
@@ -1056,6 +1065,38 @@ public:
 };
 using HailoConfClassMaskPtr = std::shared_ptr<HailoConfClassMask>;
 
+/**
+ * @brief A binary mask, run-length encoded: row after row, the lengths of the alternating runs of
+ * background and mask pixels. The first run is background (it may be empty), the runs add up to width * height.
+ */
+class HailoRleMask : public HailoMask
+{
+protected:
+    int m_class_id;
+    std::vector<uint32_t> m_runs;
+
+public:
+    HailoRleMask(std::vector<uint32_t> &&runs, int mask_width, int mask_height, float transparency, int class_id) : HailoMask(mask_width, mask_height, transparency), m_class_id(class_id), m_runs(std::move(runs)){};
+
+    virtual hailo_object_t get_type()
+    {
+        return HAILO_RLE_MASK;
+    }
+
+    const std::vector<uint32_t> &get_runs()
+    {
+        return m_runs;
+    }
+
+    virtual ~HailoRleMask() = default;
+
+    int get_class_id()
+    {
+        return m_class_id;
+    }
+};
+using HailoRleMaskPtr = std::shared_ptr<HailoRleMask>;
+
 class HailoMatrix : public HailoObject
 {
 protected:
@@ -1069,7 +1110,7 @@ public:
     HailoMatrix(std::vector<float> data,
                 uint32_t mat_height,
                 uint32_t mat_width,
-                uint32_t mat_features = HailoMatrix::DEFAULT_NUMBER_OF_FEATURES) : m_data(data),
+                uint32_t mat_features = HailoMatrix::DEFAULT_NUMBER_OF_FEATURES) : m_data(std::move(data)),
                                                                                    m_mat_height(mat_height),
                                                                                    m_mat_width(mat_width),
                                                                                    m_mat_features(mat_features){};
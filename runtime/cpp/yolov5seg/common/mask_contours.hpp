@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file mask_contours.hpp
+ * @brief Outer contours of a binary mask, simplified with Douglas-Peucker.
+ **/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace common
+{
+    struct ContourPoint
+    {
+        int x;
+        int y;
+    };
+
+    // the 8 neighbours of a pixel, clockwise (y grows downwards) from the east
+    static const int CONTOUR_DX[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+    static const int CONTOUR_DY[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+    inline int contour_direction(int dx, int dy)
+    {
+        for (int direction = 0; direction < 8; direction++)
+        {
+            if (CONTOUR_DX[direction] == dx && CONTOUR_DY[direction] == dy)
+                return direction;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Trace the outer contour of every 8-connected part of a binary mask (holes are not traced).
+     *
+     * Each contour is the clockwise list of the boundary pixels of its part (Moore neighbour tracing),
+     * a part of a single pixel is a contour of a single point.
+     *
+     * @param bits the mask, width x height row major, non zero inside
+     * @return std::vector<std::vector<ContourPoint>> the contours, in the order of the top left pixel of their part
+     */
+    inline std::vector<std::vector<ContourPoint>> trace_contours(const uint8_t *bits, int width, int height)
+    {
+        // a background border around the mask, so that the neighbours of a mask pixel are always inside
+        const int padded_width = width + 2;
+        std::vector<int> labels((size_t)padded_width * (height + 2), 0); // -1 outside, 0 unlabelled, > 0 the part
+        for (int y = 0; y < height + 2; y++)
+        {
+            for (int x = 0; x < padded_width; x++)
+            {
+                bool inside = x > 0 && y > 0 && x <= width && y <= height && bits[(y - 1) * width + (x - 1)];
+                labels[(size_t)y * padded_width + x] = inside ? 0 : -1;
+            }
+        }
+
+        std::vector<std::vector<ContourPoint>> contours;
+        std::vector<int> stack;
+        int part = 0;
+        for (int start = 0; start < (int)labels.size(); start++)
+        {
+            if (labels[start] != 0)
+                continue;
+
+            // label the part, so that its pixels are not the start of another contour
+            part++;
+            labels[start] = part;
+            stack.push_back(start);
+            while (!stack.empty())
+            {
+                int pixel = stack.back();
+                stack.pop_back();
+                for (int direction = 0; direction < 8; direction++)
+                {
+                    int neighbour = pixel + CONTOUR_DY[direction] * padded_width + CONTOUR_DX[direction];
+                    if (labels[neighbour] == 0)
+                    {
+                        labels[neighbour] = part;
+                        stack.push_back(neighbour);
+                    }
+                }
+            }
+
+            // the start is the top left pixel of its part, so its west neighbour is outside.
+            // Walk the boundary clockwise, each step searching the neighbours clockwise from the last outside one,
+            // until the start is left again in the same direction as the first time.
+            std::vector<ContourPoint> contour;
+            const int start_x = start % padded_width, start_y = start / padded_width;
+            int x = start_x, y = start_y;
+            int back = 4; // west
+            int first = -1;
+            contour.push_back({x - 1, y - 1});
+            const size_t max_steps = 4 * labels.size();
+            for (size_t step = 0; step < max_steps; step++)
+            {
+                int next = -1;
+                for (int i = 1; i <= 8; i++)
+                {
+                    int direction = (back + i) % 8;
+                    if (labels[(size_t)(y + CONTOUR_DY[direction]) * padded_width + x + CONTOUR_DX[direction]] > 0)
+                    {
+                        next = direction;
+                        break;
+                    }
+                }
+                if (next < 0) // a single pixel
+                    break;
+                if (x == start_x && y == start_y)
+                {
+                    if (next == first)
+                    {
+                        contour.pop_back(); // the start, reached again
+                        break;
+                    }
+                    if (first < 0)
+                        first = next;
+                }
+                // the last outside neighbour, seen from the next pixel
+                int previous = (next + 7) % 8;
+                int back_x = x + CONTOUR_DX[previous], back_y = y + CONTOUR_DY[previous];
+                x += CONTOUR_DX[next];
+                y += CONTOUR_DY[next];
+                back = contour_direction(back_x - x, back_y - y);
+                contour.push_back({x - 1, y - 1});
+            }
+            contours.push_back(std::move(contour));
+        }
+        return contours;
+    }
+
+    /**
+     * @brief Squared distance of a point to the segment [a, b].
+     */
+    inline float contour_segment_distance2(const ContourPoint &point, const ContourPoint &a, const ContourPoint &b)
+    {
+        float dx = (float)(b.x - a.x), dy = (float)(b.y - a.y);
+        float px = (float)(point.x - a.x), py = (float)(point.y - a.y);
+        float length2 = dx * dx + dy * dy;
+        float t = length2 > 0.0f ? (px * dx + py * dy) / length2 : 0.0f;
+        t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+        float ex = px - t * dx, ey = py - t * dy;
+        return ex * ex + ey * ey;
+    }
+
+    /**
+     * @brief Simplify a closed contour with Douglas-Peucker: keep the points further than epsilon from the simplified polygon.
+     *
+     * The contour is split at its first point and the point furthest from it, each half is simplified on its own.
+     */
+    inline std::vector<ContourPoint> simplify_contour(const std::vector<ContourPoint> &contour, float epsilon)
+    {
+        const int count = (int)contour.size();
+        if (count < 3)
+            return contour;
+
+        int furthest = 0;
+        float furthest_distance2 = -1.0f;
+        for (int i = 1; i < count; i++)
+        {
+            float dx = (float)(contour[i].x - contour[0].x), dy = (float)(contour[i].y - contour[0].y);
+            if (dx * dx + dy * dy > furthest_distance2)
+            {
+                furthest_distance2 = dx * dx + dy * dy;
+                furthest = i;
+            }
+        }
+
+        // index count is the first point again, closing the contour
+        std::vector<char> keep(count + 1, 0);
+        keep[0] = keep[furthest] = keep[count] = 1;
+        const float epsilon2 = epsilon * epsilon;
+        std::vector<std::pair<int, int>> segments = {{0, furthest}, {furthest, count}};
+        while (!segments.empty())
+        {
+            std::pair<int, int> segment = segments.back();
+            segments.pop_back();
+            const ContourPoint &a = contour[segment.first];
+            const ContourPoint &b = contour[segment.second % count];
+            int split = -1;
+            float split_distance2 = epsilon2;
+            for (int i = segment.first + 1; i < segment.second; i++)
+            {
+                float distance2 = contour_segment_distance2(contour[i], a, b);
+                if (distance2 > split_distance2)
+                {
+                    split_distance2 = distance2;
+                    split = i;
+                }
+            }
+            if (split >= 0)
+            {
+                keep[split] = 1;
+                segments.push_back({segment.first, split});
+                segments.push_back({split, segment.second});
+            }
+        }
+
+        std::vector<ContourPoint> simplified;
+        for (int i = 0; i < count; i++)
+        {
+            if (keep[i])
+                simplified.push_back(contour[i]);
+        }
+        return simplified;
+    }
+}
@@ -1,81 +1,357 @@
 #pragma once
 
-#include "xtensor/xmath.hpp"
-#include "xtensor/xadapt.hpp"
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
 
+#include "quant_lut.hpp"
+#include "tensor_view.hpp"
+#include "mask_contours.hpp"
 
-/**
- * @brief  Compute sigmoid, not in-place (lazy)
- */
-auto xtensor_sigmoid(auto &tensor)
-{
-    return 1 / (1 + xt::exp(-tensor));
-}
+#if defined(HAILO_MASK_BLAS)
+#include <cblas.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define MASK_DECODING_NEON
+#endif
+
+// proto rows decoded together by all the instances crossing them, so the prototypes of a band stay in cache
+#define MASK_BAND_ROWS 4
 
 /*
  * @brief sigmoid on a single float
  *
  *  */
-inline float sigmoid(float x) { return (float)(1.0f / (1.0f + std::exp(-1.0 * x))); }
+inline float sigmoid(float x) { return 1.0f / (1.0f + std::exp(-x)); }
 
 /**
- * @brief  Compute tensor dot product along specified axes for arrays.
-            In this case along axis 2 of the first matrix and axis 0 of the second.
- *
- * @param matrix_1 left matrix in the dot product
- * @param matrix_2 right matrix in the dot product
- * @return xt::xarray<float> the dot product result
+ * @brief The dequantized mask prototypes, stored as planes: one height x width plane per prototype.
+ *        This is the 32 x (160 * 160) right hand side of the coefficients x prototypes product,
+ *        a row of a plane is a contiguous run of pixels.
+ */
+struct MaskPrototypes
+{
+    int height = 0;
+    int width = 0;
+    int channels = 0;
+    std::vector<float> planes;
+
+    size_t plane_size() const { return (size_t)height * width; }
+};
+
+/**
+ * @brief Dequantize an HWC tensor into planes, through the dequantization table of the tensor.
  */
-xt::xarray<float> dot_product_axis_2(xt::xarray<float, xt::layout_type::row_major> matrix_1,
-                                     xt::xarray<float, xt::layout_type::row_major> matrix_2)
+template <typename T>
+void dequantize_to_planes(const T *src, size_t plane_size, int channels, const common::DequantLut<T> &lut, float *planes)
 {
-    uint axis_length = matrix_1.shape(2);
-    if (axis_length != matrix_2.shape(0))
+    // transpose 16 pixels at a time: their HWC values are in L1 and every plane gets a whole cache line
+    const size_t block = 16;
+    for (size_t begin = 0; begin < plane_size; begin += block)
     {
-        throw std::invalid_argument("dot_product_axis_2 error: axis don't match!");
+        size_t end = std::min(begin + block, plane_size);
+        for (int channel = 0; channel < channels; channel++)
+        {
+            float *plane = planes + channel * plane_size;
+            for (size_t pixel = begin; pixel < end; pixel++)
+            {
+                plane[pixel] = lut[src[pixel * channels + channel]];
+            }
+        }
     }
-    float row_sum;
-    xt::xarray<float>::shape_type shape = {matrix_1.shape(0), matrix_1.shape(1)};
-    xt::xarray<float, xt::layout_type::row_major> product_matrix(shape);
-    for (uint i = 0; i < matrix_1.shape(0); ++i)
+}
+
+/*
+ * @brief Dequantize a view of the proto output into the planes of the prototypes, already sized
+ */
+template <typename T>
+void dequantize_prototypes(const common::TensorView<T> &proto, MaskPrototypes &prototypes)
+{
+    auto lut = common::get_dequant_lut<T>(proto.qp_scale(), proto.qp_zp(), common::LutActivation::NONE);
+    dequantize_to_planes(proto.data(), prototypes.plane_size(), prototypes.channels, *lut, prototypes.planes.data());
+}
+
+/*
+ * @brief Dequantize the proto output of yolact\ yolov5seg into mask prototypes
+ *
+ * @param proto the proto output tensor (HWC, uint8 or uint16)
+ * @param prototypes the prototypes to fill, its planes are reused from frame to frame
+ */
+void dequantize_prototypes(HailoTensorPtr &proto, MaskPrototypes &prototypes)
+{
+    prototypes.height = proto->height();
+    prototypes.width = proto->width();
+    prototypes.channels = proto->features();
+    prototypes.planes.resize(prototypes.plane_size() * prototypes.channels);
+    common::visit_tensor(*proto, [&](const auto &view)
+                         { dequantize_prototypes(view, prototypes); });
+}
+
+/*
+ * @brief A detection whose mask is decoded: its box on the prototypes and the storage of its mask
+ *  */
+struct MaskJob
+{
+    HailoDetection *instance;
+    HailoMatrixPtr matrix;
+    int xmin, ymin, width, height;
+    const float *coefficients;
+    std::vector<float> data;   // MASK_OUTPUT_FLOAT: height x width, row major
+    std::vector<uint32_t> runs; // MASK_OUTPUT_RLE: the runs so far, and the current one
+    uint32_t run_length = 0;
+    bool run_inside = false;
+    std::vector<uint8_t> bits;  // MASK_OUTPUT_CONTOUR: height x width, row major
+};
+
+/*
+ * @brief Store a decoded row of a mask in the output of the job, from the values of its pixels before the sigmoid.
+ * A pixel is inside a binary mask when its confidence is above 0.5, that is when its value is positive,
+ * so the binary outputs don't compute the sigmoid.
+ *
+ * @param values the row, may be the row of job.data itself
+ *  */
+inline void store_mask_row(MaskJob &job, int row, const float *values, mask_output_t output)
+{
+    switch (output)
     {
-        for (uint j = 0; j < matrix_1.shape(1); ++j)
+    case MASK_OUTPUT_RLE:
+        for (int x = 0; x < job.width; x++)
         {
-            row_sum = 0.0;
-            for (uint k = 0; k < axis_length; ++k)
+            bool inside = values[x] > 0.0f;
+            if (inside != job.run_inside)
             {
-                row_sum += matrix_1(i, j, k) * matrix_2(k);
+                job.runs.push_back(job.run_length);
+                job.run_length = 0;
+                job.run_inside = inside;
             }
-            product_matrix(i, j) = row_sum;
+            job.run_length++;
+        }
+        break;
+    case MASK_OUTPUT_CONTOUR:
+    {
+        uint8_t *bits = job.bits.data() + (size_t)row * job.width;
+        for (int x = 0; x < job.width; x++)
+            bits[x] = values[x] > 0.0f;
+        break;
+    }
+    default:
+    {
+        float *out = job.data.data() + (size_t)row * job.width;
+        for (int x = 0; x < job.width; x++)
+            out[x] = sigmoid(values[x]);
+        break;
+    }
+    }
+}
+
+#if !defined(HAILO_MASK_BLAS)
+#if defined(__AVX2__)
+inline __m256 mask_madd(__m256 a, __m256 b, __m256 acc)
+{
+#if defined(__FMA__)
+    return _mm256_fmadd_ps(a, b, acc);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), acc);
+#endif
+}
+#endif
+
+/*
+ * @brief Decode a run of pixels of a mask row: out[x] = sum over the prototypes of coefficient * prototype[x]
+ *
+ * @param row the first pixel of the run in the first plane
+ * @param plane_size distance between the planes
+ * @param coefficients the mask coefficients, one per plane
+ * @param channels the number of planes
+ * @param count the number of pixels
+ * @param out the decoded pixels
+ *  */
+inline void decode_mask_row(const float *row, size_t plane_size, const float *coefficients, int channels, int count, float *out)
+{
+    int x = 0;
+#if defined(__AVX2__)
+    // 32 pixels are 4 independent accumulators, each prototype pixel is loaded once per instance row
+    for (; x + 32 <= count; x += 32)
+    {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        const float *plane = row + x;
+        for (int channel = 0; channel < channels; channel++, plane += plane_size)
+        {
+            __m256 coefficient = _mm256_set1_ps(coefficients[channel]);
+            acc0 = mask_madd(coefficient, _mm256_loadu_ps(plane), acc0);
+            acc1 = mask_madd(coefficient, _mm256_loadu_ps(plane + 8), acc1);
+            acc2 = mask_madd(coefficient, _mm256_loadu_ps(plane + 16), acc2);
+            acc3 = mask_madd(coefficient, _mm256_loadu_ps(plane + 24), acc3);
+        }
+        _mm256_storeu_ps(out + x, acc0);
+        _mm256_storeu_ps(out + x + 8, acc1);
+        _mm256_storeu_ps(out + x + 16, acc2);
+        _mm256_storeu_ps(out + x + 24, acc3);
+    }
+    for (; x + 8 <= count; x += 8)
+    {
+        __m256 acc = _mm256_setzero_ps();
+        const float *plane = row + x;
+        for (int channel = 0; channel < channels; channel++, plane += plane_size)
+        {
+            acc = mask_madd(_mm256_set1_ps(coefficients[channel]), _mm256_loadu_ps(plane), acc);
+        }
+        _mm256_storeu_ps(out + x, acc);
+    }
+#elif defined(MASK_DECODING_NEON)
+    for (; x + 16 <= count; x += 16)
+    {
+        float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f), acc2 = vdupq_n_f32(0.0f), acc3 = vdupq_n_f32(0.0f);
+        const float *plane = row + x;
+        for (int channel = 0; channel < channels; channel++, plane += plane_size)
+        {
+            float32x4_t coefficient = vdupq_n_f32(coefficients[channel]);
+            acc0 = vfmaq_f32(acc0, coefficient, vld1q_f32(plane));
+            acc1 = vfmaq_f32(acc1, coefficient, vld1q_f32(plane + 4));
+            acc2 = vfmaq_f32(acc2, coefficient, vld1q_f32(plane + 8));
+            acc3 = vfmaq_f32(acc3, coefficient, vld1q_f32(plane + 12));
+        }
+        vst1q_f32(out + x, acc0);
+        vst1q_f32(out + x + 4, acc1);
+        vst1q_f32(out + x + 8, acc2);
+        vst1q_f32(out + x + 12, acc3);
+    }
+    for (; x + 4 <= count; x += 4)
+    {
+        float32x4_t acc = vdupq_n_f32(0.0f);
+        const float *plane = row + x;
+        for (int channel = 0; channel < channels; channel++, plane += plane_size)
+        {
+            acc = vfmaq_f32(acc, vdupq_n_f32(coefficients[channel]), vld1q_f32(plane));
+        }
+        vst1q_f32(out + x, acc);
+    }
+#endif
+    // the rest, a prototype at a time so that the compiler can vectorize it
+    std::fill(out + x, out + count, 0.0f);
+    const float *plane = row;
+    for (int channel = 0; channel < channels; channel++, plane += plane_size)
+    {
+        const float coefficient = coefficients[channel];
+        for (int i = x; i < count; i++)
+        {
+            out[i] += coefficient * plane[i];
+        }
+    }
+}
+#endif
+
+/*
+ * @brief Decode the masks of the jobs in the rows [band_begin, band_end) of the prototypes
+ *
+ * With HAILO_MASK_BLAS the band is one GEMM of the coefficients of the instances crossing it (N x 32)
+ * by the prototypes of the band (32 x band pixels), then the boxes are cropped out of the product.
+ * Otherwise the built-in kernel decodes only the pixels inside the boxes, straight into the float masks
+ * (or into row, for the binary outputs).
+ * The sigmoid is computed inside the boxes only.
+ *  */
+void decode_mask_band(std::vector<MaskJob> &jobs, const MaskPrototypes &prototypes, int band_begin, int band_end, mask_output_t output, std::vector<float> &row)
+{
+    const size_t plane_size = prototypes.plane_size();
+    const int width = prototypes.width;
+#if defined(HAILO_MASK_BLAS)
+    std::vector<MaskJob *> active;
+    for (auto &job : jobs)
+    {
+        if (job.width > 0 && job.ymin < band_end && job.ymin + job.height > band_begin)
+            active.push_back(&job);
+    }
+    if (active.empty())
+        return;
+    const int band_pixels = (band_end - band_begin) * width;
+    std::vector<float> coefficients(active.size() * prototypes.channels);
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        std::copy(active[i]->coefficients, active[i]->coefficients + prototypes.channels, coefficients.begin() + i * prototypes.channels);
+    }
+    std::vector<float> product(active.size() * band_pixels);
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, (int)active.size(), band_pixels, prototypes.channels,
+                1.0f, coefficients.data(), prototypes.channels, prototypes.planes.data() + (size_t)band_begin * width, (int)plane_size,
+                0.0f, product.data(), band_pixels);
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        MaskJob &job = *active[i];
+        int begin = std::max(job.ymin, band_begin);
+        int end = std::min(job.ymin + job.height, band_end);
+        for (int y = begin; y < end; y++)
+        {
+            store_mask_row(job, y - job.ymin, product.data() + i * band_pixels + (size_t)(y - band_begin) * width + job.xmin, output);
+        }
+    }
+    (void)row;
+#else
+    for (auto &job : jobs)
+    {
+        int begin = std::max(job.ymin, band_begin);
+        int end = std::min(job.ymin + job.height, band_end);
+        for (int y = begin; y < end; y++)
+        {
+            float *values = output == MASK_OUTPUT_FLOAT ? job.data.data() + (size_t)(y - job.ymin) * job.width : row.data();
+            decode_mask_row(prototypes.planes.data() + (size_t)y * width + job.xmin, plane_size, job.coefficients, prototypes.channels, job.width, values);
+            store_mask_row(job, y - job.ymin, values, output);
+        }
+    }
+#endif
+}
+
+/*
+ * @brief Attach the simplified outer contours of a binary mask to its instance, one HailoLandmarks "contour" per part
+ * of the mask. The points are the centers of the boundary pixels, relative to the box of the instance, and the pairs
+ * close the polygon. Parts whose simplified contour has less than 3 points are dropped.
+ *  */
+void add_mask_contours(HailoDetection &instance, const std::vector<uint8_t> &bits, int width, int height, float epsilon)
+{
+    for (auto &contour : common::trace_contours(bits.data(), width, height))
+    {
+        std::vector<common::ContourPoint> simplified = common::simplify_contour(contour, epsilon);
+        if (simplified.size() < 3)
+            continue;
+        std::vector<HailoPoint> points;
+        std::vector<std::pair<int, int>> pairs;
+        points.reserve(simplified.size());
+        pairs.reserve(simplified.size());
+        for (size_t i = 0; i < simplified.size(); i++)
+        {
+            points.emplace_back((simplified[i].x + 0.5f) / width, (simplified[i].y + 0.5f) / height);
+            pairs.emplace_back((int)i, (int)((i + 1) % simplified.size()));
         }
+        instance.add_object(std::make_shared<HailoLandmarks>("contour", std::move(points), 0.0f, pairs));
     }
-    return product_matrix;
 }
 
 /*
  * @brief Decode the mask coefficients of yolact\ yolov5seg results into a format that makes sense
  * and add it to the detected instance for future calculation of the final mask
  *
+ * The masks of all the instances are decoded together, band of rows by band of rows, and each mask is
+ * written directly into the storage that its HailoConfClassMask takes over.
+ * With a binary output, no float mask is kept: a HailoRleMask or the contours of the mask
+ * (HailoLandmarks "contour", points relative to the box of the instance) are attached instead.
+ *
  * @param objects vector of the detected instances
- * @param proto the 32 mask prototypes that the coefficients select portions of to form the mask
+ * @param prototypes the 32 mask prototypes that the coefficients select portions of to form the mask
+ * @param output what to attach to the instances for their masks
+ * @param contour_epsilon the tolerance of the contours simplification, in proto pixels
  */
-void decode_masks(std::vector<HailoDetection> &objects, const xt::xarray<float> &proto)
+void decode_masks(std::vector<HailoDetection> &objects, const MaskPrototypes &prototypes,
+                  mask_output_t output = MASK_OUTPUT_FLOAT, float contour_epsilon = 1.0f)
 {
-    xt::xarray<float>::shape_type mask_shape = {proto.shape(0), proto.shape(1)};
-    int proto_width = proto.shape(0);
-    int proto_height = proto.shape(1);
-    int xmin, ymin, xmax, ymax;
+    // kept per thread, their capacity is reused by the next frames
+    static thread_local std::vector<MaskJob> jobs;
+    static thread_local std::vector<float> row;
+    jobs.clear();
+    jobs.reserve(objects.size());
     for (auto &instance : objects)
     {
-        // Gather the detection bounds for this instance,
-        // they are relative scale so multiply by proto size
-        HailoBBox bbox = instance.get_bbox();
-        xmin = CLAMP(bbox.xmin() * proto_width, 0, proto_width);
-        xmax = CLAMP(bbox.xmax() * proto_width, 0, proto_width);
-        ymin = CLAMP(bbox.ymin() * proto_height, 0, proto_height);
-        ymax = CLAMP(bbox.ymax() * proto_height, 0, proto_height);
-        // Crop a view of the proto layer of just this instance's detection area
-        auto cropped_proto = xt::view(proto, xt::range(ymin, ymax), xt::range(xmin, xmax));
         HailoMatrixPtr matrix = NULL;
         for (auto obj : instance.get_objects())
         {
@@ -86,23 +362,57 @@ void decode_masks(std::vector<HailoDetection> &objects, const xt::xarray<float>
         }
         if (matrix == NULL) // no mask attached
         {
-            return;
+            continue;
         }
-        xt::xarray<int>::shape_type shape = {matrix->height()};
-        xt::xarray<float> mask_coefficients = xt::adapt(matrix->get_data().data(), matrix->height(), xt::no_ownership(), shape);
-
-        // Calculate a matrix multiplication of the instance's coefficients and the cropped proto layer and transpose it
-        xt::xarray<float, xt::layout_type::column_major> cropped_mask = xt::transpose(dot_product_axis_2(cropped_proto, mask_coefficients));
-        instance.remove_object(matrix); // not needed anymore
+        if ((int)matrix->height() != prototypes.channels)
+        {
+            throw std::invalid_argument("decode_masks error: mask coefficients don't match the prototypes!");
+        }
+        // Gather the detection bounds for this instance,
+        // they are relative scale so multiply by proto size
+        HailoBBox bbox = instance.get_bbox();
+        int xmin = CLAMP(bbox.xmin() * prototypes.width, 0, prototypes.width);
+        int xmax = CLAMP(bbox.xmax() * prototypes.width, 0, prototypes.width);
+        int ymin = CLAMP(bbox.ymin() * prototypes.height, 0, prototypes.height);
+        int ymax = CLAMP(bbox.ymax() * prototypes.height, 0, prototypes.height);
+        MaskJob job;
+        job.instance = &instance;
+        job.matrix = matrix;
+        job.xmin = xmin;
+        job.ymin = ymin;
+        job.width = std::max(xmax - xmin, 0);
+        job.height = std::max(ymax - ymin, 0);
+        job.coefficients = matrix->get_data().data();
+        if (output == MASK_OUTPUT_FLOAT)
+            job.data.resize((size_t)job.width * job.height);
+        else if (output == MASK_OUTPUT_CONTOUR)
+            job.bits.resize((size_t)job.width * job.height);
+        jobs.push_back(std::move(job));
+    }
 
-        // Calculate the sigmoid of the mask
-        cropped_mask = xtensor_sigmoid(cropped_mask);
+    row.resize(prototypes.width);
+    for (int band = 0; band < prototypes.height; band += MASK_BAND_ROWS)
+    {
+        decode_mask_band(jobs, prototypes, band, std::min(band + MASK_BAND_ROWS, prototypes.height), output, row);
+    }
 
-        // allocate and memcpy to a new memory so it points to the right data
-        std::vector<float> data(cropped_mask.shape(0) * cropped_mask.shape(1));
-        memcpy(data.data(), cropped_mask.data(), sizeof(float) * cropped_mask.shape(0) * cropped_mask.shape(1));
-        
+    for (auto &job : jobs)
+    {
+        job.instance->remove_object(job.matrix); // not needed anymore
         // Add the mask to the object meta
-        instance.add_object(std::make_shared<HailoConfClassMask>(std::move(data), cropped_mask.shape(0), cropped_mask.shape(1), 0.3, instance.get_class_id()));
+        switch (output)
+        {
+        case MASK_OUTPUT_RLE:
+            job.runs.push_back(job.run_length);
+            job.instance->add_object(std::make_shared<HailoRleMask>(std::move(job.runs), job.width, job.height, 0.3, job.instance->get_class_id()));
+            break;
+        case MASK_OUTPUT_CONTOUR:
+            add_mask_contours(*job.instance, job.bits, job.width, job.height, contour_epsilon);
+            break;
+        default:
+            job.instance->add_object(std::make_shared<HailoConfClassMask>(std::move(job.data), job.width, job.height, 0.3, job.instance->get_class_id()));
+            break;
+        }
     }
+    jobs.clear(); // the jobs point to the objects of this frame
 }
@@ -15,6 +15,7 @@
 
 #include <opencv2/opencv.hpp>
 #include <algorithm>
+#include <cmath>
 #include "overlay.hpp"
 #include "overlay_utils.hpp"
 #include "hailo_common.hpp"
@@ -63,72 +64,129 @@ std::string confidence_to_string(float confidence)
 }
 
 /**
- * @brief calculate the destionation region of interest and the resized mask
+ * @brief map each pixel of an upsampled axis to the source pixel it is interpolated from and the weight of the next one,
+ * with the pixel centers aligned as in cv::resize (INTER_LINEAR)
  *
- * @param destinationROI the region of interest to paint
- * @param image_planes the image data
- * @param roi the region of interest
- * @param mask a mask object inherited from from HailoMask
- * @param resized_mask_data an output of the fucntion, the mask resized
- * @param data_ptr mask data pointer
- * @param cv_type type of cv data, example: CV_32F
+ * @param src_size the size of the mask axis
+ * @param dst_size the size of the region of interest axis
+ * @param offsets output, the source pixel of each destination pixel
+ * @param weights output, the weight of the source pixel after it
  */
-template <typename T>
-void calc_destination_roi_and_resize_mask(cv::Mat &destinationROI, cv::Mat &image_planes, HailoROIPtr roi, HailoMaskPtr mask, cv::Mat &resized_mask_data, T data_ptr, int cv_type)
+static void calc_linear_map(int src_size, int dst_size, std::vector<int> &offsets, std::vector<float> &weights)
 {
-    HailoBBox bbox = roi->get_bbox();
-    int roi_xmin = bbox.xmin() * image_planes.cols;
-    int roi_ymin = bbox.ymin() * image_planes.rows;
-    int roi_width = image_planes.cols * bbox.width();
-    int roi_height = image_planes.rows * bbox.height();
-
-    // clamp the region of interest so it is inside the image planes
-    roi_xmin = std::clamp(roi_xmin, 0, image_planes.cols);
-    roi_ymin = std::clamp(roi_ymin, 0, image_planes.rows);
-    roi_width = std::clamp(roi_width, 0, image_planes.cols - roi_xmin);
-    roi_height = std::clamp(roi_height, 0, image_planes.rows - roi_ymin);
-
-    cv::Mat mat_data = cv::Mat(mask->get_height(), mask->get_width(), cv_type, (uint8_t *)data_ptr.data());
-
-    cv::resize(mat_data, resized_mask_data, cv::Size(roi_width, roi_height), 0, 0, cv::INTER_LINEAR);
+    double scale = (double)src_size / dst_size;
+    offsets.resize(dst_size);
+    weights.resize(dst_size);
+    for (int i = 0; i < dst_size; i++)
+    {
+        float position = (float)((i + 0.5) * scale - 0.5);
+        int offset = (int)std::floor(position);
+        float weight = position - offset;
+        if (offset < 0)
+        {
+            offset = 0;
+            weight = 0;
+        }
+        if (offset >= src_size - 1)
+        {
+            offset = src_size - 1;
+            weight = 0;
+        }
+        offsets[i] = offset;
+        weights[i] = weight;
+    }
+}
 
-    cv::Rect roi_rect(cv::Point(roi_xmin, roi_ymin), cv::Size(roi_width, roi_height));
-    destinationROI = image_planes(roi_rect);
+/**
+ * @brief add the overlays of the confidence masks of a region of interest
+ *
+ * @param overlays the overlays to draw
+ * @param image_planes the image data
+ * @param roi the region of interest, its masks are stretched over its bounding box
+ */
+static void add_mask_overlays(std::vector<MaskOverlay> &overlays, const cv::Mat &image_planes, HailoROIPtr roi)
+{
+    for (auto &obj : roi->get_objects())
+    {
+        if (obj->get_type() != HAILO_CONF_CLASS_MASK)
+            continue;
+        HailoConfClassMaskPtr mask = std::dynamic_pointer_cast<HailoConfClassMask>(obj);
+        if (mask->get_height() == 0 || mask->get_width() == 0)
+            continue;
+
+        HailoBBox bbox = roi->get_bbox();
+        int roi_xmin = bbox.xmin() * image_planes.cols;
+        int roi_ymin = bbox.ymin() * image_planes.rows;
+        int roi_width = image_planes.cols * bbox.width();
+        int roi_height = image_planes.rows * bbox.height();
+
+        // clamp the region of interest so it is inside the image planes
+        roi_xmin = std::clamp(roi_xmin, 0, image_planes.cols);
+        roi_ymin = std::clamp(roi_ymin, 0, image_planes.rows);
+        roi_width = std::clamp(roi_width, 0, image_planes.cols - roi_xmin);
+        roi_height = std::clamp(roi_height, 0, image_planes.rows - roi_ymin);
+        if (roi_width == 0 || roi_height == 0)
+            continue;
+
+        overlays.emplace_back();
+        MaskOverlay &overlay = overlays.back();
+        overlay.mask_data = mask->get_data().data();
+        overlay.mask_width = mask->get_width();
+        overlay.mask_height = mask->get_height();
+        overlay.rect = cv::Rect(roi_xmin, roi_ymin, roi_width, roi_height);
+        calc_linear_map(overlay.mask_width, roi_width, overlay.x_offsets, overlay.x_weights);
+        calc_linear_map(overlay.mask_height, roi_height, overlay.y_offsets, overlay.y_weights);
+
+        // fixed-point blending: pixel = (pixel * (256 - alpha) + color * alpha + 128) / 256
+        overlay.alpha = (int)std::lround(mask->get_transparency() * 256);
+        cv::Scalar mask_color = indexToColor(mask->get_class_id());
+        for (int channel = 0; channel < 3; channel++)
+            overlay.color[channel] = (int)mask_color[channel] * overlay.alpha + 128;
+    }
 }
 
 /**
- * @brief draw a mask that its values are floats representing confidence.
- * if the pixel value is above threshold, draw this pixel in the mask's class color.
+ * @brief draw the overlays in a single pass over the rows they cross
  *
  * @param image_planes the image data
- * @param mask HailoConfClassMask mask object pointer
- * @param roi the region of interest
+ * @param overlays the overlays to draw, in drawing order
+ * @param mask_overlay_n_threads the most threads drawing at once, 0 for the OpenCV default
  * @return overlay_status_t OVERLAY_STATUS_OK
  */
-static overlay_status_t draw_conf_class_mask(cv::Mat &image_planes, HailoConfClassMaskPtr mask, HailoROIPtr roi, const uint mask_overlay_n_threads)
+static overlay_status_t draw_mask_overlays(cv::Mat &image_planes, const std::vector<MaskOverlay> &overlays, const uint mask_overlay_n_threads)
 {
-    cv::Mat resized_mask_data;
-    cv::Mat destinationROI;
-
-    calc_destination_roi_and_resize_mask(destinationROI, image_planes, roi, mask, resized_mask_data, mask->get_data(), CV_32F);
-    cv::Scalar mask_color = indexToColor(mask->get_class_id());
+    if (overlays.empty())
+        return OVERLAY_STATUS_OK;
+
+    int rows_begin = image_planes.rows;
+    int rows_end = 0;
+    for (const MaskOverlay &overlay : overlays)
+    {
+        rows_begin = std::min(rows_begin, overlay.rect.y);
+        rows_end = std::max(rows_end, overlay.rect.y + overlay.rect.height);
+    }
 
-    // perform efficient parallel matrix iteration and color every pixel its class color
-    cv::parallel_for_(cv::Range(0, destinationROI.rows * destinationROI.cols), ParallelPixelClassConfMask(destinationROI.data, resized_mask_data.data, mask->get_transparency(), image_planes.cols, destinationROI.cols, mask_color));
+    // perform efficient parallel matrix iteration and color every pixel of the masks its class color
+    // the rows are split into one stripe per thread when the number of threads is set
+    cv::parallel_for_(cv::Range(rows_begin, rows_end), ParallelMaskCompositor(image_planes, overlays),
+                      mask_overlay_n_threads > 0 ? (double)mask_overlay_n_threads : -1.0);
 
     return OVERLAY_STATUS_OK;
 }
 
 overlay_status_t draw_all(cv::Mat &mat, HailoROIPtr roi, const uint mask_overlay_n_threads)
 {
-    overlay_status_t ret = OVERLAY_STATUS_UNINITIALIZED;
-    for (auto& obj : roi->get_objects()) {
-        if (obj->get_type() == HAILO_CONF_CLASS_MASK){
-            HailoConfClassMaskPtr mask = std::dynamic_pointer_cast<HailoConfClassMask>(obj);
-            if (mask->get_height() != 0 && mask->get_width() != 0)
-                draw_conf_class_mask(mat, mask, roi, mask_overlay_n_threads);
-        }
+    std::vector<MaskOverlay> overlays;
+    add_mask_overlays(overlays, mat, roi);
+    return draw_mask_overlays(mat, overlays, mask_overlay_n_threads);
+}
+
+overlay_status_t draw_all_masks(cv::Mat &mat, const std::vector<HailoDetectionPtr> &detections, const uint mask_overlay_n_threads)
+{
+    std::vector<MaskOverlay> overlays;
+    for (auto &detection : detections)
+    {
+        add_mask_overlays(overlays, mat, detection);
     }
-    ret = OVERLAY_STATUS_OK;
-    return ret;
-}
\ No newline at end of file
+    return draw_mask_overlays(mat, overlays, mask_overlay_n_threads);
+}
@@ -28,6 +28,8 @@ typedef enum
 
 __BEGIN_DECLS
 overlay_status_t draw_all(cv::Mat &hmat, HailoROIPtr roi, uint mask_overlay_n_threads = 0);
+// draws the masks of all the detections of a frame in a single pass
+overlay_status_t draw_all_masks(cv::Mat &hmat, const std::vector<HailoDetectionPtr> &detections, uint mask_overlay_n_threads = 0);
 void face_blur(HailoMat &mat, HailoROIPtr roi);
 
 cv::Scalar indexToColor(size_t index);
@@ -2,6 +2,8 @@
 #pragma once
 
 #include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <vector>
 
 __BEGIN_DECLS
 #define CONFIDENCE 0.5
@@ -54,37 +56,78 @@ public:
         }
     }
 };
+/**
+ * @brief a confidence mask to draw on the image: its region of interest and how the mask is upsampled to it.
+ * The upsampling is the bilinear interpolation of cv::resize (INTER_LINEAR), computed only for the pixels of the region.
+ */
+struct MaskOverlay
+{
+    const float *mask_data;
+    int mask_width;
+    int mask_height;
+    cv::Rect rect;                // region of interest in the image
+    std::vector<int> x_offsets;   // for each column of the region, the mask column it is interpolated from
+    std::vector<float> x_weights; // and the weight of the mask column after it
+    std::vector<int> y_offsets;   // the same for the rows
+    std::vector<float> y_weights;
+    int alpha;                    // transparency in 1/256 units
+    int color[3];                 // class color * alpha, plus the rounding term
+};
+
 /**
  * @brief
- * this class inherites from Parallel_pixel_opencv
- * it override the virtual void operator ()(const cv::Range& range) const, and draws the color of mask classification if the pixel value is above threshold.
- * The range in the operator () represents the subset of pixels that will be
- * treated by an individual thread. This splitting is done automatically to
- * distribute equally the computation load.
+ * this class inherites from cv::ParallelLoopBody
+ * it override the virtual void operator ()(const cv::Range& range) const, and draws the color of the masks whose
+ * upsampled value is above threshold, for the rows in range.
+ * Each row is blended with all the masks crossing it, one after the other in the order of the overlays, so overlapping
+ * masks are drawn as if they were drawn one at a time. Rows and columns outside of all the regions are not visited.
  *
  */
-class ParallelPixelClassConfMask : public Parallel_pixel_opencv
+class ParallelMaskCompositor : public cv::ParallelLoopBody
 {
 private:
-    float *mask_data;
-    cv::Scalar mask_color;
+    cv::Mat &image;
+    const std::vector<MaskOverlay> &overlays;
 
 public:
-    ParallelPixelClassConfMask(uint8_t *ptr, uint8_t *mask_data, float transparency, int image_cols, int roi_cols, cv::Scalar mask_color) : Parallel_pixel_opencv(ptr, transparency, image_cols, roi_cols), mask_data((float *)mask_data), mask_color(mask_color) {}
+    ParallelMaskCompositor(cv::Mat &image, const std::vector<MaskOverlay> &overlays) : image(image), overlays(overlays) {}
 
     virtual void operator()(const cv::Range &r) const
     {
-        for (int i = r.start; i != r.end; ++i)
+        // a mask row interpolated between the two mask rows around an image row
+        std::vector<float> mask_row;
+        for (int y = r.start; y != r.end; ++y)
         {
-
-            if (mask_data[i] > CONFIDENCE) // confidence is above threshold
+            cv::Vec3b *image_row = image.ptr<cv::Vec3b>(y);
+            for (const MaskOverlay &overlay : overlays)
             {
-                // i the index inside the full image, convert it to the index inside the ROI
-                int index = i / roi_cols * image_cols + i % roi_cols;
-
-                p[index][0] = p[index][0] * (1 - transparency) + mask_color[0] * transparency;
-                p[index][1] = p[index][1] * (1 - transparency) + mask_color[1] * transparency;
-                p[index][2] = p[index][2] * (1 - transparency) + mask_color[2] * transparency;
+                int row = y - overlay.rect.y;
+                if (row < 0 || row >= overlay.rect.height)
+                    continue;
+
+                // interpolate vertically once per row at the mask resolution, then horizontally per pixel
+                int mask_y = overlay.y_offsets[row];
+                const float *mask_row0 = overlay.mask_data + mask_y * overlay.mask_width;
+                const float *mask_row1 = overlay.mask_data + std::min(mask_y + 1, overlay.mask_height - 1) * overlay.mask_width;
+                const float y_weight = overlay.y_weights[row];
+                mask_row.resize(overlay.mask_width + 1);
+                for (int x = 0; x < overlay.mask_width; ++x)
+                    mask_row[x] = mask_row0[x] * (1 - y_weight) + mask_row1[x] * y_weight;
+                mask_row[overlay.mask_width] = mask_row[overlay.mask_width - 1]; // the right border has a weight of 0
+
+                const int keep = 256 - overlay.alpha;
+                cv::Vec3b *p = image_row + overlay.rect.x;
+                for (int col = 0; col < overlay.rect.width; ++col)
+                {
+                    const float *mask_pixel = mask_row.data() + overlay.x_offsets[col];
+                    float x_weight = overlay.x_weights[col];
+                    if (mask_pixel[0] * (1 - x_weight) + mask_pixel[1] * x_weight > CONFIDENCE) // confidence is above threshold
+                    {
+                        p[col][0] = (uint8_t)((p[col][0] * keep + overlay.color[0]) >> 8);
+                        p[col][1] = (uint8_t)((p[col][1] * keep + overlay.color[1]) >> 8);
+                        p[col][2] = (uint8_t)((p[col][2] * keep + overlay.color[2]) >> 8);
+                    }
+                }
             }
         }
     }
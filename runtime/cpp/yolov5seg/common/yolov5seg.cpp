@@ -6,6 +6,10 @@
 #include "nms.hpp"
 #include "labels/coco_eighty.hpp"
 #include "mask_decoding.hpp"
+#include "quant_lut.hpp"
+#include "quant_gate.hpp"
+#include "tensor_view.hpp"
+#include "branch_executor.hpp"
 
 #include "json_config.hpp"
 #include "rapidjson/document.h"
@@ -15,7 +19,6 @@
 #include "rapidjson/schema.h"
 
 #include <thread>
-#include <future>
 #include <iterator>
 #if __GNUC__ > 8
 #include <filesystem>
@@ -28,21 +31,9 @@ namespace fs = std::experimental::filesystem;
 // the net returns 32 values representing the mask coefficients, and 4 values representing the box coordinates
 #define MASK_CO 32
 #define BOX_CO 4
-
-/**
- * @brief  Compute sigmoid's inverse
- */
-inline float inverse_sigmoid(float y) { return std::log(y/(1-y));}
-
-/**
- * @brief  perform quantization
- */
-inline uint16_t quant(float num, float qp_zp, float qp_scale) { return uint16_t((num / qp_scale)  + qp_zp); }
-
-/**
- * @brief  perform dequantization
- */
-inline float dequant(uint16_t num, float qp_zp, float qp_scale) { return (float(num) - qp_zp) * qp_scale;}
+// the three detection branches, decoded in parallel with the proto dequantization
+#define NUM_BRANCHES 3
+#define NUM_BRANCH_WORKERS 3
 
 /*
  * @brief Creates the grid and the anchor grid that will be used for each decoding
@@ -74,165 +65,209 @@ std::tuple<xt::xarray<float>, xt::xarray<float>> make_grid(xt::xarray<float> &an
 }
 
 /*
- * @brief Returns a vector of indices, of detections that have: is_object * max(class_confidence) > score_threshold
+ * @brief A row of a branch whose score passed the threshold
+ */
+struct BranchCandidate
+{
+    uint32_t row;
+    uint class_index;
+    float score;
+};
+
+/*
+ * @brief Buffers of the decoding of a branch, kept per thread and sized once for the largest branch,
+ *        so that a steady-state frame decodes its branches without heap allocations
+ */
+struct BranchWorkspace
+{
+    std::vector<uint32_t> gated;             // rows whose is_object passed the quantized gate
+    std::vector<BranchCandidate> candidates; // rows whose is_object * class confidence passed the threshold
+
+    void reserve(size_t max_rows)
+    {
+        gated.reserve(max_rows);
+        candidates.reserve(max_rows);
+    }
+};
+
+/*
+ * @brief Keeps the gated rows that have: is_object * max(class_confidence) > score_threshold
  *
- * @param all_scores an xview with the confidence scores for each class, for each detection
- * @param all_is_object an xview with the confidence that this detection is an object, for each detection
+ * @param output the quantized rows of the branch, {x, y, w, h, is_object, class scores, mask coefficients}
+ * @param row_size number of values in a row
+ * @param num_classes number of class scores in a row
+ * @param gated the rows whose is_object passed the quantized threshold gate, the class argmax is only done for them
  * @param score_threshold float
+ * @param sigmoid_lut table of sigmoid(dequant(q)) of this output
+ * @param candidates filled with the rows that pass, their class index (from 1) and score
  */
-auto filter_above_threshold(auto &all_scores, auto &is_object_threshold, const float score_threshold, const uint16_t threshold_quantized, const float qp_zp, const float qp_scale)
+template <typename T>
+void filter_above_threshold(const T *output, const size_t row_size, const int num_classes, const std::vector<uint32_t> &gated,
+                            const float score_threshold, const common::DequantLut<T> &sigmoid_lut, std::vector<BranchCandidate> &candidates)
 {
-    std::vector<uint> indices;
-    std::vector<float> scores;
-    std::vector<uint> classes;
-    int this_index;
-    float conf_deq, is_object_deq;
-    uint16_t is_object;
-    for (uint i = 0; i < is_object_threshold.size(); i++)
+    candidates.clear();
+    for (uint32_t i : gated)
     {
-        // first check if the object parameter is bigger than threshold
-        is_object = is_object_threshold(i, 0);
-        if (is_object > threshold_quantized)
+        const T *row = output + i * row_size;
+        // the first maximal quantized score, the sigmoid of the dequantized score is monotonic
+        const T *class_scores = row + BOX_CO + 1;
+        const T *best = std::max_element(class_scores, class_scores + num_classes);
+        // dequantize and decode
+        float score = sigmoid_lut[*best] * sigmoid_lut[row[BOX_CO]];
+        if (score > score_threshold)
         {
-            this_index = xt::argmax(xt::row(all_scores, i))(0) + 1;
-            // dequantize and decode
-            conf_deq = sigmoid(dequant(all_scores(i, this_index - 1), qp_zp, qp_scale));
-            is_object_deq = sigmoid(dequant(is_object, qp_zp, qp_scale));
-            if (conf_deq*is_object_deq > score_threshold)
-            {
-                indices.emplace_back(i);
-                scores.emplace_back(conf_deq * is_object_deq);
-                classes.emplace_back(this_index);
+            candidates.push_back(BranchCandidate{i, (uint)(best - class_scores) + 1, score});
         }
     }
-    }
-    return std::tuple<std::vector<uint>, std::vector<float>, std::vector<uint>>(std::move(indices), std::move(scores), std::move(classes));
 }
 
 /*
- * @brief Gets the xviews of the decoded and filtered results, and adds them to a vector of HailoDetections
+ * @brief Decodes the rows of the candidates, and adds them to a vector of HailoDetections
  *
- * @param size int representing amount of detections
- * @param boxes xview of (x, y, w, h), x and y are the center of the box
- * @param is_object an xview with the confidence that this detection is an object, for each detection
- * @param scores an xview with the confidence scores for each class, for each detection
- * @param masks an xview with 32 coefficients representing a mask per detection
+ * @param output the view of the quantized rows of the branch
+ * @param row_size number of values in a row
+ * @param num_classes number of class scores in a row
+ * @param candidates the rows to decode
+ * @param stride the stride of the branch
+ * @param grid the grid of the branch, {x, y} per row
+ * @param anchor_grid the anchor grid of the branch, {w, h} per row
+ * @param sigmoid_lut table of sigmoid(dequant(q)) of this output
  * @param objects a vecor of HailoDetections, to which the detections will be added
  *  */
-std::vector<HailoDetection> create_hailo_detections(auto &scores_vec, auto &classes_vec, auto &xy, auto wh, auto &masks, const int input_width, const int input_height)
+template <typename T>
+void create_hailo_detections(const common::TensorView<T> &output, const size_t row_size, const int num_classes, const std::vector<BranchCandidate> &candidates,
+                             const int stride, const float *grid, const float *anchor_grid, const common::DequantLut<T> &sigmoid_lut, const int input_width, const int input_height,
+                             std::vector<HailoDetection> &objects)
 {
-    int class_index;
-    float confidence, w, h, x, y = 0.0;
-    std::vector<HailoDetection> objects;
-    for (uint i = 0; i < scores_vec.size(); i++)
+    for (const BranchCandidate &candidate : candidates)
     {
-        // Get the box parameters for this box
-        x = (xy(i, 0)) / input_width;
-        y = (xy(i, 1)) / input_height;
-        w = (wh(i, 0)) / input_width;
-        h = (wh(i, 1)) / input_height;
+        const T *row = output.data() + candidate.row * row_size;
+        const float *row_grid = grid + candidate.row * 2;
+        const float *row_anchor_grid = anchor_grid + candidate.row * 2;
+        // decode xy (the center of the box) and wh
+        float x = (sigmoid_lut[row[0]] * 2 + row_grid[0]) * stride / input_width;
+        float y = (sigmoid_lut[row[1]] * 2 + row_grid[1]) * stride / input_height;
+        float w_root = sigmoid_lut[row[2]] * 2;
+        float h_root = sigmoid_lut[row[3]] * 2;
+        float w = w_root * w_root * row_anchor_grid[0] / input_width;
+        float h = h_root * h_root * row_anchor_grid[1] / input_height;
         // x and y represented center of box, so they need to be changed to left bottom corner
         HailoBBox bbox(x - w / 2, y - h / 2, w, h);
-        class_index = classes_vec[i];
-        std::string label = common::coco_eighty[class_index];
-        confidence = scores_vec[i];
-        // create mask
-        xt::xarray<float> mask_coefficients = xt::squeeze(xt::view(masks, xt::keep(i), xt::all()));
-        HailoDetection detected_instance(bbox, class_index, label, confidence);
-        std::vector<float> data(mask_coefficients.shape(0));
-        memcpy(data.data(), mask_coefficients.data(), sizeof(float) * mask_coefficients.shape(0));
+        HailoDetection detected_instance(bbox, candidate.class_index, common::coco_eighty[candidate.class_index], candidate.score);
+        // dequantize the mask coefficients
+        std::vector<float> data(MASK_CO);
+        output.dequantize(common::TensorSpan<T>{row + BOX_CO + 1 + num_classes, MASK_CO}, data.data());
         // create the detection itself
-        detected_instance.add_object((std::make_shared<HailoMatrix>(data, mask_coefficients.shape(0), 1)));
-        objects.push_back(detected_instance);
+        detected_instance.add_object(std::make_shared<HailoMatrix>(std::move(data), MASK_CO, 1));
+        objects.push_back(std::move(detected_instance));
     }
-    return objects;
 }
 
 /*
  * @brief Does the decoding and the filtering for the output, and adds the results to the HailoDetections vector
  *
+ * Works on the quantized buffer: is_object is gated in the quantized domain, and only the rows that pass are
+ * decoded, with the grids made once by init().
  *  */
-std::vector<HailoDetection> yolov5_decoding(xt::xarray<uint16_t> &output, const int stride, xt::xarray<float> &anchors, xt::xarray<float> &grid, xt::xarray<float> &anchor_grid, const int num_anchors, const float score_threshold, float qp_zp, float qp_scale, const int input_width, const int input_height)
+template <typename T>
+void yolov5_decoding(const common::TensorView<T> &output, const int stride, const xt::xarray<float> &grid, const xt::xarray<float> &anchor_grid, const int num_anchors, const float score_threshold, const int input_width, const int input_height,
+                     BranchWorkspace &workspace, std::vector<HailoDetection> &objects)
 {
-    int h = output.shape()[0];
-    int w = output.shape()[1];
-    int num_classes = (output.shape()[2] / 3) - BOX_CO - 1 - MASK_CO;
-
-    // prepare data for filter function
-    auto all_decoded = xt::reshape_view(output, {num_anchors * h * w, BOX_CO + 1 + num_classes + MASK_CO}); // {number of detections, 117}
-    auto all_is_object = xt::view(all_decoded, xt::all(), xt::range(4, 5));
-    auto all_scores = xt::view(all_decoded, xt::all(), xt::range(5, num_classes + 5));
-    // quantize the score threshold + "undecode" it (do inverse of sigmoid), to avoid doing dequantization and decoding on all class scores
-    uint16_t threshold_quantized = quant(inverse_sigmoid(score_threshold), qp_zp, qp_scale);
-    auto filtered = filter_above_threshold(all_scores, all_is_object, score_threshold, threshold_quantized, qp_zp, qp_scale);
-    std::vector<uint> indices = std::get<0>(filtered);
-    std::vector<float> scores_vec = std::get<1>(filtered);
-    std::vector<uint> classes_vec = std::get<2>(filtered);
-
-    // filter xy and grid
-    auto xy = xt::view(all_decoded, xt::all(), xt::range(_, 2));
-    auto reshaped_grid = xt::reshape_view(grid, xy.shape());
-    auto filtered_xy = xt::view(xy, xt::keep(indices), xt::all());
-    auto filtered_grid = xt::view(reshaped_grid, xt::keep(indices), xt::all());
-    // dequantize and decode xy
-    xt::xarray<float> deq_xy = (filtered_xy - qp_zp) * qp_scale;
-    deq_xy = (xtensor_sigmoid(deq_xy) * 2 + filtered_grid) * stride;
-
-    // filter wh and anchor grid
-    auto wh = xt::view(all_decoded, xt::all(), xt::range(2, 4));
-    auto reshaped_anchor_grid = xt::reshape_view(anchor_grid, wh.shape());
-    auto filtered_wh = xt::view(wh, xt::keep(indices), xt::all());
-    auto filtered_anchor_grid = xt::view(reshaped_anchor_grid, xt::keep(indices), xt::all());
-    // dequantize and decode wh
-    xt::xarray<float> deq_wh = (filtered_wh - qp_zp) * qp_scale;
-    deq_wh = xt::square(xtensor_sigmoid(deq_wh) * 2) * filtered_anchor_grid;
+    const size_t rows = (size_t)num_anchors * output.height() * output.width();
+    const size_t row_size = output.features() / num_anchors; // 117
+    const int num_classes = (int)row_size - BOX_CO - 1 - MASK_CO;
+    if (grid.size() != rows * 2 || anchor_grid.size() != rows * 2)
+    {
+        throw std::invalid_argument("yolov5seg error: output of " + std::to_string(output.height()) + "x" + std::to_string(output.width()) + " doesn't match the grids of its branch");
+    }
 
-    // filter and dequantize masks
-    auto filtered_masks = xt::view(all_decoded, xt::keep(indices), xt::range(num_classes + 5, _));
-    xt::xarray<float> masks = (filtered_masks - qp_zp) * qp_scale;
+    // dequantize + sigmoid by table lookup, shared by all frames with the same quantization params
+    common::DequantLutPtr<T> sigmoid_lut = common::get_dequant_lut<T>(output.qp_scale(), output.qp_zp(), common::LutActivation::SIGMOID);
+    // class confidence <= 1, so a detection can only pass when its is_object alone is above the score threshold:
+    // gate is_object in the quantized domain, to avoid doing dequantization and decoding on all class scores
+    const auto is_object_gate = common::QuantizedGate<T>::from_predicate([&](T q)
+                                                                         { return (*sigmoid_lut)[q] > score_threshold; });
+    if (is_object_gate.closed())
+        return;
+    workspace.gated.clear();
+    is_object_gate.scan_strided(output.data() + BOX_CO, rows, row_size, workspace.gated);
+    filter_above_threshold(output.data(), row_size, num_classes, workspace.gated, score_threshold, *sigmoid_lut, workspace.candidates);
 
     // create HailoDetections for the NMS and the mask decoding
-    std::vector<HailoDetection> objects = create_hailo_detections(scores_vec, classes_vec, deq_xy, deq_wh, masks, input_width, input_height);
-    return objects;
+    create_hailo_detections(output, row_size, num_classes, workspace.candidates, stride, grid.data(), anchor_grid.data(),
+                            *sigmoid_lut, input_width, input_height, objects);
 }
 
 /*
  * @brief Does dequantize and decoding for each output seperately
  *
  *  */
-std::vector<HailoDetection> post_per_branch(std::string branch_name, const int index, std::map<std::string, HailoTensorPtr> tensors, std::vector<xt::xarray<float>> anchor_list, std::vector<int> stride_list, const float iou_threshold, const float score_threshold, std::vector<xt::xarray<float>> grids, std::vector<xt::xarray<float>> anchor_grids, const int num_anchors, const int input_width, const int input_height)
+void post_per_branch(HailoTensorPtr &tensor, const int index, const Yolov5segParams &params, std::vector<HailoDetection> &objects)
 {
-    auto output = common::get_xtensor(tensors[branch_name]);
-    float qp_zp = tensors[branch_name]->vstream_info().quant_info.qp_zp;
-    float qp_scale = tensors[branch_name]->vstream_info().quant_info.qp_scale;
-    return yolov5_decoding(output, stride_list[index], anchor_list[index], grids[index], anchor_grids[index], num_anchors, score_threshold, qp_zp, qp_scale, input_width, input_height);
+    // the buffers of the thread, sized for the largest branch on first use
+    static thread_local BranchWorkspace workspace;
+    workspace.reserve(params.max_branch_rows);
+
+    common::visit_tensor(*tensor, [&](const auto &output)
+                         { yolov5_decoding(output, params.strides[index], params.grids[index], params.anchor_grids[index], params.num_anchors, params.score_threshold,
+                                           params.input_shape[0], params.input_shape[1], workspace, objects); });
 }
 
+/*
+ * @brief The prototypes and the detections of the frames of a thread, reused from frame to frame
+ */
+struct FrameWorkspace
+{
+    MaskPrototypes prototypes;
+    std::vector<HailoDetection> branch_detections[NUM_BRANCHES];
+};
+
 /*
  * @brief Does dequantize and decoding for each output, and then calls nms and decode masks
  *
+ * The proto dequantization and the three branches run in parallel on long-lived workers,
+ * the params are shared read-only by reference.
+ *
+ * @param detections the detections of the frame are appended here
  *  */
-std::vector<HailoDetection> yolov5seg_post(auto &tensors, auto &anchor_list, auto &stride_list, const float iou_threshold, const float score_threshold, auto &grids, auto &anchor_grids, const int num_anchors, const int input_width, const int input_height, auto &outputs_name)
+void yolov5seg_post(HailoROIPtr roi, const Yolov5segParams &params, std::vector<HailoDetection> &detections)
 {
-    auto proto_tensor = common::dequantize(common::get_xtensor(tensors[outputs_name[0]]), tensors[outputs_name[0]]->vstream_info().quant_info.qp_scale, tensors[outputs_name[0]]->vstream_info().quant_info.qp_zp);
-    // run the postprocess for each branch seperately
-    std::future<std::vector<HailoDetection>> t2 = std::async(post_per_branch, outputs_name[1], 2, tensors, anchor_list, stride_list, iou_threshold, score_threshold, grids, anchor_grids, num_anchors, input_width, input_height);
-    std::future<std::vector<HailoDetection>> t1 = std::async(post_per_branch, outputs_name[2], 1, tensors, anchor_list, stride_list, iou_threshold, score_threshold, grids, anchor_grids, num_anchors, input_width, input_height);
-    std::future<std::vector<HailoDetection>> t0 = std::async(post_per_branch, outputs_name[3], 0, tensors, anchor_list, stride_list, iou_threshold, score_threshold, grids, anchor_grids, num_anchors, input_width, input_height);
-    std::vector<HailoDetection> d2 = t2.get();
-    std::vector<HailoDetection> d1 = t1.get();
-    std::vector<HailoDetection> d0 = t0.get();
+    static common::BranchExecutor executor(NUM_BRANCH_WORKERS);
+    // the tasks run on other threads, they get the workspace of this thread by reference
+    static thread_local FrameWorkspace thread_workspace;
+    FrameWorkspace &workspace = thread_workspace;
+
+    HailoTensorPtr proto = roi->get_tensor(params.outputs_name[0]);
+    HailoTensorPtr branch_tensors[NUM_BRANCHES] = {roi->get_tensor(params.outputs_name[3]), roi->get_tensor(params.outputs_name[2]), roi->get_tensor(params.outputs_name[1])};
+    // task 0 is the proto, task 1 + i is branch i
+    executor.run(1 + NUM_BRANCHES, [&](size_t task)
+                 {
+                     if (task == 0)
+                         dequantize_prototypes(proto, workspace.prototypes);
+                     else
+                         post_per_branch(branch_tensors[task - 1], (int)task - 1, params, workspace.branch_detections[task - 1]); });
 
     // concatenate all detections
-    std::vector<HailoDetection> all_detections;
-    all_detections.reserve(d0.size() + d1.size() + d2.size());
-    all_detections.insert(all_detections.end(), d0.begin(), d0.end());
-    all_detections.insert(all_detections.end(), d1.begin(), d1.end());
-    all_detections.insert(all_detections.end(), d2.begin(), d2.end());
+    detections.reserve(detections.size() + workspace.branch_detections[0].size() + workspace.branch_detections[1].size() + workspace.branch_detections[2].size());
+    for (auto &branch : workspace.branch_detections)
+    {
+        std::move(branch.begin(), branch.end(), std::back_inserter(detections));
+        branch.clear();
+    }
+
+    common::nms(detections, params.iou_threshold);
+    decode_masks(detections, workspace.prototypes, params.mask_output, params.contour_epsilon);
+}
 
-    common::nms(all_detections, iou_threshold);
-    decode_masks(all_detections, proto_tensor);
-    return all_detections;
+bool mask_output_from_string(const std::string &name, mask_output_t &mask_output)
+{
+    static const std::map<std::string, mask_output_t> mask_outputs = {
+        {"float", MASK_OUTPUT_FLOAT}, {"rle", MASK_OUTPUT_RLE}, {"contour", MASK_OUTPUT_CONTOUR}};
+    auto it = mask_outputs.find(name);
+    if (it == mask_outputs.end())
+        return false;
+    mask_output = it->second;
+    return true;
 }
 
 Yolov5segParams *init(const std::string config_path, const std::string function_name)
@@ -287,6 +322,13 @@ Yolov5segParams *init(const std::string config_path, const std::string function_
             "items": {
                 "type": "number"
             }
+            },
+            "mask_output": {
+            "type": "string",
+            "enum": ["float", "rle", "contour"]
+            },
+            "contour_epsilon": {
+            "type": "number"
             }
         },
         "required": [
@@ -365,6 +407,16 @@ Yolov5segParams *init(const std::string config_path, const std::string function_
             }
             params->strides = strides_vec;
 
+            // optional, the output of the masks
+            if (doc_config_json.HasMember("mask_output"))
+            {
+                mask_output_from_string(doc_config_json["mask_output"].GetString(), params->mask_output);
+            }
+            if (doc_config_json.HasMember("contour_epsilon"))
+            {
+                params->contour_epsilon = doc_config_json["contour_epsilon"].GetFloat();
+            }
+
         fclose(fp);
     } }
     std::vector<int> outputs_size = params->outputs_size;
@@ -387,6 +439,11 @@ Yolov5segParams *init(const std::string config_path, const std::string function_
     params->grids = grids;
     params->anchor_grids = anchor_grids;
     params->num_anchors = num_anchors;
+    params->max_branch_rows = 0;
+    for (int size : outputs_size)
+    {
+        params->max_branch_rows = std::max(params->max_branch_rows, (size_t)num_anchors * size * size);
+    }
     return params;
 }
 
@@ -404,9 +461,12 @@ void free_resources(void *params_void_ptr)
 void yolov5seg(HailoROIPtr roi, void *params_void_ptr)
 {
     Yolov5segParams *params = reinterpret_cast<Yolov5segParams *>(params_void_ptr);
-    std::map<std::string, HailoTensorPtr> tensors = roi->get_tensors_by_name();
-    std::vector<HailoDetection> detections = yolov5seg_post(tensors, params->anchors, params->strides, params->iou_threshold, params->score_threshold, params->grids, params->anchor_grids, params->num_anchors, params->input_shape[0], params->input_shape[1], params->outputs_name);
+    // kept per thread, its capacity is reused by the next frames
+    static thread_local std::vector<HailoDetection> detections;
+    detections.clear();
+    yolov5seg_post(roi, *params, detections);
     hailo_common::add_detections(roi, detections);
+    detections.clear();
 }
 
 /**
@@ -8,6 +8,16 @@
 #include "xtensor/xio.hpp"
 
 __BEGIN_DECLS
+/**
+ * @brief What the post-process attaches to a detection for its mask
+ */
+typedef enum
+{
+    MASK_OUTPUT_FLOAT,   // HailoConfClassMask, the confidence of every pixel of the box at the proto resolution
+    MASK_OUTPUT_RLE,     // HailoRleMask, the run-length encoded binary mask at the proto resolution
+    MASK_OUTPUT_CONTOUR, // HailoLandmarks "contour", a simplified polygon per part of the mask, relative to the box
+} mask_output_t;
+
 class Yolov5segParams
 {
 public:
@@ -21,6 +31,9 @@ public:
     std::vector<int> strides;
     std::vector<xt::xarray<float>> grids;
     std::vector<xt::xarray<float>> anchor_grids;
+    size_t max_branch_rows; // rows (anchors x cells) of the largest branch
+    mask_output_t mask_output;
+    float contour_epsilon; // Douglas-Peucker tolerance of the contours, in proto pixels
 
     Yolov5segParams() {
         iou_threshold = 0.6f;
@@ -32,10 +45,14 @@ public:
                                             {10, 13, 16, 30, 33, 23} };
         input_shape = {640,640};
         strides = {32, 16, 8};
+        max_branch_rows = 0;
+        mask_output = MASK_OUTPUT_FLOAT;
+        contour_epsilon = 1.0f;
     }
 };
 
 Yolov5segParams *init(const std::string config_path, const std::string function_name);
+bool mask_output_from_string(const std::string &name, mask_output_t &mask_output);
 void yolov5seg(HailoROIPtr roi, void *params_void_ptr);
 void free_resources(void *params_void_ptr);
 void filter(HailoROIPtr roi, void *params_void_ptr);
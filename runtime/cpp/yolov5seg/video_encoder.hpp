@@ -0,0 +1,253 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file video_encoder.hpp
+ * @brief Encode of the drawn frames on worker threads, into one file or into segments concatenated at the end.
+ **/
+#pragma once
+
+#include <stddef.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "frame_ring.hpp"
+#include "stage_stats.hpp"
+
+/**
+ * @brief A frame to encode, and its index in the video.
+ */
+struct EncodedFrame
+{
+    cv::Mat image;
+    size_t index;
+};
+
+/**
+ * @brief Writes the frames of a video with cv::VideoWriter, off the thread that draws them.
+ *
+ * With one worker the frames go to a single file. With more, the video is cut in segments of
+ * segment_frames frames, segment s is encoded by worker s % workers into its own file, and the
+ * segments are concatenated into the output file by close() (ffmpeg concat demuxer, stream copy).
+ *
+ * The frames are drawn straight into the slots of the worker rings (acquire() / release()), which are
+ * allocated once. A worker ring holds a whole segment, so that the drawing can hand the next segment
+ * to the next worker while the previous one is still encoding: the encoder keeps workers * segment_frames
+ * frames of the output size (see buffer_bytes()), e.g. 4 workers of 8 frames at 1080p take 200 MB.
+ */
+class VideoEncoder
+{
+public:
+    static const size_t SINGLE_FILE_SLOTS = 4;
+
+    /**
+     * @param path Output video file.
+     * @param fps Frame rate of the output.
+     * @param size Size of the frames.
+     * @param workers Encode threads, 1 for a single file without segments.
+     * @param segment_frames Frames of a segment, when workers > 1.
+     * @param stage Stage the encode time of every frame is added to, may be null.
+     */
+    VideoEncoder(const std::string &path, double fps, cv::Size size, size_t workers, size_t segment_frames,
+                 common::StageStats::Stage *stage = nullptr)
+        : m_path(path), m_fps(fps), m_size(size), m_segment_frames(segment_frames != 0 ? segment_frames : 1),
+          m_stage(stage), m_current(0), m_frames(0), m_closed(false)
+    {
+        if (workers == 0)
+            workers = 1;
+        const size_t slots = workers == 1 ? SINGLE_FILE_SLOTS : m_segment_frames;
+        for (size_t i = 0; i < workers; i++)
+        {
+            m_rings.emplace_back(new common::FrameRing<EncodedFrame>(slots));
+            m_rings.back()->preallocate([&size](EncodedFrame &frame)
+                                        { frame.image.create(size, CV_8UC3); });
+        }
+        for (size_t i = 0; i < workers; i++)
+            m_workers.emplace_back(&VideoEncoder::worker, this, i);
+    }
+
+    ~VideoEncoder()
+    {
+        close();
+    }
+
+    VideoEncoder(const VideoEncoder &) = delete;
+    VideoEncoder &operator=(const VideoEncoder &) = delete;
+
+    size_t workers() const { return m_rings.size(); }
+
+    /**
+     * @brief Memory of the frames kept for the workers.
+     */
+    size_t buffer_bytes() const
+    {
+        return m_rings.size() * m_rings[0]->capacity() * (size_t)m_size.width * (size_t)m_size.height * 3;
+    }
+
+    /**
+     * @brief Get the image to draw frame index into, waits while the ring of its worker is full.
+     *        Frames are acquired in order, one at a time.
+     */
+    cv::Mat &acquire(size_t index)
+    {
+        m_current = m_rings.size() == 1 ? 0 : (index / m_segment_frames) % m_rings.size();
+        EncodedFrame &frame = m_rings[m_current]->acquire_write();
+        frame.index = index;
+        if (index + 1 > m_frames)
+            m_frames = index + 1;
+        return frame.image;
+    }
+
+    /**
+     * @brief Hand the frame of acquire() to its worker.
+     */
+    void release()
+    {
+        m_rings[m_current]->release_write();
+    }
+
+    /**
+     * @brief Encode the remaining frames, and concatenate the segments into the output file.
+     *
+     * @return false if the segments could not be concatenated, they are kept then.
+     */
+    bool close()
+    {
+        if (m_closed)
+            return true;
+        m_closed = true;
+        for (auto &ring : m_rings)
+            ring->close();
+        for (auto &worker : m_workers)
+            worker.join();
+        if (m_rings.size() == 1)
+            return true;
+        return concatenate();
+    }
+
+private:
+    std::string m_path;
+    double m_fps;
+    cv::Size m_size;
+    size_t m_segment_frames;
+    common::StageStats::Stage *m_stage;
+    std::vector<std::unique_ptr<common::FrameRing<EncodedFrame>>> m_rings;
+    std::vector<std::thread> m_workers;
+    size_t m_current; // worker of the frame being drawn
+    size_t m_frames;  // frames acquired
+    bool m_closed;
+
+    std::string segment_path(size_t segment) const
+    {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".part%04zu", segment);
+        size_t dot = m_path.find_last_of('.');
+        size_t slash = m_path.find_last_of('/');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            return m_path + suffix;
+        return m_path.substr(0, dot) + suffix + m_path.substr(dot);
+    }
+
+    void worker(size_t index)
+    {
+        common::FrameRing<EncodedFrame> &ring = *m_rings[index];
+        cv::VideoWriter writer;
+        size_t segment = (size_t)-1;
+        bool failed = false;
+        for (;;)
+        {
+            EncodedFrame *frame = ring.acquire_read();
+            if (frame == nullptr)
+                break;
+            size_t frame_segment = m_rings.size() == 1 ? 0 : frame->index / m_segment_frames;
+            if (frame_segment != segment)
+            {
+                // A new segment: the previous one is complete, finish its file
+                segment = frame_segment;
+                writer.release();
+                std::string path = m_rings.size() == 1 ? m_path : segment_path(segment);
+                failed = !writer.open(path, cv::VideoWriter::fourcc('m', 'p', '4', 'v'), m_fps, m_size);
+                if (failed)
+                    std::cerr << "-E- Unable to open " << path << " for writing" << std::endl;
+            }
+            if (!failed)
+            {
+                common::StageStats::Clock::time_point begin = common::StageStats::Clock::now();
+                writer.write(frame->image);
+                if (m_stage != nullptr)
+                    m_stage->add(begin, common::StageStats::Clock::now());
+            }
+            ring.release_read();
+        }
+        writer.release();
+    }
+
+    // Quoted for the list of the concat demuxer and for the shell alike: in single quotes, ' written as '\''
+    static std::string single_quote(const std::string &path)
+    {
+        std::string quoted = "'";
+        for (char c : path)
+            quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+        return quoted + "'";
+    }
+
+    // Run a command without a shell, return its exit status (-1 if it couldn't run)
+    static int run(const std::vector<std::string> &args)
+    {
+        std::vector<char *> argv;
+        for (const std::string &arg : args)
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        argv.push_back(nullptr);
+        pid_t pid;
+        if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0)
+            return -1;
+        int status = 0;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+            return -1;
+        return WEXITSTATUS(status);
+    }
+
+    bool concatenate()
+    {
+        const size_t segments = (m_frames + m_segment_frames - 1) / m_segment_frames;
+        if (segments == 0)
+            return true;
+
+        // The paths of the list are relative to its directory, which is the one of the segments
+        std::string list_path = m_path + ".segments.txt";
+        {
+            std::ofstream list(list_path);
+            for (size_t segment = 0; segment < segments; segment++)
+            {
+                std::string path = segment_path(segment);
+                list << "file " << single_quote(path.substr(path.find_last_of('/') + 1)) << "\n";
+            }
+        }
+        const std::vector<std::string> command = {"ffmpeg", "-hide_banner", "-loglevel", "error", "-y", "-f", "concat",
+                                                  "-safe", "0", "-i", list_path, "-c", "copy", m_path};
+        if (run(command) != 0)
+        {
+            std::cerr << "-W- Could not concatenate the " << segments << " segments of " << m_path
+                      << ", they are kept. To concatenate them:";
+            for (const std::string &arg : command)
+                std::cerr << " " << single_quote(arg);
+            std::cerr << std::endl;
+            return false;
+        }
+        for (size_t segment = 0; segment < segments; segment++)
+            std::remove(segment_path(segment).c_str());
+        std::remove(list_path.c_str());
+        return true;
+    }
+};
@@ -4,6 +4,11 @@
 #include "common/yolov5seg.hpp"
 #include "common/hailo_common.hpp"
 #include "common/overlay.hpp"
+#include "frame_arena.hpp"
+#include "postprocess_pool.hpp"
+#include "frame_ring.hpp"
+#include "stage_stats.hpp"
+#include "video_encoder.hpp"
 
 #include <iostream>
 #include <chrono>
@@ -20,6 +25,27 @@ constexpr bool QUANTIZED = true;
 constexpr hailo_format_type_t FORMAT_TYPE_INPUT = HAILO_FORMAT_TYPE_AUTO;
 constexpr hailo_format_type_t FORMAT_TYPE_OUTPUT = HAILO_FORMAT_TYPE_AUTO;
 std::mutex m;
+common::PostProcessOptions pp_options;
+// -mask-output= overrides the mask output of the config, empty to keep it
+std::string mask_output_option;
+// Frames the capture can be ahead of the drawing, on top of the frames being post-processed and waiting to be drawn
+constexpr size_t FRAME_RING_SLACK = 4;
+// Post-processed frames waiting for the render stage
+constexpr size_t RENDER_QUEUE_FRAMES = 4;
+// A segment per encode worker is kept in memory, see VideoEncoder
+constexpr size_t DEFAULT_SEGMENT_FRAMES = 8;
+// -output= the drawn video, encoded by -encode-workers= threads in segments of -segment-frames= frames
+std::string output_path;
+size_t encode_workers = 1;
+size_t segment_frames = DEFAULT_SEGMENT_FRAMES;
+
+// Busy time of the stages of the pipeline, printed at the end of the run
+common::StageStats stage_stats;
+common::StageStats::Stage &capture_stage = stage_stats.stage("capture + resize");
+common::StageStats::Stage &postprocess_stage = stage_stats.stage("postprocess");
+common::StageStats::Stage &render_stage = stage_stats.stage("render");
+common::StageStats::Stage &encode_stage = stage_stats.stage("encode");
+using StageClock = common::StageStats::Clock;
 
 using namespace hailort;
 
@@ -60,14 +86,12 @@ std::string info_to_str(hailo_vstream_info_t vstream_info) {
 
 template <typename T>
 hailo_status post_processing_all(std::vector<std::shared_ptr<FeatureData<T>>> &features, double frame_count, 
-                                std::chrono::duration<double>& postprocess_time, std::vector<cv::Mat>& frames, 
-                                double org_height, double org_width)
+                                std::chrono::duration<double>& postprocess_time, common::FrameRing<cv::Mat>& frames, 
+                                double org_height, double org_width, double org_fps)
 {
 
     std::sort(features.begin(), features.end(), &FeatureData<T>::sort_tensors_by_size);
 
-    // cv::VideoWriter video("./processed_video.mp4", cv::VideoWriter::fourcc('m','p','4','v'),30, cv::Size((int)org_width, (int)org_height));
-
     std::chrono::time_point<std::chrono::system_clock> t_start = std::chrono::high_resolution_clock::now();
 
     m.lock();
@@ -77,46 +101,135 @@ hailo_status post_processing_all(std::vector<std::shared_ptr<FeatureData<T>>> &f
     std::string config = "yolov5seg.json";
 
     Yolov5segParams *init_params = init(config, "");
+    if (!mask_output_option.empty()) {
+        mask_output_from_string(mask_output_option, init_params->mask_output);
+    }
 
-    for (int i = 0; i < (int)frame_count; i++){
-        HailoROIPtr roi = std::make_shared<HailoROI>(HailoROI(HailoBBox(0.0f, 0.0f, 1.0f, 1.0f)));
-        for (uint j = 0; j < features.size(); j++) {
-            roi->add_tensor(std::make_shared<HailoTensor>(reinterpret_cast<T *>(features[j]->m_buffers.get_read_buffer().data()), features[j]->m_vstream_info));
-        }
-
-        filter(roi, init_params);
-
+    // Frames are decoded on the post-processing pool, several at a time. Each frame in flight holds its output
+    // buffers in the rings of the read threads until it is emitted. Drawing and printing stay in frame order.
+    // The rings outlive the post-processor, which joins the workers still using them if an exception is thrown
+    common::OrderedPostProcessor<std::vector<HailoDetectionPtr>> post_processor(pp_options);
+
+    // Drawing and encoding run on their own threads, the post-processing only hands them its results in order
+    const cv::Size output_size((int)org_width, (int)org_height);
+    std::unique_ptr<VideoEncoder> encoder;
+    if (!output_path.empty()) {
+        encoder.reset(new VideoEncoder(output_path, org_fps, output_size, encode_workers, segment_frames, &encode_stage));
+        m.lock();
+        std::cout << "-I- Encoding " << output_path << " on " << encoder->workers() << " thread(s), "
+                  << encoder->buffer_bytes() / (1024 * 1024) << " MB of frame buffers" << std::endl;
+        m.unlock();
+    }
+    common::FrameRing<std::vector<HailoDetectionPtr>> results(RENDER_QUEUE_FRAMES);
+    auto emit_frame = [&](size_t, std::vector<HailoDetectionPtr> &detections) {
+        // Frames are emitted in order, so the oldest held buffers are the ones of this frame
         for (auto &feature : features) {
             feature->m_buffers.release_read_buffer();
         }
-
-        std::vector<HailoDetectionPtr> detections = hailo_common::get_hailo_detections(roi);
-
-        for (auto& detection : detections) {
-            if (detection->get_confidence() == 0) {
+        std::vector<HailoDetectionPtr> &slot = results.acquire_write();
+        slot.swap(detections);
+        results.release_write();
+    };
+
+    // Every frame is resized once to the output size, then drawn in place: into the slot of its encoder,
+    // or into a single image when the video isn't saved. If drawing fails the remaining frames are still
+    // consumed, so that the post-processing and the capture never wait for it, and the error is rethrown at the end.
+    auto render_thread = std::async(std::launch::async, [&]() {
+        cv::Mat display;
+        std::vector<HailoDetectionPtr> drawn;
+        std::exception_ptr error;
+        for (size_t index = 0;; index++) {
+            std::vector<HailoDetectionPtr> *detections = results.acquire_read();
+            if (detections == nullptr) {
+                break;
+            }
+            cv::Mat *frame = frames.acquire_read();
+            if (frame == nullptr) {
+                detections->clear();
+                results.release_read();
                 continue;
             }
+            if (!error) {
+                try {
+                    cv::Mat &output = encoder ? encoder->acquire(index) : display;
+                    {
+                        common::StageStats::Scope render_scope(render_stage);
+                        cv::resize(*frame, output, output_size, 1);
+                        drawn.clear();
+                        for (auto& detection : *detections) {
+                            if (detection->get_confidence() == 0) {
+                                continue;
+                            }
+
+                            drawn.push_back(detection);
+                            auto box = detection->get_bbox();
+
+                            cv::rectangle(output, cv::Point2f(float(box.xmin() * float(org_width)), float(box.ymin() * float(org_height))), 
+                                        cv::Point2f(float(box.xmax() * float(org_width)), float(box.ymax() * float(org_height))), 
+                                        cv::Scalar(0, 0, 255), 1);
+
+                            std::cout << "Detection: " << get_coco_name_from_int(detection->get_class_id()) << ", Confidence: " << std::fixed << std::setprecision(2) << detection->get_confidence() * 100.0 << "%" << std::endl;
+                        }
+                        // the masks of all the detections, blended in one pass over the rows they cross.
+                        // The binary mask outputs are for the consumers of the detections, they are not drawn.
+                        if (init_params->mask_output == MASK_OUTPUT_FLOAT) {
+                            draw_all_masks(output, drawn, 0);
+                        }
+                    }
+                    // cv::imshow("Display window", output);
+                    // cv::waitKey(0);
+                    if (encoder) {
+                        encoder->release();
+                    }
+                } catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            frames.release_read();
+            detections->clear();
+            results.release_read();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    });
+    // The render thread ends once the results are closed, also when the post-processing throws: its future
+    // waits for it when destroyed, and the encoder, destroyed after it, encodes what was drawn and closes.
+    struct CloseResults {
+        common::FrameRing<std::vector<HailoDetectionPtr>> &results;
+        ~CloseResults() { results.close(); }
+    } close_results{results};
 
-            auto box = detection->get_bbox();
+    for (int i = 0; i < (int)frame_count; i++){
+        post_processor.wait_for_slot(emit_frame);
 
-            cv::resize(frames[i], frames[i], cv::Size((int)org_width, (int)org_height), 1);
-            cv::rectangle(frames[i], cv::Point2f(float(box.xmin() * float(org_width)), float(box.ymin() * float(org_height))), 
-                        cv::Point2f(float(box.xmax() * float(org_width)), float(box.ymax() * float(org_height))), 
-                        cv::Scalar(0, 0, 255), 1);
+        std::vector<T *> buffers(features.size());
+        for (uint j = 0; j < features.size(); j++) {
+            buffers[j] = features[j]->m_buffers.hold_read_buffer().data();
+        }
 
-            draw_all(frames[i], detection, 0);
+        post_processor.submit([&features, buffers, init_params]() {
+            // The roi and its tensors live in the frame arena of the worker, released all at once when the frame ends
+            common::FrameArenaScope frame_scope;
+            common::StageStats::Scope postprocess_scope(postprocess_stage);
+            HailoROIPtr roi = std::allocate_shared<HailoROI>(common::ArenaAllocator<HailoROI>(), HailoBBox(0.0f, 0.0f, 1.0f, 1.0f));
+            for (uint j = 0; j < features.size(); j++) {
+                roi->add_tensor(std::allocate_shared<HailoTensor>(common::ArenaAllocator<HailoTensor>(), buffers[j], features[j]->m_vstream_info));
+            }
 
-            std::cout << "Detection: " << get_coco_name_from_int(detection->get_class_id()) << ", Confidence: " << std::fixed << std::setprecision(2) << detection->get_confidence() * 100.0 << "%" << std::endl;
-        }
-        // cv::imshow("Display window", frames[i]);
-        // cv::waitKey(0);
-        // video.write(frames[i]);
-        frames[i].release();
+            filter(roi, init_params);
+            return hailo_common::get_hailo_detections(roi);
+        });
+    }
+    post_processor.drain(emit_frame);
+    results.close();
+    render_thread.get();
+    if (encoder) {
+        encoder->close();
     }
 
     std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::high_resolution_clock::now();
     postprocess_time = t_end - t_start;
-    // video.release();
 
     return HAILO_SUCCESS;
 }
@@ -144,7 +257,7 @@ hailo_status read_all(OutputVStream& output_vstream, std::shared_ptr<FeatureData
 }
 
 hailo_status write_all(InputVStream& input_vstream, std::string video_path, 
-                        std::chrono::time_point<std::chrono::system_clock>& write_time_vec, std::vector<cv::Mat>& frames) {
+                        std::chrono::time_point<std::chrono::system_clock>& write_time_vec, common::FrameRing<cv::Mat>& frames) {
     m.lock();
     std::cout << CYAN << "-I- Started write thread: " << info_to_str(input_vstream.get_info()) << std::endl << RESET;
     m.unlock();
@@ -156,27 +269,37 @@ hailo_status write_all(InputVStream& input_vstream, std::string video_path,
     int width = input_shape.width;
 
     cv::VideoCapture capture(video_path);
-    if(!capture.isOpened())
+    if(!capture.isOpened()) {
+        frames.close();
         throw "Unable to read video file";
+    }
     
-    int i = 0;
     cv::Mat org_frame;
 
     write_time_vec = std::chrono::high_resolution_clock::now();
     for(;;) {
+        StageClock::time_point capture_begin = StageClock::now();
         capture >> org_frame;
         if(org_frame.empty()) {
             break;
             }
+        StageClock::duration capture_time = StageClock::now() - capture_begin;
 
-        cv::resize(org_frame, frames[i], cv::Size(height, width), 1);
+        // Waits while the ring is full, so the capture never runs more than its capacity ahead of the drawing
+        cv::Mat &frame = frames.acquire_write();
+        StageClock::time_point resize_begin = StageClock::now();
+        cv::resize(org_frame, frame, cv::Size(height, width), 1);
+        capture_stage.add(capture_time + (StageClock::now() - resize_begin));
 
-        input_vstream.write(MemoryView(frames[i].data, input_vstream.get_frame_size())); // Writing height * width, 3 channels of uint8
-        if (HAILO_SUCCESS != status)
+        status = input_vstream.write(MemoryView(frame.data, input_vstream.get_frame_size())); // Writing height * width, 3 channels of uint8
+        frames.release_write();
+        if (HAILO_SUCCESS != status) {
+            frames.close();
             return status;
-        i++;
+        }
     }
 
+    frames.close();
     capture.release();
     return HAILO_SUCCESS;
 }
@@ -184,7 +307,9 @@ hailo_status write_all(InputVStream& input_vstream, std::string video_path,
 template <typename T>
 hailo_status create_feature(hailo_vstream_info_t vstream_info, size_t output_frame_size, std::shared_ptr<FeatureData<T>> &feature) {
     feature = std::make_shared<FeatureData<T>>(static_cast<uint32_t>(output_frame_size), vstream_info.quant_info.qp_zp,
-        vstream_info.quant_info.qp_scale, vstream_info.shape.width, vstream_info);
+        vstream_info.quant_info.qp_scale, vstream_info.shape.width, vstream_info,
+        // The frames in flight hold their buffers in the ring, the read thread keeps the default slots to write in
+        static_cast<uint32_t>(pp_options.max_in_flight) + RingBuffer<T>::DEFAULT_SLOTS);
 
     return HAILO_SUCCESS;
 }
@@ -194,7 +319,7 @@ hailo_status run_inference(std::vector<InputVStream>& input_vstream, std::vector
                     std::chrono::time_point<std::chrono::system_clock>& write_time_vec,
                     std::vector<std::chrono::time_point<std::chrono::system_clock>>& read_time_vec,
                     std::chrono::duration<double>& inference_time, std::chrono::duration<double>& postprocess_time, 
-                    double frame_count, double org_height, double org_width) {
+                    double frame_count, double org_height, double org_width, double org_fps) {
 
     hailo_status status = HAILO_UNINITIALIZED;
     
@@ -213,7 +338,12 @@ hailo_status run_inference(std::vector<InputVStream>& input_vstream, std::vector
         features.emplace_back(feature);
     }
 
-    std::vector<cv::Mat> frames((int)frame_count);
+    // Only the frames between the capture and the drawing are kept, whatever the length of the video
+    common::FrameRing<cv::Mat> frames(pp_options.max_in_flight + RENDER_QUEUE_FRAMES + FRAME_RING_SLACK);
+    auto input_shape = input_vstream[0].get_info().shape;
+    frames.preallocate([&input_shape](cv::Mat &frame) {
+        frame.create(cv::Size((int)input_shape.height, (int)input_shape.width), CV_8UC3);
+    });
 
     auto input_thread(std::async(write_all, std::ref(input_vstream[0]), video_path, std::ref(write_time_vec), std::ref(frames)));
 
@@ -224,7 +354,7 @@ hailo_status run_inference(std::vector<InputVStream>& input_vstream, std::vector
         output_threads.emplace_back(std::async(read_all<T>, std::ref(output_vstreams[i]), features[i], frame_count, std::ref(read_time_vec[i]))); 
     }
 
-    auto pp_thread(std::async(post_processing_all<T>, std::ref(features), frame_count, std::ref(postprocess_time), std::ref(frames), org_height, org_width));
+    auto pp_thread(std::async(post_processing_all<T>, std::ref(features), frame_count, std::ref(postprocess_time), std::ref(frames), org_height, org_width, org_fps));
 
     for (size_t i = 0; i < output_threads.size(); i++) {
         status = output_threads[i].get();
@@ -324,6 +454,27 @@ int main(int argc, char** argv) {
 
     std::string yolo_hef       = getCmdOption(argc, argv, "-hef=");
     std::string video_path      = getCmdOption(argc, argv, "-input=");
+    std::string pp_threads      = getCmdOption(argc, argv, "-pp-threads=");
+    std::string pp_in_flight    = getCmdOption(argc, argv, "-pp-in-flight=");
+    pp_options = common::PostProcessOptions(pp_threads.empty() ? 0 : std::stoul(pp_threads),
+                                            pp_in_flight.empty() ? 0 : std::stoul(pp_in_flight));
+    mask_output_option          = getCmdOption(argc, argv, "-mask-output=");
+    mask_output_t mask_output;
+    if (!mask_output_option.empty() && !mask_output_from_string(mask_output_option, mask_output)) {
+        std::cerr << "Invalid -mask-output=" << mask_output_option << ", expected float, rle or contour" << std::endl;
+        return HAILO_INVALID_ARGUMENT;
+    }
+    output_path                 = getCmdOption(argc, argv, "-output=");
+    std::string workers_option  = getCmdOption(argc, argv, "-encode-workers=");
+    std::string segment_option  = getCmdOption(argc, argv, "-segment-frames=");
+    encode_workers = workers_option.empty() ? 1 : std::stoul(workers_option);
+    segment_frames = segment_option.empty() ? DEFAULT_SEGMENT_FRAMES : std::stoul(segment_option);
+    if (encode_workers == 0 || segment_frames == 0) {
+        std::cerr << "-encode-workers= and -segment-frames= must be at least 1" << std::endl;
+        return HAILO_INVALID_ARGUMENT;
+    }
+    postprocess_stage.set_workers(pp_options.num_threads);
+    encode_stage.set_workers(encode_workers);
 
     std::chrono::time_point<std::chrono::system_clock> write_time_vec;
     std::chrono::duration<double> inference_time;
@@ -379,14 +530,20 @@ int main(int argc, char** argv) {
     double frame_count = capture.get(cv::CAP_PROP_FRAME_COUNT);
     double org_height = capture.get(cv::CAP_PROP_FRAME_HEIGHT);
     double org_width = capture.get(cv::CAP_PROP_FRAME_WIDTH);
+    double org_fps = capture.get(cv::CAP_PROP_FPS);
     capture.release();
+    if (org_fps <= 0) {
+        org_fps = 30;
+    }
 
+    auto run_start = StageClock::now();
     status = run_inference<uint16_t>(std::ref(vstreams.first), 
                         std::ref(vstreams.second), 
                         video_path, 
                         write_time_vec, read_time_vec, 
                         inference_time, postprocess_time, 
-                        frame_count, org_height, org_width);
+                        frame_count, org_height, org_width, org_fps);
+    auto run_time = StageClock::now() - run_start;
 
     if (HAILO_SUCCESS != status) {
         std::cerr << "Failed running inference with status = " << status << std::endl;
@@ -395,6 +552,13 @@ int main(int argc, char** argv) {
 
     print_inference_statistics(inference_time, postprocess_time, yolo_hef, frame_count);
 
+    std::cout << BOLDGREEN << "\n-I-----------------------------------------------" << std::endl;
+    std::cout << "-I- Pipeline stages" << std::endl;
+    std::cout << "-I-----------------------------------------------" << std::endl;
+    stage_stats.print(std::cout, (size_t)frame_count, run_time);
+    stage_stats.print_utilization(std::cout, run_time);
+    std::cout << "-I-----------------------------------------------" << std::endl << RESET;
+
     std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::high_resolution_clock::now();
     total_time = t_end - t_start;
 
@@ -21,7 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "hailo/hailort.h"
-#include "double_buffer.hpp"
+#include "ring_buffer.hpp"
 
 
 #define RESET "\033[0m"
@@ -45,12 +45,12 @@
 
 class FeatureData {
 public:
-    FeatureData(uint32_t buffers_size, float32_t qp_zp, float32_t qp_scale, uint32_t width, hailo_vstream_info_t vstream_info) :
-    m_buffers(buffers_size), m_qp_zp(qp_zp), m_qp_scale(qp_scale), m_width(width), m_vstream_info(vstream_info)
+    FeatureData(uint32_t buffers_size, float32_t qp_zp, float32_t qp_scale, uint32_t width, hailo_vstream_info_t vstream_info, uint32_t buffers_count = RingBuffer<uint8_t>::DEFAULT_SLOTS) :
+    m_buffers(buffers_size, buffers_count), m_qp_zp(qp_zp), m_qp_scale(qp_scale), m_width(width), m_vstream_info(vstream_info)
     {}
     static bool sort_tensors_by_size (std::shared_ptr<FeatureData> i, std::shared_ptr<FeatureData> j) { return i->m_width < j->m_width; };
 
-    DoubleBuffer m_buffers;
+    RingBuffer<uint8_t> m_buffers;
     float32_t m_qp_zp;
     float32_t m_qp_scale;
     uint32_t m_width;
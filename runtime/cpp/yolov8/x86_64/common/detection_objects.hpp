@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2021-2022 Hailo Technologies Ltd. All rights reserved.
+ * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
+ **/
+/**
+ * @file detection_objects.hpp
+ * @brief HailoDetection objects of the flat detection records, for the consumers of the ROI tree.
+ *        Kept per example, as each example has its own hailo_objects.hpp.
+ **/
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "detection_record.hpp"
+#include "hailo_objects.hpp"
+
+namespace common
+{
+    /**
+     * @brief Build a HailoDetection object from a record.
+     *
+     * @param record The record to convert.
+     * @param labels Labels map the record's label_index points into.
+     * @return HailoDetection
+     */
+    inline HailoDetection to_detection(const DetectionRecord &record, const std::map<uint8_t, std::string> &labels)
+    {
+        return HailoDetection(HailoBBox(record.xmin, record.ymin, record.width, record.height),
+                              record.class_id, record_label(record, labels), record.confidence);
+    }
+
+    /**
+     * @brief Build a shared HailoDetection from a record.
+     *
+     * @param record The record to convert.
+     * @param labels Labels map the record's label_index points into.
+     * @return HailoDetectionPtr
+     */
+    inline HailoDetectionPtr make_detection(const DetectionRecord &record, const std::map<uint8_t, std::string> &labels)
+    {
+        return std::make_shared<HailoDetection>(HailoBBox(record.xmin, record.ymin, record.width, record.height),
+                                                record.class_id, record_label(record, labels), record.confidence);
+    }
+
+    /**
+     * @brief Materialize records as HailoDetection objects under a ROI.
+     *        Only needed when a consumer (overlay, tracker...) works on the ROI tree.
+     *
+     * @param roi The ROI to add the detections to.
+     * @param records The records to convert.
+     * @param labels Labels map the records' label_index points into.
+     */
+    inline void add_detections(HailoROIPtr roi, const std::vector<DetectionRecord> &records, const std::map<uint8_t, std::string> &labels)
+    {
+        for (const auto &record : records)
+        {
+            roi->add_object(make_detection(record, labels));
+        }
+    }
+}
@@ -6,6 +6,8 @@
 
 #include "hailo_objects.hpp"
 #include "hailo_common.hpp"
+#include "nms_engine.hpp"
+#include "detection_record.hpp"
 namespace common
 {
 
@@ -25,7 +27,7 @@ namespace common
     }
 
     /**
-     * @brief Perform IOU based NMS on a vector of HailoDetection objects
+     * @brief Perform IOU based NMS on a vector of HailoDetection objects, see NmsEngine.
      *
      * @param objects  -  std::vector<HailoDetection>
      *        The detections to perform NMS on.
@@ -38,45 +40,74 @@ namespace common
      */
     void nms(std::vector<HailoDetection> &objects, const float iou_thr, bool should_nms_cross_classes = false)
     {
-        std::vector<HailoDetection> objects_after_nms;
         // The network may propose multiple detections of similar size/score,
         // which are actually the same detection. We want to filter out the lesser
-        // detections with a simple nms.
-        std::sort(objects.begin(), objects.end(),
-                  [](HailoDetection a, HailoDetection b)
-                  { return a.get_confidence() > b.get_confidence(); });
+        // detections with a simple nms. The buffers are kept per thread, so steady
+        // state frames don't allocate.
+        static thread_local NmsEngine engine;
+        static thread_local std::vector<uint32_t> candidates;
+        static thread_local std::vector<uint32_t> kept;
+        static thread_local std::vector<uint32_t> positions;
+        engine.clear();
+        candidates.clear();
+        kept.clear();
 
-        for (uint index = 0; index < objects.size(); index++)
+        for (uint32_t index = 0; index < objects.size(); index++)
         {
-            if (objects[index].get_confidence() != 0.0f)
-            {
-                for (uint jindex = index + 1; jindex < objects.size(); jindex++)
-                {
-                    if ((should_nms_cross_classes || (objects[index].get_class_id() == objects[jindex].get_class_id())) &&
-                        objects[jindex].get_confidence() != 0.0f)
-                    {
-                        // For each detection, calculate the IOU against each following detection.
-                        float iou = iou_calc(objects[index].get_bbox(), objects[jindex].get_bbox());
-                        // If the IOU is above threshold, then we have two similar detections,
-                        // and want to delete the one.
-                        if (iou >= iou_thr)
-                        {
-                            // The detections are arranged in highest score order,
-                            // so we want to erase the latter detection.
-                            objects[jindex].set_confidence(0.0f);
-                        }
-                    }
-                }
-            }
+            // Zero confidence detections are considered already filtered.
+            float confidence = objects[index].get_confidence();
+            if (confidence == 0.0f)
+                continue;
+            HailoBBox &bbox = objects[index].get_bbox();
+            engine.add_box(bbox.xmin(), bbox.ymin(), bbox.xmax(), bbox.ymax(), confidence, objects[index].get_class_id());
+            candidates.push_back(index);
         }
-        for (uint index = 0; index < objects.size(); index++)
+
+        for (uint32_t index : engine.nms(iou_thr, should_nms_cross_classes))
+        {
+            kept.push_back(candidates[index]);
+        }
+        // The kept detections are ordered by descending confidence.
+        keep_by_indices(objects, kept, positions);
+    }
+
+    /**
+     * @brief Perform IOU based NMS on a vector of DetectionRecord, see NmsEngine.
+     *
+     * @param records  -  std::vector<DetectionRecord>
+     *        The records to perform NMS on, compacted in place to the kept records ordered by descending confidence.
+     *
+     * @param iou_thr  -  float
+     *        Threshold for IOU filtration
+     *
+     * @param should_nms_cross_classes  -  bool
+     *        If true, then apply NMS regardless of class differences. Default false.
+     */
+    void nms(std::vector<DetectionRecord> &records, const float iou_thr, bool should_nms_cross_classes = false)
+    {
+        static thread_local NmsEngine engine;
+        static thread_local std::vector<uint32_t> candidates;
+        static thread_local std::vector<uint32_t> kept;
+        static thread_local std::vector<uint32_t> positions;
+        engine.clear();
+        candidates.clear();
+        kept.clear();
+
+        for (uint32_t index = 0; index < records.size(); index++)
+        {
+            const DetectionRecord &record = records[index];
+            // Zero confidence records are considered already filtered.
+            if (record.confidence == 0.0f)
+                continue;
+            engine.add_box(record.xmin, record.ymin, record.xmin + record.width, record.ymin + record.height, record.confidence, record.class_id);
+            candidates.push_back(index);
+        }
+
+        for (uint32_t index : engine.nms(iou_thr, should_nms_cross_classes))
         {
-            if (objects[index].get_confidence() != 0.0f)
-            {
-                objects_after_nms.push_back(objects[index]);
-            }
+            kept.push_back(candidates[index]);
         }
-        objects = objects_after_nms;
+        keep_by_indices(records, kept, positions);
     }
 
 }
@@ -3,10 +3,51 @@
 * Distributed under the LGPL license (https://www.gnu.org/licenses/old-licenses/lgpl-2.1.txt)
 **/
 #pragma once
+#include <atomic>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 #include "common/hailo_objects.hpp"
 #include "common/hailo_common.hpp"
+#include "yolov8_geometry.hpp"
 
 __BEGIN_DECLS
-void nanodet_repvgg(HailoROIPtr roi);
-void filter(HailoROIPtr roi);
+class Yolov8Params
+{
+public:
+    static constexpr float DEFAULT_SCORE_THRESHOLD = 0.4f;
+    static constexpr float DEFAULT_IOU_THRESHOLD = 0.7f;
+    // The labels are keyed by uint8_t, the label of class_index is labels[class_index + 1]
+    static constexpr uint32_t MAX_CLASSES = 255;
+
+    common::Yolov8Geometry geometry;
+    std::map<uint8_t, std::string> labels;
+
+    Yolov8Params(const common::Yolov8Geometry &model_geometry);
+
+    /**
+     * @brief The thresholds can be changed while frames are being post-processed, a frame uses the values it read when it started.
+     */
+    void set_score_threshold(float threshold);
+    void set_iou_threshold(float threshold);
+    float score_threshold() const { return m_score_threshold.load(std::memory_order_relaxed); }
+    float iou_threshold() const { return m_iou_threshold.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Unique id of these params, the per-thread decode buffers are rebuilt when it changes.
+     */
+    uint64_t id() const { return m_id; }
+
+private:
+    std::atomic<float> m_score_threshold;
+    std::atomic<float> m_iou_threshold;
+    uint64_t m_id;
+};
+
+Yolov8Params *init(const hailo_vstream_info_t &input_info, const std::vector<hailo_vstream_info_t> &output_infos);
+void yolov8(HailoROIPtr roi, void *params_void_ptr);
+void free_resources(void *params_void_ptr);
+void filter(HailoROIPtr roi, void *params_void_ptr);
 __END_DECLS
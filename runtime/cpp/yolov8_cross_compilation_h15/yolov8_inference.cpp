@@ -3,11 +3,15 @@
 
 #include "common/hailo_objects.hpp"
 #include "yolov8_postprocess.hpp"
+#include "frame_arena.hpp"
+#include "postprocess_pool.hpp"
+#include "frame_ring.hpp"
 
 #include <iostream>
 #include <chrono>
 #include <mutex>
 #include <future>
+#include <memory>
 
 #include <opencv2/videoio.hpp>
 #include <opencv2/opencv.hpp>
@@ -17,6 +21,9 @@
 
 constexpr bool QUANTIZED = true;
 constexpr hailo_format_type_t FORMAT_TYPE = HAILO_FORMAT_TYPE_AUTO;
+common::PostProcessOptions pp_options;
+// Frames the capture can be ahead of the drawing, on top of the frames being post-processed
+constexpr size_t FRAME_RING_SLACK = 4;
 
 using namespace hailort;
 
@@ -37,32 +44,35 @@ void print_inference_statistics(std::chrono::duration<double> inference_time,
 
 hailo_status post_processing_all(std::vector<std::shared_ptr<FeatureData>> &features, double frame_count,
                                 std::chrono::time_point<std::chrono::system_clock>& postprocess_time, 
-                                std::vector<cv::Mat>& frames, 
+                                common::FrameRing<cv::Mat>& frames, 
                                 double org_height, 
-                                double org_width) {
+                                double org_width,
+                                Yolov8Params *params) {
     auto status = HAILO_SUCCESS;   
 
     std::sort(features.begin(), features.end(), &FeatureData::sort_tensors_by_size);
 
-    for (int i = 0; i < (int)frame_count; i++){
-        HailoROIPtr roi = std::make_shared<HailoROI>(HailoROI(HailoBBox(0.0f, 0.0f, 1.0f, 1.0f)));
-        
-        for (auto& feature : features) {
-            roi->add_tensor(std::make_shared<HailoTensor>(reinterpret_cast<uint8_t*>(feature->m_buffers.get_read_buffer().data()), feature->m_vstream_info));
-        }
+    // Frames are decoded on the post-processing pool, several at a time. Each frame in flight holds its output
+    // buffers in the rings of the read threads until it is drawn. Drawing and printing stay in frame order.
+    // The rings outlive the post-processor, which joins the workers still using them if an exception is thrown
+    common::OrderedPostProcessor<std::vector<HailoDetectionPtr>> post_processor(pp_options);
 
-        filter(roi);
-    
+    // Frames are drawn on a copy at the original size, so their slot in the ring keeps its storage for the next frames
+    cv::Mat display;
+    auto draw_frame = [&](size_t i, std::vector<HailoDetectionPtr> &detections) {
+        // Frames are emitted in order, so the oldest held buffers are the ones of this frame
         for (auto &feature : features) {
             feature->m_buffers.release_read_buffer();
         }
-
-        std::vector<HailoDetectionPtr> detections = hailo_common::get_hailo_detections(roi);
-        cv::resize(frames[0], frames[0], cv::Size((int)org_width, (int)org_height), 1);
+        cv::Mat *frame = frames.acquire_read();
+        if (frame == nullptr) {
+            return;
+        }
+        cv::resize(*frame, display, cv::Size((int)org_width, (int)org_height), 1);
         for (auto &detection : detections) {
             HailoBBox bbox = detection->get_bbox();
         
-            cv::rectangle(frames[0], cv::Point2f(bbox.xmin() * float(org_width), bbox.ymin() * float(org_height)), 
+            cv::rectangle(display, cv::Point2f(bbox.xmin() * float(org_width), bbox.ymin() * float(org_height)), 
                         cv::Point2f(bbox.xmax() * float(org_width), bbox.ymax() * float(org_height)), 
                         cv::Scalar(0, 0, 255), 1);
             
@@ -70,11 +80,32 @@ hailo_status post_processing_all(std::vector<std::shared_ptr<FeatureData>> &feat
         }
 
         if (i == 0) {
-		cv::imwrite("output.jpg",frames[0]);
+		cv::imwrite("output.jpg",display);
 	}
-        frames[0].release();
-        frames.erase(frames.begin());
+        frames.release_read();
+    };
+
+    for (int i = 0; i < (int)frame_count; i++){
+        post_processor.wait_for_slot(draw_frame);
+
+        std::vector<uint8_t *> buffers(features.size());
+        for (uint j = 0; j < features.size(); j++) {
+            buffers[j] = features[j]->m_buffers.hold_read_buffer().data();
+        }
+
+        post_processor.submit([&features, buffers, params]() {
+            // The roi and its tensors live in the frame arena of the worker, released all at once when the frame ends
+            common::FrameArenaScope frame_scope;
+            HailoROIPtr roi = std::allocate_shared<HailoROI>(common::ArenaAllocator<HailoROI>(), HailoBBox(0.0f, 0.0f, 1.0f, 1.0f));
+            for (uint j = 0; j < features.size(); j++) {
+                roi->add_tensor(std::allocate_shared<HailoTensor>(common::ArenaAllocator<HailoTensor>(), buffers[j], features[j]->m_vstream_info));
+            }
+
+            filter(roi, params);
+            return hailo_common::get_hailo_detections(roi);
+        });
     }
+    post_processor.drain(draw_frame);
     postprocess_time = std::chrono::high_resolution_clock::now();
     return status;
 }
@@ -97,13 +128,16 @@ hailo_status read_all(std::vector<OutputVStream>& output_vstreams, std::vector<s
 
 
 hailo_status use_single_frame(InputVStream& input_vstream, std::chrono::time_point<std::chrono::system_clock>& write_time_vec, 
-                                std::vector<cv::Mat>& frames, cv::Mat& image, int frame_count){
+                                common::FrameRing<cv::Mat>& frames, cv::Mat& image, int frame_count){
     
     hailo_status status = HAILO_SUCCESS;
     write_time_vec = std::chrono::high_resolution_clock::now();
     for(int i = 0; i < frame_count; i++) {
-        frames.push_back(image);
-        status = input_vstream.write(MemoryView(frames[frames.size() - 1].data, input_vstream.get_frame_size()));
+        // The slot shares the image, the same frame is written frame_count times without copies
+        cv::Mat &frame = frames.acquire_write();
+        frame = image;
+        status = input_vstream.write(MemoryView(frame.data, input_vstream.get_frame_size()));
+        frames.release_write();
         if (HAILO_SUCCESS != status)
             return status;
     }
@@ -113,7 +147,7 @@ hailo_status use_single_frame(InputVStream& input_vstream, std::chrono::time_poi
 
 hailo_status write_all(InputVStream& input_vstream, const std::string input_path, 
                         std::chrono::time_point<std::chrono::system_clock>& write_time_vec, 
-                        std::vector<cv::Mat>& frames, const std::string& cmd_num_frames) {
+                        common::FrameRing<cv::Mat>& frames, const std::string& cmd_num_frames) {
     hailo_status status = HAILO_SUCCESS;
     
     auto input_shape = input_vstream.get_info().shape;
@@ -121,8 +155,10 @@ hailo_status write_all(InputVStream& input_vstream, const std::string input_path
     int width = input_shape.width;
 
     cv::VideoCapture capture(input_path);
-    if(!capture.isOpened())
+    if(!capture.isOpened()) {
+        frames.close();
         throw "Unable to read video file";
+    }
     
     cv::Mat org_frame;
 
@@ -131,8 +167,10 @@ hailo_status write_all(InputVStream& input_vstream, const std::string input_path
         capture.release();
         cv::resize(org_frame, org_frame, cv::Size(width, height), 1);
         status = use_single_frame(input_vstream, write_time_vec, frames, std::ref(org_frame), std::stoi(cmd_num_frames));
-        if (HAILO_SUCCESS != status)
+        if (HAILO_SUCCESS != status) {
+            frames.close();
             return status;
+        }
     }
     else {
         write_time_vec = std::chrono::high_resolution_clock::now();
@@ -142,17 +180,20 @@ hailo_status write_all(InputVStream& input_vstream, const std::string input_path
                 break;
             }
             
-            cv::resize(org_frame, org_frame, cv::Size(height, width), 1);
-            frames.push_back(org_frame);
-            input_vstream.write(MemoryView(frames[frames.size() - 1].data, input_vstream.get_frame_size())); // Writing height * width, 3 channels of uint8
-            if (HAILO_SUCCESS != status)
+            // Waits while the ring is full, so the capture never runs more than its capacity ahead of the drawing
+            cv::Mat &frame = frames.acquire_write();
+            cv::resize(org_frame, frame, cv::Size(height, width), 1);
+            status = input_vstream.write(MemoryView(frame.data, input_vstream.get_frame_size())); // Writing height * width, 3 channels of uint8
+            frames.release_write();
+            if (HAILO_SUCCESS != status) {
+                frames.close();
                 return status;
-            
-            org_frame.release();
+            }
         }
         capture.release();
     }
 
+    frames.close();
     return HAILO_SUCCESS;
 }
 
@@ -176,7 +217,9 @@ hailo_status check_inference_status(hailo_status input_status, hailo_status outp
 
 hailo_status create_feature(hailo_vstream_info_t vstream_info, size_t output_frame_size, std::shared_ptr<FeatureData> &feature) {
     feature = std::make_shared<FeatureData>(static_cast<uint32_t>(output_frame_size), vstream_info.quant_info.qp_zp,
-        vstream_info.quant_info.qp_scale, vstream_info.shape.width, vstream_info);
+        vstream_info.quant_info.qp_scale, vstream_info.shape.width, vstream_info,
+        // The frames in flight hold their buffers in the ring, the read thread keeps the default slots to write in
+        static_cast<uint32_t>(pp_options.max_in_flight) + RingBuffer<uint8_t>::DEFAULT_SLOTS);
 
     return HAILO_SUCCESS;
 }
@@ -185,7 +228,7 @@ hailo_status create_feature(hailo_vstream_info_t vstream_info, size_t output_fra
 hailo_status run_inference(std::vector<InputVStream>& input_vstream, std::vector<OutputVStream>& output_vstreams, const std::string input_path,
                     std::chrono::time_point<std::chrono::system_clock>& write_time_vec,
                     std::chrono::duration<double>& inference_time, std::chrono::time_point<std::chrono::system_clock>& postprocess_time, 
-                    double frame_count, double org_height, double org_width, const std::string cmd_img_num) {
+                    double frame_count, double org_height, double org_width, const std::string cmd_img_num, Yolov8Params *params) {
 
     hailo_status status = HAILO_UNINITIALIZED;
     
@@ -205,7 +248,12 @@ hailo_status run_inference(std::vector<InputVStream>& input_vstream, std::vector
         features.emplace_back(feature);
     }
 
-    std::vector<cv::Mat> frames;
+    // Only the frames between the capture and the drawing are kept, whatever the length of the video
+    common::FrameRing<cv::Mat> frames(pp_options.max_in_flight + FRAME_RING_SLACK);
+    auto input_shape = input_vstream[0].get_info().shape;
+    frames.preallocate([&input_shape](cv::Mat &frame) {
+        frame.create(cv::Size((int)input_shape.width, (int)input_shape.height), CV_8UC3);
+    });
 
     // Create the write thread
     auto input_thread(std::async(write_all, std::ref(input_vstream[0]), input_path, std::ref(write_time_vec), std::ref(frames), std::ref(cmd_img_num)));
@@ -214,7 +262,7 @@ hailo_status run_inference(std::vector<InputVStream>& input_vstream, std::vector
     auto output_thread(std::async(read_all, std::ref(output_vstreams), std::ref(features), frame_count));
 
     // Create the postprocessing thread
-    auto pp_thread(std::async(post_processing_all, std::ref(features), frame_count, std::ref(postprocess_time), std::ref(frames), org_height, org_width));
+    auto pp_thread(std::async(post_processing_all, std::ref(features), frame_count, std::ref(postprocess_time), std::ref(frames), org_height, org_width, params));
 
     // Join the threads
     auto input_status = input_thread.get();
@@ -297,6 +345,12 @@ int main(int argc, char** argv) {
     const std::string yolov_hef      = getCmdOption(argc, argv, "-hef=");
     const std::string input_path      = getCmdOption(argc, argv, "-input=");
     const std::string image_num      = getCmdOption(argc, argv, "-num=");
+    const std::string pp_threads      = getCmdOption(argc, argv, "-pp-threads=");
+    const std::string pp_in_flight      = getCmdOption(argc, argv, "-pp-in-flight=");
+    const std::string score_thr      = getCmdOption(argc, argv, "-score-thr=");
+    const std::string iou_thr      = getCmdOption(argc, argv, "-iou-thr=");
+    pp_options = common::PostProcessOptions(pp_threads.empty() ? 0 : std::stoul(pp_threads),
+                                            pp_in_flight.empty() ? 0 : std::stoul(pp_in_flight));
 
     std::chrono::time_point<std::chrono::system_clock> write_time_vec;
     std::chrono::time_point<std::chrono::system_clock> postprocess_end_time;
@@ -325,6 +379,26 @@ int main(int argc, char** argv) {
 
     print_net_banner(vstreams);
 
+    // The classes, regression bins, strides and input size of the model are read from its vstreams
+    std::vector<hailo_vstream_info_t> output_infos;
+    for (auto &output_vstream : vstreams.second) {
+        output_infos.push_back(output_vstream.get_info());
+    }
+    std::unique_ptr<Yolov8Params> params;
+    try {
+        params.reset(init(vstreams.first[0].get_info(), output_infos));
+        if (!score_thr.empty())
+            params->set_score_threshold(std::stof(score_thr));
+        if (!iou_thr.empty())
+            params->set_iou_threshold(std::stof(iou_thr));
+    }
+    catch (const std::exception &e) {
+        std::cerr << "Failed to set up the yolov8 post-processing: " << e.what() << std::endl;
+        return HAILO_INVALID_ARGUMENT;
+    }
+    std::cout << "-I- Model geometry: " << params->geometry.network_width << "x" << params->geometry.network_height
+              << ", " << params->geometry.num_classes << " classes, " << params->geometry.levels.size() << " strides" << std::endl;
+
     cv::VideoCapture capture(input_path);
     if (!capture.isOpened()){
         throw "Error when reading input file";
@@ -345,7 +419,7 @@ int main(int argc, char** argv) {
                         std::ref(vstreams.second), 
                         input_path, 
                         write_time_vec, inference_time, postprocess_end_time, 
-                        frame_count, org_height, org_width, image_num);
+                        frame_count, org_height, org_width, image_num, params.get());
 
     if (HAILO_SUCCESS != status) {
         std::cerr << "Failed running inference with status = " << status << std::endl;
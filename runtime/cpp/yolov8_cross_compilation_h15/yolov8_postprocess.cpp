@@ -4,233 +4,238 @@
 **/
 // General includes
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <iostream>
-#include <iterator>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <tuple>
 #include <vector>
 
 // Hailo includes
-#include "common/math.hpp"
 #include "common/hailo_objects.hpp"
-#include "common/tensors.hpp"
+#include "tensor_view.hpp"
+#include "quant_gate.hpp"
+#include "yolov8_geometry.hpp"
+#include "yolov8_decode.hpp"
 #include "common/nms.hpp"
+#include "common/detection_objects.hpp"
 #include "common/labels/coco_eighty.hpp"
 #include "yolov8_postprocess.hpp"
 
-using namespace xt::placeholders;
+static std::atomic<uint64_t> next_params_id(0);
 
-#define SCORE_THRESHOLD 0.4
-#define IOU_THRESHOLD 0.7
-#define NUM_CLASSES 80
+/**
+ * @brief Decode buffers of a model geometry, sized once for its largest frame, one per post-processing thread
+ */
+struct Yolov8Workspace
+{
+    uint64_t params_id;
+    common::Yolov8BoxDecoder decoder;
+    std::vector<uint32_t> candidates;
+    std::vector<std::tuple<uint, int, float>> proposals;
+    common::DetectionArena arena;
+
+    Yolov8Workspace(const Yolov8Params &params)
+        : params_id(params.id()), decoder(params.geometry), arena(params.geometry.max_proposals())
+    {
+        // Every proposal of a level can pass, the candidates hold one passing score per proposal or more
+        candidates.reserve(params.geometry.max_proposals());
+        proposals.reserve(params.geometry.max_proposals());
+    }
+};
 
 /**
- * @brief Split the raw output tensors into boxes and scores
+ * @brief Get the proposals of a scores output whose best class passes the score threshold
  * 
- * @param tensors  -  std::vector<HailoTensorPtr>
- *        The network output tensors
+ * @param scores_output  -  HailoTensor
+ *        Quantized scores output, a row of num_classes scores per proposal
  * 
- * @param num_classes  -  int
- *        Number of classes
+ * @param score_threshold  -  float
+ *        Minimal score of a proposal's best class
  * 
- * @param regression_length  -  int
- *        Regression length of anchors
- *  
- * @return std::pair<std::vector<xt::xarray<float>>, xt::xarray<float>> 
- *         The separated score and box vectors
+ * @param candidates  -  std::vector<uint32_t>
+ *        Buffer of the candidate score indices
+ * 
+ * @param[out] proposals  -  std::vector<std::tuple<uint, int, float>>
+ *         Filled with (proposal index, class index, confidence) of the passing proposals, in proposal order
  */
-std::pair<std::vector<HailoTensorPtr>, xt::xarray<float>> get_boxes_and_scores(std::vector<HailoTensorPtr> &tensors,
-                                                                                  int num_classes,
-                                                                                  int regression_length)
+void get_scored_proposals(HailoTensor &scores_output, float score_threshold, std::vector<uint32_t> &candidates,
+                          std::vector<std::tuple<uint, int, float>> &proposals)
 {
-    std::vector<HailoTensorPtr> outputs_boxes(tensors.size() / 2);
-    
-    // Prepare the scores xarray at the size we will fill in in-place
-    int total_scores = 0;
-    for (uint i = 0; i < tensors.size(); i = i + 2) { 
-        total_scores += tensors[i+1]->width() * tensors[i+1]->height(); 
-    }
+    candidates.clear();
+    proposals.clear();
+    common::visit_tensor(scores_output, [&](const auto &view)
+                         {
+        using T = decltype(view.at(0, 0, 0));
+        // A proposal passes when its best score does, that is when any of its scores passes the gate
+        const auto gate = common::QuantizedGate<T>::from_predicate([&](T q)
+                                                                   { return !(view.dequantize(q) < score_threshold); });
+        gate.scan(view.data(), view.size(), candidates);
+
+        const uint num_classes = view.features();
+        int last_proposal = -1;
+        for (uint32_t candidate : candidates)
+        {
+            uint proposal = candidate / num_classes;
+            if ((int)proposal == last_proposal)
+                continue;
+            last_proposal = (int)proposal;
+            // Same choice as xt::argmax on the dequantized scores: the first maximal score
+            const T *proposal_scores = view.data() + (size_t)proposal * num_classes;
+            int class_index = (int)(std::max_element(proposal_scores, proposal_scores + num_classes) - proposal_scores);
+            proposals.emplace_back(proposal, class_index, view.dequantize(proposal_scores[class_index]));
+        } });
+}
 
-    std::vector<size_t> shape = { (long unsigned int)total_scores, (long unsigned int)num_classes};
-    
-    xt::xarray<float> scores(shape);
-    int view_index = 0;
+/**
+ * @brief Decode the boxes of the proposals that pass the score threshold
+ * 
+ * @param roi  -  HailoROIPtr
+ *        The roi that contains the output tensors, looked up by the names in the geometry
+ * 
+ * @param params  -  Yolov8Params
+ *        Geometry and thresholds of the model
+ * 
+ * @param workspace  -  Yolov8Workspace
+ *        Decoder and buffers of the geometry
+ * 
+ * @param[out] records  -  std::vector<common::DetectionRecord>
+ *         The decoded records are appended here
+ */
+void decode_boxes(HailoROIPtr roi, const Yolov8Params &params, Yolov8Workspace &workspace,
+                  std::vector<common::DetectionRecord> &records)
+{
+    int class_index;
+    float confidence = 0.0;
+    uint j;
+    const float score_threshold = params.score_threshold();
 
-    for (uint i = 0; i < tensors.size(); i = i + 2)
+    for (uint i = 0; i < params.geometry.levels.size(); i++)
     {
-        // Bounding boxes extraction will be done later on only on the boxes that surpass the score threshold
-        outputs_boxes[i / 2] = tensors[i];
-
-        // Extract and dequantize the scores outputs
-        auto dequantized_output_s = common::dequantize(common::get_xtensor(tensors[i+1]), tensors[i+1]->vstream_info().quant_info.qp_scale, tensors[i+1]->vstream_info().quant_info.qp_zp);
-        int num_proposals_scores = dequantized_output_s.shape(0)*dequantized_output_s.shape(1);
-
-        // From the layer extract the scores
-        auto output_scores = xt::view(dequantized_output_s, xt::all(), xt::all(), xt::all());
-        xt::view(scores, xt::range(view_index, view_index + num_proposals_scores), xt::all()) = xt::reshape_view(output_scores, {num_proposals_scores, num_classes});
-        view_index += num_proposals_scores;
+        const common::Yolov8OutputLevel &level = params.geometry.levels[i];
+        get_scored_proposals(*roi->get_tensor(level.scores_name), score_threshold, workspace.candidates, workspace.proposals);
+        if (workspace.proposals.empty())
+            continue;
+        common::visit_tensor(*roi->get_tensor(level.boxes_name), [&](const auto &view)
+                             {
+            for (auto &proposal : workspace.proposals)
+            {
+                std::tie(j, class_index, confidence) = proposal;
+                workspace.decoder.decode(view, i, j, class_index, confidence, records);
+            } });
     }
-
-    return std::pair<std::vector<HailoTensorPtr>, xt::xarray<float>>( outputs_boxes, scores );
 }
 
-float dequantize_value(uint8_t val, float32_t qp_scale, float32_t qp_zp){
-    return (float(val) - qp_zp) * qp_scale;
-}
-
-void dequantize_box_values(xt::xarray<float>& box, int index, xt::xarray<uint8_t>& quantized_box, size_t dim1, size_t dim2, float32_t qp_scale, float32_t qp_zp){
-    for (size_t i = 0; i < dim1; i++){
-        for (size_t j = 0; j < dim2; j++){
-            box(i, j) = dequantize_value(quantized_box(index, i, j), qp_scale, qp_zp);
-        }
+void yolov8_postprocess(HailoROIPtr roi,
+                        const Yolov8Params &params,
+                        Yolov8Workspace &workspace,
+                        std::vector<common::DetectionRecord> &records)
+{
+    if (!roi->has_tensors())
+    {
+        return;
     }
-}
-
-std::vector<xt::xarray<double>> get_centers(std::vector<int>& strides, std::vector<int>& network_dims,
-                                        std::size_t boxes_num, int strided_width, int strided_height){
-
-        std::vector<xt::xarray<double>> centers(boxes_num);
 
-        for (uint i=0; i < boxes_num; i++) {
-            strided_width = network_dims[0] / strides[i];
-            strided_height = network_dims[1] / strides[i];
-
-            // Create a meshgrid of the proper strides
-            xt::xarray<int> grid_x = xt::arange(0, strided_width);
-            xt::xarray<int> grid_y = xt::arange(0, strided_height);
-
-            auto mesh = xt::meshgrid(grid_x, grid_y);
-            grid_x = std::get<1>(mesh);
-            grid_y = std::get<0>(mesh);
-
-            // Use the meshgrid to build up box center prototypes
-            auto ct_row = (xt::flatten(grid_y) + 0.5) * strides[i];
-            auto ct_col = (xt::flatten(grid_x) + 0.5) * strides[i];
-
-            centers[i] = xt::stack(xt::xtuple(ct_col, ct_row, ct_col, ct_row), 1);
-        }
+    // Decode the boxes
+    decode_boxes(roi, params, workspace, records);
 
-        return centers;
+    // Filter with NMS
+    common::nms(records, params.iou_threshold(), true);
 }
 
-std::vector<HailoDetection> decode_boxes(std::vector<HailoTensorPtr> raw_boxes_outputs,
-                                            xt::xarray<float> scores,
-                                            std::vector<int> network_dims,
-                                            std::vector<int> strides,
-                                            int regression_length)
+Yolov8Params::Yolov8Params(const common::Yolov8Geometry &model_geometry)
+    : geometry(model_geometry), m_score_threshold(DEFAULT_SCORE_THRESHOLD), m_iou_threshold(DEFAULT_IOU_THRESHOLD), m_id(next_params_id++)
 {
-    int strided_width, strided_height, class_index;
-    std::vector<HailoDetection> detections;
-    int instance_index = 0;
-    float confidence = 0.0;
-    std::string label;
-
-    auto centers = get_centers(std::ref(strides), std::ref(network_dims), raw_boxes_outputs.size(), strided_width, strided_height);
-
-    // Box distribution to distance
-    auto regression_distance =  xt::reshape_view(xt::arange(0, regression_length + 1), {1, 1, regression_length + 1});
-
-    for (uint i = 0; i < raw_boxes_outputs.size(); i++)
+    // The label of class_index is labels[class_index + 1]
+    if (geometry.num_classes > MAX_CLASSES)
     {
-        auto output_b = common::get_xtensor(raw_boxes_outputs[i]);
-        int num_proposals = output_b.shape(0) * output_b.shape(1);
-        auto output_boxes = xt::view(output_b, xt::all(), xt::all(), xt::all());
-        xt::xarray<uint8_t> quantized_boxes = xt::reshape_view(output_boxes, {num_proposals, 4, regression_length + 1});
-
-        float32_t qp_scale = raw_boxes_outputs[i]->vstream_info().quant_info.qp_scale;
-        float32_t qp_zp = raw_boxes_outputs[i]->vstream_info().quant_info.qp_zp;
-
-        auto shape = {quantized_boxes.shape(1), quantized_boxes.shape(2)};
-
-        for (uint j = 0; j < num_proposals; j++)
+        throw std::invalid_argument("The model has " + std::to_string(geometry.num_classes) + " classes, at most " +
+                                    std::to_string(MAX_CLASSES) + " are supported");
+    }
+    if (geometry.num_classes == 80)
+    {
+        labels = common::coco_eighty;
+    }
+    else
+    {
+        labels[0] = "unlabeled";
+        for (uint i = 0; i < geometry.num_classes; i++)
         {
-            class_index = xt::argmax(xt::row(scores, instance_index))(0);
-            confidence = scores(instance_index, class_index);
-            instance_index++;
-            if (confidence < SCORE_THRESHOLD)
-                continue;
-
-            xt::xarray<float> box(shape);
-
-            dequantize_box_values(box, j, quantized_boxes, box.shape(0), box.shape(1), qp_scale, qp_zp);
-
-            common::softmax_2D(box.data(), box.shape(0), box.shape(1));
-            
-            auto box_distance = box * regression_distance;
-            xt::xarray<float> reduced_distances = xt::sum(box_distance, {2});
-            auto strided_distances = reduced_distances * strides[i];
-
-            // Decode box
-            auto distance_view1 = xt::view(strided_distances, xt::all(), xt::range(_, 2)) * -1;
-            auto distance_view2 = xt::view(strided_distances, xt::all(), xt::range(2, _));
-            auto distance_view = xt::concatenate(xt::xtuple(distance_view1, distance_view2), 1);
-            auto decoded_box = centers[i] + distance_view;
-
-            HailoBBox bbox(decoded_box(j, 0) / network_dims[0],
-                           decoded_box(j, 1) / network_dims[1],
-                           (decoded_box(j, 2) - decoded_box(j, 0)) / network_dims[0],
-                           (decoded_box(j, 3) - decoded_box(j, 1)) / network_dims[1]);
-
-            label = common::coco_eighty[class_index + 1];
-            HailoDetection detected_instance(bbox, class_index, label, confidence);
-            detections.push_back(detected_instance);
+            labels[(uint8_t)(i + 1)] = "class_" + std::to_string(i);
         }
     }
-    return detections;
 }
 
-std::vector<HailoDetection> yolov8_postprocess(std::vector<HailoTensorPtr> &tensors,
-                                                   std::vector<int> network_dims,
-                                                   std::vector<int> strides,
-                                                   int regression_length,
-                                                   int num_classes)
+void Yolov8Params::set_score_threshold(float threshold)
 {
-    std::vector<HailoDetection> detections;
-    if (tensors.size() == 0)
-    {
-        return detections;
-    }
-
-    auto boxes_and_scores = get_boxes_and_scores(tensors, num_classes, regression_length);
-    std::vector<HailoTensorPtr> raw_boxes = boxes_and_scores.first;
-    xt::xarray<float> scores = boxes_and_scores.second;
-
-    // Calculate the sigmoid of the scores
-    // common::sigmoid(scores.data(), scores.size());
-
-    // Decode the boxes
-    detections = decode_boxes(raw_boxes, scores, network_dims, strides, regression_length);
+    if (!(threshold >= 0.0f && threshold <= 1.0f))
+        throw std::invalid_argument("Score threshold " + std::to_string(threshold) + " is not in [0, 1]");
+    m_score_threshold.store(threshold, std::memory_order_relaxed);
+}
 
-    // Filter with NMS
-    common::nms(detections, IOU_THRESHOLD, true);
+void Yolov8Params::set_iou_threshold(float threshold)
+{
+    if (!(threshold >= 0.0f && threshold <= 1.0f))
+        throw std::invalid_argument("IoU threshold " + std::to_string(threshold) + " is not in [0, 1]");
+    m_iou_threshold.store(threshold, std::memory_order_relaxed);
+}
 
-    return detections;
+/**
+ * @brief Get the params of a yolov8 model from the vstream infos of its configured network group
+ * 
+ * @param input_info  -  hailo_vstream_info_t
+ *        The input vstream info
+ * 
+ * @param output_infos  -  std::vector<hailo_vstream_info_t>
+ *        The output vstream infos, in any order
+ * 
+ * @return Yolov8Params* 
+ *         To be released with free_resources()
+ */
+Yolov8Params *init(const hailo_vstream_info_t &input_info, const std::vector<hailo_vstream_info_t> &output_infos)
+{
+    return new Yolov8Params(common::Yolov8Geometry::from_vstream_infos(input_info, output_infos));
 }
 
 /**
  * @brief yolov8 postprocess
- *        Provides network specific paramters
+ *        Decodes the outputs of the geometry in the params
  * 
  * @param roi  -  HailoROIPtr
  *        The roi that contains the ouput tensors
+ * 
+ * @param params_void_ptr  -  Yolov8Params*
+ *        Params returned by init()
  */
-void yolov8(HailoROIPtr roi)
+void yolov8(HailoROIPtr roi, void *params_void_ptr)
+{
+    const Yolov8Params &params = *reinterpret_cast<Yolov8Params *>(params_void_ptr);
+
+    // The decoder and buffers are built once per thread for the geometry of the params
+    static thread_local std::unique_ptr<Yolov8Workspace> workspace;
+    if (!workspace || workspace->params_id != params.id())
+    {
+        workspace.reset(new Yolov8Workspace(params));
+    }
+
+    // Records are kept per thread, HailoDetection objects are only built when added to the roi
+    workspace->arena.reset();
+    yolov8_postprocess(roi, params, *workspace, workspace->arena.records());
+    common::add_detections(roi, workspace->arena.records(), params.labels);
+}
+
+void free_resources(void *params_void_ptr)
 {
-    // anchor params
-    int regression_length = 15;
-    std::vector<int> strides = {8, 16, 32};
-    std::vector<int> network_dims = {640, 640};
-
-    std::vector<HailoTensorPtr> tensors = roi->get_tensors();
-    std::vector<HailoDetection> detections = yolov8_postprocess(tensors, network_dims, strides, regression_length, NUM_CLASSES);
-    hailo_common::add_detections(roi, detections);
+    Yolov8Params *params = reinterpret_cast<Yolov8Params *>(params_void_ptr);
+    delete params;
 }
 
 //******************************************************************
 //  DEFAULT FILTER
 //******************************************************************
-void filter(HailoROIPtr roi)
+void filter(HailoROIPtr roi, void *params_void_ptr)
 {
-    yolov8(roi);
+    yolov8(roi, params_void_ptr);
 }
@@ -1,6 +1,7 @@
 #include "hailo/hailort.hpp"
 #include "common.h"
 #include "yolo_post_processing.hpp"
+#include "postprocess_pool.hpp"
 
 #include <iostream>
 #include <chrono>
@@ -54,16 +55,14 @@ hailo_status post_processing_all(std::vector<std::shared_ptr<FeatureData>> &feat
     std::sort(features.begin(), features.end(), &FeatureData::sort_tensors_by_size);
     std::chrono::time_point<std::chrono::system_clock> t_start = std::chrono::high_resolution_clock::now();
 
-    for (int idx_frame = 0; idx_frame < frame_count; idx_frame++) {
-        auto detections_struct = post_processing(max_num_detections, thr, arch,
-            features[0]->m_buffers.get_read_buffer().data(), features[0]->m_qp_zp, features[0]->m_qp_scale,
-            features[1]->m_buffers.get_read_buffer().data(), features[1]->m_qp_zp, features[1]->m_qp_scale,
-            features[2]->m_buffers.get_read_buffer().data(), features[2]->m_qp_zp, features[2]->m_qp_scale);
-    
-        for (auto &feature : features) {
-            feature->m_buffers.release_read_buffer();
-        }
+    // Frames are decoded on the post-processing pool, several at a time. Each frame in flight owns a copy of the
+    // output buffers, so the read threads get theirs back right away. Results are still handed to C# in frame order.
+    const common::PostProcessOptions pp_options;
+    // The slots outlive the post-processor, which joins the workers still using them if an exception is thrown
+    std::vector<std::vector<std::vector<uint8_t>>> slot_buffers(pp_options.max_in_flight, std::vector<std::vector<uint8_t>>(features.size()));
+    common::OrderedPostProcessor<std::vector<DetectionObject>> post_processor(pp_options);
 
+    auto emit_frame = [&](size_t idx_frame, std::vector<DetectionObject> &detections_struct) {
         int num_detections = 0;
         int detection_size = 6;
         int idx_buffer = idx_frame % buffer_size;
@@ -84,8 +83,27 @@ hailo_status post_processing_all(std::vector<std::shared_ptr<FeatureData>> &feat
         }
         
         frames_ready[idx_buffer] = num_detections; // indicates (to c#) that we have finished processing frame idx_buffer, and found num_detections detections.
-        frames[idx_frame].release();   
+        frames[idx_frame].release();
+    };
+
+    for (int idx_frame = 0; idx_frame < frame_count; idx_frame++) {
+        post_processor.wait_for_slot(emit_frame);
+
+        std::vector<std::vector<uint8_t>> &buffers = slot_buffers[post_processor.next_slot()];
+        for (size_t i = 0; i < features.size(); i++) {
+            std::vector<uint8_t> &read_buffer = features[i]->m_buffers.get_read_buffer();
+            buffers[i].assign(read_buffer.begin(), read_buffer.end());
+            features[i]->m_buffers.release_read_buffer();
+        }
+
+        post_processor.submit([&features, &buffers, &arch, max_num_detections, thr]() {
+            return post_processing(max_num_detections, thr, arch,
+                buffers[0].data(), features[0]->m_qp_zp, features[0]->m_qp_scale,
+                buffers[1].data(), features[1]->m_qp_zp, features[1]->m_qp_scale,
+                buffers[2].data(), features[2]->m_qp_zp, features[2]->m_qp_scale);
+        });
     }
+    post_processor.drain(emit_frame);
 
     std::chrono::time_point<std::chrono::system_clock> t_end = std::chrono::high_resolution_clock::now();
     postprocess_time = t_end - t_start;
@@ -140,12 +140,12 @@ std::string get_coco_name_from_int(int cls)
 
 class FeatureData {
 public:
-    FeatureData(uint32_t buffers_size, float32_t qp_zp, float32_t qp_scale, uint32_t width) :
-    m_buffers(buffers_size), m_qp_zp(qp_zp), m_qp_scale(qp_scale), m_width(width)
+    FeatureData(uint32_t buffers_size, float32_t qp_zp, float32_t qp_scale, uint32_t width, uint32_t buffers_count = RingBuffer<uint8_t>::DEFAULT_SLOTS) :
+    m_buffers(buffers_size, buffers_count), m_qp_zp(qp_zp), m_qp_scale(qp_scale), m_width(width)
     {}
     static bool sort_tensors_by_size (std::shared_ptr<FeatureData> i, std::shared_ptr<FeatureData> j) { return i->m_width < j->m_width; };
 
-    DoubleBuffer m_buffers;
+    RingBuffer<uint8_t> m_buffers;
     float32_t m_qp_zp;
     float32_t m_qp_scale;
     uint32_t m_width;
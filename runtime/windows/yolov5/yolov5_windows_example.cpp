@@ -27,7 +27,7 @@
 
 
 #include "yolov5_post_processing.hpp"
-#include "double_buffer.hpp"
+#include "ring_buffer.hpp"
 
 #include "common.h"
 #include "hailo/hailort.h"